@@ -3,9 +3,17 @@
 // Default vertex shader for materials. Extend this to deal with bump mapping, defered rendering, shadows etc.
 //
 
-// matrices
-uniform mat4 modelToProjection;
-uniform mat4 modelToCamera;
+// matrices: with uniform buffers, these come from a ring buffer that changes every draw.
+#if OCTET_UNIFORM_BUFFERS
+  #extension GL_ARB_uniform_buffer_object : enable
+  layout(std140) uniform octet_draw {
+    mat4 modelToProjection;
+    mat4 modelToCamera;
+  };
+#else
+  uniform mat4 modelToProjection;
+  uniform mat4 modelToCamera;
+#endif
 
 // attributes from vertex buffer
 attribute vec4 pos;
@@ -0,0 +1,36 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//
+// Instanced version of default.vs. Each instance has its own model to camera matrix,
+// so one draw call can draw many copies of a mesh. Use with the default fragment shaders.
+//
+
+// matrices
+uniform mat4 cameraToProjection;
+
+// attributes from vertex buffer
+attribute vec4 pos;
+attribute vec2 uv;
+attribute vec3 normal;
+attribute vec4 color;
+
+// attribute from the instance buffer
+attribute mat4 instance_modelToCamera;
+
+// outputs
+varying vec3 normal_;
+varying vec2 uv_;
+varying vec4 color_;
+varying vec3 model_pos_;
+varying vec3 camera_pos_;
+
+void main() {
+  vec4 tpos = instance_modelToCamera * pos;
+  gl_Position = cameraToProjection * tpos;
+  vec3 tnormal = (instance_modelToCamera * vec4(normal, 0.0)).xyz;
+  normal_ = tnormal;
+  uv_ = uv;
+  color_ = color;
+  camera_pos_ = tpos.xyz;
+  model_pos_ = pos.xyz;
+}
+
@@ -0,0 +1,70 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//
+// Skinned version of default.vs. Each vertex is moved by up to four joints of a skeleton,
+// read from a float texture (see scene/skinning.h), so there is no limit on the number of joints.
+// Use with the default fragment shaders.
+//
+
+// matrices: with uniform buffers, these come from a ring buffer that changes every draw.
+#if OCTET_UNIFORM_BUFFERS
+  #extension GL_ARB_uniform_buffer_object : enable
+  layout(std140) uniform octet_draw {
+    mat4 modelToProjection;
+    mat4 modelToCamera;
+  };
+#else
+  uniform mat4 modelToProjection;
+  uniform mat4 modelToCamera;
+#endif
+
+// joints in model space: 256 to a row, each the first three columns of its matrix.
+uniform sampler2D joint_texture;
+uniform float joint_rows;
+
+// attributes from vertex buffer
+attribute vec4 pos;
+attribute vec2 uv;
+attribute vec3 normal;
+attribute vec4 color;
+
+// weights of joints 1-3 (joint 0 gets the rest) and the four joints.
+attribute vec3 blendweight;
+attribute vec4 blendindices;
+
+// outputs
+varying vec3 normal_;
+varying vec2 uv_;
+varying vec4 color_;
+varying vec3 model_pos_;
+varying vec3 camera_pos_;
+
+// add a weighted joint to the blended columns.
+void add_joint(inout vec4 x, inout vec4 y, inout vec4 z, float index, float weight) {
+  float row = floor((index + 0.5) / 256.0);
+  float u = (floor(index + 0.5) - row * 256.0) * (3.0 / 768.0) + (0.5 / 768.0);
+  float v = (row + 0.5) / joint_rows;
+  x += texture2DLod(joint_texture, vec2(u, v), 0.0) * weight;
+  y += texture2DLod(joint_texture, vec2(u + 1.0 / 768.0, v), 0.0) * weight;
+  z += texture2DLod(joint_texture, vec2(u + 2.0 / 768.0, v), 0.0) * weight;
+}
+
+void main() {
+  vec4 x = vec4(0.0), y = vec4(0.0), z = vec4(0.0);
+  float weight0 = 1.0 - blendweight.x - blendweight.y - blendweight.z;
+  add_joint(x, y, z, blendindices.x, weight0);
+  add_joint(x, y, z, blendindices.y, blendweight.x);
+  add_joint(x, y, z, blendindices.z, blendweight.y);
+  add_joint(x, y, z, blendindices.w, blendweight.z);
+
+  vec4 skinned_pos = vec4(dot(pos, x), dot(pos, y), dot(pos, z), 1.0);
+  vec3 skinned_normal = vec3(dot(normal, x.xyz), dot(normal, y.xyz), dot(normal, z.xyz));
+
+  gl_Position = modelToProjection * skinned_pos;
+  vec3 tnormal = (modelToCamera * vec4(skinned_normal, 0.0)).xyz;
+  vec3 tpos = (modelToCamera * skinned_pos).xyz;
+  normal_ = tnormal;
+  uv_ = uv;
+  color_ = color;
+  camera_pos_ = tpos;
+  model_pos_ = skinned_pos.xyz;
+}
@@ -3,10 +3,22 @@
 // default frament shader for solid colours
 //
 
-// constant parameters
-uniform vec4 lighting[17];
-uniform int num_lights;
-uniform vec4 diffuse;
+// constant parameters: with uniform buffers, the lights are in one buffer shared by all
+// materials and the rest in one buffer per material.
+#if OCTET_UNIFORM_BUFFERS
+  #extension GL_ARB_uniform_buffer_object : enable
+  layout(std140) uniform octet_lighting {
+    vec4 lighting[17];
+    int num_lights;
+  };
+  layout(std140) uniform octet_material {
+    vec4 diffuse;
+  };
+#else
+  uniform vec4 lighting[17];
+  uniform int num_lights;
+  uniform vec4 diffuse;
+#endif
 
 // inputs
 varying vec2 uv_;
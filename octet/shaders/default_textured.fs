@@ -3,9 +3,17 @@
 // default frament shader for textures
 //
 
-// constant parameters
-uniform vec4 lighting[17];
-uniform int num_lights;
+// constant parameters: with uniform buffers, the lights are in one buffer shared by all materials.
+#if OCTET_UNIFORM_BUFFERS
+  #extension GL_ARB_uniform_buffer_object : enable
+  layout(std140) uniform octet_lighting {
+    vec4 lighting[17];
+    int num_lights;
+  };
+#else
+  uniform vec4 lighting[17];
+  uniform int num_lights;
+#endif
 uniform sampler2D diffuse_sampler;
 
 // inputs
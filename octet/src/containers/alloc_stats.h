@@ -0,0 +1,152 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Allocation instrumentation
+//
+// Counters for bytes and allocations by resource type and by dynarray instantiation.
+// Together with the allocator's own totals, these tell you who is using the heap.
+//
+
+// name of the current function, including template arguments.
+#ifdef _MSC_VER
+  #define OCTET_FUNCTION_SIGNATURE __FUNCSIG__
+#else
+  #define OCTET_FUNCTION_SIGNATURE __PRETTY_FUNCTION__
+#endif
+
+namespace octet { namespace containers {
+  /// Allocation statistics by type.
+  ///
+  /// Each counter_t is a static object (one per resource class, one per dynarray type)
+  /// that adds itself to a global list when it is first used.
+  /// Jobs allocate on other threads, so the counters and the list are updated under the allocator's lock.
+  ///
+  /// The counters can be seen in the http_server debug interface (operation=get_alloc_stats)
+  /// and are written to log.txt at exit.
+  class alloc_stats {
+  public:
+    /// allocation counter for one kind of object.
+    struct counter_t {
+      const char *kind;       /// "resource" or "dynarray"
+      const char *name;       /// class name or function signature
+      int id;                 /// atom for resources
+      counter_t *next;        /// next counter in the global list
+      size_t num_bytes;       /// bytes currently allocated
+      size_t peak_bytes;      /// high water mark of num_bytes
+      unsigned num_allocs;    /// blocks currently allocated
+      unsigned total_allocs;  /// blocks allocated since the start
+
+      /// the counts, read together.
+      struct counts_t {
+        size_t num_bytes;
+        size_t peak_bytes;
+        unsigned num_allocs;
+        unsigned total_allocs;
+      };
+
+      counter_t(const char *kind_, const char *name_, int id_ = 0) {
+        kind = kind_;
+        name = name_;
+        id = id_;
+        num_bytes = peak_bytes = 0;
+        num_allocs = total_allocs = 0;
+        allocator::scoped_lock lock;
+        next = first();
+        first() = this;
+      }
+
+      /// record an allocation
+      void add(size_t size) {
+        allocator::scoped_lock lock;
+        num_bytes += size;
+        num_allocs++;
+        total_allocs++;
+        if (num_bytes > peak_bytes) peak_bytes = num_bytes;
+      }
+
+      /// record a free
+      void remove(size_t size) {
+        allocator::scoped_lock lock;
+        num_bytes -= size;
+        num_allocs--;
+      }
+
+      /// get the counts while other threads may be allocating.
+      counts_t get_counts() const {
+        allocator::scoped_lock lock;
+        counts_t result = { num_bytes, peak_bytes, num_allocs, total_allocs };
+        return result;
+      }
+
+      /// get a short name for the counter; dynarray signatures are trimmed to the template arguments.
+      const char *get_name(char *buf, size_t size) const {
+        const char *p = strstr(name, "[with ");
+        if (!p) return name;
+        p += 6;
+        const char *e = strchr(p, ';');
+        if (!e) e = strchr(p, ']');
+        const char *eq = strstr(p, " = ");
+        if (eq && (!e || eq < e)) p = eq + 3;
+        size_t len = e ? (size_t)(e - p) : strlen(p);
+        if (len >= size) len = size - 1;
+        memcpy(buf, p, len);
+        buf[len] = 0;
+        return buf;
+      }
+    };
+
+    /// get the first counter; follow counter_t::next for the rest.
+    static counter_t *get_first() {
+      allocator::scoped_lock lock;
+      return first();
+    }
+
+    /// write the allocator totals and all active counters to a file.
+    static void dump(FILE *file) {
+      allocator::stats_t stats;
+      allocator::get_stats(stats);
+      fprintf(file, "allocator: %u bytes in %u blocks, peak %u bytes\n",
+        (unsigned)stats.num_bytes, stats.num_allocs, (unsigned)stats.peak_bytes
+      );
+      fprintf(file, "allocator: %u allocations in total, %u allocations (%u bytes) last frame\n",
+        stats.total_allocs, stats.last_frame_allocs, (unsigned)stats.last_frame_bytes
+      );
+      fprintf(file, "%-9s %10s %10s %8s %8s  %s\n", "kind", "bytes", "peak", "blocks", "total", "name");
+      for (counter_t *c = get_first(); c; c = c->next) {
+        counter_t::counts_t counts = c->get_counts();
+        if (counts.total_allocs) {
+          char tmp[256];
+          fprintf(file, "%-9s %10u %10u %8u %8u  %s\n",
+            c->kind, (unsigned)counts.num_bytes, (unsigned)counts.peak_bytes, counts.num_allocs, counts.total_allocs, c->get_name(tmp, sizeof(tmp))
+          );
+        }
+      }
+    }
+
+    /// write the statistics to log.txt when the program exits.
+    static void dump_at_exit() {
+      static bool registered = false;
+      if (!registered) {
+        registered = true;
+        atexit(on_exit);
+      }
+    }
+
+  private:
+    // head of the list of counters; new counters go on the front.
+    static counter_t *&first() {
+      static counter_t *instance;
+      return instance;
+    }
+
+    static void on_exit() {
+      FILE *file = log("\nallocation statistics at exit\n");
+      dump(file);
+      fflush(file);
+    }
+  };
+} }
+
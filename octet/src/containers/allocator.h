@@ -6,14 +6,20 @@
 //
 // game-style memory allocator
 //
-// this is a placeholder for a game-style memory allocator
 // using malloc and free is frowned upon in grown-up circles.
 //
-// these functions are poor for the following reasons:
+// the system heap is poor for the following reasons:
 //
 // 1) free() has to compute the size of the block to free
 // 2) these functions use heavy weight locks to guard the heap.
 // 3) implementations are quite variable
+//
+// so small blocks come from pools of fixed size blocks instead.
+// Each size class keeps a list of 64k slabs with free blocks in them.
+// Slabs are aligned to their size, so free() finds the slab header with a mask.
+// A small table of slab addresses tells pool blocks from system blocks, so a
+// caller that passes the wrong size to free() can not send a block to the wrong heap.
+// Large blocks still go to the system heap.
 
 // this is a dummy class used to customise the placement new and delete
 struct dynarray_dummy_t {};
@@ -49,60 +55,564 @@ void operator delete(void *ptr, void *place, dynarray_dummy_t x) {}
 
 
 namespace octet { namespace containers {
+  /// Memory allocator used by all the containers and by resource::operator new.
+  ///
+  /// Blocks of up to max_pool_size bytes are allocated from per-size-class pools.
+  /// Larger blocks use the system heap.
+  ///
+  /// Note: free() and realloc() should be given the size that the block was allocated with.
+  /// The statistics depend on it, but which heap the block goes back to does not.
+  /// The pools are guarded by a spin lock so that jobs can allocate on any thread
+  /// (see OCTET_THREAD_SAFE_ALLOCATOR). The alloc_stats counters use the same lock.
   class allocator {
+  public:
+    enum {
+      /// all blocks are aligned to this.
+      alignment = 16,
+
+      /// size and alignment of a slab.
+      slab_size = 0x10000,
+
+      /// blocks bigger than this go to the system heap.
+      max_pool_size = 1024,
+
+      /// number of block sizes in the pool.
+      num_size_classes = 20,
+    };
+
+    /// occupancy of one size class.
+    struct class_stats_t {
+      unsigned block_size;    /// bytes per block
+      unsigned num_slabs;     /// slabs owned by this size class
+      unsigned num_blocks;    /// blocks available in those slabs
+      unsigned num_used;      /// blocks handed out
+      size_t num_requested;   /// bytes asked for by callers in this size class
+    };
+
+    /// allocator statistics; see get_stats() and dump_stats()
+    struct stats_t {
+      size_t num_bytes;       /// total bytes requested by callers (pool and system)
+      size_t peak_bytes;      /// high water mark of num_bytes
+      size_t system_bytes;    /// bytes requested from the system heap (large blocks)
+      unsigned num_allocs;    /// blocks in use
+      unsigned total_allocs;  /// calls to malloc and realloc since the start
+      unsigned frame_allocs;  /// calls to malloc and realloc this frame
+      size_t frame_bytes;     /// bytes allocated this frame
+      unsigned last_frame_allocs; /// calls to malloc and realloc in the previous frame
+      size_t last_frame_bytes; /// bytes allocated in the previous frame
+      size_t pool_requested;  /// bytes requested from the pools
+      size_t pool_used;       /// bytes in blocks handed out by the pools
+      size_t pool_reserved;   /// bytes in slabs
+      unsigned num_slabs;     /// number of slabs in all size classes
+      unsigned num_spare_slabs; /// empty slabs kept for reuse
+      class_stats_t classes[num_size_classes];
+
+      /// fraction of handed out block memory wasted by rounding up to the block size.
+      float get_internal_fragmentation() const {
+        return pool_used ? 1.0f - (float)pool_requested / pool_used : 0.0f;
+      }
+
+      /// fraction of slab memory not in use.
+      float get_external_fragmentation() const {
+        return pool_reserved ? 1.0f - (float)pool_used / pool_reserved : 0.0f;
+      }
+    };
+
+  private:
+    // header at the start of every slab.
+    struct slab_t {
+      slab_t *next;           // next slab in the size class partial list
+      slab_t *prev;           // previous slab in the size class partial list
+      void *free_list;        // blocks freed back to this slab
+      void *system_ptr;       // pointer to return to the system heap
+      uint32_t bump;          // offset of the first block never handed out
+      uint32_t num_used;      // blocks in use
+      uint32_t size_class;    // index into block_sizes()
+      uint32_t is_partial;    // is this slab in the partial list?
+    };
+
+    enum { header_size = 64 };
+
+    // one pool per block size.
+    struct size_class_t {
+      slab_t *partial;        // slabs with at least one free block
+      unsigned num_slabs;
+      unsigned num_used;
+      size_t num_requested;
+    };
+
     // singleton state, a bit like an old-world global variable
     struct state_t {
       size_t num_bytes;
+      size_t peak_bytes;
+      size_t system_bytes;
+      unsigned num_allocs;
+      unsigned total_allocs;
+      unsigned frame_allocs;
+      size_t frame_bytes;
+      unsigned last_frame_allocs;
+      size_t last_frame_bytes;
+      size_class_t classes[num_size_classes];
+      slab_t *spare;          // empty slabs kept back to avoid thrashing the system heap
+      unsigned num_spare;
+      slab_t **slab_table;    // open addressed set of every slab we own, from the system heap
+      unsigned slab_table_size;
+      unsigned num_table_slabs;
     };
 
+    enum { max_spare_slabs = 4 };
+
     static state_t &state() {
       static state_t instance;
       return instance;
     }
 
+    #if OCTET_THREAD_SAFE_ALLOCATOR
+      static spin_lock &get_lock() {
+        static spin_lock lock;
+        return lock;
+      }
+    #endif
+
   public:
-    // todo: implement this from scratch using a pool allocator
-    static void *malloc(size_t size) {
-      state().num_bytes += size;
+    #if OCTET_THREAD_SAFE_ALLOCATOR
+      /// Holds the allocator lock until the end of the scope. Do not allocate while holding it.
+      struct scoped_lock {
+        scoped_lock() { get_lock().lock(); }
+        ~scoped_lock() { get_lock().unlock(); }
+      };
+    #else
+      struct scoped_lock {
+      };
+    #endif
+
+  private:
+
+    // size of the blocks in each size class
+    static unsigned block_size(unsigned size_class) {
+      static const uint16_t sizes[num_size_classes] = {
+        16, 32, 48, 64, 80, 96, 112, 128,
+        160, 192, 224, 256,
+        320, 384, 448, 512,
+        640, 768, 896, 1024,
+      };
+      return sizes[size_class];
+    }
+
+    // size class for a size of up to max_pool_size bytes.
+    static unsigned size_class(size_t size) {
+      static const uint8_t classes[max_pool_size/alignment+1] = {
+        0,
+        0, 1, 2, 3, 4, 5, 6, 7,
+        8, 8, 9, 9, 10, 10, 11, 11,
+        12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15,
+        16, 16, 16, 16, 16, 16, 16, 16, 17, 17, 17, 17, 17, 17, 17, 17,
+        18, 18, 18, 18, 18, 18, 18, 18, 19, 19, 19, 19, 19, 19, 19, 19,
+      };
+      return classes[(size + alignment - 1) / alignment];
+    }
+
+    // find the slab that owns a pooled block.
+    static slab_t *get_slab(void *ptr) {
+      return (slab_t*)((intptr_t)ptr & ~(intptr_t)(slab_size - 1));
+    }
+
+    static void *system_malloc(size_t size) {
       #if OCTET_MAC
         void *res = 0;
-        posix_memalign(&res, 16, size);
+        posix_memalign(&res, alignment, size);
       #elif OCTET_SSE
-        void *res = ::_aligned_malloc(size, 16);
+        void *res = ::_aligned_malloc(size, alignment);
       #elif OCTET_VITA
-        void *res = ::memalign(size, 16);
+        void *res = ::memalign(alignment, size);
       #else
         void *res = ::malloc(size);
       #endif
-      //printf("malloc %p[%d] -> %d\n", res, size, state().num_bytes);
       return res;
     }
 
-    static void free(void *ptr, size_t size) {
-      state().num_bytes -= size;
-      //printf("free %p[%d] -> %d\n", ptr, size, state().num_bytes);
+    static void system_free(void *ptr) {
       #if OCTET_MAC
-        return ::free(ptr);
+        ::free(ptr);
       #elif OCTET_SSE
-        return ::_aligned_free(ptr);
+        ::_aligned_free(ptr);
       #else
-        return ::free(ptr);
+        ::free(ptr);
       #endif
     }
 
-    static void *realloc(void *ptr, size_t old_size, size_t size) {
-      state().num_bytes += size - old_size;
+    static void *system_realloc(void *ptr, size_t size) {
       #if OCTET_MAC
         void *res = ::realloc(ptr, size);
       #elif OCTET_SSE
-        void *res = ::_aligned_realloc(ptr, size, 16);
+        void *res = ::_aligned_realloc(ptr, size, alignment);
       #else
         void *res = ::realloc(ptr, size);
       #endif
-      //printf("realloc %p[%d] -> %p[%d] %d\n", ptr, old_size, res, size, state().num_bytes);
       return res;
     }
 
+    // where to start looking for a slab in slab_table.
+    static unsigned slab_hash(slab_t *slab, unsigned mask) {
+      return ((unsigned)((uintptr_t)slab / slab_size) * 0x9E3779B1u) & mask;
+    }
+
+    // true if ptr is in one of our slabs, as opposed to a system heap block.
+    static bool is_pool_block(void *ptr) {
+      state_t &s = state();
+      if (!s.slab_table) return false;
+      slab_t *slab = get_slab(ptr);
+      unsigned mask = s.slab_table_size - 1;
+      for (unsigned i = slab_hash(slab, mask); s.slab_table[i]; i = (i + 1) & mask) {
+        if (s.slab_table[i] == slab) return true;
+      }
+      return false;
+    }
+
+    // add a slab to slab_table, growing it at half full. Returns false if we are out of memory.
+    static bool add_table_slab(slab_t *slab) {
+      state_t &s = state();
+      if ((s.num_table_slabs + 1) * 2 > s.slab_table_size) {
+        unsigned new_size = s.slab_table_size ? s.slab_table_size * 2 : 64;
+        slab_t **table = (slab_t**)system_malloc(new_size * sizeof(slab_t*));
+        if (!table) return false;
+        memset(table, 0, new_size * sizeof(slab_t*));
+        for (unsigned j = 0; j != s.slab_table_size; ++j) {
+          slab_t *old = s.slab_table[j];
+          if (old) {
+            unsigned i = slab_hash(old, new_size - 1);
+            while (table[i]) i = (i + 1) & (new_size - 1);
+            table[i] = old;
+          }
+        }
+        if (s.slab_table) system_free(s.slab_table);
+        s.slab_table = table;
+        s.slab_table_size = new_size;
+      }
+      unsigned mask = s.slab_table_size - 1;
+      unsigned i = slab_hash(slab, mask);
+      while (s.slab_table[i]) i = (i + 1) & mask;
+      s.slab_table[i] = slab;
+      s.num_table_slabs++;
+      return true;
+    }
+
+    // remove a slab from slab_table, moving back any later slabs that would no longer be found.
+    static void remove_table_slab(slab_t *slab) {
+      state_t &s = state();
+      unsigned mask = s.slab_table_size - 1;
+      unsigned i = slab_hash(slab, mask);
+      while (s.slab_table[i] != slab) i = (i + 1) & mask;
+      s.slab_table[i] = 0;
+      s.num_table_slabs--;
+      for (unsigned j = (i + 1) & mask; s.slab_table[j]; j = (j + 1) & mask) {
+        unsigned home = slab_hash(s.slab_table[j], mask);
+        // move it to the hole unless its home is between the hole and here.
+        bool stays = i < j ? home > i && home <= j : home > i || home <= j;
+        if (!stays) {
+          s.slab_table[i] = s.slab_table[j];
+          s.slab_table[j] = 0;
+          i = j;
+        }
+      }
+    }
+
+    // return a slab's memory to the system.
+    static void free_slab_memory(slab_t *slab) {
+      #if OCTET_SSE
+        ::_aligned_free(slab->system_ptr);
+      #else
+        ::free(slab->system_ptr);
+      #endif
+    }
+
+    // get a slab_size aligned block of slab_size bytes from the system.
+    static slab_t *new_slab() {
+      state_t &s = state();
+      if (s.spare) {
+        slab_t *slab = s.spare;
+        s.spare = slab->next;
+        s.num_spare--;
+        return slab;
+      }
+
+      #if OCTET_MAC || OCTET_LINUX
+        void *system_ptr = 0;
+        posix_memalign(&system_ptr, slab_size, slab_size);
+        slab_t *slab = (slab_t*)system_ptr;
+      #elif OCTET_SSE
+        void *system_ptr = ::_aligned_malloc(slab_size, slab_size);
+        slab_t *slab = (slab_t*)system_ptr;
+      #elif OCTET_VITA
+        void *system_ptr = ::memalign(slab_size, slab_size);
+        slab_t *slab = (slab_t*)system_ptr;
+      #else
+        // no aligned allocation on this platform: over-allocate and align by hand.
+        void *system_ptr = ::malloc(slab_size * 2);
+        slab_t *slab = system_ptr ? get_slab((char*)system_ptr + slab_size - 1) : 0;
+      #endif
+
+      if (!slab) {
+        return 0;
+      }
+      slab->system_ptr = system_ptr;
+      if (!add_table_slab(slab)) {
+        free_slab_memory(slab);
+        return 0;
+      }
+      return slab;
+    }
+
+    // return an empty slab to the spare list or to the system.
+    static void delete_slab(slab_t *slab) {
+      state_t &s = state();
+      if (s.num_spare < max_spare_slabs) {
+        slab->next = s.spare;
+        s.spare = slab;
+        s.num_spare++;
+      } else {
+        remove_table_slab(slab);
+        free_slab_memory(slab);
+      }
+    }
+
+    static void link_partial(size_class_t &sc, slab_t *slab) {
+      slab->prev = 0;
+      slab->next = sc.partial;
+      if (sc.partial) sc.partial->prev = slab;
+      sc.partial = slab;
+      slab->is_partial = 1;
+    }
+
+    static void unlink_partial(size_class_t &sc, slab_t *slab) {
+      if (slab->prev) slab->prev->next = slab->next; else sc.partial = slab->next;
+      if (slab->next) slab->next->prev = slab->prev;
+      slab->next = slab->prev = 0;
+      slab->is_partial = 0;
+    }
+
+    // get a block from a size class, adding a new slab if there is no space.
+    static void *pool_malloc(unsigned cls, size_t size) {
+      size_class_t &sc = state().classes[cls];
+      slab_t *slab = sc.partial;
+      unsigned bsize = block_size(cls);
+
+      if (!slab) {
+        // slab refill
+        slab = new_slab();
+        if (!slab) return 0;
+        slab->free_list = 0;
+        slab->bump = header_size;
+        slab->num_used = 0;
+        slab->size_class = cls;
+        link_partial(sc, slab);
+        sc.num_slabs++;
+      }
+
+      void *res;
+      if (slab->free_list) {
+        res = slab->free_list;
+        slab->free_list = *(void**)res;
+      } else {
+        res = (char*)slab + slab->bump;
+        slab->bump += bsize;
+      }
+
+      slab->num_used++;
+      sc.num_used++;
+      sc.num_requested += size;
+
+      // full slabs leave the partial list until a block is freed.
+      if (!slab->free_list && slab->bump + bsize > slab_size) {
+        unlink_partial(sc, slab);
+      }
+      return res;
+    }
+
+    // return a block to its slab.
+    // the slab header knows the block size, so strings that have been shortened in place still work.
+    static void pool_free(void *ptr, size_t size) {
+      slab_t *slab = get_slab(ptr);
+      unsigned cls = slab->size_class;
+      size_class_t &sc = state().classes[cls];
+
+      *(void**)ptr = slab->free_list;
+      slab->free_list = ptr;
+      slab->num_used--;
+      sc.num_used--;
+      sc.num_requested -= size;
+
+      if (slab->num_used == 0 && (sc.partial != slab || slab->next)) {
+        // keep at least one slab per size class, free the rest.
+        if (slab->is_partial) unlink_partial(sc, slab);
+        sc.num_slabs--;
+        delete_slab(slab);
+      } else if (!slab->is_partial) {
+        link_partial(sc, slab);
+      }
+    }
+
+    // instrumentation: called for every malloc, free and realloc.
+    static void count_alloc(size_t size) {
+      state_t &s = state();
+      s.num_bytes += size;
+      s.num_allocs++;
+      s.total_allocs++;
+      s.frame_allocs++;
+      s.frame_bytes += size;
+      if (s.num_bytes > s.peak_bytes) s.peak_bytes = s.num_bytes;
+    }
+
+    static void count_free(size_t size) {
+      state_t &s = state();
+      s.num_bytes -= size;
+      s.num_allocs--;
+    }
+
+    static void count_realloc(size_t old_size, size_t size) {
+      count_free(old_size);
+      count_alloc(size);
+    }
+
+    // malloc, free and realloc with the lock held.
+    static void *locked_malloc(size_t size) {
+      count_alloc(size);
+      #if OCTET_POOL_ALLOCATOR
+        if (size <= max_pool_size) {
+          return pool_malloc(size_class(size), size);
+        }
+      #endif
+      state().system_bytes += size;
+      return system_malloc(size);
+    }
+
+    static void locked_free(void *ptr, size_t size) {
+      if (!ptr) return;
+      count_free(size);
+      #if OCTET_POOL_ALLOCATOR
+        if (is_pool_block(ptr)) {
+          return pool_free(ptr, size);
+        }
+      #endif
+      state().system_bytes -= size;
+      system_free(ptr);
+    }
+
+    static void *locked_realloc(void *ptr, size_t old_size, size_t size) {
+      if (!ptr) return locked_malloc(size);
+      #if OCTET_POOL_ALLOCATOR
+        bool pooled = is_pool_block(ptr);
+        if (pooled || size <= max_pool_size) {
+          if (pooled && size <= max_pool_size && get_slab(ptr)->size_class == size_class(size)) {
+            // same block size: nothing to move.
+            count_realloc(old_size, size);
+            state().classes[get_slab(ptr)->size_class].num_requested += size - old_size;
+            return ptr;
+          }
+          // never copy more than the old block holds, whatever old_size says.
+          size_t old_bytes = pooled && old_size > block_size(get_slab(ptr)->size_class) ? block_size(get_slab(ptr)->size_class) : old_size;
+          void *res = locked_malloc(size);
+          if (res) {
+            memcpy(res, ptr, old_bytes < size ? old_bytes : size);
+          }
+          locked_free(ptr, old_size);
+          return res;
+        }
+      #endif
+      count_realloc(old_size, size);
+      state().system_bytes += size - old_size;
+      return system_realloc(ptr, size);
+    }
+
+  public:
+    /// allocate size bytes aligned to 16 bytes.
+    static void *malloc(size_t size) {
+      scoped_lock lock;
+      return locked_malloc(size);
+    }
+
+    /// free a block; size must be the size it was allocated with.
+    static void free(void *ptr, size_t size) {
+      scoped_lock lock;
+      locked_free(ptr, size);
+    }
+
+    /// change the size of a block; old_size must be the size it was allocated with.
+    static void *realloc(void *ptr, size_t old_size, size_t size) {
+      scoped_lock lock;
+      return locked_realloc(ptr, old_size, size);
+    }
+
+    /// get the block size that will be used for an allocation of size bytes.
+    static size_t get_block_size(size_t size) {
+      #if OCTET_POOL_ALLOCATOR
+        if (size <= max_pool_size) {
+          return block_size(size_class(size));
+        }
+      #endif
+      return size;
+    }
+
+    /// start counting allocations for a new frame. Called by app_common::end_frame().
+    static void end_frame() {
+      scoped_lock lock;
+      state_t &s = state();
+      s.last_frame_allocs = s.frame_allocs;
+      s.last_frame_bytes = s.frame_bytes;
+      s.frame_allocs = 0;
+      s.frame_bytes = 0;
+    }
+
+    /// fill in the allocator statistics: bytes in use, slab occupancy and fragmentation.
+    static void get_stats(stats_t &stats) {
+      scoped_lock lock;
+      state_t &s = state();
+      memset(&stats, 0, sizeof(stats));
+      stats.num_bytes = s.num_bytes;
+      stats.peak_bytes = s.peak_bytes;
+      stats.system_bytes = s.system_bytes;
+      stats.num_allocs = s.num_allocs;
+      stats.total_allocs = s.total_allocs;
+      stats.frame_allocs = s.frame_allocs;
+      stats.frame_bytes = s.frame_bytes;
+      stats.last_frame_allocs = s.last_frame_allocs;
+      stats.last_frame_bytes = s.last_frame_bytes;
+      stats.num_spare_slabs = s.num_spare;
+      for (unsigned i = 0; i != num_size_classes; ++i) {
+        const size_class_t &sc = s.classes[i];
+        class_stats_t &cs = stats.classes[i];
+        cs.block_size = block_size(i);
+        cs.num_slabs = sc.num_slabs;
+        cs.num_blocks = sc.num_slabs * ((slab_size - header_size) / cs.block_size);
+        cs.num_used = sc.num_used;
+        cs.num_requested = sc.num_requested;
+        stats.pool_requested += sc.num_requested;
+        stats.pool_used += (size_t)sc.num_used * cs.block_size;
+        stats.pool_reserved += (size_t)sc.num_slabs * slab_size;
+        stats.num_slabs += sc.num_slabs;
+      }
+    }
+
+    /// write a table of the allocator statistics to a file (eg. stdout or log())
+    static void dump_stats(FILE *file) {
+      stats_t stats;
+      get_stats(stats);
+      fprintf(file, "allocator: %u bytes in use, %u system, %u pooled in %u slabs (%u spare)\n",
+        (unsigned)stats.num_bytes, (unsigned)stats.system_bytes, (unsigned)stats.pool_requested, stats.num_slabs, stats.num_spare_slabs
+      );
+      fprintf(file, "allocator: fragmentation internal %5.1f%% external %5.1f%%\n",
+        stats.get_internal_fragmentation() * 100, stats.get_external_fragmentation() * 100
+      );
+      for (unsigned i = 0; i != num_size_classes; ++i) {
+        const class_stats_t &cs = stats.classes[i];
+        if (cs.num_slabs) {
+          fprintf(file, "  %5d bytes: %4d slabs %7d/%7d blocks used (%5.1f%%)\n",
+            cs.block_size, cs.num_slabs, cs.num_used, cs.num_blocks, cs.num_used * 100.0f / cs.num_blocks
+          );
+        }
+      }
+    }
+
     // crude check of stack integrity
     static void test(const char *label) {
       printf("test %s\n", label);
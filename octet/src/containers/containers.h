@@ -25,14 +25,25 @@
 #ifndef OCTET_CONTAINERS_INCLUDED
 #define OCTET_CONTAINERS_INCLUDED
 
+#include "../containers/spin_lock.h"
 #include "../containers/allocator.h"
-#include "../containers/dictionary.h"
+#include "../containers/alloc_stats.h"
+#include "../containers/frame_allocator.h"
+#include "../containers/wyhash.h"
 #include "../containers/hash_map.h"
+#include "../containers/istring.h"
+#include "../containers/dictionary.h"
 #include "../containers/double_list.h"
 #include "../containers/dynarray.h"
+#include "../containers/string_view.h"
 #include "../containers/string.h"
+#include "../containers/number_parser.h"
+#include "../containers/ref_count.h"
 #include "../containers/ref.h"
 #include "../containers/bitset.h"
+#include "../containers/dynamic_bitset.h"
+#include "../containers/slot_map.h"
+#include "../containers/radix_sort.h"
 
 namespace octet {
   using namespace containers;
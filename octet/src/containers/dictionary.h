@@ -21,19 +21,15 @@ namespace octet { namespace containers {
   ///     int annes_age = my_dict["anne"];
   ///
   template <class value_t, class allocator_t=allocator> class dictionary {
-    struct entry_t { const char *key; unsigned hash; value_t value; };
+    // is_interned is set if the key is istring text, which the dictionary does not own.
+    struct entry_t { const char *key; unsigned hash; unsigned is_interned; value_t value; };
     entry_t *entries;
     unsigned num_entries;
     unsigned max_entries;
   
-    // hash is a compromise between fewer collisions and
-    // faster hash calculation.
-    unsigned calc_hash( const char *key ) {
-      unsigned hash = 0;
-      for (int i = 0; key[i]; ++i) {
-        hash = ( hash << 5 ) ^ ( hash << 3 ) ^ (key[i] & 0xff);
-      }
-      return hash;
+    // wyhash is fast and mixes well, so we only need the bottom bits.
+    static unsigned calc_hash( const char *key ) {
+      return (unsigned)wyhash::hash(key);
     }
   
     // internal method to find an entry for a key
@@ -44,12 +40,36 @@ namespace octet { namespace containers {
         if (!entry->key) {
           return entry;
         }
-        if (entry->hash == hash && !strcmp(entry->key, key)) {
+        if (entry->hash == hash && (entry->key == key || !strcmp(entry->key, key))) {
           return entry;
         }
       }
       return 0;
     }
+
+    // add a key if it is not there already.
+    value_t &insert(const char *key, unsigned hash, bool is_interned) {
+      entry_t *entry = find( key, hash );
+      if (!entry || !entry->key) {
+        // reducing this ratio decreases hot search time at the
+        // expense of size (cold search time).
+        if (num_entries > max_entries * 3 / 4) {
+          expand();
+          entry = find(key, hash);
+        }
+        num_entries++;
+        if (is_interned) {
+          entry->key = key;
+        } else {
+          size_t bytes = strlen(key) + 1;
+          entry->key = (char *)allocator_t::malloc(bytes);
+          memcpy((void*)entry->key, key, bytes);
+        }
+        entry->hash = hash;
+        entry->is_interned = is_interned;
+      }
+      return entry->value;
+    }
   
     // grow the dictionary when needed
     void expand() {
@@ -71,7 +91,7 @@ namespace octet { namespace containers {
     void release() {
       for (unsigned i = 0; i != max_entries; ++i) {
         entry_t *entry = &entries[i];
-        if (entry->key ) {
+        if (entry->key && !entry->is_interned) {
           allocator_t::free((void*)entry->key, strlen(entry->key)+1);
         }
       }
@@ -97,22 +117,13 @@ namespace octet { namespace containers {
     /// This will create a new element if one does not exist.
     /// For more detail, use get_index(), get_key() and get_value()
     value_t &operator[]( const char *key ) {
-      unsigned hash = calc_hash( key );
-      entry_t *entry = find( key, hash );
-      if (!entry || !entry->key) {
-        // reducing this ratio decreases hot search time at the
-        // expense of size (cold search time).
-        if (num_entries > max_entries * 3 / 4) {
-          expand();
-          entry = find(key, hash);
-        }
-        num_entries++;
-        size_t bytes = strlen(key) + 1;
-        entry->key = (char *)allocator_t::malloc(bytes);
-        entry->hash = hash;
-        memcpy((void*)entry->key, key, bytes);
-      }
-      return entry->value;
+      return insert(key, calc_hash(key), false);
+    }
+
+    /// Access an element by interned name. The hash is not recomputed
+    /// and new keys share the interned text instead of making a copy.
+    value_t &operator[]( const istring &key ) {
+      return insert(key.c_str(), (unsigned)key.get_hash(), true);
     }
 
     /// Return true if the dictionary contains key.
@@ -122,6 +133,12 @@ namespace octet { namespace containers {
       return entry && entry->key;
     }
 
+    /// Return true if the dictionary contains key.
+    bool contains(const istring &key) {
+      entry_t *entry = find( key.c_str(), (unsigned)key.get_hash() );
+      return entry && entry->key;
+    }
+
     /// Return the number of entries stored in the dictionary.
     unsigned get_size() const {
       return num_entries;
@@ -151,6 +168,12 @@ namespace octet { namespace containers {
       return entry && entry->key ? (int)(entry - entries) : -1;
     }
 
+    /// Get the index for a certain key, or -1 if the key is not found.
+    int get_index(const istring &key) {
+      entry_t *entry = find( key.c_str(), (unsigned)key.get_hash() );
+      return entry && entry->key ? (int)(entry - entries) : -1;
+    }
+
     /// Reset the dictionary to empty and free up the resources.
     void reset() {
       release();
@@ -0,0 +1,500 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Dynamic bit set with wide (SSE2/AVX2) logic and fast set-bit iteration.
+//
+
+namespace octet { namespace containers {
+  /// Bit counting and scanning on single words.
+  class bit_ops {
+  public:
+    /// number of one bits in a 64 bit word.
+    static unsigned pop_count(uint64_t v) {
+      #if defined(__GNUC__) || defined(__clang__)
+        return (unsigned)__builtin_popcountll(v);
+      #elif defined(_MSC_VER) && defined(_M_X64) && OCTET_AVX2
+        // every AVX2 cpu has the popcnt instruction.
+        return (unsigned)__popcnt64(v);
+      #else
+        v = v - ((v >> 1) & 0x5555555555555555ull);
+        v = (v & 0x3333333333333333ull) + ((v >> 2) & 0x3333333333333333ull);
+        v = (v + (v >> 4)) & 0x0f0f0f0f0f0f0f0full;
+        return (unsigned)((v * 0x0101010101010101ull) >> 56);
+      #endif
+    }
+
+    /// number of one bits in a 32 bit word.
+    static unsigned pop_count(uint32_t v) {
+      return pop_count((uint64_t)v);
+    }
+
+    /// index of the lowest one bit. v must not be zero.
+    static unsigned find_first(uint64_t v) {
+      assert(v != 0);
+      #if defined(__GNUC__) || defined(__clang__)
+        return (unsigned)__builtin_ctzll(v);
+      #elif defined(_MSC_VER) && defined(_M_X64)
+        unsigned long bit;
+        _BitScanForward64(&bit, v);
+        return (unsigned)bit;
+      #elif defined(_MSC_VER)
+        unsigned long bit;
+        if ((uint32_t)v) {
+          _BitScanForward(&bit, (uint32_t)v);
+          return (unsigned)bit;
+        }
+        _BitScanForward(&bit, (uint32_t)(v >> 32));
+        return (unsigned)bit + 32;
+      #else
+        unsigned bit = 0;
+        while (!(v & 1)) { v >>= 1; bit++; }
+        return bit;
+      #endif
+    }
+
+    /// index of the lowest one bit. v must not be zero.
+    static unsigned find_first(uint32_t v) {
+      return find_first((uint64_t)v);
+    }
+
+    /// call fn(index) for each one bit in a word, lowest first.
+    template <class fn_t> static void for_each_set_bit(uint64_t v, unsigned base, fn_t &fn) {
+      for (; v; v &= v - 1) {
+        fn(base + find_first(v));
+      }
+    }
+  };
+
+  /// Bit set whose size is chosen at run time.
+  ///
+  /// Use dynamic_bitset for per-object flags (visibility, dirty, occupancy) where
+  /// the number of objects is not known in advance. The bits are stored in
+  /// 64 bit words padded to 256 bits, so the set operations run four words at
+  /// a time with AVX2 (OCTET_AVX2), two at a time with SSE2 (OCTET_SSE) or one
+  /// word at a time otherwise. Bits past size() are always zero.
+  ///
+  /// Example:
+  ///
+  ///     dynamic_bitset visible(num_nodes);
+  ///     visible.set(3);
+  ///     visible.set(70);
+  ///     visible &= enabled;
+  ///     for (dynamic_bitset::iterator i = visible.begin(); i != visible.end(); ++i) {
+  ///       draw(*i);
+  ///     }
+  template <class allocator_t=allocator> class basic_dynamic_bitset {
+  public:
+    typedef uint64_t word_t;
+
+  private:
+    enum {
+      word_bits = 64,
+      block_words = 4,   // 256 bits: one AVX2 register or two SSE2 registers
+    };
+
+    dynarray<word_t, allocator_t, false> words;
+    unsigned num_bits;
+
+    static unsigned words_for(unsigned size) {
+      unsigned num_words = (size + word_bits - 1) / word_bits;
+      return (num_words + block_words - 1) & ~(unsigned)(block_words - 1);
+    }
+
+    // zero the bits past size() in the last word.
+    void clear_tail() {
+      unsigned used = num_bits % word_bits;
+      if (used) {
+        words[num_bits / word_bits] &= ~(word_t)0 >> (word_bits - used);
+      }
+    }
+
+    // apply op to every block of words with the widest registers we have.
+    template <class op_t> void combine(const basic_dynamic_bitset &rhs, op_t op) {
+      assert(num_bits == rhs.num_bits);
+      word_t *dest = words.data();
+      const word_t *src = rhs.words.data();
+      unsigned num_words = words.size();
+      for (unsigned i = 0; i != num_words; i += block_words) {
+        #if OCTET_AVX2
+          __m256i a = _mm256_loadu_si256((const __m256i*)(dest + i));
+          __m256i b = _mm256_loadu_si256((const __m256i*)(src + i));
+          _mm256_storeu_si256((__m256i*)(dest + i), op(a, b));
+        #elif OCTET_SSE
+          __m128i a0 = _mm_loadu_si128((const __m128i*)(dest + i));
+          __m128i a1 = _mm_loadu_si128((const __m128i*)(dest + i + 2));
+          __m128i b0 = _mm_loadu_si128((const __m128i*)(src + i));
+          __m128i b1 = _mm_loadu_si128((const __m128i*)(src + i + 2));
+          _mm_storeu_si128((__m128i*)(dest + i), op(a0, b0));
+          _mm_storeu_si128((__m128i*)(dest + i + 2), op(a1, b1));
+        #else
+          for (unsigned j = 0; j != block_words; ++j) {
+            dest[i + j] = op(dest[i + j], src[i + j]);
+          }
+        #endif
+      }
+    }
+
+    // wide bitwise operators for combine()
+    struct or_op {
+      #if OCTET_AVX2
+        __m256i operator()(__m256i a, __m256i b) const { return _mm256_or_si256(a, b); }
+      #elif OCTET_SSE
+        __m128i operator()(__m128i a, __m128i b) const { return _mm_or_si128(a, b); }
+      #else
+        word_t operator()(word_t a, word_t b) const { return a | b; }
+      #endif
+    };
+
+    struct and_op {
+      #if OCTET_AVX2
+        __m256i operator()(__m256i a, __m256i b) const { return _mm256_and_si256(a, b); }
+      #elif OCTET_SSE
+        __m128i operator()(__m128i a, __m128i b) const { return _mm_and_si128(a, b); }
+      #else
+        word_t operator()(word_t a, word_t b) const { return a & b; }
+      #endif
+    };
+
+    struct xor_op {
+      #if OCTET_AVX2
+        __m256i operator()(__m256i a, __m256i b) const { return _mm256_xor_si256(a, b); }
+      #elif OCTET_SSE
+        __m128i operator()(__m128i a, __m128i b) const { return _mm_xor_si128(a, b); }
+      #else
+        word_t operator()(word_t a, word_t b) const { return a ^ b; }
+      #endif
+    };
+
+    // a & ~b (note that the intrinsics compute ~first & second)
+    struct and_not_op {
+      #if OCTET_AVX2
+        __m256i operator()(__m256i a, __m256i b) const { return _mm256_andnot_si256(b, a); }
+      #elif OCTET_SSE
+        __m128i operator()(__m128i a, __m128i b) const { return _mm_andnot_si128(b, a); }
+      #else
+        word_t operator()(word_t a, word_t b) const { return a & ~b; }
+      #endif
+    };
+
+    // popcount of 256 bits.
+    static unsigned block_pop_count(const word_t *src) {
+      #if OCTET_AVX2
+        // nibble lookup table with pshufb, then sum the bytes with psadbw.
+        const __m256i table = _mm256_setr_epi8(
+          0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+          0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+        );
+        const __m256i low_nibbles = _mm256_set1_epi8(0x0f);
+        __m256i v = _mm256_loadu_si256((const __m256i*)src);
+        __m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(v, low_nibbles));
+        __m256i hi = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), low_nibbles));
+        __m256i sums = _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+        __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+        return (unsigned)(_mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sum, sum)));
+      #elif OCTET_SSE
+        // bit slice counting in each byte, then sum the bytes with psadbw.
+        const __m128i m1 = _mm_set1_epi8(0x55);
+        const __m128i m2 = _mm_set1_epi8(0x33);
+        const __m128i m4 = _mm_set1_epi8(0x0f);
+        __m128i total = _mm_setzero_si128();
+        for (unsigned i = 0; i != block_words; i += 2) {
+          __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+          v = _mm_sub_epi8(v, _mm_and_si128(_mm_srli_epi16(v, 1), m1));
+          v = _mm_add_epi8(_mm_and_si128(v, m2), _mm_and_si128(_mm_srli_epi16(v, 2), m2));
+          v = _mm_and_si128(_mm_add_epi8(v, _mm_srli_epi16(v, 4)), m4);
+          total = _mm_add_epi64(total, _mm_sad_epu8(v, _mm_setzero_si128()));
+        }
+        return (unsigned)(_mm_cvtsi128_si32(total) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(total, total)));
+      #else
+        return bit_ops::pop_count(src[0]) + bit_ops::pop_count(src[1]) + bit_ops::pop_count(src[2]) + bit_ops::pop_count(src[3]);
+      #endif
+    }
+
+    // true if any of 256 bits are set.
+    static bool block_any(const word_t *src) {
+      #if OCTET_AVX2
+        __m256i v = _mm256_loadu_si256((const __m256i*)src);
+        return !_mm256_testz_si256(v, v);
+      #elif OCTET_SSE
+        __m128i v = _mm_or_si128(_mm_loadu_si128((const __m128i*)src), _mm_loadu_si128((const __m128i*)(src + 2)));
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xffff;
+      #else
+        return (src[0] | src[1] | src[2] | src[3]) != 0;
+      #endif
+    }
+
+    // true if two blocks of 256 bits have a bit in common.
+    static bool block_intersects(const word_t *a, const word_t *b) {
+      #if OCTET_AVX2
+        return !_mm256_testz_si256(_mm256_loadu_si256((const __m256i*)a), _mm256_loadu_si256((const __m256i*)b));
+      #elif OCTET_SSE
+        __m128i v = _mm_or_si128(
+          _mm_and_si128(_mm_loadu_si128((const __m128i*)a), _mm_loadu_si128((const __m128i*)b)),
+          _mm_and_si128(_mm_loadu_si128((const __m128i*)(a + 2)), _mm_loadu_si128((const __m128i*)(b + 2)))
+        );
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xffff;
+      #else
+        return ((a[0] & b[0]) | (a[1] & b[1]) | (a[2] & b[2]) | (a[3] & b[3])) != 0;
+      #endif
+    }
+
+  public:
+    /// Iterator over the indices of the set bits, lowest first.
+    class iterator {
+      const word_t *words;
+      unsigned num_words;
+      unsigned word_index;
+      word_t bits;          // unvisited bits of the current word
+
+      void skip_empty() {
+        while (!bits) {
+          if (++word_index >= num_words) {
+            word_index = num_words;
+            return;
+          }
+          bits = words[word_index];
+        }
+      }
+
+    public:
+      iterator(const word_t *words_, unsigned num_words_, unsigned word_index_) {
+        words = words_;
+        num_words = num_words_;
+        word_index = word_index_;
+        bits = word_index < num_words ? words[word_index] : 0;
+        if (word_index < num_words) skip_empty();
+      }
+
+      /// index of the current bit
+      unsigned operator*() const {
+        return word_index * word_bits + bit_ops::find_first(bits);
+      }
+
+      /// move to the next set bit
+      iterator &operator++() {
+        bits &= bits - 1;
+        skip_empty();
+        return *this;
+      }
+
+      bool operator==(const iterator &rhs) const {
+        return word_index == rhs.word_index && bits == rhs.bits;
+      }
+
+      bool operator!=(const iterator &rhs) const {
+        return !(*this == rhs);
+      }
+    };
+
+    /// make a set of size bits, all zero.
+    explicit basic_dynamic_bitset(unsigned size = 0) {
+      num_bits = 0;
+      resize(size);
+    }
+
+    /// change the number of bits. New bits are zero.
+    void resize(unsigned size) {
+      unsigned old_words = words.size();
+      unsigned new_words = words_for(size);
+      words.resize(new_words);
+      if (new_words > old_words) {
+        memset(words.data() + old_words, 0, (new_words - old_words) * sizeof(word_t));
+      } else if (size < num_bits) {
+        // zero the bits we dropped, including whole words of padding.
+        unsigned used_words = (size + word_bits - 1) / word_bits;
+        memset(words.data() + used_words, 0, (new_words - used_words) * sizeof(word_t));
+      }
+      num_bits = size;
+      if (new_words) clear_tail();
+    }
+
+    /// number of bits
+    unsigned size() const {
+      return num_bits;
+    }
+
+    /// return true if a bit is set
+    bool operator[](unsigned index) const {
+      return test(index);
+    }
+
+    /// return true if a bit is set
+    bool test(unsigned index) const {
+      assert(index < num_bits);
+      return (words[index / word_bits] >> (index % word_bits)) & 1;
+    }
+
+    /// set a bit to one
+    void set(unsigned index) {
+      assert(index < num_bits);
+      words[index / word_bits] |= (word_t)1 << (index % word_bits);
+    }
+
+    /// set a bit to zero
+    void reset(unsigned index) {
+      assert(index < num_bits);
+      words[index / word_bits] &= ~((word_t)1 << (index % word_bits));
+    }
+
+    /// set a bit to value
+    void assign(unsigned index, bool value) {
+      if (value) set(index); else reset(index);
+    }
+
+    /// invert a bit
+    void flip(unsigned index) {
+      assert(index < num_bits);
+      words[index / word_bits] ^= (word_t)1 << (index % word_bits);
+    }
+
+    /// set all the bits to one
+    void set_all() {
+      if (!words.size()) return;
+      memset(words.data(), 0xff, words.size() * sizeof(word_t));
+      // the padding words must stay zero.
+      unsigned used_words = (num_bits + word_bits - 1) / word_bits;
+      memset(words.data() + used_words, 0, (words.size() - used_words) * sizeof(word_t));
+      clear_tail();
+    }
+
+    /// set all the bits to zero
+    void clear() {
+      if (words.size()) memset(words.data(), 0, words.size() * sizeof(word_t));
+    }
+
+    /// number of one bits
+    unsigned count() const {
+      unsigned total = 0;
+      for (unsigned i = 0; i != words.size(); i += block_words) {
+        total += block_pop_count(words.data() + i);
+      }
+      return total;
+    }
+
+    /// true if any bit is one
+    bool any() const {
+      for (unsigned i = 0; i != words.size(); i += block_words) {
+        if (block_any(words.data() + i)) return true;
+      }
+      return false;
+    }
+
+    /// true if all bits are zero
+    bool none() const {
+      return !any();
+    }
+
+    /// index of the first one bit at or after start, or -1 if there is none.
+    int find_next(unsigned start) const {
+      if (start >= num_bits) return -1;
+      unsigned w = start / word_bits;
+      word_t bits = words[w] & (~(word_t)0 << (start % word_bits));
+      for (;;) {
+        if (bits) return (int)(w * word_bits + bit_ops::find_first(bits));
+        if (++w == words.size()) return -1;
+
+        // skip empty blocks quickly.
+        while ((w % block_words) == 0 && w != words.size() && !block_any(words.data() + w)) {
+          w += block_words;
+        }
+        if (w == words.size()) return -1;
+        bits = words[w];
+      }
+    }
+
+    /// index of the first one bit, or -1 if there is none.
+    int find_first() const {
+      return find_next(0);
+    }
+
+    /// Call fn(index) for every one bit, lowest first.
+    /// This is usually faster than the iterator as empty blocks are skipped with wide tests.
+    template <class fn_t> void for_each_set_bit(fn_t fn) const {
+      const word_t *src = words.data();
+      for (unsigned i = 0; i != words.size(); i += block_words) {
+        if (!block_any(src + i)) continue;
+        for (unsigned j = 0; j != block_words; ++j) {
+          bit_ops::for_each_set_bit(src[i + j], (i + j) * word_bits, fn);
+        }
+      }
+    }
+
+    /// first set bit
+    iterator begin() const {
+      return iterator(words.data(), words.size(), 0);
+    }
+
+    /// one past the last set bit
+    iterator end() const {
+      return iterator(words.data(), words.size(), words.size());
+    }
+
+    /// union
+    basic_dynamic_bitset &operator|=(const basic_dynamic_bitset &rhs) {
+      combine(rhs, or_op());
+      return *this;
+    }
+
+    /// intersection
+    basic_dynamic_bitset &operator&=(const basic_dynamic_bitset &rhs) {
+      combine(rhs, and_op());
+      return *this;
+    }
+
+    /// symmetric difference
+    basic_dynamic_bitset &operator^=(const basic_dynamic_bitset &rhs) {
+      combine(rhs, xor_op());
+      return *this;
+    }
+
+    /// remove the bits of rhs from this set (this &= ~rhs)
+    basic_dynamic_bitset &and_not(const basic_dynamic_bitset &rhs) {
+      combine(rhs, and_not_op());
+      return *this;
+    }
+
+    /// invert all the bits
+    void flip_all() {
+      unsigned used_words = (num_bits + word_bits - 1) / word_bits;
+      for (unsigned i = 0; i != used_words; ++i) {
+        words[i] = ~words[i];
+      }
+      if (used_words) clear_tail();
+    }
+
+    /// return true if the two sets have a bit in common.
+    bool intersects(const basic_dynamic_bitset &rhs) const {
+      assert(num_bits == rhs.num_bits);
+      for (unsigned i = 0; i != words.size(); i += block_words) {
+        if (block_intersects(words.data() + i, rhs.words.data() + i)) return true;
+      }
+      return false;
+    }
+
+    /// compare two sets
+    bool operator==(const basic_dynamic_bitset &rhs) const {
+      return num_bits == rhs.num_bits && !memcmp(words.data(), rhs.words.data(), words.size() * sizeof(word_t));
+    }
+
+    /// compare two sets
+    bool operator!=(const basic_dynamic_bitset &rhs) const {
+      return !(*this == rhs);
+    }
+
+    /// the words holding the bits, lowest bit first. There are num_words() words.
+    const word_t *data() const {
+      return words.data();
+    }
+
+    /// number of 64 bit words, including padding.
+    unsigned num_words() const {
+      return words.size();
+    }
+  };
+
+  /// dynamic bit set using the default allocator.
+  typedef basic_dynamic_bitset<> dynamic_bitset;
+} }
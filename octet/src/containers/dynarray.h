@@ -7,6 +7,15 @@
 
 
 namespace octet { namespace containers {
+  /// Can objects of this type be moved in memory with memcpy/realloc?
+  ///
+  /// True for trivially copyable types. Specialize this for classes that
+  /// only hold pointers to other objects (eg. ref<> and string) so dynarray
+  /// can grow with realloc instead of copying elements one at a time.
+  template <class item_t> struct is_relocatable {
+    enum { value = std::is_trivially_copyable<item_t>::value };
+  };
+
   /// Dynamic array class similar to std::vector.
   ///
   /// Example
@@ -33,6 +42,119 @@ namespace octet { namespace containers {
     int_size_t capacity_;
     enum { min_capacity = 8 };
 
+    // top bit of capacity_ is set if data_ is the inline buffer of a small_dynarray
+    enum { inline_flag = 0x80000000 };
+
+    // can we move the elements with realloc?
+    enum { use_realloc = !use_new_delete || is_relocatable<item_t>::value };
+
+    #if OCTET_ALLOC_STATS
+      // one counter per instantiation of dynarray
+      static alloc_stats::counter_t &get_alloc_counter() {
+        static alloc_stats::counter_t counter("dynarray", OCTET_FUNCTION_SIGNATURE);
+        return counter;
+      }
+    #endif
+
+    item_t *allocate(int_size_t capacity) {
+      #if OCTET_ALLOC_STATS
+        get_alloc_counter().add(capacity * sizeof(item_t));
+      #endif
+      return (item_t*)allocator_t::malloc(capacity * sizeof(item_t));
+    }
+
+    void deallocate(item_t *data, int_size_t capacity) {
+      #if OCTET_ALLOC_STATS
+        get_alloc_counter().remove(capacity * sizeof(item_t));
+      #endif
+      allocator_t::free(data, capacity * sizeof(item_t));
+    }
+
+    item_t *reallocate(item_t *data, int_size_t old_capacity, int_size_t capacity) {
+      #if OCTET_ALLOC_STATS
+        get_alloc_counter().remove(old_capacity * sizeof(item_t));
+        get_alloc_counter().add(capacity * sizeof(item_t));
+      #endif
+      return (item_t*)allocator_t::realloc(data, old_capacity * sizeof(item_t), capacity * sizeof(item_t));
+    }
+
+    bool is_inline() const {
+      return (capacity_ & inline_flag) != 0;
+    }
+
+    // free the memory, but not the inline buffer of a small_dynarray
+    void release() {
+      if (data_ && !is_inline()) {
+        deallocate(data_, capacity_);
+        data_ = 0;
+        capacity_ = 0;
+      }
+    }
+
+    void destroy(int_size_t first, int_size_t last) {
+      if (use_new_delete) {
+        for (int_size_t i = first; i != last; ++i) {
+          data_[i].~item_t();
+        }
+      }
+    }
+
+    void copy(const dynarray &rhs) {
+      reserve(rhs.size_);
+      if (use_new_delete) {
+        dynarray_dummy_t x;
+        for (int_size_t i = 0; i != rhs.size_; ++i) {
+          new (data_ + i, x)item_t(rhs.data_[i]);
+        }
+      } else {
+        memcpy((void*)data_, (void*)rhs.data_, rhs.size_ * sizeof(item_t));
+      }
+      size_ = rhs.size_;
+    }
+
+    // take the contents of rhs, leaving it empty.
+    void move(dynarray &rhs) {
+      if (!rhs.is_inline()) {
+        // steal the memory (our inline buffer, if any, goes unused)
+        data_ = rhs.data_;
+        size_ = rhs.size_;
+        capacity_ = rhs.capacity_;
+        rhs.data_ = 0;
+        rhs.size_ = 0;
+        rhs.capacity_ = 0;
+      } else {
+        // rhs is a small_dynarray using its inline buffer: move the elements
+        reserve(rhs.size_);
+        dynarray_dummy_t x;
+        for (int_size_t i = 0; i != rhs.size_; ++i) {
+          new (data_ + i, x)item_t(std::move(rhs.data_[i]));
+        }
+        size_ = rhs.size_;
+        rhs.resize(0);
+      }
+    }
+
+    // grow the array by one for push_back and emplace_back
+    item_t *grow_by_one() {
+      if (size_ == get_capacity()) {
+        int_size_t new_capacity = size_ == 0 ? min_capacity : size_ * 2;
+        reserve(new_capacity);
+      }
+      return data_ + size_++;
+    }
+
+    int_size_t get_capacity() const {
+      return capacity_ & ~(int_size_t)inline_flag;
+    }
+
+  protected:
+    /// used by small_dynarray to supply an inline buffer.
+    dynarray(item_t *inline_data, int_size_t inline_capacity) {
+      data_ = inline_data;
+      size_ = 0;
+      capacity_ = inline_capacity | inline_flag;
+    }
+
   public:
     /// Create a new, empty, dynamic array
     dynarray() {
@@ -43,7 +165,7 @@ namespace octet { namespace containers {
 
     /// Create a new dynamic array of a certain size.
     dynarray(int_size_t size) {
-      data_ = (item_t*)allocator::malloc(size * sizeof(item_t));
+      data_ = allocate(size);
       size_ = capacity_ = size;
       if (use_new_delete) {
         dynarray_dummy_t x;
@@ -56,17 +178,39 @@ namespace octet { namespace containers {
     /// Create a copy of a dynamic array.
     ///
     /// Note: this is very slow and will happen frequently in naive code.
+    /// Use std::move() when you do not need the original.
     dynarray(const dynarray &rhs) {
-      data_ = (item_t*)allocator::malloc(rhs.size_ * sizeof(item_t));
-      size_ = capacity_ = rhs.size_;
-      if (use_new_delete) {
-        dynarray_dummy_t x;
-        for (int_size_t i = 0; i != size_; ++i) {
-          new (data_ + i, x)item_t(rhs.data_[i]);
-        }
-      } else {
-        memcpy(data_, rhs.data_, rhs.size_ * sizeof(item_t));
+      data_ = 0;
+      size_ = 0;
+      capacity_ = 0;
+      copy(rhs);
+    }
+
+    /// Move a dynamic array. This just takes the memory of rhs, leaving it empty.
+    dynarray(dynarray &&rhs) {
+      data_ = 0;
+      size_ = 0;
+      capacity_ = 0;
+      move(rhs);
+    }
+
+    /// Copy a dynamic array.
+    dynarray &operator=(const dynarray &rhs) {
+      if (this != &rhs) {
+        resize(0);
+        copy(rhs);
       }
+      return *this;
+    }
+
+    /// Move a dynamic array. This just takes the memory of rhs, leaving it empty.
+    dynarray &operator=(dynarray &&rhs) {
+      if (this != &rhs) {
+        resize(0);
+        release();
+        move(rhs);
+      }
+      return *this;
     }
 
     /// Destroy the array and its contents.
@@ -111,7 +255,7 @@ namespace octet { namespace containers {
       int_size_t old_length = size_;
       resize(size_+1);
       for (int_size_t i = old_length; i != it.elem; --i) {
-        data_[i] = data_[i-1];
+        data_[i] = std::move(data_[i-1]);
       }
       data_[it.elem] = new_item;
       return it;
@@ -120,7 +264,7 @@ namespace octet { namespace containers {
     /// iterator erase for STL compatibility
     iterator erase(iterator it) {
       for (int_size_t i = it.elem; i < size_-1; ++i) {
-        data_[i] = data_[i+1];
+        data_[i] = std::move(data_[i+1]);
       }
       resize(size_-1);
       return it;
@@ -129,16 +273,40 @@ namespace octet { namespace containers {
     /// Erase an item; move subsequent items down to fill the gap.
     void erase(unsigned elem) {
       for (int_size_t i = elem; i < size_-1; ++i) {
-        data_[i] = data_[i+1];
+        data_[i] = std::move(data_[i+1]);
       }
       resize(size_-1);
     }
 
     /// Add an item at the back of the array.
     void push_back(const item_t &new_item) {
-      int_size_t old_length = size_;
-      resize(size_+1);
-      data_[old_length] = new_item;
+      dynarray_dummy_t x;
+      if (size_ != get_capacity()) {
+        new (data_ + size_, x)item_t(new_item);
+        size_++;
+      } else {
+        // new_item may be one of our own elements: copy it before the memory moves.
+        item_t tmp(new_item);
+        new (grow_by_one(), x)item_t(std::move(tmp));
+      }
+    }
+
+    /// Move an item to the back of the array.
+    void push_back(item_t &&new_item) {
+      emplace_back(std::move(new_item));
+    }
+
+    /// Construct an item in place at the back of the array.
+    ///
+    /// Example:
+    ///
+    ///     dynarray<ref<mesh_instance> > instances;
+    ///     instances.emplace_back(new mesh_instance(node, mesh, mat));
+    template <class... args_t> item_t &emplace_back(args_t&&... args) {
+      dynarray_dummy_t x;
+      item_t *item = grow_by_one();
+      new (item, x)item_t(std::forward<args_t>(args)...);
+      return *item;
     }
 
     /// Get the last element in the array.
@@ -162,7 +330,7 @@ namespace octet { namespace containers {
     int_size_t size() const { return size_; }
 
     /// Return the number of elements in the array before we have to reallocate the memory
-    int_size_t capacity() const { return capacity_; }
+    int_size_t capacity() const { return get_capacity(); }
 
     /// Get a constant pointer to the first element of the array.
     const item_t *data() const { return data_; }
@@ -174,7 +342,7 @@ namespace octet { namespace containers {
     void resize(size_t new_length) {
       bool trace = false; // hack this for detailed traces
       dynarray_dummy_t x;
-      if (new_length >= size_ && new_length <= capacity_) {
+      if (new_length >= size_ && new_length <= get_capacity()) {
         if (trace) printf("case 1: growing dynarray up to capacity_\n");
         if (use_new_delete) {
           int_size_t len = size_; // avoid aliases
@@ -184,13 +352,13 @@ namespace octet { namespace containers {
           }
         }
         size_ = (int_size_t)new_length;
-      } else if (new_length > capacity_) {
+      } else if (new_length > get_capacity()) {
         if (trace) printf("case 2: growing dynarray beyond capacity_\n");
         int_size_t new_capacity = ((int_size_t)new_length < size_ ? size_ : (int_size_t)new_length);
 
         if (new_length == size_ + 1) {
           // growing array by 1: round up to power of two.
-          new_capacity = capacity_ == 0 ? min_capacity : capacity_ * 2;
+          new_capacity = get_capacity() == 0 ? min_capacity : get_capacity() * 2;
           while (new_capacity < new_length) new_capacity *= 2;
         }
 
@@ -221,49 +389,120 @@ namespace octet { namespace containers {
 
     /// Reserve an amount of memory to use with this array.
     /// Use this before you start a loop with push_back calls, for example.
+    ///
+    /// Trivially copyable (and relocatable) types are moved with realloc,
+    /// others are moved one at a time.
     void reserve(int_size_t new_capacity) {
-      if (new_capacity >= size_) {
-        dynarray_dummy_t x;
-        item_t *new_data = (item_t *)allocator_t::malloc(sizeof(item_t) * new_capacity);
-      
-        if (use_new_delete) {
-          // initialize new data_ elements from old ones
-          for (int_size_t i = 0; i != size_; ++i) {
-            new (new_data + i, x) item_t(data_[i]);
-            data_[i].~item_t();
-          }
-        }
+      if (new_capacity < size_ || new_capacity == get_capacity()) {
+        return;
+      }
 
-        // free up data_
-        if (data_) {
-          allocator_t::free(data_, capacity_ * sizeof(item_t));
-        }
+      if (is_inline() && new_capacity <= get_capacity()) {
+        // keep using the inline buffer
+        return;
+      }
 
-        data_ = new_data;
+      if (use_realloc && data_ && !is_inline()) {
+        data_ = reallocate(data_, capacity_, new_capacity);
         capacity_ = new_capacity;
+        return;
+      }
+
+      item_t *new_data = allocate(new_capacity);
+      if (use_realloc) {
+        if (size_) memcpy((void*)new_data, (void*)data_, size_ * sizeof(item_t));
+      } else {
+        // initialize new data_ elements from old ones
+        dynarray_dummy_t x;
+        for (int_size_t i = 0; i != size_; ++i) {
+          new (new_data + i, x) item_t(std::move(data_[i]));
+          data_[i].~item_t();
+        }
       }
+
+      // free up data_
+      release();
+
+      data_ = new_data;
+      capacity_ = new_capacity;
     }
 
     /// Shrink the size of the array by one.
     void pop_back() {
       assert(size_ != 0);
       size_--;
+      destroy(size_, size_ + 1);
     }
 
     /// Reset the array to zero size, freeing up the data.
     /// This is not the same as resize(0)
     void reset() {
-      if (use_new_delete) {
-        for (int_size_t i = 0; i != size_; ++i) {
-          data_[i].~item_t();
-        }
-      }
-      if (data_) {
-        allocator_t::free(data_, capacity_ * sizeof(item_t));
-      }
-      data_ = 0;
+      destroy(0, size_);
       size_ = 0;
-      capacity_ = 0;
+      release();
+    }
+  };
+
+  /// dynarrays only contain a pointer to their data, so they can be moved with memcpy.
+  template <class item_t, class allocator_t, bool use_new_delete>
+  struct is_relocatable<dynarray<item_t, allocator_t, use_new_delete> > {
+    enum { value = 1 };
+  };
+
+  /// A dynarray with space for N elements inside the object.
+  ///
+  /// Short arrays (polygon vertices, parameter lists, child nodes) do not need
+  /// a heap allocation. If the array grows beyond N elements it moves to the heap.
+  /// small_dynarray can be passed to functions that take a dynarray reference.
+  /// Once it has moved to the heap, it behaves like an ordinary dynarray.
+  ///
+  /// Example:
+  ///
+  ///     small_dynarray<vec3p, 8> vertices;
+  ///     vertices.push_back(vec3p(0, 0, 0));  // no allocation
+  template <class item_t, unsigned N, class allocator_t=allocator>
+  class small_dynarray : public dynarray<item_t, allocator_t> {
+    typedef dynarray<item_t, allocator_t> base_t;
+
+    // uninitialized storage for N elements
+    typename std::aligned_storage<sizeof(item_t) * N, alignof(item_t)>::type buffer;
+
+    item_t *inline_data() {
+      return (item_t*)&buffer;
+    }
+  public:
+    /// Create an empty array using the inline buffer.
+    small_dynarray() : base_t(inline_data(), N) {
+    }
+
+    /// Copy a dynarray.
+    small_dynarray(const base_t &rhs) : base_t(inline_data(), N) {
+      base_t::operator=(rhs);
+    }
+
+    /// Copy a small_dynarray.
+    small_dynarray(const small_dynarray &rhs) : base_t(inline_data(), N) {
+      base_t::operator=(rhs);
+    }
+
+    /// Move a dynarray.
+    small_dynarray(base_t &&rhs) : base_t(inline_data(), N) {
+      base_t::operator=(std::move(rhs));
+    }
+
+    /// Move a small_dynarray.
+    small_dynarray(small_dynarray &&rhs) : base_t(inline_data(), N) {
+      base_t::operator=(std::move((base_t&)rhs));
+    }
+
+    small_dynarray &operator=(const small_dynarray &rhs) {
+      base_t::operator=(rhs);
+      return *this;
+    }
+
+    small_dynarray &operator=(small_dynarray &&rhs) {
+      base_t::operator=(std::move((base_t&)rhs));
+      return *this;
     }
   };
 
@@ -0,0 +1,252 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Per-frame linear arena for transient allocations
+//
+// Allocation is a pointer bump and free is (almost) free.
+// All the memory is reclaimed at once when the app calls end_frame().
+//
+
+namespace octet { namespace containers {
+  /// Linear "frame" allocator for temporary data in update and render.
+  ///
+  /// Use it as the allocator_t parameter of dynarray, hash_map or dictionary
+  /// for containers that do not outlive the current frame.
+  ///
+  /// Example:
+  ///
+  ///     dynarray<vec3, frame_allocator> scratch;
+  ///     hash_map<int, unsigned, hash_map_cmp, frame_allocator> seen;
+  ///
+  /// All memory is recycled by reset(), which app_common::end_frame() calls.
+  ///
+  /// There is one arena and it has no lock: only the main thread may use it.
+  /// Job threads (eg. in job_scheduler::parallel_for) must use the default allocator.
+  /// The first thread to use the arena owns it and other threads assert.
+  /// With OCTET_FRAME_ALLOCATOR_DEBUG set, blocks are tagged with the frame they
+  /// were allocated in, freeing or growing a block from an earlier frame asserts
+  /// and reset() fills the old memory with 0xdd to make stale reads obvious.
+  class frame_allocator {
+  public:
+    enum {
+      alignment = 16,
+
+      /// default size of a chunk of arena memory.
+      chunk_size = 0x40000,
+
+      /// largest chunk kept between frames.
+      max_keep_size = 0x400000,
+    };
+
+  private:
+    // chunks of arena memory come from the main allocator.
+    struct chunk_t {
+      chunk_t *next;
+      size_t size;
+      size_t pad[2];
+    };
+
+    #if OCTET_FRAME_ALLOCATOR_DEBUG
+      // debug header before each block.
+      struct debug_header_t {
+        uint32_t magic;
+        uint32_t frame;
+        size_t size;
+      };
+
+      enum { debug_magic = 0xf4a3e0ac, header_size = 16 };
+    #else
+      enum { header_size = 0 };
+    #endif
+
+    // singleton state, a bit like an old-world global variable
+    struct state_t {
+      chunk_t *chunks;      // the current chunk is at the head of the list
+      uint8_t *top;         // next free byte in the current chunk
+      uint8_t *end;         // end of the current chunk
+      uint8_t *last;        // most recent allocation (can be freed or grown in place)
+      size_t total_size;    // bytes in all chunks
+      size_t num_bytes;     // bytes allocated this frame
+      size_t peak_bytes;    // largest num_bytes in any frame
+      unsigned num_allocs;  // allocations this frame
+      unsigned frame;       // number of calls to reset()
+      std::thread::id owner;  // the thread allowed to use the arena
+    };
+
+    static state_t &state() {
+      static state_t instance;
+      return instance;
+    }
+
+    // the arena is not thread safe: catch job threads that use it.
+    static void check_thread(state_t &s) {
+      std::thread::id id = std::this_thread::get_id();
+      if (s.owner == std::thread::id()) s.owner = id;
+      assert(s.owner == id && "frame_allocator: only the main thread may use the frame arena");
+    }
+
+    static size_t round_up(size_t size) {
+      return (size + (alignment - 1)) & ~(size_t)(alignment - 1);
+    }
+
+    // start a new chunk big enough for at least size bytes.
+    static void new_chunk(size_t size) {
+      state_t &s = state();
+      size_t bytes = round_up(size) + sizeof(chunk_t);
+      if (bytes < chunk_size) bytes = chunk_size;
+      chunk_t *chunk = (chunk_t*)allocator::malloc(bytes);
+      chunk->next = s.chunks;
+      chunk->size = bytes;
+      s.chunks = chunk;
+      s.top = (uint8_t*)(chunk + 1);
+      s.end = (uint8_t*)chunk + bytes;
+      s.last = 0;
+      s.total_size += bytes;
+    }
+
+    static void delete_chunks(chunk_t *chunk) {
+      while (chunk) {
+        chunk_t *next = chunk->next;
+        state().total_size -= chunk->size;
+        allocator::free(chunk, chunk->size);
+        chunk = next;
+      }
+    }
+
+    #if OCTET_FRAME_ALLOCATOR_DEBUG
+      // is ptr in one of the current chunks?
+      static bool owns(void *ptr) {
+        for (chunk_t *chunk = state().chunks; chunk; chunk = chunk->next) {
+          if ((uint8_t*)ptr > (uint8_t*)chunk && (uint8_t*)ptr < (uint8_t*)chunk + chunk->size) {
+            return true;
+          }
+        }
+        return false;
+      }
+
+      static void check_block(void *ptr, size_t size) {
+        assert(owns(ptr) && "frame_allocator: block has escaped from an earlier frame");
+        debug_header_t *hdr = (debug_header_t*)((uint8_t*)ptr - header_size);
+        assert(hdr->magic == debug_magic && "frame_allocator: block is not live in this frame");
+        assert(hdr->frame == state().frame && "frame_allocator: block has escaped from an earlier frame");
+        assert(hdr->size == size && "frame_allocator: size does not match the allocation");
+      }
+    #endif
+
+  public:
+    /// allocate size bytes, aligned to 16 bytes, that live until the end of the frame.
+    static void *malloc(size_t size) {
+      state_t &s = state();
+      check_thread(s);
+      size_t bytes = round_up(size) + header_size;
+      if (s.top + bytes > s.end) {
+        new_chunk(bytes);
+      }
+      uint8_t *res = s.top + header_size;
+      s.top += bytes;
+      s.last = res;
+      s.num_bytes += size;
+      s.num_allocs++;
+      if (s.num_bytes > s.peak_bytes) s.peak_bytes = s.num_bytes;
+      #if OCTET_FRAME_ALLOCATOR_DEBUG
+        debug_header_t *hdr = (debug_header_t*)(res - header_size);
+        hdr->magic = debug_magic;
+        hdr->frame = s.frame;
+        hdr->size = size;
+      #endif
+      return res;
+    }
+
+    /// free a block. Only the most recent block is actually reclaimed before reset().
+    static void free(void *ptr, size_t size) {
+      if (!ptr) return;
+      state_t &s = state();
+      check_thread(s);
+      #if OCTET_FRAME_ALLOCATOR_DEBUG
+        check_block(ptr, size);
+      #endif
+      s.num_bytes -= size;
+      if (ptr == s.last) {
+        s.top = s.last - header_size;
+        s.last = 0;
+      }
+    }
+
+    /// grow or shrink a block. The most recent block is resized in place.
+    static void *realloc(void *ptr, size_t old_size, size_t size) {
+      if (!ptr) return malloc(size);
+      state_t &s = state();
+      check_thread(s);
+      #if OCTET_FRAME_ALLOCATOR_DEBUG
+        check_block(ptr, old_size);
+      #endif
+      if (ptr == s.last && s.last + round_up(size) <= s.end) {
+        s.top = s.last + round_up(size);
+        s.num_bytes += size - old_size;
+        if (s.num_bytes > s.peak_bytes) s.peak_bytes = s.num_bytes;
+        #if OCTET_FRAME_ALLOCATOR_DEBUG
+          ((debug_header_t*)(s.last - header_size))->size = size;
+        #endif
+        return ptr;
+      }
+      void *res = malloc(size);
+      memcpy(res, ptr, old_size < size ? old_size : size);
+      free(ptr, old_size);
+      return res;
+    }
+
+    /// recycle all the frame memory. Called by app_common::end_frame().
+    ///
+    /// If the frame needed more than one chunk, the chunks are replaced by
+    /// a single chunk big enough for the whole frame (up to max_keep_size).
+    static void reset() {
+      state_t &s = state();
+      check_thread(s);
+      if (s.chunks && s.chunks->next) {
+        size_t total = s.total_size;
+        delete_chunks(s.chunks);
+        s.chunks = 0;
+        new_chunk(total < max_keep_size ? total : chunk_size);
+      } else if (s.chunks && s.chunks->size > max_keep_size) {
+        delete_chunks(s.chunks);
+        s.chunks = 0;
+        new_chunk(chunk_size);
+      }
+
+      if (s.chunks) {
+        #if OCTET_FRAME_ALLOCATOR_DEBUG
+          memset(s.chunks + 1, 0xdd, s.top - (uint8_t*)(s.chunks + 1));
+        #endif
+        s.top = (uint8_t*)(s.chunks + 1);
+      }
+      s.last = 0;
+      s.num_bytes = 0;
+      s.num_allocs = 0;
+      s.frame++;
+    }
+
+    /// bytes allocated (and not freed) since the last reset()
+    static size_t get_num_bytes() { return state().num_bytes; }
+
+    /// allocations since the last reset()
+    static unsigned get_num_allocs() { return state().num_allocs; }
+
+    /// largest number of bytes used in one frame
+    static size_t get_peak_bytes() { return state().peak_bytes; }
+
+    /// bytes of arena memory reserved from the main allocator
+    static size_t get_reserved_bytes() { return state().total_size; }
+
+    /// free all the arena memory, eg. at exit.
+    static void shutdown() {
+      state_t &s = state();
+      delete_chunks(s.chunks);
+      s.chunks = 0;
+      s.top = s.end = s.last = 0;
+    }
+  };
+} }
+
@@ -6,21 +6,46 @@
 //
 // map key_t to value_t.
 //
-// strings and values are owned by the dictionary.
+// This is an open addressing hash map in the style of the "Swiss table".
+// Each slot has a control byte that is either empty, deleted or the bottom
+// seven bits of the key's hash. Slots are probed in groups of sixteen, so one
+// SSE2 compare tests sixteen slots at once and we only compare keys whose
+// hash bits match. Without SSE, groups of eight are tested in a 64 bit word.
 //
 namespace octet { namespace containers {
 
   /// A support class for hash_map that is used to implement different kinds of key.
+  ///
+  /// Custom key types derive from this and provide get_hash() for their key.
+  /// The hash should have all its bits well mixed; fuzz_hash() will do this for you.
   class hash_map_cmp {
   public:
-    // mix in some bits from higher positions to lower positions
-    static unsigned fuzz_hash(unsigned hash) { return hash ^ (hash >> 3) ^ (hash >> 5); }
+    /// mix all the bits of a 32 bit hash (murmur3 finalizer)
+    static unsigned fuzz_hash(unsigned hash) {
+      hash ^= hash >> 16;
+      hash *= 0x85ebca6b;
+      hash ^= hash >> 13;
+      hash *= 0xc2b2ae35;
+      hash ^= hash >> 16;
+      return hash;
+    }
+
+    /// mix all the bits of a 64 bit hash (murmur3 finalizer)
+    static uint64_t fuzz_hash64(uint64_t hash) {
+      hash ^= hash >> 33;
+      hash *= 0xff51afd7ed558ccdull;
+      hash ^= hash >> 33;
+      hash *= 0xc4ceb9fe1a85ec53ull;
+      hash ^= hash >> 33;
+      return hash;
+    }
 
-    static unsigned get_hash(void *key) { return fuzz_hash((unsigned)(intptr_t)key); }
-    static unsigned get_hash(int key) { return fuzz_hash((unsigned)key); }
-    static unsigned get_hash(unsigned key) { return fuzz_hash((unsigned)key); }
-    static unsigned get_hash(uint64_t key) { return fuzz_hash((unsigned)(key ^ (key >> 32))); }
+    static uint64_t get_hash(void *key) { return fuzz_hash64((uint64_t)(intptr_t)key); }
+    static uint64_t get_hash(int key) { return fuzz_hash64((uint64_t)(unsigned)key); }
+    static uint64_t get_hash(unsigned key) { return fuzz_hash64((uint64_t)key); }
+    static uint64_t get_hash(uint64_t key) { return fuzz_hash64(key); }
 
+    // no longer needed by hash_map, which can store zero keys, but kept for old cmp classes.
     static bool is_empty(void *key) { return !key; }
     static bool is_empty(int key) { return !key; }
     static bool is_empty(unsigned key) { return !key; }
@@ -34,70 +59,267 @@ namespace octet { namespace containers {
   /// Do not use for strings, use %dictionary instead.
   ///
   /// A hash map is like a dictionary in JavaScript or Python, but works with only one type of key and value.
+  /// Any key can be stored, including zero and null pointers.
+  ///
+  /// Keys and values are moved with memcpy when the map grows, so they must not
+  /// contain pointers to themselves. Unused slots hold default constructed keys and values.
   ///
   /// Example:
   ///
   ///     hash_map<int, int> int_to_int;
   ///     int_to_int[5] = 7;
   ///     int_to_int[9] = 11;
-  ///     printf("[5]=%d [9]=%d\n", int_to_int[5], int_to_int[9]);
+  ///     int_to_int.erase(5);
+  ///     printf("[9]=%d\n", int_to_int[9]);
   ///
-  ///     for (unsigned i = 0; i != int_to_int.size(); ++i) {
-  ///       printf("key=d value=%d\n", int_to_int.get_key(i), int_to_int.get_value(i));
+  ///     for (hash_map<int, int>::iterator i = int_to_int.begin(); i != int_to_int.end(); ++i) {
+  ///       printf("key=%d value=%d\n", i->key, i->value);
   ///     }
   template <typename key_t, typename value_t, class cmp_t=hash_map_cmp, class allocator_t=allocator> class hash_map {
-    // internal gubbins to implement the hash map
-    struct entry_t { key_t key; unsigned hash; value_t value; };
+  public:
+    /// a key and its value.
+    struct entry_t { key_t key; value_t value; };
+
+  private:
+    enum {
+      ctrl_empty = 0x80,
+      ctrl_deleted = 0xfe,
+    };
+
+    // a group of control bytes, tested in parallel.
+    // matches return a bit mask with one bit (sse) or one byte (portable) per slot.
+    struct group_t {
+      #if OCTET_SSE
+        enum { size = 16, mask_shift = 0 };
+
+        __m128i ctrl;
+
+        group_t(const uint8_t *p) {
+          ctrl = _mm_load_si128((const __m128i*)p);
+        }
+
+        // bit mask of slots whose control byte is value
+        uint64_t match(uint8_t value) const {
+          return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)value)));
+        }
+
+        // bit mask of slots that are empty or deleted (top bit set)
+        uint64_t match_free() const {
+          return (unsigned)_mm_movemask_epi8(ctrl);
+        }
+
+        // bit mask of slots in use
+        uint64_t match_full() const {
+          return ~match_free() & 0xffff;
+        }
+      #else
+        // portable version: eight control bytes in a 64 bit word.
+        // The top bit of each byte of the mask is set for a match.
+        enum { size = 8, mask_shift = 3 };
+
+        uint64_t ctrl;
+
+        group_t(const uint8_t *p) {
+          memcpy(&ctrl, p, sizeof(ctrl));
+        }
+
+        uint64_t match(uint8_t value) const {
+          // find the zero bytes of ctrl ^ value (exact, no false positives)
+          const uint64_t low7 = 0x7f7f7f7f7f7f7f7full;
+          uint64_t x = ctrl ^ (0x0101010101010101ull * value);
+          return ~(((x & low7) + low7) | x | low7);
+        }
+
+        uint64_t match_free() const {
+          return ctrl & 0x8080808080808080ull;
+        }
+
+        uint64_t match_full() const {
+          return ~ctrl & 0x8080808080808080ull;
+        }
+      #endif
+
+      uint64_t match_empty() const {
+        return match(ctrl_empty);
+      }
+
+      // slot number of the lowest bit in a mask
+      static unsigned lowest(uint64_t mask) {
+        #ifdef _MSC_VER
+          unsigned long result;
+          #ifdef _WIN64
+            _BitScanForward64(&result, mask);
+          #else
+            if ((unsigned)mask) _BitScanForward(&result, (unsigned)mask); else { _BitScanForward(&result, (unsigned)(mask >> 32)); result += 32; }
+          #endif
+          return (unsigned)result >> mask_shift;
+        #else
+          return (unsigned)__builtin_ctzll(mask) >> mask_shift;
+        #endif
+      }
+    };
 
+    enum { group_size = group_t::size };
+
+    // internal gubbins to implement the hash map
+    uint8_t *ctrl;
     entry_t *entries;
     unsigned num_entries;
     unsigned max_entries;
+    unsigned growth_left;
+
+    static uint64_t get_hash(const key_t &key) {
+      return (uint64_t)cmp_t::get_hash(key);
+    }
+
+    // the bottom seven bits of the hash go in the control byte
+    static uint8_t get_h2(uint64_t hash) {
+      return (uint8_t)(hash & 0x7f);
+    }
+
+    // the rest of the hash selects the first group to probe
+    unsigned get_first_group(uint64_t hash) const {
+      return (unsigned)(hash >> 7) & (max_entries / group_size - 1);
+    }
+
+    // maximum number of keys for a given capacity (7/8 load)
+    static unsigned get_max_load(unsigned capacity) {
+      return capacity - capacity / 8;
+    }
 
     // internal method to find an existing key in the map
-    entry_t *find( const key_t &key, unsigned hash ) {
-      unsigned mask = max_entries - 1;
-      for (unsigned i = 0; i != max_entries; ++i) {
-        entry_t *entry = &entries[ ( i + hash ) & mask ];
-        if (cmp_t::is_empty(entry->key)) {
-          return entry;
+    int find(const key_t &key, uint64_t hash) const {
+      if (!max_entries) return -1;
+      unsigned group_mask = max_entries / group_size - 1;
+      unsigned group = get_first_group(hash);
+      uint8_t h2 = get_h2(hash);
+      // triangular probing visits every group once.
+      for (unsigned step = 1; ; ++step) {
+        group_t g(ctrl + group * group_size);
+        for (uint64_t mask = g.match(h2); mask; mask &= mask - 1) {
+          unsigned index = group * group_size + group_t::lowest(mask);
+          if (entries[index].key == key) {
+            return (int)index;
+          }
         }
-        if (entry->hash == hash && entry->key == key) {
-          return entry;
+
+        // an empty slot means the key would have been placed here.
+        if (g.match_empty()) {
+          return -1;
         }
+        group = (group + step) & group_mask;
       }
-      assert(0 && "hash_map: all entries are used. expand() did not get called");
-      return 0;
     }
-  
-    // increase the size of the map if we have run out of space
-    void expand() {
+
+    // find an empty or deleted slot for a new key.
+    // There is always at least one empty slot as we limit the load.
+    unsigned find_free(uint64_t hash) const {
+      unsigned group_mask = max_entries / group_size - 1;
+      unsigned group = get_first_group(hash);
+      for (unsigned step = 1; ; ++step) {
+        group_t g(ctrl + group * group_size);
+        uint64_t mask = g.match_free();
+        if (mask) {
+          return group * group_size + group_t::lowest(mask);
+        }
+        group = (group + step) & group_mask;
+      }
+    }
+
+    // allocate control bytes and entries in one block.
+    void allocate(unsigned capacity) {
+      size_t bytes = capacity + sizeof(entry_t) * capacity;
+      ctrl = (uint8_t*)allocator_t::malloc(bytes);
+      entries = (entry_t*)(ctrl + capacity);
+      memset(ctrl, ctrl_empty, capacity);
+      // unused slots read as default (zero) keys and values.
+      dynarray_dummy_t x;
+      for (unsigned i = 0; i != capacity; ++i) {
+        new (&entries[i].key, x) key_t();
+        new (&entries[i].value, x) value_t();
+      }
+      max_entries = capacity;
+      growth_left = get_max_load(capacity) - num_entries;
+    }
+
+    // move all the keys and values to a new table
+    void rehash(unsigned capacity) {
+      uint8_t *old_ctrl = ctrl;
       entry_t *old_entries = entries;
       unsigned old_max_entries = max_entries;
-      entries = (entry_t *)allocator_t::malloc(sizeof(entry_t) * max_entries*2);
-      memset(entries, 0, sizeof(entry_t) * max_entries*2);
-      max_entries *= 2;
+
+      allocate(capacity);
+
       for (unsigned i = 0; i != old_max_entries; ++i) {
-        entry_t *old_entry = &old_entries[i];
-        if (!cmp_t::is_empty(old_entry->key)) {
-          entry_t *new_entry = find(old_entry->key, old_entry->hash);
-          *new_entry = *old_entry;
+        if (old_ctrl[i] < ctrl_empty) {
+          // relocate the key and value over the empty slot's defaults.
+          uint64_t hash = get_hash(old_entries[i].key);
+          unsigned index = find_free(hash);
+          ctrl[index] = get_h2(hash);
+          destroy_entry(&entries[index]);
+          memcpy((void*)&entries[index], (void*)&old_entries[i], sizeof(entry_t));
+        } else {
+          destroy_entry(&old_entries[i]);
         }
       }
-      allocator_t::free(old_entries, sizeof(entry_t) * old_max_entries);
+
+      if (old_ctrl) {
+        allocator_t::free(old_ctrl, old_max_entries + sizeof(entry_t) * old_max_entries);
+      }
+    }
+
+    // we have run out of empty slots: grow, or just remove the deleted slots.
+    void expand() {
+      if (max_entries == 0) {
+        rehash(group_size);
+      } else if (num_entries < max_entries / 2) {
+        rehash(max_entries);
+      } else {
+        rehash(max_entries * 2);
+      }
+    }
+
+    static void destroy_entry(entry_t *entry) {
+      entry->key.~key_t();
+      entry->value.~value_t();
+    }
+
+    // destroy all the keys and values, including the defaults in unused slots
+    void destroy() {
+      for (unsigned i = 0; i != max_entries; ++i) {
+        destroy_entry(&entries[i]);
+      }
     }
 
     void release() {
-      allocator_t::free(entries, sizeof(entry_t) * max_entries);
+      if (ctrl) {
+        destroy();
+        allocator_t::free(ctrl, max_entries + sizeof(entry_t) * max_entries);
+      }
+      init();
+    }
+
+    void init() {
+      ctrl = 0;
       entries = 0;
       num_entries = 0;
       max_entries = 0;
+      growth_left = 0;
     }
 
-    void init() {
-      num_entries = 0;
-      max_entries = 4;
-      entries = (entry_t*)allocator_t::malloc(sizeof(entry_t) * max_entries);
-      memset(entries, 0, sizeof(entry_t) * max_entries);
+    void copy(const hash_map &rhs) {
+      if (rhs.max_entries) {
+        allocate(rhs.max_entries);
+        for (unsigned i = 0; i != max_entries; ++i) {
+          if (rhs.ctrl[i] < ctrl_empty) {
+            ctrl[i] = rhs.ctrl[i];
+            entries[i].key = rhs.entries[i].key;
+            entries[i].value = rhs.entries[i].value;
+          }
+        }
+        num_entries = rhs.num_entries;
+        growth_left = get_max_load(max_entries) - num_entries;
+      }
     }
   public:
     // Create an empty map.
@@ -105,47 +327,107 @@ namespace octet { namespace containers {
       init();
     }
 
+    /// Copy a map.
+    hash_map(const hash_map &rhs) {
+      init();
+      copy(rhs);
+    }
+
+    /// Copy a map.
+    hash_map &operator=(const hash_map &rhs) {
+      if (this != &rhs) {
+        release();
+        copy(rhs);
+      }
+      return *this;
+    }
+
     /// Remove all keys and values from the hash map.
     void clear() {
       release();
-      init();
     }
-  
-    /// Access the map by key
+
+    /// Make space for at least this many keys without growing.
+    void reserve(unsigned size) {
+      unsigned capacity = group_size;
+      while (get_max_load(capacity) < size) {
+        capacity *= 2;
+      }
+      if (capacity > max_entries) {
+        rehash(capacity);
+      }
+    }
+
+    /// Access the map by key. New values are zero (or default constructed).
     value_t &operator[]( const key_t &key ) {
-      unsigned hash = cmp_t::get_hash(key);
-      entry_t *entry = find( key, hash );
-      if (cmp_t::is_empty(entry->key)) {
-        // reducing this ratio decreases hot search time at the
-        // expense of size (cold search time).
-        if (num_entries >= max_entries * 3 / 4) {
-          expand();
-          entry = find(key, hash);
-        }
-        num_entries++;
-        entry->key = key;
-        entry->hash = hash;
+      uint64_t hash = get_hash(key);
+      int index = find(key, hash);
+      if (index >= 0) {
+        return entries[index].value;
+      }
+
+      if (growth_left == 0) {
+        expand();
+      }
+
+      unsigned free_index = find_free(hash);
+      if (ctrl[free_index] == ctrl_empty) {
+        growth_left--;
       }
+      ctrl[free_index] = get_h2(hash);
+      num_entries++;
+
+      // the slot already holds a default value.
+      entry_t *entry = &entries[free_index];
+      entry->key = key;
       return entry->value;
     }
 
+    /// Remove a key from the map. Returns false if the key was not there.
+    bool erase(const key_t &key) {
+      int index = find(key, get_hash(key));
+      if (index < 0) return false;
+
+      // put the defaults back, releasing anything the key and value own.
+      entry_t *entry = &entries[index];
+      entry->key = key_t();
+      entry->value = value_t();
+
+      // if the group has never been full, no probe can have passed through it
+      // and the slot can be made empty, otherwise leave a tombstone.
+      group_t g(ctrl + (index & ~(group_size-1)));
+      if (g.match_empty()) {
+        ctrl[index] = ctrl_empty;
+        growth_left++;
+      } else {
+        ctrl[index] = ctrl_deleted;
+      }
+      num_entries--;
+      return true;
+    }
+
     /// Does the map have this key?
-    bool contains(const key_t &key) {
-      unsigned hash = cmp_t::get_hash(key);
-      entry_t *entry = find( key, hash );
-      return !cmp_t::is_empty(entry->key);
+    bool contains(const key_t &key) const {
+      return find(key, get_hash(key)) >= 0;
     }
 
     /// Get an integer that represents the position in the map of this key.
+    /// Returns -1 if the key is not in the map.
     ///
     /// Note: only valid if the map does not change size.
-    int get_index(const key_t &key) {
-      unsigned hash = cmp_t::get_hash(key);
-      entry_t *entry = find( key, hash );
-      return entry ? (int)(entry - entries) : -1;
+    int get_index(const key_t &key) const {
+      return find(key, get_hash(key));
     }
 
-    /// For a specfic index, get the key.
+    /// Is there a key at this index?
+    ///
+    /// Used for iterating through the map by index.
+    bool is_occupied(int index) const {
+      assert((unsigned)index < max_entries);
+      return ctrl[index] < ctrl_empty;
+    }
+
+    /// For a specfic index, get the key. Unused slots have zero keys.
     ///
     /// Used for iterating through the map or if using find()
     const key_t &get_key(int index) const {
@@ -159,20 +441,65 @@ namespace octet { namespace containers {
       return entries[index].value;
     }
 
+    /// For a specific index, get the value
+    value_t &get_value(int index) {
+      assert((unsigned)index < max_entries);
+      return entries[index].value;
+    }
+
     /// bye bye hash map
     ~hash_map() {
-      allocator_t::free(entries, sizeof(entry_t) * max_entries);
-      entries = 0;
-      num_entries = 0;
-      max_entries = 0;
+      release();
     }
 
     /// Get the maximum number of keys and values in the map.
     ///
-    /// Used for iteration.
-    unsigned size() { return max_entries; }
-    
-    //key_t key(unsigned i) { return entries[i].key; }
-    //value_t value(unsigned i) { return entries[i].value; }
+    /// Used for iteration by index.
+    unsigned size() const { return max_entries; }
+
+    /// Get the number of keys in the map.
+    unsigned get_num_entries() const { return num_entries; }
+
+    /// iterator over the occupied slots of the map
+    class iterator {
+      hash_map *map;
+      unsigned index;
+
+      // move to the next occupied slot, skipping whole groups at a time.
+      void skip() {
+        while (index < map->max_entries) {
+          unsigned group = index & ~(group_size-1);
+          uint64_t mask = group_t(map->ctrl + group).match_full() >> ((index - group) << group_t::mask_shift);
+          if (mask) {
+            index += group_t::lowest(mask);
+            return;
+          }
+          index = group + group_size;
+        }
+        index = map->max_entries;
+      }
+
+      friend class hash_map;
+    public:
+      iterator(hash_map *map_, unsigned index_) : map(map_), index(index_) { skip(); }
+      entry_t *operator ->() { return &map->entries[index]; }
+      entry_t &operator *() { return map->entries[index]; }
+      bool operator != (const iterator &rhs) const { return index != rhs.index; }
+      void operator++() { index++; skip(); }
+      void operator++(int) { index++; skip(); }
+
+      /// position in the map, see get_key() and get_value()
+      int get_index() const { return (int)index; }
+    };
+
+    /// iterator start for STL compatibility
+    iterator begin() {
+      return iterator(this, 0);
+    }
+
+    /// iterator end for STL compatibility
+    iterator end() {
+      return iterator(this, max_entries);
+    }
   };
 } }
@@ -0,0 +1,151 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Interned strings: one copy of each distinct text with a precomputed hash.
+//
+
+namespace octet { namespace containers {
+  /// Interned string.
+  ///
+  /// Every istring with the same text points to the same shared copy, so
+  /// comparing two istrings is a pointer compare and the hash is computed once,
+  /// when the string is first interned.
+  ///
+  /// Use istring for names that are looked up over and over again
+  /// (scene ids, animation targets, resource names).
+  /// Interned text lives until the program exits.
+  /// Interning takes a spin lock, so istrings can be made on job threads.
+  ///
+  /// Example:
+  ///
+  ///     istring name("fred");
+  ///     hash_map<istring, int, istring_cmp> ages;
+  ///     ages[name] = 27;
+  ///     atom_t a = app_utils::get_atom(name);  // cached in the istring
+  class istring {
+    // shared copy of the text
+    struct entry_t {
+      uint64_t hash;
+      entry_t *next;        // next entry with the same hash (very rare)
+      unsigned length;
+      int atom;             // cached atom (see app_utils::get_atom) or 0
+      char text[8];         // text follows, null terminated
+    };
+
+    entry_t *entry;
+
+    typedef hash_map<uint64_t, entry_t *> table_t;
+
+    static table_t &table() {
+      static table_t instance;
+      return instance;
+    }
+
+    // guards the table and the entry lists.
+    static spin_lock &get_lock() {
+      static spin_lock lock;
+      return lock;
+    }
+
+    static entry_t *intern(const char *text, size_t length) {
+      uint64_t hash = wyhash::hash(text, length);
+      std::lock_guard<spin_lock> guard(get_lock());
+      entry_t *&head = table()[hash];
+      for (entry_t *e = head; e; e = e->next) {
+        if (e->length == length && !memcmp(e->text, text, length)) {
+          return e;
+        }
+      }
+
+      size_t bytes = sizeof(entry_t) + length;
+      entry_t *e = (entry_t*)allocator::malloc(bytes);
+      e->hash = hash;
+      e->next = head;
+      e->length = (unsigned)length;
+      e->atom = 0;
+      memcpy(e->text, text, length);
+      e->text[length] = 0;
+      head = e;
+      return e;
+    }
+
+    static entry_t *empty_entry() {
+      static entry_t *instance = intern("", 0);
+      return instance;
+    }
+
+  public:
+    /// the empty string
+    istring() {
+      entry = empty_entry();
+    }
+
+    /// intern a C string
+    explicit istring(const char *text) {
+      entry = text ? intern(text, strlen(text)) : empty_entry();
+    }
+
+    /// intern a substring
+    istring(const char *text, size_t length) {
+      entry = intern(text, length);
+    }
+
+    /// get the text of the string.
+    const char *c_str() const {
+      return entry->text;
+    }
+
+    /// number of bytes in the string.
+    unsigned size() const {
+      return entry->length;
+    }
+
+    /// return true if the string is empty.
+    bool empty() const {
+      return entry->length == 0;
+    }
+
+    /// precomputed 64 bit hash (wyhash) of the text
+    uint64_t get_hash() const {
+      return entry->hash;
+    }
+
+    /// compare two interned strings (a pointer compare)
+    bool operator==(const istring &rhs) const { return entry == rhs.entry; }
+
+    /// compare two interned strings (a pointer compare)
+    bool operator!=(const istring &rhs) const { return entry != rhs.entry; }
+
+    /// compare with a C string
+    bool operator==(const char *rhs) const { return !strcmp(entry->text, rhs); }
+
+    /// compare with a C string
+    bool operator!=(const char *rhs) const { return strcmp(entry->text, rhs) != 0; }
+
+    /// cached atom for this string, or 0. See app_utils::get_atom()
+    int get_atom() const {
+      return entry->atom;
+    }
+
+    /// cache the atom for this string. See app_utils::get_atom()
+    void set_atom(int atom) const {
+      entry->atom = atom;
+    }
+
+    /// number of distinct strings interned so far.
+    static unsigned get_num_strings() {
+      std::lock_guard<spin_lock> guard(get_lock());
+      return table().get_num_entries();
+    }
+  };
+
+  /// Use istring as a hash_map key: the hash is precomputed and equality is a pointer compare.
+  class istring_cmp : public hash_map_cmp {
+  public:
+    static uint64_t get_hash(const istring &key) { return key.get_hash(); }
+  };
+} }
+
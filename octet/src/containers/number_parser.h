@@ -0,0 +1,243 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Fast number parsing for text file loaders (OBJ, collada).
+//
+// Digits are accumulated in a 64 bit integer, then floats use Clinger's fast path:
+// if the decimal mantissa and the power of ten are both exact in floating point,
+// one multiply or divide gives a correctly rounded result. This covers almost every number written by a modelling package.
+// Anything else goes to strtof, so results always match the C library.
+//
+
+namespace octet { namespace containers {
+  /// Parse numbers from text without copying or allocating.
+  ///
+  /// Example:
+  ///
+  ///     dynarray<float> values;
+  ///     number_parser::parse_floats(values, "1.2 3.4 43.12");
+  class number_parser {
+    static bool is_digit(char c) {
+      return (unsigned)(c - '0') < 10;
+    }
+
+    static bool is_space(char c) {
+      return (unsigned char)(c - 1) < ' ';
+    }
+
+    // powers of ten that are exact in a float.
+    static const float *float_powers() {
+      static const float values[] = {
+        1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+      };
+      return values;
+    }
+
+    // powers of ten that are exact in a double.
+    static const double *double_powers() {
+      static const double values[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+      };
+      return values;
+    }
+
+    // the slow, exact path: let the C library do it.
+    static float parse_float_slow(const char *begin, const char *end) {
+      char tmp[64];
+      size_t len = (size_t)(end - begin);
+      if (len >= sizeof(tmp)) {
+        string copy(begin, (unsigned)len);
+        return strtof(copy.c_str(), NULL);
+      }
+      memcpy(tmp, begin, len);
+      tmp[len] = 0;
+      return strtof(tmp, NULL);
+    }
+
+    // true if p may be read. Null terminated text is not checked against end:
+    // the terminator is not a digit or a space, so it stops every loop by itself.
+    template <bool terminated> static bool in_text(const char *p, const char *end) {
+      return terminated || p != end;
+    }
+
+    // accumulate digits into the mantissa; returns the first character after them.
+    template <bool terminated> static const char *scan_digits(const char *p, const char *end, uint64_t &mantissa) {
+      for (; in_text<terminated>(p, end) && is_digit(*p); ++p) {
+        mantissa = mantissa * 10 + (unsigned)(*p - '0');
+      }
+      return p;
+    }
+
+    // parse a float at p; returns the first character after it or null if there is no number.
+    // Pointers are passed and returned by value so that they stay in registers in the loops.
+    template <bool terminated> static const char *scan_float(const char *p, const char *end, float &result) {
+      const char *begin = p;
+      bool negative = false;
+      if (*p == '-' || *p == '+') {
+        negative = *p++ == '-';
+      }
+
+      uint64_t mantissa = 0;
+      const char *int_begin = p;
+      p = scan_digits<terminated>(p, end, mantissa);
+      int num_digits = (int)(p - int_begin);
+      int exponent = 0;
+
+      if (in_text<terminated>(p, end) && *p == '.') {
+        const char *frac_begin = ++p;
+        p = scan_digits<terminated>(p, end, mantissa);
+        exponent = -(int)(p - frac_begin);
+        num_digits -= exponent;
+      }
+      if (num_digits == 0) return 0;
+
+      // more than 19 digits (including leading zeros) may have overflowed the mantissa.
+      bool truncated = num_digits > 19;
+
+      if (in_text<terminated>(p, end) && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        bool negative_exp = false;
+        if (in_text<terminated>(q, end) && (*q == '-' || *q == '+')) {
+          negative_exp = *q++ == '-';
+        }
+        if (in_text<terminated>(q, end) && is_digit(*q)) {
+          int exp = 0;
+          for (; in_text<terminated>(q, end) && is_digit(*q); ++q) {
+            if (exp < 10000) exp = exp * 10 + (*q - '0');
+          }
+          exponent += negative_exp ? -exp : exp;
+          p = q;
+        }
+      }
+
+      if (!truncated) {
+        if (mantissa == 0) {
+          result = negative ? -0.0f : 0.0f;
+          return p;
+        }
+
+        // mantissa and power of ten are exact floats: one correctly rounded operation.
+        if (mantissa <= (1 << 24) && exponent >= -10 && exponent <= 10) {
+          float value = (float)(int64_t)mantissa;
+          value = exponent < 0 ? value / float_powers()[-exponent] : value * float_powers()[exponent];
+          result = negative ? -value : value;
+          return p;
+        }
+
+        // the same in double precision.
+        if (mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22) {
+          double value = (double)(int64_t)mantissa;
+          value = exponent < 0 ? value / double_powers()[-exponent] : value * double_powers()[exponent];
+
+          // rounding to float is exact unless the double lies exactly half way between two floats.
+          uint64_t bits;
+          memcpy(&bits, &value, sizeof(bits));
+          if ((bits & 0x1fffffff) != 0x10000000) {
+            result = (float)(negative ? -value : value);
+            return p;
+          }
+        }
+      }
+
+      result = parse_float_slow(begin, p);
+      return p;
+    }
+
+    // parse an integer at p; returns the first character after it or null if there is no number.
+    template <bool terminated> static const char *scan_int(const char *p, const char *end, int &result) {
+      bool negative = false;
+      if (*p == '-' || *p == '+') {
+        negative = *p++ == '-';
+      }
+      if (!in_text<terminated>(p, end) || !is_digit(*p)) return 0;
+      unsigned value = 0;
+      for (; in_text<terminated>(p, end) && is_digit(*p); ++p) {
+        value = value * 10 + (unsigned)(*p - '0');
+      }
+      result = negative ? -(int)value : (int)value;
+      return p;
+    }
+
+    // parse white space separated numbers into a small buffer and append them in blocks,
+    // so that the inner loop does not touch the dynarray.
+    template <bool terminated, class value_t, const char *(*scan)(const char *, const char *, value_t &)>
+    static unsigned parse_array(dynarray<value_t> &values, const char *p, const char *end) {
+      unsigned num_values = 0;
+      bool done = false;
+      while (!done) {
+        value_t buffer[64];
+        unsigned num_buffered = 0;
+        while (num_buffered != 64) {
+          while (in_text<terminated>(p, end) && is_space(*p)) ++p;
+          bool at_end = terminated ? *p == 0 : p == end;
+          const char *next = at_end ? 0 : scan(p, end, buffer[num_buffered]);
+          if (!next) {
+            done = true;
+            break;
+          }
+          p = next;
+          num_buffered++;
+        }
+        unsigned size = values.size();
+        if (size + num_buffered > values.capacity()) {
+          // grow geometrically, resize() would only make room for this block.
+          values.reserve(size * 2 + num_buffered);
+        }
+        values.resize(size + num_buffered);
+        for (unsigned i = 0; i != num_buffered; ++i) {
+          values[size + i] = buffer[i];
+        }
+        num_values += num_buffered;
+      }
+      return num_values;
+    }
+
+  public:
+    /// Parse a float like "-1.25e3" at src and move src past it.
+    /// Returns false and leaves src alone if there is no number there.
+    static bool parse_float(const char *&src, const char *end, float &result) {
+      const char *p = src == end ? 0 : scan_float<false>(src, end, result);
+      if (!p) return false;
+      src = p;
+      return true;
+    }
+
+    /// Parse an integer like "-123" at src and move src past it.
+    /// Returns false and leaves src alone if there is no number there.
+    static bool parse_int(const char *&src, const char *end, int &result) {
+      const char *p = src == end ? 0 : scan_int<false>(src, end, result);
+      if (!p) return false;
+      src = p;
+      return true;
+    }
+
+    /// Append white space separated floats to an array.
+    /// Stops at the end of the text or at anything that is not a number.
+    /// returns the number of floats added.
+    static unsigned parse_floats(dynarray<float> &values, const string_view &text) {
+      return parse_array<false, float, scan_float<false> >(values, text.begin(), text.end());
+    }
+
+    /// Append floats from null terminated text (such as XML element text) to an array.
+    /// This saves finding the length first.
+    static unsigned parse_floats(dynarray<float> &values, const char *text) {
+      return parse_array<true, float, scan_float<true> >(values, text, 0);
+    }
+
+    /// Append white space separated integers to an array.
+    /// Stops at the end of the text or at anything that is not a number.
+    /// returns the number of integers added.
+    static unsigned parse_ints(dynarray<int> &values, const string_view &text) {
+      return parse_array<false, int, scan_int<false> >(values, text.begin(), text.end());
+    }
+
+    /// Append integers from null terminated text to an array.
+    static unsigned parse_ints(dynarray<int> &values, const char *text) {
+      return parse_array<true, int, scan_int<true> >(values, text, 0);
+    }
+  };
+} }
@@ -0,0 +1,76 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Radix sort for 64 bit keys
+//
+
+namespace octet { namespace containers {
+  /// Sort things by a 64 bit integer key in linear time.
+  ///
+  /// This is a least significant digit radix sort with 8 bit digits.
+  /// All the digit counts are made in one pass, then digits that are the same in every key
+  /// (such as the top bits of small keys) are skipped, so it often takes fewer than eight passes.
+  /// The sort is stable: things with equal keys stay in the same order.
+  ///
+  /// Example:
+  ///
+  ///     struct entry { uint64_t key; unsigned index; };
+  ///     dynarray<entry> entries, tmp;
+  ///     radix_sort::sort(entries, tmp, [](const entry &e) { return e.key; });
+  class radix_sort {
+  public:
+    enum { digit_bits = 8, num_digits = 64 / digit_bits, digit_size = 1 << digit_bits };
+
+    /// Sort items by key. tmp is used as workspace and is resized as needed.
+    /// Items are moved with assignment, so keep them small (a key and an index is ideal).
+    template <class item_t, class key_fn_t> static void sort(dynarray<item_t> &items, dynarray<item_t> &tmp, key_fn_t get_key) {
+      unsigned num_items = items.size();
+      if (num_items < 2) return;
+      tmp.resize(num_items);
+
+      unsigned counts[num_digits][digit_size];
+      memset(counts, 0, sizeof(counts));
+      for (unsigned i = 0; i != num_items; ++i) {
+        uint64_t key = get_key(items[i]);
+        for (unsigned d = 0; d != num_digits; ++d) {
+          counts[d][(key >> (d * digit_bits)) & (digit_size - 1)]++;
+        }
+      }
+
+      item_t *src = items.data();
+      item_t *dest = tmp.data();
+      for (unsigned d = 0; d != num_digits; ++d) {
+        unsigned *count = counts[d];
+
+        // every key has the same digit here: nothing would move.
+        uint64_t first_digit = (get_key(src[0]) >> (d * digit_bits)) & (digit_size - 1);
+        if (count[first_digit] == num_items) continue;
+
+        // counts -> offsets
+        unsigned offset = 0;
+        for (unsigned i = 0; i != digit_size; ++i) {
+          unsigned n = count[i];
+          count[i] = offset;
+          offset += n;
+        }
+
+        for (unsigned i = 0; i != num_items; ++i) {
+          unsigned digit = (unsigned)(get_key(src[i]) >> (d * digit_bits)) & (digit_size - 1);
+          dest[count[digit]++] = src[i];
+        }
+
+        item_t *t = src; src = dest; dest = t;
+      }
+
+      // an odd number of passes leaves the result in tmp.
+      if (src != items.data()) {
+        for (unsigned i = 0; i != num_items; ++i) {
+          items[i] = src[i];
+        }
+      }
+    }
+  };
+} }
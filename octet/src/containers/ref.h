@@ -46,6 +46,12 @@ namespace octet { namespace containers {
       if (item) item->add_ref();
     }
 
+    /// move constructor - takes the reference from rhs without touching the ref count.
+    ref(ref &&rhs) {
+      item = rhs.item;
+      rhs.item = 0;
+    }
+
     /// initialize with new item - pointer then "owns" object
     ref(item_t *new_item) {
       if (new_item) new_item->add_ref();
@@ -61,6 +67,16 @@ namespace octet { namespace containers {
       return rhs;
     }
 
+    /// take the item from rhs - frees any old object
+    ref &operator=(ref &&rhs) {
+      if (this != &rhs) {
+        if (item) item->release();
+        item = rhs.item;
+        rhs.item = 0;
+      }
+      return *this;
+    }
+
     /// replace item with new one - frees any old object
     item_t *operator=(item_t *new_item) {
       if (new_item) new_item->add_ref();
@@ -90,4 +106,83 @@ namespace octet { namespace containers {
       item = 0;
     }
   };
+
+  /// Weak reference to a resource.
+  ///
+  /// A weak_ref does not keep the object alive. Use lock() to get a ref<> that does,
+  /// this is empty if the object has been deleted.
+  /// Weak refs and locks are thread safe if OCTET_ATOMIC_REFCOUNT is set.
+  ///
+  /// Anything using a weak_ref must implement get_weak_block() as well as add_ref() and release().
+  ///
+  /// Example:
+  ///
+  ///     weak_ref<mesh> cached = my_mesh;
+  ///     ...
+  ///     ref<mesh> m = cached.lock();
+  ///     if (m) m->get_num_vertices();
+  template <class item_t> class weak_ref {
+    item_t *item;
+    weak_ref_block *block;
+
+  public:
+    /// empty weak reference.
+    weak_ref() {
+      item = 0;
+      block = 0;
+    }
+
+    /// make a weak reference to a live object.
+    weak_ref(item_t *new_item) {
+      item = new_item;
+      block = new_item ? new_item->get_weak_block() : 0;
+      if (block) block->add_ref();
+    }
+
+    /// make a weak reference to the object held by a ref.
+    weak_ref(const ref<item_t> &rhs) {
+      item = (item_t*)rhs;
+      block = item ? item->get_weak_block() : 0;
+      if (block) block->add_ref();
+    }
+
+    weak_ref(const weak_ref &rhs) {
+      item = rhs.item;
+      block = rhs.block;
+      if (block) block->add_ref();
+    }
+
+    weak_ref &operator=(const weak_ref &rhs) {
+      if (rhs.block) rhs.block->add_ref();
+      if (block) block->release();
+      item = rhs.item;
+      block = rhs.block;
+      return *this;
+    }
+
+    ~weak_ref() {
+      if (block) block->release();
+    }
+
+    /// get a strong reference to the object; empty if it has died.
+    ref<item_t> lock() const {
+      ref<item_t> result;
+      if (block && block->lock()) {
+        // we have added a life, give it to the result.
+        result = item;
+        item->release();
+      }
+      return result;
+    }
+
+    /// true if the object has been deleted (or there never was one).
+    bool expired() const {
+      return !block || block->expired();
+    }
+  };
+
+  /// refs are just pointers, so dynarray can move them with realloc.
+  template <class item_t, class allocator_t> struct is_relocatable<ref<item_t, allocator_t> > {
+    enum { value = 1 };
+  };
 } }
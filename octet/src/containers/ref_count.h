@@ -0,0 +1,162 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Reference counters for intrusively counted objects (resources, zip files).
+//
+// OCTET_ATOMIC_REFCOUNT selects the counter used by resource.
+// Use atomic counters if resources are shared between threads.
+//
+
+namespace octet { namespace containers {
+  /// Plain reference counter for objects used on one thread only.
+  class plain_ref_count {
+    int value;
+  public:
+    plain_ref_count() {
+      value = 0;
+    }
+
+    /// add a life.
+    void add_ref() {
+      value++;
+    }
+
+    /// remove a life, return true if this was the last one.
+    bool release() {
+      return --value == 0;
+    }
+
+    /// add a life only if the object is still alive (see weak_ref).
+    bool try_add_ref() {
+      if (value == 0) return false;
+      value++;
+      return true;
+    }
+
+    /// current number of lives.
+    int get() const {
+      return value;
+    }
+  };
+
+  /// Thread safe reference counter.
+  ///
+  /// Increments are relaxed: a thread can only add a life to an object it can already see.
+  /// Decrements are acquire-release so that every write to the object happens before
+  /// the thread that removes the last life deletes it.
+  class atomic_ref_count {
+    std::atomic<int> value;
+  public:
+    atomic_ref_count() : value(0) {
+    }
+
+    /// add a life.
+    void add_ref() {
+      value.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /// remove a life, return true if this was the last one.
+    bool release() {
+      return value.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+    /// add a life only if the object is still alive (see weak_ref).
+    bool try_add_ref() {
+      int old = value.load(std::memory_order_relaxed);
+      while (old != 0) {
+        if (value.compare_exchange_weak(old, old + 1, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    /// current number of lives.
+    int get() const {
+      return value.load(std::memory_order_relaxed);
+    }
+  };
+
+  #if OCTET_ATOMIC_REFCOUNT
+    typedef atomic_ref_count ref_count_t;
+  #else
+    typedef plain_ref_count ref_count_t;
+  #endif
+
+  /// Shared block between an object and its weak references.
+  ///
+  /// The object owns one reference to the block and expires it when it dies.
+  /// Each weak_ref owns another. The small spin lock only stops the object being
+  /// deleted while a weak_ref is locking it, so there is no global lock.
+  template <class count_t> class basic_weak_ref_block {
+    std::atomic<int> num_refs;
+    std::atomic_flag busy;
+    count_t *count;
+
+    void lock_block() {
+      while (busy.test_and_set(std::memory_order_acquire)) {
+      }
+    }
+
+    void unlock_block() {
+      busy.clear(std::memory_order_release);
+    }
+
+  public:
+    /// make a block for an object's reference counter. The object owns the first reference.
+    basic_weak_ref_block(count_t *count_) : num_refs(1) {
+      busy.clear();
+      count = count_;
+    }
+
+    /// add a reference to the block
+    void add_ref() {
+      num_refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /// remove a reference and free the block when nothing uses it.
+    void release() {
+      if (num_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        this->~basic_weak_ref_block();
+        allocator::free(this, sizeof(*this));
+      }
+    }
+
+    /// add a life to the object if it is still alive.
+    /// returns false if the object has died.
+    bool lock() {
+      lock_block();
+      bool result = count && count->try_add_ref();
+      unlock_block();
+      return result;
+    }
+
+    /// Called by the object when its last life has gone, before it is deleted.
+    void expire() {
+      lock_block();
+      count = 0;
+      unlock_block();
+    }
+
+    /// true if the object has died.
+    bool expired() {
+      lock_block();
+      bool result = count == 0;
+      unlock_block();
+      return result;
+    }
+
+    /// make a new block using the allocator.
+    static basic_weak_ref_block *create(count_t *count) {
+      dynarray_dummy_t x;
+      return new (allocator::malloc(sizeof(basic_weak_ref_block)), x) basic_weak_ref_block(count);
+    }
+  };
+
+  /// weak reference block for resources
+  typedef basic_weak_ref_block<ref_count_t> weak_ref_block;
+} }
+
@@ -0,0 +1,203 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Slot map: dense storage with stable, generational handles.
+//
+
+namespace octet { namespace containers {
+  /// Handle to an item in a slot_map.
+  ///
+  /// A handle stays valid until its item is erased; after that it will never
+  /// find another item, even if the slot is re-used.
+  struct slot_map_handle {
+    uint32_t index;       /// slot number
+    uint32_t generation;  /// must match the slot's generation; 0 for a null handle
+
+    /// make a null handle
+    slot_map_handle() {
+      index = 0;
+      generation = 0;
+    }
+
+    slot_map_handle(uint32_t index_, uint32_t generation_) {
+      index = index_;
+      generation = generation_;
+    }
+
+    /// true if this handle has never been set
+    bool is_null() const {
+      return generation == 0;
+    }
+
+    bool operator==(const slot_map_handle &rhs) const {
+      return index == rhs.index && generation == rhs.generation;
+    }
+
+    bool operator!=(const slot_map_handle &rhs) const {
+      return !(*this == rhs);
+    }
+  };
+
+  /// Slot map: an array of items with stable handles.
+  ///
+  /// Items are kept packed in one array, so iteration is as fast as a dynarray.
+  /// Insert and erase are O(1): erase moves the last item into the gap, so the
+  /// order of items changes. Use handles, not indices, to keep track of an item.
+  ///
+  /// Example:
+  ///
+  ///     slot_map<ref<mesh_instance> > instances;
+  ///     slot_map_handle h = instances.insert(new mesh_instance(node, msh, mat));
+  ///     ...
+  ///     for (unsigned i = 0; i != instances.size(); ++i) {
+  ///       instances[i]->update(delta_time);
+  ///     }
+  ///     ...
+  ///     instances.erase(h);
+  ///     assert(instances.get(h) == 0);
+  template <class item_t, class allocator_t=allocator> class slot_map {
+    struct slot_t {
+      uint32_t dense_index;   // index into values or next free slot
+      uint32_t generation;    // incremented each time the slot is freed
+    };
+
+    enum { no_slot = 0xffffffff };
+
+    // the items, packed
+    dynarray<item_t, allocator_t> values;
+
+    // the slot for each item
+    dynarray<uint32_t, allocator_t, false> value_slots;
+
+    // handle index -> item
+    dynarray<slot_t, allocator_t, false> slots;
+
+    // first free slot
+    uint32_t free_slot;
+
+    uint32_t alloc_slot() {
+      if (free_slot != no_slot) {
+        uint32_t index = free_slot;
+        free_slot = slots[index].dense_index;
+        return index;
+      }
+      slot_t slot = { 0, 1 };
+      slots.push_back(slot);
+      return slots.size() - 1;
+    }
+
+    // find the slot for a live handle or return 0
+    const slot_t *find(slot_map_handle handle) const {
+      if (handle.index >= slots.size()) return 0;
+      const slot_t &slot = slots[handle.index];
+      return slot.generation == handle.generation ? &slot : 0;
+    }
+
+  public:
+    slot_map() {
+      free_slot = no_slot;
+    }
+
+    /// Construct a new item at the end of the array and return its handle.
+    template <class... args_t> slot_map_handle insert(args_t&&... args) {
+      uint32_t index = alloc_slot();
+      slots[index].dense_index = values.size();
+      values.emplace_back(std::forward<args_t>(args)...);
+      value_slots.push_back(index);
+      return slot_map_handle(index, slots[index].generation);
+    }
+
+    /// Erase the item for a handle. The last item moves into its place.
+    /// returns false if the handle is stale.
+    bool erase(slot_map_handle handle) {
+      if (!find(handle)) return false;
+
+      slot_t &slot = slots[handle.index];
+      uint32_t dense_index = slot.dense_index;
+      uint32_t last = values.size() - 1;
+      if (dense_index != last) {
+        values[dense_index] = std::move(values[last]);
+        value_slots[dense_index] = value_slots[last];
+        slots[value_slots[dense_index]].dense_index = dense_index;
+      }
+      values.pop_back();
+      value_slots.pop_back();
+
+      // invalidate old handles (zero is the null handle)
+      if (++slot.generation == 0) slot.generation = 1;
+      slot.dense_index = free_slot;
+      free_slot = handle.index;
+      return true;
+    }
+
+    /// Erase the item at an index in the packed array.
+    void erase_at(unsigned dense_index) {
+      erase(get_handle(dense_index));
+    }
+
+    /// true if the handle refers to a live item.
+    bool contains(slot_map_handle handle) const {
+      return find(handle) != 0;
+    }
+
+    /// get the item for a handle or null if it has been erased.
+    item_t *get(slot_map_handle handle) {
+      const slot_t *slot = find(handle);
+      return slot ? &values[slot->dense_index] : 0;
+    }
+
+    /// get the item for a handle or null if it has been erased.
+    const item_t *get(slot_map_handle handle) const {
+      const slot_t *slot = find(handle);
+      return slot ? &values[slot->dense_index] : 0;
+    }
+
+    /// get the index in the packed array for a handle or -1 if it has been erased.
+    int get_index(slot_map_handle handle) const {
+      const slot_t *slot = find(handle);
+      return slot ? (int)slot->dense_index : -1;
+    }
+
+    /// get the handle for an item in the packed array.
+    slot_map_handle get_handle(unsigned dense_index) const {
+      uint32_t index = value_slots[dense_index];
+      return slot_map_handle(index, slots[index].generation);
+    }
+
+    /// access an item in the packed array.
+    item_t &operator[](unsigned dense_index) { return values[dense_index]; }
+
+    /// read an item in the packed array.
+    const item_t &operator[](unsigned dense_index) const { return values[dense_index]; }
+
+    /// number of items.
+    unsigned size() const { return values.size(); }
+
+    /// true if there are no items.
+    bool empty() const { return values.empty(); }
+
+    /// pointer to the packed items.
+    item_t *data() { return values.data(); }
+
+    /// pointer to the packed items.
+    const item_t *data() const { return values.data(); }
+
+    /// reserve space for a number of items.
+    void reserve(unsigned capacity) {
+      values.reserve(capacity);
+      value_slots.reserve(capacity);
+      slots.reserve(capacity);
+    }
+
+    /// erase all the items. Existing handles become stale.
+    void reset() {
+      while (!values.empty()) {
+        erase(get_handle(values.size() - 1));
+      }
+    }
+  };
+} }
+
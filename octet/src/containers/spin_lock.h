@@ -0,0 +1,47 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Spin lock for very short critical sections shared between threads.
+//
+
+namespace octet { namespace containers {
+  /// A one byte lock for guarding a few instructions (a list push, a pool allocation).
+  ///
+  /// Unlike a mutex it never sleeps in the kernel, so only hold it for a very short time.
+  /// After a few failed tries it yields so that a descheduled owner can finish.
+  ///
+  /// Example:
+  ///
+  ///     spin_lock lock;
+  ///     std::lock_guard<spin_lock> guard(lock);
+  class spin_lock {
+    std::atomic_flag flag;
+
+    spin_lock(const spin_lock &);
+    spin_lock &operator=(const spin_lock &);
+  public:
+    spin_lock() {
+      flag.clear();
+    }
+
+    /// wait until we own the lock.
+    void lock() {
+      for (unsigned i = 0; flag.test_and_set(std::memory_order_acquire); ++i) {
+        if (i >= 64) std::this_thread::yield();
+      }
+    }
+
+    /// take the lock if nobody else has it; returns true if we got it.
+    bool try_lock() {
+      return !flag.test_and_set(std::memory_order_acquire);
+    }
+
+    /// let another thread have the lock.
+    void unlock() {
+      flag.clear(std::memory_order_release);
+    }
+  };
+} }
@@ -13,6 +13,13 @@
 //
 
 namespace octet { namespace containers {
+  class string;
+
+  /// strings only contain a pointer to their text, so dynarray can move them with realloc.
+  template <> struct is_relocatable<string> {
+    enum { value = 1 };
+  };
+
   /// The string class is used to hold persistant text strings.
   ///
   /// Only use this class as a data member in another class. Do not pass strings as parameters
@@ -155,10 +162,16 @@ namespace octet { namespace containers {
     
     /// Copy of another string
     string(const string& rhs) { data_ = null_string(); *this = rhs.c_str(); }
+
+    /// Move another string, leaving it empty
+    string(string &&rhs) { data_ = rhs.data_; rhs.data_ = null_string(); }
     
     /// Copy of a substring
     string(const char *value, unsigned size) { data_ = null_string(); set(value, size); }
 
+    /// Copy of a string_view
+    string(const string_view &value) { data_ = null_string(); set(value.data(), value.size()); }
+
     /// Free up memory used by the string.
     ~string() { release(); }
 
@@ -258,7 +271,10 @@ namespace octet { namespace containers {
     }
 
     /// copy another string
-    string &operator=(const string& rhs) { data_ = null_string(); *this = rhs.c_str(); return *this; }
+    string &operator=(const string& rhs) { if (this != &rhs) *this = rhs.c_str(); return *this; }
+
+    /// take the text of another string, leaving it empty
+    string &operator=(string &&rhs) { if (this != &rhs) { release(); data_ = rhs.data_; rhs.data_ = null_string(); } return *this; }
 
     /// copy a substring
     string &set(const char *value, unsigned size) {
@@ -403,6 +419,21 @@ namespace octet { namespace containers {
       result.back() = cur;
     }
 
+    /// python-style string split without copying; the views point into this string.
+    ///
+    /// Example.
+    ///
+    ///     dynarray<string_view> parts;
+    ///     my_csv.split(parts, ",")
+    void split(dynarray<string_view> &result, const char *delimiter) const {
+      string_view(data_, (unsigned)strlen(data_)).split(result, delimiter);
+    }
+
+    /// get a view of the string
+    string_view view() const {
+      return string_view(data_, (unsigned)strlen(data_));
+    }
+
     /// return true if the string is empty.
     bool empty() {
       return size() == 0;
@@ -0,0 +1,169 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Non-owning view of a piece of text.
+//
+
+namespace octet { namespace containers {
+  /// A pointer and a length into somebody else's text.
+  ///
+  /// Use string_view to pick text apart without making copies, for example
+  /// when tokenizing files. The text must outlive the view and need not be
+  /// null terminated, so use size() and do not call C string functions on data().
+  ///
+  /// Example:
+  ///
+  ///     string_view text("fred bert harry");
+  ///     string_view token;
+  ///     while (text.pop_token(token)) {
+  ///       printf("%.*s\n", token.size(), token.data());
+  ///     }
+  class string_view {
+    const char *data_;
+    unsigned size_;
+
+    static bool is_space(char c) {
+      return (unsigned char)(c - 1) < ' ';
+    }
+
+  public:
+    /// empty view
+    string_view() {
+      data_ = "";
+      size_ = 0;
+    }
+
+    /// view of a C string
+    string_view(const char *text) {
+      data_ = text ? text : "";
+      size_ = (unsigned)strlen(data_);
+    }
+
+    /// view of some characters
+    string_view(const char *text, unsigned size) {
+      data_ = text;
+      size_ = size;
+    }
+
+    /// view of the characters between begin and end
+    string_view(const char *begin, const char *end) {
+      data_ = begin;
+      size_ = (unsigned)(end - begin);
+    }
+
+    /// first character
+    const char *data() const { return data_; }
+
+    /// first character
+    const char *begin() const { return data_; }
+
+    /// one after the last character
+    const char *end() const { return data_ + size_; }
+
+    /// number of characters
+    unsigned size() const { return size_; }
+
+    /// true if there are no characters
+    bool empty() const { return size_ == 0; }
+
+    /// get one character
+    char operator[](unsigned index) const { return data_[index]; }
+
+    /// get part of the view. pos and len are clipped to the view.
+    string_view substr(unsigned pos, unsigned len = ~0u) const {
+      if (pos > size_) pos = size_;
+      if (len > size_ - pos) len = size_ - pos;
+      return string_view(data_ + pos, len);
+    }
+
+    /// find a character; returns -1 if not found.
+    int find(char c, unsigned pos = 0) const {
+      for (unsigned i = pos; i < size_; ++i) {
+        if (data_[i] == c) return (int)i;
+      }
+      return -1;
+    }
+
+    /// find a substring; returns -1 if not found.
+    int find(const string_view &str, unsigned pos = 0) const {
+      if (str.size_ > size_) return -1;
+      for (unsigned i = pos; i + str.size_ <= size_; ++i) {
+        if (!memcmp(data_ + i, str.data_, str.size_)) return (int)i;
+      }
+      return -1;
+    }
+
+    /// true if the view starts with some text
+    bool starts_with(const string_view &str) const {
+      return str.size_ <= size_ && !memcmp(data_, str.data_, str.size_);
+    }
+
+    /// get the view without leading and trailing white space.
+    string_view trim() const {
+      const char *b = begin(), *e = end();
+      while (b != e && is_space(*b)) ++b;
+      while (e != b && is_space(e[-1])) --e;
+      return string_view(b, e);
+    }
+
+    /// Take the next white space separated token off the front of the view.
+    /// returns false if there are no more tokens.
+    bool pop_token(string_view &token) {
+      const char *b = begin(), *e = end();
+      while (b != e && is_space(*b)) ++b;
+      const char *p = b;
+      while (p != e && !is_space(*p)) ++p;
+      token = string_view(b, p);
+      data_ = p;
+      size_ = (unsigned)(e - p);
+      return !token.empty();
+    }
+
+    /// python-style split that does not copy the text.
+    ///
+    /// Example:
+    ///
+    ///     dynarray<string_view> parts;
+    ///     string_view("100,fred,bert").split(parts, ",");
+    void split(dynarray<string_view> &result, const string_view &delimiter) const {
+      result.resize(0);
+      unsigned pos = 0;
+      for (;;) {
+        int next = delimiter.empty() ? -1 : find(delimiter, pos);
+        if (next < 0) break;
+        result.push_back(string_view(data_ + pos, next - pos));
+        pos = next + delimiter.size_;
+      }
+      result.push_back(string_view(data_ + pos, size_ - pos));
+    }
+
+    /// 64 bit hash of the text (see wyhash)
+    uint64_t get_hash() const {
+      return wyhash::hash(data_, size_);
+    }
+
+    /// compare text
+    bool operator==(const string_view &rhs) const {
+      return size_ == rhs.size_ && !memcmp(data_, rhs.data_, size_);
+    }
+
+    /// compare text
+    bool operator!=(const string_view &rhs) const {
+      return !(*this == rhs);
+    }
+
+    /// compare with a C string
+    bool operator==(const char *rhs) const {
+      return *this == string_view(rhs);
+    }
+
+    /// compare with a C string
+    bool operator!=(const char *rhs) const {
+      return !(*this == string_view(rhs));
+    }
+  };
+} }
+
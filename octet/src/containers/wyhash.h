@@ -0,0 +1,107 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Fast, high quality 64 bit hash for strings and other byte arrays.
+//
+// This follows Wang Yi's wyhash (public domain): 64x64->128 bit multiplies
+// fold the input into the state sixteen or forty eight bytes at a time.
+//
+
+namespace octet { namespace containers {
+  /// 64 bit hash function for strings and blocks of memory.
+  ///
+  /// Example:
+  ///
+  ///     uint64_t h = wyhash::hash("fred");
+  ///     uint64_t h2 = wyhash::hash(&my_struct, sizeof(my_struct));
+  class wyhash {
+    // read little-endian values of various sizes
+    static uint64_t r8(const uint8_t *p) { uint64_t v; memcpy(&v, p, 8); return v; }
+    static uint64_t r4(const uint8_t *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+    static uint64_t r3(const uint8_t *p, size_t k) { return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1]; }
+
+    // 64x64 -> 128 bit multiply, A gets the low half, B the high half.
+    static void mum(uint64_t *A, uint64_t *B) {
+      #if defined(__SIZEOF_INT128__)
+        __uint128_t r = (__uint128_t)*A * *B;
+        *A = (uint64_t)r;
+        *B = (uint64_t)(r >> 64);
+      #elif defined(_MSC_VER) && defined(_M_X64)
+        *A = _umul128(*A, *B, B);
+      #else
+        uint64_t ha = *A >> 32, hb = *B >> 32, la = (uint32_t)*A, lb = (uint32_t)*B;
+        uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+        uint64_t t = rl + (rm0 << 32), c = t < rl;
+        uint64_t lo = t + (rm1 << 32);
+        c += lo < t;
+        *A = lo;
+        *B = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+      #endif
+    }
+
+    static uint64_t mix(uint64_t A, uint64_t B) {
+      mum(&A, &B);
+      return A ^ B;
+    }
+
+    static const uint64_t *secret() {
+      static const uint64_t values[4] = {
+        0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull
+      };
+      return values;
+    }
+
+  public:
+    /// hash a block of bytes.
+    static uint64_t hash(const void *key, size_t len, uint64_t seed = 0) {
+      const uint64_t *s = secret();
+      const uint8_t *p = (const uint8_t *)key;
+      seed ^= mix(seed ^ s[0], s[1]);
+      uint64_t a, b;
+      if (len <= 16) {
+        if (len >= 4) {
+          a = (r4(p) << 32) | r4(p + ((len >> 3) << 2));
+          b = (r4(p + len - 4) << 32) | r4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+          a = r3(p, len);
+          b = 0;
+        } else {
+          a = b = 0;
+        }
+      } else {
+        size_t i = len;
+        if (i > 48) {
+          uint64_t see1 = seed, see2 = seed;
+          do {
+            seed = mix(r8(p) ^ s[1], r8(p + 8) ^ seed);
+            see1 = mix(r8(p + 16) ^ s[2], r8(p + 24) ^ see1);
+            see2 = mix(r8(p + 32) ^ s[3], r8(p + 40) ^ see2);
+            p += 48;
+            i -= 48;
+          } while (i > 48);
+          seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+          seed = mix(r8(p) ^ s[1], r8(p + 8) ^ seed);
+          i -= 16;
+          p += 16;
+        }
+        a = r8(p + i - 16);
+        b = r8(p + i - 8);
+      }
+      a ^= s[1];
+      b ^= seed;
+      mum(&a, &b);
+      return mix(a ^ s[0] ^ len, b ^ s[1]);
+    }
+
+    /// hash a C string.
+    static uint64_t hash(const char *str) {
+      return hash(str, strlen(str));
+    }
+  };
+} }
+
@@ -94,8 +94,9 @@ namespace octet {
       app_scene->begin_render(vx, vy);
 
       scene_node *camera_node = the_camera->get_node();
-      mat4t &camera_to_world = camera_node->access_nodeToParent();
+      mat4t camera_to_world = camera_node->get_nodeToParent();
       mouse_look_helper.update(camera_to_world);
+      camera_node->set_nodeToParent(camera_to_world);
 
       fps_helper.update(player_node, camera_node);
 
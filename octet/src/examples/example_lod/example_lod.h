@@ -29,26 +29,20 @@ namespace octet {
       // second material to show effect
       material *mat2 = new material(vec4(0, 1, 0, 1));
 
-      // four different LOD models
-      mesh_sphere *spheres[] = {
-        new mesh_sphere(vec3(0), 0.5f, 3),
-        new mesh_sphere(vec3(0), 0.5f, 2),
-        new mesh_sphere(vec3(0), 0.5f, 1),
-        new mesh_sphere(vec3(0), 0.5f, 0)
-      };
-
-      // distances where LOD values change
-      static const float distances[] = {
-        //-1e37f, 3, 6, 18, 1e37f   // high performance, low quality
-        //-1e37f, 3, 6, 18, 1e37f   // high performance, low quality
-        -1e37f, 5, 15, 45, 1e37f  // medium performance and quality
-        //-1e37f, 5, 25, 125, 1e37f // low performance, high quality
-      };
+      // four different LOD models, with the furthest any triangle gets from the real sphere.
+      lod_group *lod = new lod_group();
+      lod->add_level(new mesh_sphere(vec3(0), 0.5f, 3), 0.0023f);
+      lod->add_level(new mesh_sphere(vec3(0), 0.5f, 2), 0.0089f);
+      lod->add_level(new mesh_sphere(vec3(0), 0.5f, 1), 0.033f);
 
       // materials for LODs (it is common to have simpler shaders for further objects).
-      material *mats[] = {
-        mat, mat, mat, mat  // show smallest lod in different cocalclour
-      };
+      // use mat2 here to show the smallest lod in a different colour.
+      lod->add_level(new mesh_sphere(vec3(0), 0.5f, 0), 0.10f, mat);
+
+      // pixels of error allowed: bigger is faster but spheres go lumpy sooner.
+      //lod->set_max_pixel_error(4);  // high performance, low quality
+      lod->set_max_pixel_error(1);    // medium performance and quality
+      //lod->set_max_pixel_error(0.25f); // low performance, high quality
 
       int num_x = 10;
       int num_y = 5;
@@ -62,16 +56,11 @@ namespace octet {
             scene_node *node = new scene_node();
             node->translate(vec3((x-num_x*0.5f) * 2.0f, (y - num_y*0.5f) * 2.0f, -z * 2.0f));
             app_scene->add_child(node);
-            for (int k = 0; k != 4; ++k) {
-              // The mesh instance has a min and max distance.
-              // By choosing these carefully, we will draw only one of the four variants
-              // depending on distance.
-              mesh_instance *mi = new mesh_instance(node, spheres[k], mats[k]);
-              mi->set_min_draw_distance(distances[k]);
-              mi->set_max_draw_distance(distances[k+1]);
-              mi->set_flags(mesh_instance::flag_enabled|mesh_instance::flag_lod);
-              app_scene->add_mesh_instance(mi);
-            }
+            // One instance per sphere: the scene picks one of the four variants
+            // each frame by how big its error would look on the screen.
+            mesh_instance *mi = new mesh_instance(node, 0, mat);
+            mi->set_lod_group(lod);
+            app_scene->add_mesh_instance(mi);
           }
         }
       }
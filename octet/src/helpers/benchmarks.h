@@ -0,0 +1,1029 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Micro-benchmarks for engine subsystems.
+//
+// Call these from an app (or a command line tool) and read the results from stdout.
+// Build with optimisation on or the numbers are meaningless.
+//
+// This file is not part of octet.h: include it after octet.h in the code that runs them.
+//
+
+#include <chrono>
+
+namespace octet { namespace helpers {
+  /// Micro-benchmarks for containers and other subsystems.
+  ///
+  /// Example:
+  ///
+  ///     benchmarks::hash_map_benchmark();
+  class benchmarks {
+  public:
+    /// a simple wall clock timer in seconds.
+    class timer {
+      std::chrono::high_resolution_clock::time_point start;
+    public:
+      timer() {
+        start = std::chrono::high_resolution_clock::now();
+      }
+
+      double get_seconds() const {
+        return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+      }
+    };
+
+  private:
+    // The hash map as it was before the Swiss table, kept for comparison.
+    // Linear probing, zero keys are empty, no erase.
+    template <typename key_t, typename value_t> class linear_hash_map {
+      struct entry_t { key_t key; unsigned hash; value_t value; };
+
+      entry_t *entries;
+      unsigned num_entries;
+      unsigned max_entries;
+
+      static unsigned fuzz_hash(unsigned hash) { return hash ^ (hash >> 3) ^ (hash >> 5); }
+      static unsigned get_hash(uint64_t key) { return fuzz_hash((unsigned)(key ^ (key >> 32))); }
+
+      entry_t *find(const key_t &key, unsigned hash) {
+        unsigned mask = max_entries - 1;
+        for (unsigned i = 0; i != max_entries; ++i) {
+          entry_t *entry = &entries[(i + hash) & mask];
+          if (!entry->key || (entry->hash == hash && entry->key == key)) {
+            return entry;
+          }
+        }
+        return 0;
+      }
+
+      void expand() {
+        entry_t *old_entries = entries;
+        unsigned old_max_entries = max_entries;
+        entries = (entry_t *)allocator::malloc(sizeof(entry_t) * max_entries*2);
+        memset(entries, 0, sizeof(entry_t) * max_entries*2);
+        max_entries *= 2;
+        for (unsigned i = 0; i != old_max_entries; ++i) {
+          entry_t *old_entry = &old_entries[i];
+          if (old_entry->key) {
+            *find(old_entry->key, old_entry->hash) = *old_entry;
+          }
+        }
+        allocator::free(old_entries, sizeof(entry_t) * old_max_entries);
+      }
+
+    public:
+      linear_hash_map() {
+        num_entries = 0;
+        max_entries = 4;
+        entries = (entry_t*)allocator::malloc(sizeof(entry_t) * max_entries);
+        memset(entries, 0, sizeof(entry_t) * max_entries);
+      }
+
+      ~linear_hash_map() {
+        allocator::free(entries, sizeof(entry_t) * max_entries);
+      }
+
+      value_t &operator[](const key_t &key) {
+        unsigned hash = get_hash(key);
+        entry_t *entry = find(key, hash);
+        if (!entry->key) {
+          if (num_entries >= max_entries * 3 / 4) {
+            expand();
+            entry = find(key, hash);
+          }
+          num_entries++;
+          entry->key = key;
+          entry->hash = hash;
+        }
+        return entry->value;
+      }
+
+      bool contains(const key_t &key) {
+        return find(key, get_hash(key))->key != 0;
+      }
+    };
+
+    // make num_indices keys with about six uses of each key, like the indices of a mesh.
+    static void make_reindex_keys(dynarray<uint64_t> &keys, unsigned num_indices) {
+      keys.resize(num_indices);
+      unsigned num_vertices = num_indices / 6 + 1;
+      unsigned seed = 0x1234567;
+      for (unsigned i = 0; i != num_indices; ++i) {
+        seed = seed * 1103515245 + 12345;
+        // quantised positions make keys with poor low bits
+        keys[i] = ((uint64_t)((seed >> 8) % num_vertices) + 1) << 4;
+      }
+    }
+
+    template <class map_t> static double time_reindex(const dynarray<uint64_t> &keys, unsigned &result) {
+      timer t;
+      map_t map;
+      unsigned num_unique = 0;
+      for (unsigned i = 0; i != keys.size(); ++i) {
+        unsigned &e = map[keys[i]];
+        if (e == 0) e = ++num_unique;
+      }
+      unsigned found = 0;
+      for (unsigned i = 0; i != keys.size(); ++i) {
+        found += map.contains(keys[i] + 1);
+      }
+      result = num_unique + found;
+      return t.get_seconds();
+    }
+
+
+    // an object with a reference counter of some kind (see ref_count.h)
+    template <class count_t> struct counted_object {
+      count_t count;
+      char padding[64];
+    };
+
+    // each thread adds and removes num_ops lives on one shared object.
+    template <class count_t> static double time_ref_count(unsigned num_threads, unsigned num_ops) {
+      counted_object<count_t> object;
+      object.count.add_ref();
+      timer t;
+      std::vector<std::thread> threads;
+      for (unsigned i = 0; i != num_threads; ++i) {
+        threads.push_back(std::thread([&object, num_ops]() {
+          for (unsigned j = 0; j != num_ops; ++j) {
+            object.count.add_ref();
+            // stop the compiler from folding the pair away
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+            object.count.release();
+          }
+        }));
+      }
+      for (unsigned i = 0; i != num_threads; ++i) {
+        threads[i].join();
+      }
+      return t.get_seconds();
+    }
+
+    // each thread locks a weak reference to one shared object num_ops times.
+    static double time_weak_lock(unsigned num_threads, unsigned num_ops) {
+      atomic_ref_count count;
+      count.add_ref();
+      basic_weak_ref_block<atomic_ref_count> *block = basic_weak_ref_block<atomic_ref_count>::create(&count);
+      timer t;
+      std::vector<std::thread> threads;
+      for (unsigned i = 0; i != num_threads; ++i) {
+        threads.push_back(std::thread([block, &count, num_ops]() {
+          for (unsigned j = 0; j != num_ops; ++j) {
+            if (block->lock()) count.release();
+          }
+        }));
+      }
+      for (unsigned i = 0; i != num_threads; ++i) {
+        threads[i].join();
+      }
+      block->release();
+      return t.get_seconds();
+    }
+
+    // The collada number parsers as they were before number_parser, kept for comparison.
+    static void old_atofv(dynarray<float> &values, const char *src) {
+      values.resize(0);
+      while (*src > 0 && *src <= ' ') ++src;
+      while(*src != 0) {
+        double whole = 0, msign = 1;
+        if (*src == '-') { msign = -1; src++; }
+        if( !(*src >= '0' && *src <= '9') && *src != '.' ) break;
+        while (*src >= '0' && *src <= '9') whole = whole * 10 + (*src++ - '0');
+        if (*src == '.') {
+          src++;
+          double frac = 0, v = 1;
+          while (*src >= '0' && *src <= '9') { frac = frac * 10 + (*src++ - '0'); v *= 10; }
+          whole += frac / v;
+        }
+        if (*src == 'e' || *src == 'E') {
+          int esign = 1;
+          src++;
+          if (*src == '-') { esign = -1; src++; }
+          else if (*src == '+') src++;
+          int exp = 0;
+          while (*src >= '0' && *src <= '9') { exp = exp * 10 + (*src++ - '0'); }
+          whole = whole * pow(10.0, exp * esign);
+        }
+        values.push_back((float)(whole * msign));
+        while (*src > 0 && *src <= ' ') ++src;
+      }
+    }
+
+    static void old_atoiv(dynarray<int> &values, const char *src) {
+      while (*src > 0 && *src <= ' ') ++src;
+      while(*src != 0) {
+        int whole = 0, msign = 1;
+        if (*src == '-') { msign = -1; src++; }
+        while (*src >= '0' && *src <= '9') whole = whole * 10 + (*src++ - '0');
+        values.push_back(whole * msign);
+        while (*src > 0 && *src <= ' ') ++src;
+      }
+    }
+
+    // find the text of all the number arrays in a collada file.
+    static void find_number_arrays(TiXmlElement *elem, dynarray<const char *> &floats, dynarray<const char *> &ints) {
+      for (; elem; elem = elem->NextSiblingElement()) {
+        const char *value = elem->Value();
+        const char *text = elem->GetText();
+        if (text) {
+          if (!strcmp(value, "float_array")) {
+            floats.push_back(text);
+          } else if (!strcmp(value, "p") || !strcmp(value, "vcount") || !strcmp(value, "v")) {
+            ints.push_back(text);
+          }
+        }
+        find_number_arrays(elem->FirstChildElement(), floats, ints);
+      }
+    }
+
+    // mesh::ray_cast as it was before the triangle bvh, kept for comparison.
+    // Tests every triangle.
+    static bool old_ray_cast(mesh *msh, const ray &the_ray, vec4 &bary_numer, float &bary_denom) {
+      unsigned pos_slot = msh->get_slot(attribute_pos);
+      unsigned pos_offset = msh->get_offset(pos_slot);
+      unsigned stride = msh->get_stride();
+      vec3 org = the_ray.get_start();
+      vec3 dir = the_ray.get_distance();
+
+      gl_resource::rolock idx_lock(msh->get_indices());
+      gl_resource::rolock vtx_lock(msh->get_vertices());
+      const uint32_t *idx = idx_lock.u32() + msh->get_first_index();
+      const uint8_t *vtx = vtx_lock.u8() + pos_offset;
+
+      float best_denom = 0;
+      vec4 best_numer(0, 0, 0, 0);
+      for (unsigned i = 0; i + 3 <= msh->get_num_indices(); i += 3) {
+        vec3 a = *(const vec3p*)(vtx + stride * idx[i+0]);
+        vec3 b = *(const vec3p*)(vtx + stride * idx[i+1]);
+        vec3 c = *(const vec3p*)(vtx + stride * idx[i+2]);
+        vec4 numer;
+        float denom;
+        if (mesh::ray_cast_triangle_test(a, b, c, org, dir, numer, denom)) {
+          rational best_distance(best_numer[3], best_denom);
+          rational new_distance(numer[3], denom);
+          if (!(new_distance > best_distance)) {
+            best_numer = numer;
+            best_denom = denom;
+          }
+        }
+      }
+      bary_numer = best_numer;
+      bary_denom = best_denom;
+      return fabsf(best_denom) >= 1e-6f;
+    }
+
+    // random rays that pass through a box from outside it.
+    static void make_rays(dynarray<ray> &rays, const aabb &bb, unsigned num_rays) {
+      class random rand;
+      vec3 center = bb.get_center(), half = bb.get_half_extent();
+      float radius = length(half) * 2 + 1e-3f;
+      rays.resize(num_rays);
+      for (unsigned i = 0; i != num_rays; ++i) {
+        vec3 dir(rand.get(-1.0f, 1.0f), rand.get(-1.0f, 1.0f), rand.get(-1.0f, 1.0f));
+        vec3 start = center + normalize(dir + vec3(1e-3f, 0, 0)) * radius;
+        vec3 target = center + half * vec3(rand.get(-1.0f, 1.0f), rand.get(-1.0f, 1.0f), rand.get(-1.0f, 1.0f));
+        rays[i] = ray(start, target + (target - start));
+      }
+    }
+
+    // an animation target that copies each channel's value into a pose, so the two evaluators can be compared.
+    // The channel sids are channel numbers.
+    class pose_recorder : public resource {
+      float *pose;
+      const unsigned *offsets;
+      const unsigned *sizes;
+    public:
+      pose_recorder(float *pose, const unsigned *offsets, const unsigned *sizes) : pose(pose), offsets(offsets), sizes(sizes) {
+      }
+
+      void set_value(atom_t sid, atom_t sub_target, atom_t component, float *value) {
+        memcpy(pose + offsets[sid], value, sizes[sid] * sizeof(float));
+      }
+    };
+
+    // a rig-like animation: half of the channels are matrices, a quarter translations, a quarter angles.
+    static animation *make_test_animation(unsigned num_channels, unsigned num_keys, dynarray<unsigned> &sizes) {
+      class random rand;
+      animation *anim = new animation();
+      dynarray<float> times(num_keys), values;
+      for (unsigned k = 0; k != num_keys; ++k) {
+        times[k] = k / 30.0f;
+      }
+      sizes.resize(num_channels);
+      for (unsigned c = 0; c != num_channels; ++c) {
+        unsigned size = c % 2 == 0 ? 16 : c % 4 == 1 ? 3 : 1;
+        sizes[c] = size;
+        values.resize(num_keys * size);
+        for (unsigned i = 0; i != values.size(); ++i) {
+          values[i] = rand.get(-1.0f, 1.0f);
+        }
+        anim->add_channel(0, (atom_t)c, size == 16 ? atom_transform : size == 3 ? atom_translate : atom_rotateX, atom_, times, values);
+      }
+      return anim;
+    }
+
+    // a smooth rig-like animation sampled at 30Hz: each bone turns back and forth about its
+    // own axis and some bob up and down, as a bone of a real character would.
+    // The channel sids are bone numbers; targets, if given, has a node for each bone.
+    static animation *make_smooth_animation(unsigned num_bones, unsigned num_keys, scene_node *const *targets = 0) {
+      class random rand;
+      animation *anim = new animation();
+      dynarray<float> times(num_keys), values(num_keys * 16);
+      for (unsigned k = 0; k != num_keys; ++k) {
+        times[k] = k / 30.0f;
+      }
+      for (unsigned b = 0; b != num_bones; ++b) {
+        vec3 axis = normalize(vec3(rand.get(-1.0f, 1.0f), rand.get(-1.0f, 1.0f), rand.get(0.1f, 1.0f)));
+        vec3 offset(rand.get(-1.0f, 1.0f), rand.get(0.0f, 2.0f), rand.get(-1.0f, 1.0f));
+        float speed = rand.get(0.5f, 2.0f), swing = rand.get(10.0f, 90.0f), bob = b % 4 == 0 ? 0.1f : 0.0f;
+        for (unsigned k = 0; k != num_keys; ++k) {
+          mat4t m;
+          m.rotate(sinf(times[k] * speed) * swing, axis.x(), axis.y(), axis.z());
+          m.translate(offset.x(), offset.y() + sinf(times[k] * speed * 2) * bob, offset.z());
+          // collada order: the columns of the octet matrix.
+          for (unsigned i = 0; i != 16; ++i) {
+            values[k * 16 + i] = m[i & 3][i >> 2];
+          }
+        }
+        anim->add_channel(targets ? targets[b] : 0, (atom_t)b, atom_transform, atom_, times, values);
+      }
+      return anim;
+    }
+
+    // skeleton::calc_transforms() as it was: the hierarchy from the nodes, a linear search of the
+    // sids the first time and modelToBind * bindToModel * boneToNode for every joint every time.
+    static void old_calc_transforms(skeleton *skel, scene_node **nodes, skin *skn, dynarray<mat4t> &boneToNode, dynarray<mat4t> &result, dynarray<int> &indices) {
+      unsigned num_bones = (unsigned)skel->get_num_joints();
+      boneToNode.resize(num_bones);
+      for (unsigned i = 0; i != num_bones; ++i) {
+        int parent = skel->get_parent(i);
+        boneToNode[i] = parent == -1 ? nodes[i]->get_nodeToParent() : nodes[i]->get_nodeToParent() * boneToNode[parent];
+      }
+
+      unsigned num_joints = skn->get_num_joints();
+      if (result.size() < num_joints) {
+        result.resize(num_joints);
+        indices.resize(num_joints);
+        for (unsigned i = 0; i != num_joints; ++i) {
+          indices[i] = -1;
+          for (unsigned j = 0; j != num_bones; ++j) {
+            if (nodes[j]->get_sid() == skn->get_joint(i)) { indices[i] = j; break; }
+          }
+        }
+      }
+
+      for (unsigned i = 0; i != num_joints; ++i) {
+        int index = indices[i];
+        result[i] = index != -1 ? skn->get_modelToBind() * skn->get_bindToModel(i) * boneToNode[index] : mat4t();
+      }
+    }
+
+  public:
+    /// Compare hash_map with the old linear probing map on reindex-sized workloads.
+    /// Each test inserts num_indices keys (about one in six unique), then makes num_indices failed lookups.
+    static void hash_map_benchmark(unsigned max_indices = 1000000) {
+      printf("hash_map benchmark: reindex workload (insert/find, then missing key lookups)\n");
+      printf("%10s %12s %12s %8s\n", "indices", "linear ms", "swiss ms", "speedup");
+      for (unsigned num_indices = 1000; num_indices <= max_indices; num_indices *= 10) {
+        dynarray<uint64_t> keys;
+        make_reindex_keys(keys, num_indices);
+        unsigned r0 = 0, r1 = 0;
+        double t0 = time_reindex<linear_hash_map<uint64_t, unsigned> >(keys, r0);
+        double t1 = time_reindex<hash_map<uint64_t, unsigned> >(keys, r1);
+        printf("%10d %12.3f %12.3f %8.2f%s\n", num_indices, t0 * 1000, t1 * 1000, t0 / t1, r0 == r1 ? "" : " MISMATCH");
+      }
+    }
+
+    /// Measure the cost of reference counting when many threads share one object.
+    /// Times are nanoseconds per add_ref/release pair (or weak lock/release pair) per thread.
+    static void ref_count_benchmark(unsigned num_ops = 1000000) {
+      printf("ref_count benchmark: add_ref + release on one shared object\n");
+      printf("%8s %12s %12s %12s\n", "threads", "plain ns", "atomic ns", "weak ns");
+      unsigned max_threads = std::thread::hardware_concurrency();
+      if (max_threads < 2) max_threads = 2;
+      for (unsigned num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+        double scale = 1e9 / num_ops;
+        double t1 = time_ref_count<atomic_ref_count>(num_threads, num_ops) * scale;
+        double t2 = time_weak_lock(num_threads, num_ops) * scale;
+        if (num_threads == 1) {
+          // the plain counter is only correct on one thread.
+          double t0 = time_ref_count<plain_ref_count>(1, num_ops) * scale;
+          printf("%8d %12.2f %12.2f %12.2f\n", num_threads, t0, t1, t2);
+        } else {
+          printf("%8d %12s %12.2f %12.2f\n", num_threads, "-", t1, t2);
+        }
+      }
+    }
+
+    /// Time the number parsing part of loading a collada file, old parser against number_parser.
+    /// The XML is parsed first, then every float_array, p, vcount and v element is converted to numbers.
+    static void parse_benchmark(const char *url = "assets/Laurana50k.dae", unsigned num_repeats = 10) {
+      printf("parse benchmark: %s\n", url);
+      timer xml_timer;
+      TiXmlDocument doc;
+      doc.LoadFile(app_utils::get_path(url));
+      if (!doc.RootElement()) {
+        printf("file %s not found\n", url);
+        return;
+      }
+      double xml_time = xml_timer.get_seconds();
+
+      dynarray<const char *> floats, ints;
+      find_number_arrays(doc.RootElement(), floats, ints);
+
+      dynarray<float> fvalues;
+      dynarray<int> ivalues;
+      dynarray<float> old_fvalues;
+      dynarray<int> old_ivalues;
+
+      timer t0;
+      for (unsigned r = 0; r != num_repeats; ++r) {
+        old_fvalues.resize(0);
+        old_ivalues.resize(0);
+        dynarray<float> tmp;
+        for (unsigned i = 0; i != floats.size(); ++i) {
+          old_atofv(tmp, floats[i]);
+          for (unsigned j = 0; j != tmp.size(); ++j) old_fvalues.push_back(tmp[j]);
+        }
+        for (unsigned i = 0; i != ints.size(); ++i) {
+          old_atoiv(old_ivalues, ints[i]);
+        }
+      }
+      double old_time = t0.get_seconds() / num_repeats;
+
+      timer t1;
+      for (unsigned r = 0; r != num_repeats; ++r) {
+        fvalues.resize(0);
+        ivalues.resize(0);
+        for (unsigned i = 0; i != floats.size(); ++i) {
+          number_parser::parse_floats(fvalues, floats[i]);
+        }
+        for (unsigned i = 0; i != ints.size(); ++i) {
+          number_parser::parse_ints(ivalues, ints[i]);
+        }
+      }
+      double new_time = t1.get_seconds() / num_repeats;
+
+      // the old parser accumulated rounding errors, count the floats where that mattered.
+      unsigned num_different = 0;
+      for (unsigned i = 0; i != fvalues.size() && i != old_fvalues.size(); ++i) {
+        num_different += fvalues[i] != old_fvalues[i];
+      }
+      bool ints_match = ivalues.size() == old_ivalues.size() && !memcmp(ivalues.data(), old_ivalues.data(), ivalues.size() * sizeof(int));
+
+      printf("xml parse %.3f ms, %d floats, %d ints\n", xml_time * 1000, fvalues.size(), ivalues.size());
+      printf("%12s %12s %8s\n", "old ms", "new ms", "speedup");
+      printf("%12.3f %12.3f %8.2f\n", old_time * 1000, new_time * 1000, old_time / new_time);
+      printf("%d floats rounded differently from the old parser%s\n", num_different,
+        fvalues.size() == old_fvalues.size() && ints_match ? "" : " MISMATCH"
+      );
+    }
+
+    /// Ray cast rate of mesh::ray_cast with the triangle bvh against the old test-every-triangle loop.
+    /// Random rays are fired through each mesh in a collada file (or each of the bundled models if url is null).
+    /// The old loop is slow, so it only gets num_rays / 100 rays.
+    static void ray_cast_benchmark(const char *url = 0, unsigned num_rays = 100000) {
+      static const char *default_urls[] = {
+        "assets/Laurana50k.dae", "assets/duck_triangulate.dae", "assets/rollercoaster.dae", 0
+      };
+      const char *one_url[] = { url, 0 };
+      const char **urls = url ? one_url : default_urls;
+
+      printf("ray cast benchmark: %d rays per mesh\n", num_rays);
+      printf("%-32s %10s %10s %12s %12s %8s\n", "mesh", "triangles", "build ms", "old rays/s", "new rays/s", "speedup");
+      for (; *urls; ++urls) {
+        collada_builder loader;
+        if (!loader.load_xml(*urls)) continue;
+        resource_dict dict;
+        loader.get_resources(dict);
+        dynarray<resource*> meshes;
+        dict.find_all(meshes, atom_mesh);
+
+        for (unsigned m = 0; m != meshes.size(); ++m) {
+          mesh *msh = meshes[m]->get_mesh();
+          if (!msh || msh->get_num_indices() < 3) continue;
+          msh->calc_aabb();
+
+          timer build_timer;
+          if (!msh->get_triangle_tree()) continue;
+          double build_time = build_timer.get_seconds();
+
+          dynarray<ray> rays;
+          make_rays(rays, msh->get_aabb(), num_rays);
+
+          unsigned num_old_rays = num_rays / 100 ? num_rays / 100 : 1;
+          dynarray<float> old_t(num_old_rays);
+          timer t0;
+          for (unsigned i = 0; i != num_old_rays; ++i) {
+            vec4 numer;
+            float denom;
+            old_t[i] = old_ray_cast(msh, rays[i], numer, denom) ? numer[3] / denom : -1;
+          }
+          double old_time = t0.get_seconds();
+
+          dynarray<float> new_t(num_rays);
+          timer t1;
+          for (unsigned i = 0; i != num_rays; ++i) {
+            int indices[3];
+            vec4 numer;
+            float denom;
+            new_t[i] = msh->ray_cast(rays[i], indices, numer, denom) ? numer[3] / denom : -1;
+          }
+          double new_time = t1.get_seconds();
+
+          // both should find the same nearest hit.
+          unsigned num_different = 0;
+          for (unsigned i = 0; i != num_old_rays; ++i) {
+            num_different += fabsf(old_t[i] - new_t[i]) > 1e-4f;
+          }
+
+          char name[33];
+          const char *file = strrchr(*urls, '/');
+          snprintf(name, sizeof(name), "%s #%d", file ? file + 1 : *urls, m);
+          double old_rate = num_old_rays / old_time, new_rate = num_rays / new_time;
+          printf("%-32s %10d %10.3f %12.0f %12.0f %8.2f%s\n",
+            name, msh->get_num_indices() / 3, build_time * 1000, old_rate, new_rate, new_rate / old_rate,
+            num_different ? " MISMATCH" : ""
+          );
+        }
+      }
+    }
+
+    /// Time a frame of transform work on a hierarchy: every node turns, then world and
+    /// model to projection matrices are made for every node. The first column moves
+    /// scene_nodes one at a time, the second writes a transform_store by handle and updates it in batches.
+    static void transform_benchmark(unsigned num_nodes = 100000, unsigned num_frames = 20) {
+      printf("transform benchmark: %d nodes, %d frames\n", num_nodes, num_frames);
+      printf("%-16s %12s %12s\n", "", "nodes ms", "store ms");
+
+      // two identical random hierarchies, about five deep.
+      dynarray<ref<scene_node> > nodes[2];
+      for (unsigned s = 0; s != 2; ++s) {
+        unsigned seed = 1;
+        ref<scene_node> root = new scene_node();
+        if (s == 1) root->use_transform_store(new transform_store());
+        nodes[s].push_back(root);
+        for (unsigned i = 1; i != num_nodes; ++i) {
+          seed = seed * 1103515245 + 12345;
+          scene_node *parent = nodes[s][(seed >> 8) % ((i + 3) / 4)];
+          scene_node *node = new scene_node();
+          node->translate(vec3((float)(seed & 15), (float)((seed >> 4) & 15), (float)((seed >> 12) & 15)));
+          parent->add_child(node);
+          nodes[s].push_back(node);
+        }
+      }
+
+      mat4t worldToCamera, cameraToProjection;
+      worldToCamera.translate(vec3(0, 0, -100));
+      cameraToProjection.frustum(-0.1f, 0.1f, -0.1f, 0.1f, 0.1f, 1000);
+
+      double times[2];
+      dynarray<mat4t> results[2];
+      for (unsigned s = 0; s != 2; ++s) {
+        dynarray<mat4t> &result = results[s];
+        result.resize(num_nodes);
+        transform_store *store = nodes[s][0]->get_transform_store();
+        timer t;
+        for (unsigned f = 0; f != num_frames; ++f) {
+          if (store) {
+            for (unsigned i = 0; i != num_nodes; ++i) {
+              store->access_local(nodes[s][i]->get_transform_handle()).rotate(1.0f, 0, 1, 0);
+            }
+            store->calc_view(worldToCamera, cameraToProjection);
+          } else {
+            for (unsigned i = 0; i != num_nodes; ++i) {
+              nodes[s][i]->rotate(1.0f, vec3(0, 1, 0));
+            }
+            nodes[s][0]->update_world_transforms();
+            for (unsigned i = 0; i != num_nodes; ++i) {
+              result[i] = nodes[s][i]->get_nodeToWorld() * worldToCamera * cameraToProjection;
+            }
+          }
+        }
+        times[s] = t.get_seconds() / num_frames;
+        if (store) {
+          for (unsigned i = 0; i != num_nodes; ++i) {
+            result[i] = store->get_modelToProjection(nodes[s][i]->get_transform_handle());
+          }
+        }
+      }
+
+      float max_error = 0;
+      for (unsigned i = 0; i != num_nodes; ++i) {
+        for (unsigned j = 0; j != 16; ++j) {
+          float a = results[0][i].get()[j], b = results[1][i].get()[j];
+          float error = fabsf(a - b) / (fabsf(a) + 1);
+          if (error > max_error) max_error = error;
+        }
+      }
+      printf("%-16s %12.3f %12.3f %8.2fx%s\n", "frame", times[0] * 1000, times[1] * 1000, times[0] / times[1], max_error < 1e-4f ? "" : " MISMATCH");
+    }
+
+    /// Compare a loop on one thread with the same loop split up by job_scheduler::parallel_for.
+    /// Each item does a little trigonometry, about as much work as skinning a vertex.
+    static void job_benchmark(unsigned num_items = 1 << 22, unsigned num_repeats = 10) {
+      job_scheduler &sched = job_scheduler::get();
+      printf("job benchmark: %d items, %d worker threads\n", num_items, sched.get_num_threads());
+      printf("%10s %12s %12s %8s\n", "min size", "serial ms", "jobs ms", "speedup");
+
+      dynarray<float> serial(num_items), parallel(num_items);
+      float *dest = serial.data();
+      auto work = [&dest](unsigned begin, unsigned end) {
+        for (unsigned i = begin; i != end; ++i) {
+          float x = i * 0.001f;
+          dest[i] = sinf(x) * cosf(x * 0.5f) + sqrtf(x);
+        }
+      };
+
+      timer t0;
+      for (unsigned r = 0; r != num_repeats; ++r) {
+        work(0, num_items);
+      }
+      double serial_time = t0.get_seconds() / num_repeats;
+
+      dest = parallel.data();
+      for (unsigned min_size = 256; min_size <= 65536; min_size *= 16) {
+        timer t1;
+        for (unsigned r = 0; r != num_repeats; ++r) {
+          sched.parallel_for(0, num_items, min_size, work);
+        }
+        double job_time = t1.get_seconds() / num_repeats;
+        bool same = memcmp(serial.data(), parallel.data(), num_items * sizeof(float)) == 0;
+        printf("%10d %12.3f %12.3f %8.2f%s\n", min_size, serial_time * 1000, job_time * 1000, serial_time / job_time, same ? "" : " MISMATCH");
+      }
+    }
+
+    /// Play an animation forwards at 60Hz, evaluating the channels one at a time with
+    /// animation::eval_chan() and all together with animation::eval() into a pose.
+    static void animation_benchmark(unsigned num_channels = 400, unsigned num_keys = 120, unsigned num_frames = 2000) {
+      dynarray<unsigned> sizes;
+      ref<animation> anim = make_test_animation(num_channels, num_keys, sizes);
+      unsigned pose_size = anim->get_pose_size();
+      dynarray<unsigned> offsets(num_channels);
+      for (unsigned c = 0; c != num_channels; ++c) {
+        offsets[c] = anim->get_pose_offset(c);
+      }
+      printf("animation benchmark: %d channels, %d floats per pose, %d keys, %d frames\n", num_channels, pose_size, num_keys, num_frames);
+      printf("%-20s %12s %16s\n", "", "ms", "channels/s");
+
+      float end_time = anim->get_end_time();
+      dynarray<float> old_pose(pose_size), new_pose(pose_size);
+      ref<pose_recorder> recorder = new pose_recorder(old_pose.data(), offsets.data(), sizes.data());
+      dynarray<unsigned> cursors(num_channels);
+      for (unsigned c = 0; c != num_channels; ++c) cursors[c] = 0;
+
+      double times[3];
+      for (unsigned method = 0; method != 3; ++method) {
+        timer t;
+        for (unsigned f = 0; f != num_frames; ++f) {
+          float time = fmodf(f / 60.0f, end_time);
+          if (method == 0) {
+            for (unsigned c = 0; c != num_channels; ++c) {
+              anim->eval_chan(c, time, recorder);
+            }
+          } else {
+            anim->eval(time, cursors.data(), new_pose.data());
+            if (method == 2) anim->apply(new_pose.data(), recorder);
+          }
+        }
+        times[method] = t.get_seconds();
+      }
+
+      // check that the two agree, at whole milliseconds because eval_chan rounds the time down to them.
+      float max_error = 0;
+      for (unsigned f = 0; f < num_frames; f += 97) {
+        float time = (int)(fmodf(f / 60.0f, end_time) * 1000) * 0.001f;
+        for (unsigned c = 0; c != num_channels; ++c) {
+          anim->eval_chan(c, time, recorder);
+        }
+        anim->eval(time, cursors.data(), new_pose.data());
+        for (unsigned i = 0; i != pose_size; ++i) {
+          float error = fabsf(new_pose[i] - old_pose[i]);
+          if (error > max_error) max_error = error;
+        }
+      }
+
+      const char *names[] = { "eval_chan", "eval", "eval + apply" };
+      for (unsigned method = 0; method != 3; ++method) {
+        printf("%-20s %12.3f %16.0f\n", names[method], times[method] * 1000, (double)num_channels * num_frames / times[method]);
+      }
+      printf("speedup %.2fx (eval), %.2fx (eval + apply)%s\n", times[0] / times[1], times[0] / times[2], max_error < 1e-4f ? "" : " MISMATCH");
+    }
+    /// Compress a long, smooth animation with animation::compress() and play it on many characters
+    /// at once, each at a different time, comparing memory, error and time with the uncompressed clip.
+    static void animation_compression_benchmark(unsigned num_bones = 60, unsigned num_keys = 2400, unsigned num_characters = 100, unsigned num_frames = 200, float tolerance = 0.001f) {
+      ref<animation> raw = make_smooth_animation(num_bones, num_keys);
+      ref<animation> packed = make_smooth_animation(num_bones, num_keys);
+      unsigned raw_bytes = raw->get_memory_size();
+      timer ct;
+      packed->compress(tolerance);
+      double compress_time = ct.get_seconds();
+      unsigned packed_bytes = packed->get_memory_size();
+
+      unsigned pose_size = raw->get_pose_size();
+      float end_time = raw->get_end_time();
+      printf("animation compression benchmark: %d bones, %d keys (%.1fs), %d characters, %d frames\n", num_bones, num_keys, end_time, num_characters, num_frames);
+      printf("%-12s %12s %12s %16s\n", "", "bytes", "ms", "channels/s");
+
+      // each character has its own cursors and pose.
+      dynarray<unsigned> cursors(num_characters * num_bones);
+      dynarray<float> poses(num_characters * pose_size);
+      ref<animation> anims[2] = { raw, packed };
+      double times[2];
+      for (unsigned method = 0; method != 2; ++method) {
+        for (unsigned i = 0; i != cursors.size(); ++i) cursors[i] = 0;
+        timer t;
+        for (unsigned f = 0; f != num_frames; ++f) {
+          for (unsigned c = 0; c != num_characters; ++c) {
+            float time = fmodf(f / 60.0f + c * end_time / num_characters, end_time);
+            anims[method]->eval(time, cursors.data() + c * num_bones, poses.data() + c * pose_size);
+          }
+        }
+        times[method] = t.get_seconds();
+      }
+
+      // biggest difference anywhere, including between the keys.
+      dynarray<float> raw_pose(pose_size), packed_pose(pose_size);
+      dynarray<unsigned> raw_cursors(num_bones), packed_cursors(num_bones);
+      for (unsigned i = 0; i != num_bones; ++i) raw_cursors[i] = packed_cursors[i] = 0;
+      float max_error = 0;
+      for (float time = 0; time < end_time; time += 0.0123f) {
+        raw->eval(time, raw_cursors.data(), raw_pose.data());
+        packed->eval(time, packed_cursors.data(), packed_pose.data());
+        for (unsigned i = 0; i != pose_size; ++i) {
+          float error = fabsf(raw_pose[i] - packed_pose[i]);
+          if (error > max_error) max_error = error;
+        }
+      }
+
+      const char *names[] = { "raw", "compressed" };
+      unsigned bytes[] = { raw_bytes, packed_bytes };
+      for (unsigned method = 0; method != 2; ++method) {
+        printf("%-12s %12d %12.3f %16.0f\n", names[method], bytes[method], times[method] * 1000, (double)num_bones * num_characters * num_frames / times[method]);
+      }
+      printf("%.1fx smaller, max error %f (tolerance %f), compressed in %.1fms\n", (double)raw_bytes / packed_bytes, max_error, tolerance, compress_time * 1000);
+    }
+
+    /// Play an animation on many characters' skeletons with animation_instances, which set
+    /// every channel on a scene_node, and with animation_mixers, which blend poses and set
+    /// the skeletons directly. The mixers are also timed with a compressed clip, whose keys decode
+    /// straight to rotations, and with three blended layers of compressed clips.
+    static void animation_mixer_benchmark(unsigned num_bones = 60, unsigned num_characters = 32, unsigned num_frames = 200) {
+      unsigned num_keys = 120;
+      dynarray<ref<scene_node> > nodes(num_characters * num_bones);
+      dynarray<ref<skeleton> > skeletons(num_characters);
+      dynarray<ref<animation_instance> > instances(num_characters);
+      dynarray<ref<animation_mixer> > mixers(num_characters), packed_mixers(num_characters), layered(num_characters);
+      ref<animation> shared = make_smooth_animation(num_bones, num_keys);
+      ref<animation> packed = make_smooth_animation(num_bones, num_keys);
+      ref<animation> breathe = make_smooth_animation(num_bones, num_keys);
+      packed->compress();
+      breathe->compress();
+      for (unsigned c = 0; c != num_characters; ++c) {
+        skeleton *skel = skeletons[c] = new skeleton();
+        scene_node **bones = (scene_node **)&nodes[c * num_bones];
+        for (unsigned b = 0; b != num_bones; ++b) {
+          nodes[c * num_bones + b] = new scene_node(mat4t(), (atom_t)b);
+          skel->add_bone(bones[b], b ? (b - 1) / 2 : -1);
+        }
+
+        // the old way needs an animation with this character's nodes as targets.
+        instances[c] = new animation_instance(make_smooth_animation(num_bones, num_keys, bones));
+        mixers[c] = new animation_mixer(skel);
+        mixers[c]->add_layer(shared);
+        packed_mixers[c] = new animation_mixer(skel);
+        packed_mixers[c]->add_layer(packed);
+
+        // legs, upper body at half weight and something additive on top.
+        animation_mixer *mixer = layered[c] = new animation_mixer(skel);
+        mixer->add_layer(packed);
+        dynarray<float> mask;
+        mixer->make_mask(mask, (atom_t)2);
+        mixer->add_layer(breathe, animation_layer::blend_override, 0.5f)->set_mask(mask);
+        mixer->add_layer(breathe, animation_layer::blend_additive, 0.5f);
+      }
+
+      printf("animation mixer benchmark: %d bones, %d characters, %d frames\n", num_bones, num_characters, num_frames);
+      printf("%-24s %12s %16s\n", "", "ms", "bones/s");
+
+      ref<animation_mixer> *mixer_sets[] = { 0, mixers.data(), packed_mixers.data(), layered.data() };
+      double times[4];
+      for (unsigned method = 0; method != 4; ++method) {
+        timer t;
+        for (unsigned f = 0; f != num_frames; ++f) {
+          for (unsigned c = 0; c != num_characters; ++c) {
+            if (method == 0) {
+              instances[c]->update(1.0f / 60);
+            } else {
+              mixer_sets[method][c]->update(1.0f / 60);
+            }
+          }
+        }
+        times[method] = t.get_seconds();
+      }
+
+      // at the keys, the two ways must agree.
+      ref<animation_instance> inst = instances[0];
+      ref<animation_mixer> mixer = new animation_mixer(skeletons[0]);
+      mixer->add_layer(shared);
+      float max_error = 0;
+      for (unsigned f = 0; f < num_keys - 1; f += 7) {
+        ref<animation_instance> check = new animation_instance((animation*)inst->get_anim());
+        check->update(f / 30.0f);
+        check->update(0);
+        mixer->get_layer(0)->set_time(f / 30.0f);
+        mixer->update(0);
+        for (unsigned b = 0; b != num_bones; ++b) {
+          const mat4t &a = nodes[b]->get_nodeToParent();
+          const mat4t &m = skeletons[0]->get_bone(b);
+          for (unsigned i = 0; i != 16; ++i) {
+            float error = fabsf(a[i >> 2][i & 3] - m[i >> 2][i & 3]);
+            if (error > max_error) max_error = error;
+          }
+        }
+      }
+
+      const char *names[] = { "animation_instance", "animation_mixer", "mixer, compressed", "compressed, 3 layers" };
+      for (unsigned method = 0; method != 4; ++method) {
+        printf("%-24s %12.3f %16.0f\n", names[method], times[method] * 1000, (double)num_bones * num_characters * num_frames / times[method]);
+      }
+      printf("speedup %.2fx (raw), %.2fx (compressed), max error %f%s\n", times[0] / times[1], times[0] / times[2], max_error, max_error < 1e-3f ? "" : " MISMATCH");
+    }
+
+    /// Compare skinning a mesh on the CPU on one thread and on the job threads with a plain
+    /// mat4t version. There are more joints than the old 192 uniform limit.
+    static void skinning_benchmark(unsigned num_vertices = 100000, unsigned num_joints = 300, unsigned num_frames = 20) {
+      struct skin_vertex {
+        vec3p pos;
+        vec3p normal;
+        vec2p uv;
+        float weights[3];
+        float indices[4];
+      };
+
+      ref<mesh> format = new mesh();
+      format->add_attribute(attribute_pos, 3, GL_FLOAT, 0);
+      format->add_attribute(attribute_normal, 3, GL_FLOAT, 12);
+      format->add_attribute(attribute_uv, 2, GL_FLOAT, 24);
+      format->add_attribute(attribute_blendweight, 3, GL_FLOAT, 32);
+      format->add_attribute(attribute_blendindices, 4, GL_FLOAT, 44);
+      format->set_params(sizeof(skin_vertex), 0, num_vertices, GL_TRIANGLES, 0);
+
+      // a random mesh with one to four joints for each vertex.
+      class random r(0x9e3779b9);
+      dynarray<skin_vertex> vertices(num_vertices);
+      for (unsigned i = 0; i != num_vertices; ++i) {
+        skin_vertex &v = vertices[i];
+        v.pos = vec3(r.get(-1.0f, 1.0f), r.get(-1.0f, 1.0f), r.get(-1.0f, 1.0f));
+        v.normal = normalize(vec3(r.get(-1.0f, 1.0f), r.get(-1.0f, 1.0f), 1.0f));
+        v.uv = vec2(0, 0);
+        unsigned num_influences = 1 + i % 4;
+        float total = 1;
+        for (unsigned j = 0; j != 3; ++j) {
+          float w = j + 1 < num_influences ? r.get(0.0f, total * 0.5f) : 0;
+          v.weights[j] = w;
+          total -= w;
+        }
+        for (unsigned j = 0; j != 4; ++j) {
+          v.indices[j] = (float)(j < num_influences ? r.get(0, (int)num_joints - 1) : 0);
+        }
+      }
+
+      dynarray<mat4t> joints(num_joints);
+      for (unsigned i = 0; i != num_joints; ++i) {
+        joints[i].loadIdentity();
+        joints[i].translate(r.get(-1.0f, 1.0f), r.get(-1.0f, 1.0f), r.get(-1.0f, 1.0f));
+        joints[i].rotateX(r.get(-90.0f, 90.0f));
+        joints[i].rotateY(r.get(-90.0f, 90.0f));
+      }
+
+      ref<cpu_skinner> skinner = new cpu_skinner();
+      skinner->init(format, vertices.data(), num_vertices);
+      dynarray<skin_vertex> reference(num_vertices);
+
+      printf("skinning benchmark: %d vertices, %d joints, %d frames\n", num_vertices, num_joints, num_frames);
+      printf("%-24s %12s %16s\n", "", "ms", "vertices/s");
+
+      double times[3];
+      for (unsigned method = 0; method != 3; ++method) {
+        timer t;
+        for (unsigned f = 0; f != num_frames; ++f) {
+          if (method == 0) {
+            for (unsigned i = 0; i != num_vertices; ++i) {
+              const skin_vertex &v = vertices[i];
+              float w0 = 1 - v.weights[0] - v.weights[1] - v.weights[2];
+              mat4t m = joints[(int)v.indices[0]] * w0 + joints[(int)v.indices[1]] * v.weights[0] + joints[(int)v.indices[2]] * v.weights[1] + joints[(int)v.indices[3]] * v.weights[2];
+              reference[i].pos = (vec4(v.pos, 1) * m).xyz();
+              reference[i].normal = (vec4(v.normal, 0) * m).xyz();
+            }
+          } else {
+            skinner->skin(joints.data(), num_joints, method == 2);
+          }
+        }
+        times[method] = t.get_seconds();
+      }
+
+      const skin_vertex *skinned = (const skin_vertex *)skinner->get_vertices();
+      float max_error = 0;
+      for (unsigned i = 0; i != num_vertices; ++i) {
+        float error = std::max(length(vec3(skinned[i].pos) - vec3(reference[i].pos)), length(vec3(skinned[i].normal) - vec3(reference[i].normal)));
+        if (error > max_error) max_error = error;
+      }
+
+      const char *names[] = { "mat4t", "cpu_skinner, 1 thread", "cpu_skinner, jobs" };
+      for (unsigned method = 0; method != 3; ++method) {
+        printf("%-24s %12.3f %16.0f\n", names[method], times[method] * 1000, (double)num_vertices * num_frames / times[method]);
+      }
+      printf("speedup %.2fx (1 thread), %.2fx (jobs), max error %f%s\n", times[0] / times[1], times[0] / times[2], max_error, max_error < 1e-4f ? "" : " MISMATCH");
+    }
+
+    /// Compare posing a crowd of skinned characters the old way (one at a time, skin matrices
+    /// multiplied every frame) with skeleton::calc_skins() on one thread and on the job threads.
+    static void skeleton_benchmark(unsigned num_characters = 200, unsigned num_bones = 60, unsigned num_frames = 100) {
+      dynarray<ref<scene_node> > nodes(num_characters * num_bones);
+      dynarray<ref<skeleton> > skeletons(num_characters);
+      dynarray<unsigned> bindings(num_characters);
+
+      // one skin for everyone, with its joints in a different order to the skeleton's.
+      class random r(0x2545f491);
+      ref<skin> skn = new skin(mat4t().translate(0, -1, 0));
+      for (unsigned j = 0; j != num_bones; ++j) {
+        mat4t bindToModel;
+        bindToModel.translate(0, -(float)j, 0);
+        skn->add_joint(bindToModel, (atom_t)(num_bones - 1 - j));
+      }
+
+      for (unsigned c = 0; c != num_characters; ++c) {
+        skeleton *skel = skeletons[c] = new skeleton();
+        for (unsigned b = 0; b != num_bones; ++b) {
+          mat4t nodeToParent;
+          nodeToParent.translate(0, 1, 0);
+          nodeToParent.rotateZ(r.get(-30.0f, 30.0f));
+          nodes[c * num_bones + b] = new scene_node(nodeToParent, (atom_t)b);
+          skel->add_bone(nodes[c * num_bones + b], b ? (b - 1) / 2 : -1);
+        }
+        bindings[c] = skel->bind_skin(skn);
+      }
+
+      printf("skeleton benchmark: %d characters, %d bones, %d frames\n", num_characters, num_bones, num_frames);
+      printf("%-24s %12s %16s\n", "", "ms", "joints/s");
+
+      dynarray<mat4t> boneToNode;
+      dynarray<dynarray<mat4t> *> old_results(num_characters);
+      dynarray<dynarray<int> *> old_indices(num_characters);
+      for (unsigned c = 0; c != num_characters; ++c) {
+        old_results[c] = new dynarray<mat4t>();
+        old_indices[c] = new dynarray<int>();
+      }
+
+      double times[3];
+      for (unsigned method = 0; method != 3; ++method) {
+        timer t;
+        for (unsigned f = 0; f != num_frames; ++f) {
+          if (method == 0) {
+            for (unsigned c = 0; c != num_characters; ++c) {
+              old_calc_transforms(skeletons[c], (scene_node **)&nodes[c * num_bones], skn, boneToNode, *old_results[c], *old_indices[c]);
+            }
+          } else if (method == 1) {
+            for (unsigned c = 0; c != num_characters; ++c) {
+              skeletons[c]->calc_skins();
+            }
+          } else {
+            ref<skeleton> *skels = skeletons.data();
+            job_scheduler::get().parallel_for(0, num_characters, 4, [skels](unsigned begin, unsigned end) {
+              for (unsigned c = begin; c != end; ++c) {
+                skels[c]->calc_skins();
+              }
+            });
+          }
+        }
+        times[method] = t.get_seconds();
+      }
+
+      float max_error = 0;
+      for (unsigned c = 0; c != num_characters; ++c) {
+        const mat4t *joints = skeletons[c]->get_skin_transforms(bindings[c]);
+        for (unsigned j = 0; j != num_bones; ++j) {
+          const mat4t &a = (*old_results[c])[j];
+          for (unsigned i = 0; i != 16; ++i) {
+            float error = fabsf(a[i >> 2][i & 3] - joints[j][i >> 2][i & 3]);
+            if (error > max_error) max_error = error;
+          }
+        }
+        delete old_results[c];
+        delete old_indices[c];
+      }
+
+      const char *names[] = { "calc_transforms (old)", "calc_skins, 1 thread", "calc_skins, jobs" };
+      for (unsigned method = 0; method != 3; ++method) {
+        printf("%-24s %12.3f %16.0f\n", names[method], times[method] * 1000, (double)num_bones * num_characters * num_frames / times[method]);
+      }
+      printf("speedup %.2fx (1 thread), %.2fx (jobs), max error %f%s\n", times[0] / times[1], times[0] / times[2], max_error, max_error < 1e-3f ? "" : " MISMATCH");
+    }
+  };
+} }
+
@@ -48,8 +48,9 @@ namespace octet { namespace helpers {
         }
         player_node->set_friction(friction);
 
-        mat4t &camera_to_world = camera_node->access_nodeToParent();
+        mat4t camera_to_world = camera_node->get_nodeToParent();
         camera_to_world.w() = (player_node->get_position() + vec3(0, 1.25f , 0) ).xyz1();
+        camera_node->set_nodeToParent(camera_to_world);
       #endif
     }
   };
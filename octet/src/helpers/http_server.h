@@ -32,35 +32,38 @@ namespace octet { namespace helpers {
     }
 
     void parse_http_request(session &s, char *p) {
-      string header(p);
+      string_view header(p);
 
-      dynarray<string> lines;
+      dynarray<string_view> lines;
       lines.reserve(32);
       header.split(lines, "\n");
       if (lines.size() == 0) return;
 
-      dynarray<string> line0;
+      dynarray<string_view> line0;
       lines[0].split(line0, " ");
       if (line0.size() < 3) return;
       if (line0[0] != "GET") return;
 
-      log("http get from: %s\n", line0[1].c_str());
+      log("http get from: %.*s\n", line0[1].size(), line0[1].data());
 
       // /graph?operation=get_children&id=1
-      dynarray<string> url;
+      dynarray<string_view> url;
       line0[1].split(url, "?");
       if (url.size() < 2) return;
 
-      dynarray<string> ops;
+      dynarray<string_view> ops;
       url[1].split(ops, "&");
       string id;
       string callback;
       bool get_children = false;
+      bool get_alloc_stats = false;
+      dynarray<string_view> lhsrhs;
       for (unsigned i = 0; i != ops.size(); ++i) {
-        dynarray<string> lhsrhs;
         ops[i].split(lhsrhs, "=");
+        if (lhsrhs.size() < 2) continue;
         if (lhsrhs[0] == "operation") {
           get_children = lhsrhs[1] == "get_children";
+          get_alloc_stats = lhsrhs[1] == "get_alloc_stats";
         } else if (lhsrhs[0] == "id") {
           id = lhsrhs[1];
         } else if (lhsrhs[0] == "callback") {
@@ -69,6 +72,14 @@ namespace octet { namespace helpers {
         //log("%s = %s\n", lhsrhs[0].c_str(), lhsrhs[1].c_str());
       }
 
+      if (get_alloc_stats) {
+        // /graph?operation=get_alloc_stats
+        dynarray<string> response;
+        write_alloc_stats(response, callback);
+        send_response(s, response);
+        return;
+      }
+
       if (!get_children) return;
 
       //dynarray<string> id_parts;
@@ -84,6 +95,39 @@ namespace octet { namespace helpers {
       response.resize(response.size()+1);
       response.back().format("])\n");
 
+      send_response(s, response);
+    }
+
+    // allocator totals and per-type counters as JSON
+    void write_alloc_stats(dynarray<string> &response, const string &callback) {
+      allocator::stats_t stats;
+      allocator::get_stats(stats);
+      response.resize(response.size()+1);
+      response.back().format(
+        "%s({ \"bytes\": %u, \"peak_bytes\": %u, \"blocks\": %u, \"total_allocs\": %u, "
+        "\"frame_allocs\": %u, \"frame_bytes\": %u, \"internal_fragmentation\": %f, \"external_fragmentation\": %f, \"counters\": [\n",
+        callback.c_str(), (unsigned)stats.num_bytes, (unsigned)stats.peak_bytes, stats.num_allocs, stats.total_allocs,
+        stats.last_frame_allocs, (unsigned)stats.last_frame_bytes,
+        stats.get_internal_fragmentation(), stats.get_external_fragmentation()
+      );
+      const char *separator = " ";
+      for (alloc_stats::counter_t *c = alloc_stats::get_first(); c; c = c->next) {
+        alloc_stats::counter_t::counts_t counts = c->get_counts();
+        if (counts.total_allocs) {
+          char tmp[256];
+          response.resize(response.size()+1);
+          response.back().format(
+            " %s{ \"kind\": \"%s\", \"name\": \"%s\", \"bytes\": %u, \"peak_bytes\": %u, \"blocks\": %u, \"total_allocs\": %u }\n",
+            separator, c->kind, c->get_name(tmp, sizeof(tmp)), (unsigned)counts.num_bytes, (unsigned)counts.peak_bytes, counts.num_allocs, counts.total_allocs
+          );
+          separator = ",";
+        }
+      }
+      response.resize(response.size()+1);
+      response.back().format("]})\n");
+    }
+
+    void send_response(session &s, dynarray<string> &response) {
       // With HTTP 1.1 we can keep the connection open and respond to more
       // feeds without the overhead of a new connection.
       unsigned num_bytes = 0;
@@ -11,10 +11,16 @@ namespace octet { namespace helpers {
   class object_picker {
     app *the_app;
     dynarray<ref<mesh_instance> > objects;
+    ref<mesh_instance> picked;
   public:
     object_picker() {
     }
 
+    /// get the mesh instance under the mouse at the last click (or null).
+    mesh_instance *get_picked() const {
+      return picked;
+    }
+
     void init(app *the_app) {
       this->the_app = the_app;
     }
@@ -37,8 +43,10 @@ namespace octet { namespace helpers {
         ray the_ray = cam->get_ray(x, y);
         //the_scene->add_debug_line(the_ray.get_start(), the_ray.get_end());
 
+        // cast_ray uses the scene's bvh, so this is quick even for large scenes.
         visual_scene::cast_result res;
         the_scene->cast_ray(res, the_ray);
+        picked = res.mi;
         if (res.mi) {
           //printf("%s\n", res.depth.toString());
         }
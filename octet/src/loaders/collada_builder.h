@@ -32,6 +32,9 @@ namespace octet { namespace loaders {
     dictionary<TiXmlElement *, allocator> ids;
     dynarray<float> temp_floats;
 
+    // greatest error allowed when compressing animations, 0 = do not compress.
+    float animation_tolerance;
+
     // find all the ids in an xml file
     void find_ids(TiXmlElement *parent) {
       for (TiXmlElement *elem = parent->FirstChildElement(); elem; elem = elem->NextSiblingElement()) {
@@ -101,69 +104,26 @@ namespace octet { namespace loaders {
     }
 
     // convert a string like "1.2 3.4 43.12" into an array of float values
-    void atofv(dynarray<float> &values, const char *src) {  
+    void atofv(dynarray<float> &values, const char *src) {
       values.resize(0);
       if (!src) return;
-
-      while (*src > 0 && *src <= ' ') ++src;
-      while(*src != 0) {
-        double whole = 0, msign = 1;
-        if (*src == '-') { msign = -1; src++; }
-        if( !(*src >= '0' && *src <= '9') && *src != '.' ) break;
-        while (*src >= '0' && *src <= '9') whole = whole * 10 + (*src++ - '0');
-        if (*src == '.') {
-          src++;
-          double frac = 0, v = 1;
-          while (*src >= '0' && *src <= '9') { frac = frac * 10 + (*src++ - '0'); v *= 10; }
-          whole += frac / v;
-        }
-        if (*src == 'e' || *src == 'E') {
-          int esign = 1;
-          src++;
-          if (*src == '-') { esign = -1; src++; }
-          else if (*src == '+') src++;
-          int exp = 0;
-          while (*src >= '0' && *src <= '9') { exp = exp * 10 + (*src++ - '0'); }
-          whole = whole * pow(10.0, exp * esign);
-        }
-        values.push_back((float)(whole * msign));
-        while (*src > 0 && *src <= ' ') ++src;
-      }
+      number_parser::parse_floats(values, src);
     }
 
     // convert an ascii sequence of integers like "1 3 9 12 34" to an array of integers
-    void atoiv(dynarray<int> &values, const char *src) {  
-      //values.resize(0);
+    void atoiv(dynarray<int> &values, const char *src) {
       if (!src) return;
-
-      while (*src > 0 && *src <= ' ') ++src;
-      while(*src != 0) {
-        int whole = 0, msign = 1;
-        if (*src == '-') { msign = -1; src++; }
-        while (*src >= '0' && *src <= '9') whole = whole * 10 + (*src++ - '0');
-        values.push_back(whole * msign);
-        while (*src > 0 && *src <= ' ') ++src;
-      }
+      number_parser::parse_ints(values, src);
     }
 
-    // convert an ascii sequence of integers like "fred bert harry" into an array of strings
+    // convert an ascii sequence of names like "fred bert harry" into an array of strings
     void atonv(dynarray<string> &values, const char *src) {
       values.resize(0);
       if (!src) return;
 
-      while (*src != 0 && *src <= ' ') ++src;
-      while(*src != 0) {
-        int index = (int)values.size();
-        values.resize(index + 1);
-        char tmp[128];
-        int i = 0;
-        while (*src != 0 && *src != ' ') {
-          if (i < sizeof(tmp)-1) tmp[i++] = *src;
-          src++;
-        }
-        tmp[i] = 0;
-        values[index] = tmp;
-        while (*src != 0 && *src <= ' ') ++src;
+      string_view text(src), token;
+      while (text.pop_token(token)) {
+        values.push_back(string(token));
       }
     }
 
@@ -807,6 +767,10 @@ namespace octet { namespace loaders {
             anim->add_channel(target, node_sid, sub_target_sid, component_sid, times, values);
           }
         }
+
+        if (animation_tolerance > 0) {
+          anim->compress(animation_tolerance);
+        }
       }
     }
 
@@ -850,7 +814,7 @@ namespace octet { namespace loaders {
       for (int ni = 0; ni != node_elems.size(); ++ni) {
         TiXmlElement *node_elem = node_elems[ni];
         scene_node *node = nodes[ni];
-        mat4t &matrix = node->access_nodeToParent();
+        mat4t matrix;
         matrix.loadIdentity();
 
         for (TiXmlElement *child = node_elem->FirstChildElement(); child != NULL; child = child->NextSiblingElement()) {
@@ -883,6 +847,7 @@ namespace octet { namespace loaders {
             }
           }
         }
+        node->set_nodeToParent(matrix);
       }
     }
 
@@ -1211,6 +1176,12 @@ namespace octet { namespace loaders {
 
   public:
     collada_builder() {
+      animation_tolerance = 0;
+    }
+
+    /// Compress animations as they load (see animation::compress()). 0, the default, keeps the floats.
+    void set_animation_tolerance(float value) {
+      animation_tolerance = value;
     }
 
     // public function to load a collada file
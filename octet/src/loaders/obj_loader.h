@@ -25,9 +25,9 @@ namespace octet { namespace loaders {
       material_index = 0;
       
       for (const uint8_t *src = file.data(); src != eof; ) {
-        while (*src == ' ' && src != eof) ++src;
+        while (src != eof && *src == ' ') ++src;
         const uint8_t *begin = src;
-        while (*src != '\n' && *src != '\r' && src != eof) ++src;
+        while (src != eof && *src != '\n' && *src != '\r') ++src;
         const uint8_t *end = src;
         src += src != eof && *src == '\r';
         src += src != eof && *src == '\n';
@@ -175,49 +175,28 @@ namespace octet { namespace loaders {
     dynarray<int> ivalues;
     uint32_t material_index;
 
-    // convert an ascii sequence of integers like "1 3 9 12 34" to an array of integers
+    // convert an ascii sequence of integers like "1/2/3 4/5/6" to an array of integers
     void atoiv(dynarray<int> &values, unsigned &slashes, const uint8_t *src, const uint8_t *end) {
       values.resize(0);
       slashes = 0;
 
-      while (src != end && *src > 0 && *src <= ' ') ++src;
-      while(src != end) {
-        int whole = 0, msign = 1;
-        if (src != end && *src == '-') { msign = -1; src++; }
-        while (src != end && *src >= '0' && *src <= '9') whole = whole * 10 + (*src++ - '0');
-        values.push_back(whole * msign);
-        while (src != end && *src > 0 && *src <= ' ') ++src;
-        if (src != end && *src == '/') { slashes++; src++; }
+      const char *p = (const char*)src, *e = (const char*)end;
+      while (p != e && *p > 0 && *p <= ' ') ++p;
+      while (p != e) {
+        // missing indices (as in "1//3") become zero
+        int value = 0;
+        bool is_number = number_parser::parse_int(p, e, value);
+        if (!is_number && *p != '/') break;
+        values.push_back(value);
+        while (p != e && *p > 0 && *p <= ' ') ++p;
+        if (p != e && *p == '/') { slashes++; p++; }
       }
     }
 
+    // convert an ascii sequence of floats like "1.2 3.4 43.12" to an array of floats
     void atofv(dynarray<float> &values, const uint8_t *src, const uint8_t *end) {
       values.resize(0);
-
-      while (*src > 0 && *src <= ' ') ++src;
-      while(src != end) {
-        double whole = 0, msign = 1;
-        if (*src == '-') { msign = -1; src++; }
-        if( !(*src >= '0' && *src <= '9') && *src != '.' ) break;
-        while (*src >= '0' && *src <= '9') whole = whole * 10 + (*src++ - '0');
-        if (*src == '.') {
-          src++;
-          double frac = 0, v = 1;
-          while (*src >= '0' && *src <= '9') { frac = frac * 10 + (*src++ - '0'); v *= 10; }
-          whole += frac / v;
-        }
-        if (*src == 'e' || *src == 'E') {
-          int esign = 1;
-          src++;
-          if (*src == '-') { esign = -1; src++; }
-          else if (*src == '+') src++;
-          int exp = 0;
-          while (*src >= '0' && *src <= '9') { exp = exp * 10 + (*src++ - '0'); }
-          whole = whole * pow(10.0, exp * esign);
-        }
-        values.push_back((float)(whole * msign));
-        while (*src > 0 && *src <= ' ') ++src;
-      }
+      number_parser::parse_floats(values, string_view((const char*)src, (const char*)end));
     }
 
     void flush() {
@@ -0,0 +1,425 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Bounding volume hierarchy for ray casting
+//
+
+namespace octet { namespace math {
+  /// Bounding volume hierarchy: a binary tree of boxes around items (such as mesh instances).
+  ///
+  /// Ray casts only look at items whose boxes the ray passes through, nearest first,
+  /// so they take roughly log(n) time instead of n.
+  /// When the items move, refit() updates the boxes without changing the tree.
+  /// This is fine for small movements, but rebuild the tree if things move a long way.
+  ///
+  /// build() splits at the median, which is quick and good for things that move.
+  /// build_sah() uses the surface area heuristic, which is slower to build but gives
+  /// faster ray casts for static geometry such as the triangles of a mesh.
+  ///
+  /// Example:
+  ///
+  ///     bvh<mesh_instance*> tree;
+  ///     tree.build(instances.data(), bounds.data(), instances.size());
+  ///     tree.cast(the_ray, 1.0f, [&](mesh_instance *mi, float &t_max) {
+  ///       // test the mesh, reduce t_max for a hit, return true to stop.
+  ///       return false;
+  ///     });
+  template <class item_t> class bvh {
+  public:
+    /// A box in the tree (32 bytes). Inner nodes have two children at first and first + 1.
+    /// Leaf nodes have count items starting at first.
+    struct node_t {
+      float bb_min[3];
+      uint32_t first;
+      float bb_max[3];
+      uint32_t count;
+
+      bool is_leaf() const {
+        return count != 0;
+      }
+
+      aabb get_aabb() const {
+        vec3 lo(bb_min[0], bb_min[1], bb_min[2]);
+        vec3 hi(bb_max[0], bb_max[1], bb_max[2]);
+        return aabb((lo + hi) * 0.5f, (hi - lo) * 0.5f);
+      }
+
+      void set_aabb(const aabb &bb) {
+        vec3 lo = bb.get_min(), hi = bb.get_max();
+        bb_min[0] = lo.x(); bb_min[1] = lo.y(); bb_min[2] = lo.z();
+        bb_max[0] = hi.x(); bb_max[1] = hi.y(); bb_max[2] = hi.z();
+      }
+
+      void set_empty() {
+        for (int i = 0; i != 3; ++i) {
+          bb_min[i] = 1e37f;
+          bb_max[i] = -1e37f;
+        }
+      }
+
+      void add(const node_t &rhs) {
+        for (int i = 0; i != 3; ++i) {
+          bb_min[i] = rhs.bb_min[i] < bb_min[i] ? rhs.bb_min[i] : bb_min[i];
+          bb_max[i] = rhs.bb_max[i] > bb_max[i] ? rhs.bb_max[i] : bb_max[i];
+        }
+      }
+
+      float get_center(int axis) const {
+        return bb_min[axis] + bb_max[axis];
+      }
+
+      // half the surface area
+      float get_area() const {
+        float dx = bb_max[0] - bb_min[0], dy = bb_max[1] - bb_min[1], dz = bb_max[2] - bb_min[2];
+        return dx < 0 ? 0 : dx * dy + dy * dz + dz * dx;
+      }
+    };
+
+  private:
+    enum {
+      num_bins = 16,
+
+      // below this depth, use median splits so that the tree depth is bounded.
+      max_sah_depth = 40,
+
+      max_stack = 128
+    };
+
+    // a ray in the form used by the box test.
+    struct ray_data {
+      float org[4];
+      float inv_dir[4];
+    };
+
+    // nodes[0] is the root. Children are always after their parents.
+    dynarray<node_t> nodes;
+
+    // items in leaf order
+    dynarray<item_t> items;
+
+    // item boxes in leaf order, from build() and refit()
+    dynarray<node_t> item_bounds;
+
+    // entry distance of a ray (org + dir * t) into a box or -1 if it misses between 0 and t_max.
+    static float intersect(const node_t &node, const ray_data &r, float t_max) {
+      #if OCTET_SSE
+        __m128 org = _mm_loadu_ps(r.org);
+        __m128 inv_dir = _mm_loadu_ps(r.inv_dir);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.bb_min), org), inv_dir);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.bb_max), org), inv_dir);
+
+        // the fourth lanes hold first and count, so replace them with x.
+        __m128 lo = _mm_min_ps(t0, t1), hi = _mm_max_ps(t0, t1);
+        lo = _mm_shuffle_ps(lo, lo, _MM_SHUFFLE(0, 2, 1, 0));
+        hi = _mm_shuffle_ps(hi, hi, _MM_SHUFFLE(0, 2, 1, 0));
+        lo = _mm_max_ps(lo, _mm_shuffle_ps(lo, lo, _MM_SHUFFLE(2, 3, 0, 1)));
+        lo = _mm_max_ps(lo, _mm_shuffle_ps(lo, lo, _MM_SHUFFLE(1, 0, 3, 2)));
+        hi = _mm_min_ps(hi, _mm_shuffle_ps(hi, hi, _MM_SHUFFLE(2, 3, 0, 1)));
+        hi = _mm_min_ps(hi, _mm_shuffle_ps(hi, hi, _MM_SHUFFLE(1, 0, 3, 2)));
+        lo = _mm_max_ss(lo, _mm_setzero_ps());
+        hi = _mm_min_ss(hi, _mm_set_ss(t_max));
+        float t_near = _mm_cvtss_f32(lo);
+        return _mm_comile_ss(lo, hi) ? t_near : -1.0f;
+      #else
+        float t_near = 0, t_far = t_max;
+        for (int i = 0; i != 3; ++i) {
+          float t0 = (node.bb_min[i] - r.org[i]) * r.inv_dir[i];
+          float t1 = (node.bb_max[i] - r.org[i]) * r.inv_dir[i];
+          if (t0 > t1) { float t = t0; t0 = t1; t1 = t; }
+          t_near = t0 > t_near ? t0 : t_near;
+          t_far = t1 < t_far ? t1 : t_far;
+        }
+        return t_near <= t_far ? t_near : -1.0f;
+      #endif
+    }
+
+    // split the items in nodes[index] in two at the median of their centers on the longest axis.
+    unsigned split_median(unsigned first, unsigned count, dynarray<unsigned> &order) {
+      float lo[3] = { 1e37f, 1e37f, 1e37f }, hi[3] = { -1e37f, -1e37f, -1e37f };
+      for (unsigned i = first; i != first + count; ++i) {
+        const node_t &b = item_bounds[order[i]];
+        for (int j = 0; j != 3; ++j) {
+          float c = b.get_center(j);
+          lo[j] = c < lo[j] ? c : lo[j];
+          hi[j] = c > hi[j] ? c : hi[j];
+        }
+      }
+      int axis = 0;
+      for (int j = 1; j != 3; ++j) {
+        if (hi[j] - lo[j] > hi[axis] - lo[axis]) axis = j;
+      }
+
+      unsigned half = count / 2;
+      const dynarray<node_t> &bounds = item_bounds;
+      std::nth_element(
+        order.data() + first, order.data() + first + half, order.data() + first + count,
+        [&bounds, axis](unsigned a, unsigned b) {
+          return bounds[a].get_center(axis) < bounds[b].get_center(axis);
+        }
+      );
+      return half;
+    }
+
+    // split the items in two where the surface area heuristic says a ray cast costs least.
+    // Items are sorted into bins by their centers, and each bin boundary is tried.
+    unsigned split_sah(unsigned first, unsigned count, dynarray<unsigned> &order) {
+      node_t centers;
+      centers.set_empty();
+      for (unsigned i = first; i != first + count; ++i) {
+        const node_t &b = item_bounds[order[i]];
+        for (int j = 0; j != 3; ++j) {
+          float c = b.get_center(j);
+          centers.bb_min[j] = c < centers.bb_min[j] ? c : centers.bb_min[j];
+          centers.bb_max[j] = c > centers.bb_max[j] ? c : centers.bb_max[j];
+        }
+      }
+
+      float best_cost = 1e37f;
+      int best_axis = -1, best_bin = 0;
+      for (int axis = 0; axis != 3; ++axis) {
+        float extent = centers.bb_max[axis] - centers.bb_min[axis];
+        if (extent <= 0) continue;
+        float scale = num_bins / extent;
+
+        node_t bins[num_bins];
+        unsigned bin_counts[num_bins] = { 0 };
+        for (int b = 0; b != num_bins; ++b) bins[b].set_empty();
+        for (unsigned i = first; i != first + count; ++i) {
+          const node_t &bb = item_bounds[order[i]];
+          int b = (int)((bb.get_center(axis) - centers.bb_min[axis]) * scale);
+          b = b < num_bins - 1 ? b : num_bins - 1;
+          bins[b].add(bb);
+          bin_counts[b]++;
+        }
+
+        // sweep from the right to get the cost of everything above each boundary...
+        float right_cost[num_bins];
+        node_t right;
+        right.set_empty();
+        unsigned right_count = 0;
+        for (int b = num_bins - 1; b != 0; --b) {
+          right.add(bins[b]);
+          right_count += bin_counts[b];
+          right_cost[b] = right.get_area() * right_count;
+        }
+
+        // ...then from the left to add the cost of everything below.
+        node_t left;
+        left.set_empty();
+        unsigned left_count = 0;
+        for (int b = 0; b != num_bins - 1; ++b) {
+          left.add(bins[b]);
+          left_count += bin_counts[b];
+          if (left_count == 0 || left_count == count) continue;
+          float cost = left.get_area() * left_count + right_cost[b + 1];
+          if (cost < best_cost) {
+            best_cost = cost;
+            best_axis = axis;
+            best_bin = b + 1;
+          }
+        }
+      }
+
+      // all the centers are in the same place: any split will do.
+      if (best_axis < 0) {
+        return count / 2;
+      }
+
+      float scale = num_bins / (centers.bb_max[best_axis] - centers.bb_min[best_axis]);
+      float split_min = centers.bb_min[best_axis];
+      const dynarray<node_t> &bounds = item_bounds;
+      unsigned *mid = std::partition(
+        order.data() + first, order.data() + first + count,
+        [&bounds, best_axis, scale, split_min, best_bin](unsigned a) {
+          int b = (int)((bounds[a].get_center(best_axis) - split_min) * scale);
+          return (b < num_bins - 1 ? b : num_bins - 1) < best_bin;
+        }
+      );
+      unsigned num_left = (unsigned)(mid - (order.data() + first));
+      return num_left == 0 || num_left == count ? count / 2 : num_left;
+    }
+
+    // build the tree top down with one of the split functions.
+    void build_tree(const item_t *new_items, const aabb *bounds, unsigned num_items, unsigned max_leaf_items, bool use_sah) {
+      nodes.resize(0);
+      items.resize(0);
+      item_bounds.resize(0);
+      if (num_items == 0) return;
+      if (max_leaf_items < 1) max_leaf_items = 1;
+
+      // split_*() look at item_bounds through order[].
+      dynarray<unsigned> order(num_items);
+      item_bounds.resize(num_items);
+      for (unsigned i = 0; i != num_items; ++i) {
+        item_bounds[i].set_aabb(bounds[i]);
+        order[i] = i;
+      }
+
+      dynarray<uint8_t> depth;
+      nodes.reserve(num_items * 2);
+      nodes.resize(1);
+      depth.push_back(0);
+      nodes[0].first = 0;
+      nodes[0].count = num_items;
+      for (unsigned i = 0; i != nodes.size(); ++i) {
+        unsigned first = nodes[i].first, count = nodes[i].count;
+        if (count <= max_leaf_items) continue;
+
+        bool sah = use_sah && depth[i] < max_sah_depth;
+        unsigned num_left = sah ? split_sah(first, count, order) : split_median(first, count, order);
+
+        unsigned child = nodes.size();
+        nodes.resize(child + 2);
+        nodes[child].first = first;
+        nodes[child].count = num_left;
+        nodes[child+1].first = first + num_left;
+        nodes[child+1].count = count - num_left;
+        nodes[i].first = child;
+        nodes[i].count = 0;
+        uint8_t d = (uint8_t)(depth[i] + 1);
+        depth.push_back(d);
+        depth.push_back(d);
+      }
+
+      // put the items in leaf order.
+      dynarray<node_t> unsorted_bounds(std::move(item_bounds));
+      items.resize(num_items);
+      item_bounds.resize(num_items);
+      for (unsigned i = 0; i != num_items; ++i) {
+        items[i] = new_items[order[i]];
+        item_bounds[i] = unsorted_bounds[order[i]];
+      }
+      update_nodes();
+    }
+
+    // recompute the boxes of the nodes from the item boxes.
+    void update_nodes() {
+      for (unsigned i = nodes.size(); i-- != 0; ) {
+        node_t &node = nodes[i];
+        unsigned first = node.first, count = node.count;
+        node.set_empty();
+        if (node.is_leaf()) {
+          for (unsigned j = first; j != first + count; ++j) {
+            node.add(item_bounds[j]);
+          }
+        } else {
+          node.add(nodes[first]);
+          node.add(nodes[first + 1]);
+        }
+      }
+    }
+
+  public:
+    bvh() {
+    }
+
+    /// Build the tree for some items and their bounding boxes, splitting at the median.
+    void build(const item_t *new_items, const aabb *bounds, unsigned num_items, unsigned max_leaf_items = 4) {
+      build_tree(new_items, bounds, num_items, max_leaf_items, false);
+    }
+
+    /// Build the tree for some items and their bounding boxes using the surface area heuristic.
+    void build_sah(const item_t *new_items, const aabb *bounds, unsigned num_items, unsigned max_leaf_items = 4) {
+      build_tree(new_items, bounds, num_items, max_leaf_items, true);
+    }
+
+    /// Update the boxes after items have moved. get_bounds(item) returns an item's new aabb.
+    template <class bounds_fn_t> void refit(bounds_fn_t get_bounds) {
+      for (unsigned i = 0; i != items.size(); ++i) {
+        item_bounds[i].set_aabb(get_bounds(items[i]));
+      }
+      update_nodes();
+    }
+
+    /// Remove everything.
+    void reset() {
+      nodes.reset();
+      items.reset();
+      item_bounds.reset();
+    }
+
+    /// Get the box around all the items. Returns false if there are none.
+    bool get_bounds(aabb &result) const {
+      if (nodes.empty()) return false;
+      result = nodes[0].get_aabb();
+      return true;
+    }
+
+    /// number of items
+    unsigned size() const {
+      return items.size();
+    }
+
+    /// true if there are no items
+    bool empty() const {
+      return items.empty();
+    }
+
+    /// get an item (in leaf order)
+    const item_t &get_item(unsigned index) const {
+      return items[index];
+    }
+
+    /// access the nodes: nodes[0] is the root.
+    const dynarray<node_t> &get_nodes() const {
+      return nodes;
+    }
+
+    /// Visit the items whose boxes are crossed by the ray between start and start + distance * t_max,
+    /// nearer boxes first. fn(item, t_max) may reduce t_max to skip things further away
+    /// than a hit and returns true to stop early. Returns true if fn stopped.
+    ///
+    /// Note that ray's distance is the whole length of the ray, so t_max = 1 is the end.
+    template <class fn_t> bool cast(const ray &the_ray, float t_max, fn_t fn) const {
+      if (nodes.empty()) return false;
+
+      ray_data r;
+      vec3 start = the_ray.get_start(), dist = the_ray.get_distance();
+      for (int i = 0; i != 3; ++i) {
+        // a zero distance gives an infinite slab, which is what we want.
+        float d = dist[i];
+        r.org[i] = start[i];
+        r.inv_dir[i] = fabsf(d) > 1e-30f ? 1.0f / d : (d < 0 ? -1e30f : 1e30f);
+      }
+      r.org[3] = r.inv_dir[3] = 0;
+
+      struct entry_t { unsigned node; float t; };
+      entry_t stack[max_stack];
+      int sp = 0;
+
+      float t = intersect(nodes[0], r, t_max);
+      if (t < 0) return false;
+      stack[sp].node = 0;
+      stack[sp++].t = t;
+
+      while (sp) {
+        entry_t e = stack[--sp];
+        if (e.t > t_max) continue;
+        const node_t &node = nodes[e.node];
+        if (node.is_leaf()) {
+          for (unsigned i = node.first; i != node.first + node.count; ++i) {
+            if (intersect(item_bounds[i], r, t_max) >= 0 && fn(items[i], t_max)) {
+              return true;
+            }
+          }
+        } else {
+          // push the further child first so that the nearer one is visited first.
+          unsigned n0 = node.first, n1 = node.first + 1;
+          float t0 = intersect(nodes[n0], r, t_max);
+          float t1 = intersect(nodes[n1], r, t_max);
+          if (t1 >= 0 && (t0 < 0 || t1 < t0)) {
+            float tt = t0; t0 = t1; t1 = tt;
+            unsigned nn = n0; n0 = n1; n1 = nn;
+          }
+          // the depth of the tree is limited by build_tree(), so the stack can not overflow.
+          if (t1 >= 0) { stack[sp].node = n1; stack[sp++].t = t1; }
+          if (t0 >= 0) { stack[sp].node = n0; stack[sp++].t = t0; }
+        }
+      }
+      return false;
+    }
+  };
+} }
@@ -0,0 +1,141 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// View frustum for culling
+//
+
+namespace octet { namespace math {
+  /// The six planes of a camera's view volume, used to skip objects that are off screen.
+  ///
+  /// The planes are kept in structure of arrays form, padded to eight, so that
+  /// an aabb can be tested against four planes at a time with SSE.
+  ///
+  /// Example:
+  ///
+  ///     frustum view(worldToProjection);
+  ///     if (view.intersects(bb)) {
+  ///       draw();
+  ///     }
+  class frustum {
+    // dot(normal, x) + offset >= 0 inside each plane.
+    // planes 6 and 7 are padding that everything is inside.
+    float nx[8];
+    float ny[8];
+    float nz[8];
+    float offset[8];
+
+    void set_plane(int i, const vec4 &p) {
+      float len = length(p.xyz());
+      float scale = len > 0 ? 1.0f / len : 0.0f;
+      nx[i] = p.x() * scale;
+      ny[i] = p.y() * scale;
+      nz[i] = p.z() * scale;
+      offset[i] = p.w() * scale;
+    }
+
+    void init_padding() {
+      for (int i = num_planes; i != 8; ++i) {
+        nx[i] = ny[i] = nz[i] = 0;
+        offset[i] = 1;
+      }
+    }
+
+  public:
+    /// plane numbers: the bit 1 << plane is used in masks.
+    enum { left, right, bottom, top, near_plane, far_plane, num_planes };
+
+    enum {
+      /// mask to test all the planes
+      all_planes = (1 << num_planes) - 1,
+
+      /// result of classify() for boxes completely outside a plane
+      outside = ~0u
+    };
+
+    /// A frustum that contains everything.
+    frustum() {
+      for (int i = 0; i != num_planes; ++i) {
+        set_plane(i, vec4(0, 0, 0, 1));
+      }
+      init_padding();
+    }
+
+    /// Extract the planes from a (world or model) to projection matrix.
+    /// The view volume is -w <= x, y, z <= w in projection space.
+    frustum(const mat4t &toProjection) {
+      // octet matrices multiply row vectors, so projection space x is dot(p, column(0)).
+      vec4 x = toProjection.column(0);
+      vec4 y = toProjection.column(1);
+      vec4 z = toProjection.column(2);
+      vec4 w = toProjection.column(3);
+      set_plane(left, w + x);
+      set_plane(right, w - x);
+      set_plane(bottom, w + y);
+      set_plane(top, w - y);
+      set_plane(near_plane, w + z);
+      set_plane(far_plane, w - z);
+      init_padding();
+    }
+
+    /// Get one of the planes. The normal points into the view volume.
+    half_space get_plane(int i) const {
+      return half_space(vec3(nx[i], ny[i], nz[i]), offset[i]);
+    }
+
+    /// Test a box against the planes in mask.
+    /// Returns outside if the box is completely outside one of them, otherwise
+    /// the mask of planes the box crosses. Zero means the box is completely inside,
+    /// so nothing contained in it needs testing again.
+    unsigned classify(const aabb &bb, unsigned mask = all_planes) const {
+      vec3 center = bb.get_center();
+      vec3 half = bb.get_half_extent();
+      #if OCTET_SSE
+        __m128 cx = _mm_set1_ps(center.x()), cy = _mm_set1_ps(center.y()), cz = _mm_set1_ps(center.z());
+        __m128 hx = _mm_set1_ps(half.x()), hy = _mm_set1_ps(half.y()), hz = _mm_set1_ps(half.z());
+        __m128 sign = _mm_set1_ps(-0.0f);
+        unsigned out_bits = 0, cross_bits = 0;
+        for (int i = 0; i != 8; i += 4) {
+          __m128 px = _mm_loadu_ps(nx + i), py = _mm_loadu_ps(ny + i), pz = _mm_loadu_ps(nz + i);
+
+          // distance from the plane to the center and the "radius" of the box along the normal
+          __m128 d = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(px, cx), _mm_mul_ps(py, cy)),
+            _mm_add_ps(_mm_mul_ps(pz, cz), _mm_loadu_ps(offset + i))
+          );
+          __m128 r = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(_mm_andnot_ps(sign, px), hx), _mm_mul_ps(_mm_andnot_ps(sign, py), hy)),
+            _mm_mul_ps(_mm_andnot_ps(sign, pz), hz)
+          );
+          __m128 zero = _mm_setzero_ps();
+          out_bits |= (unsigned)_mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(d, r), zero)) << i;
+          cross_bits |= (unsigned)_mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(d, r), zero)) << i;
+        }
+        return out_bits & mask ? (unsigned)outside : cross_bits & mask;
+      #else
+        unsigned result = 0;
+        for (unsigned bits = mask & all_planes; bits; bits &= bits - 1) {
+          int i = (int)bit_ops::find_first((uint32_t)bits);
+          float d = nx[i] * center.x() + ny[i] * center.y() + nz[i] * center.z() + offset[i];
+          float r = fabsf(nx[i]) * half.x() + fabsf(ny[i]) * half.y() + fabsf(nz[i]) * half.z();
+          if (d + r < 0) return outside;
+          if (d - r < 0) result |= 1 << i;
+        }
+        return result;
+      #endif
+    }
+
+    /// Is any part of the box inside the frustum?
+    /// (a box near a corner may pass without actually being inside)
+    bool intersects(const aabb &bb) const {
+      return classify(bb) != outside;
+    }
+
+    /// Is the point inside the frustum?
+    bool intersects(const vec3 &pos) const {
+      return classify(aabb(pos, vec3(0, 0, 0))) != outside;
+    }
+  };
+} }
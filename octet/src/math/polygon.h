@@ -10,7 +10,7 @@
 namespace octet { namespace math {
   /// Polygon: one polygon in 3d: vertices in a loop.
   class polygon {
-    dynarray<vec3p> vertices;
+    small_dynarray<vec3p, 16> vertices;
     unsigned ref_count;
   public:
     /// construct a new polygon with optional capacity
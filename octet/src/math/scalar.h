@@ -159,11 +159,7 @@ namespace octet { namespace math {
 
   /// return number of 1 bits
   inline static int pop_count(uint32_t v) {
-    v = (v & 0x55555555) + ((v>>1) & 0x55555555);
-    v = (v & 0x33333333) + ((v>>2) & 0x33333333);
-    v = (v & 0x0f0f0f0f) + ((v>>4) & 0x0f0f0f0f);
-    v = (v & 0x00ff00ff) + ((v>>8) & 0x00ff00ff);
-    return (v + (v>>16)) & 0xff;
+    return (int)bit_ops::pop_count(v);
   }
 
   /// count leading zeros. Examples: 0xffffffff -> 0, 0x00ffffff -> 8, 0x00000000 -> 32
@@ -22,6 +22,7 @@ namespace octet {
     attribute_blendindices = 7,
     attribute_texcoord = 8,
     attribute_uv = 8,
+    attribute_instance_modelToCamera = 9, // per instance matrix, uses 9 to 12
     attribute_tangent = 14,
     attribute_bitangent = 15,
     attribute_binormal = 15,
@@ -93,6 +94,9 @@ namespace octet {
       mouse_abs_x = mouse_abs_y = 0;
       is_gles3 = false;
       frame_number = 0;
+      #if OCTET_ALLOC_STATS
+        alloc_stats::dump_at_exit();
+      #endif
     }
 
     virtual ~app_common() {
@@ -106,6 +110,10 @@ namespace octet {
 
     void end_frame() {
       prev_keys = keys;
+
+      // recycle temporary memory used in this frame.
+      frame_allocator::reset();
+      allocator::end_frame();
     }
 
     virtual void draw_world(int x, int y, int w, int h) = 0;
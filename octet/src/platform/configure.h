@@ -26,6 +26,63 @@
   #define OCTET_OPENCL 0
 #endif
 
+// set to 0 to send all allocations to the system heap (eg. for memory debuggers)
+#ifndef OCTET_POOL_ALLOCATOR
+  #define OCTET_POOL_ALLOCATOR 1
+#endif
+
+// set to 0 to disable the per-type allocation counters (see alloc_stats)
+#ifndef OCTET_ALLOC_STATS
+  #define OCTET_ALLOC_STATS 1
+#endif
+
+// set to 1 to catch frame_allocator memory that is used after the end of the frame
+#ifndef OCTET_FRAME_ALLOCATOR_DEBUG
+  #define OCTET_FRAME_ALLOCATOR_DEBUG 0
+#endif
+
+// set to 1 to use thread safe reference counts for resources (see ref_count.h)
+#ifndef OCTET_ATOMIC_REFCOUNT
+  #define OCTET_ATOMIC_REFCOUNT 0
+#endif
+
+// set to 0 to remove the allocator lock if only one thread ever allocates (see allocator.h)
+#ifndef OCTET_THREAD_SAFE_ALLOCATOR
+  #define OCTET_THREAD_SAFE_ALLOCATOR 1
+#endif
+
+// number of worker threads started by the job scheduler (see job.h).
+// 0 means one for each core except the main thread's.
+#ifndef OCTET_JOB_THREADS
+  #define OCTET_JOB_THREADS 0
+#endif
+
+// set to 1 to use AVX2 for wide bit operations (see dynamic_bitset.h).
+// The cpu must support AVX2 and the compiler must target it (/arch:AVX2 or -mavx2).
+#ifndef OCTET_AVX2
+  #define OCTET_AVX2 0
+#endif
+
+// set to 0 to draw repeated meshes one at a time instead of with glDrawElementsInstanced.
+// Instancing needs OpenGL 3.1 or OpenGL ES 3.
+#ifndef OCTET_INSTANCING
+  #if OCTET_MAC
+    #define OCTET_INSTANCING 0
+  #else
+    #define OCTET_INSTANCING 1
+  #endif
+#endif
+
+// set to 0 to send material parameters with glUniform* instead of uniform buffer objects.
+// Uniform buffers need OpenGL 3.1 or GL_ARB_uniform_buffer_object (see uniform_ring.h).
+#ifndef OCTET_UNIFORM_BUFFERS
+  #if OCTET_MAC
+    #define OCTET_UNIFORM_BUFFERS 0
+  #else
+    #define OCTET_UNIFORM_BUFFERS 1
+  #endif
+#endif
+
 #if defined(WIN32)
   #define OCTET_SSE 1
   #pragma warning(disable : 4996)
@@ -55,11 +112,29 @@
 #include <iostream>
 #include <fstream>
 #include <cmath>
+#include <type_traits>
+#include <utility>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #if defined(WIN32)
   #include <direct.h>
 #endif
 
+#ifdef _MSC_VER
+  #include <intrin.h>
+#endif
+
+#if OCTET_SSE
+  #include <emmintrin.h>
+#endif
+
+#if OCTET_AVX2
+  #include <immintrin.h>
+#endif
+
 namespace octet {
   /// write some text to log.txt
   inline static FILE * log(const char *fmt, ...) {
@@ -223,22 +223,36 @@ namespace octet { namespace resources {
       if (name == 0 || name[0] == 0) {
         return atom_;
       }
+      return get_atom(istring(name));
+    }
+
+    /// Get the atom for an interned string.
+    /// The atom is cached in the interned string, so repeated lookups do not search the atom dictionary.
+    static atom_t get_atom(const istring &name) {
+      atom_t cached = (atom_t)name.get_atom();
+      if (cached != atom_ || name.empty()) {
+        return cached;
+      }
 
       dictionary<atom_t> *dict = get_atom_dict();
 
       static int num_atoms = 0;
       if (num_atoms == 0) {
         for (++num_atoms; predefined_atom(num_atoms); num_atoms++) {
-          (*dict)[predefined_atom(num_atoms)] = (atom_t)num_atoms;
+          (*dict)[istring(predefined_atom(num_atoms))] = (atom_t)num_atoms;
         }
       }
+
+      atom_t result;
       if (dict->contains(name)) {
         //log("old atom %s %d\n", name, (*dict)[name]);
-        return (*dict)[name];
+        result = (*dict)[name];
       } else {
         //log("new atom %s %d\n", name, num_atoms);
-        return (*dict)[name] = (atom_t)num_atoms++;
+        result = (*dict)[name] = (atom_t)num_atoms++;
       }
+      name.set_atom(result);
+      return result;
     }
 
     /// Get the text of a predefined atom (atom_*)
@@ -144,3 +144,16 @@ OCTET_ATOM(npos)
 OCTET_ATOM(diffuse_light)
 OCTET_ATOM(specular_light)
 OCTET_ATOM(first_index)
+OCTET_ATOM(meshes)
+OCTET_ATOM(materials)
+OCTET_ATOM(errors)
+OCTET_ATOM(packed)
+OCTET_ATOM(packed_channels)
+OCTET_ATOM(packed_ranges)
+OCTET_ATOM(layers)
+OCTET_ATOM(weight)
+OCTET_ATOM(speed)
+OCTET_ATOM(mask)
+OCTET_ATOM(animation_mixers)
+OCTET_ATOM(animation_layer)
+OCTET_ATOM(animation_mixer)
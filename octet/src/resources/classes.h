@@ -36,4 +36,8 @@ OCTET_CLASS(scene, mesh_voxel_grid)
 #endif
 OCTET_CLASS(scene, mesh_points)
 OCTET_CLASS(scene, mesh_cylinder)
+OCTET_CLASS(scene, lod_group)
+OCTET_CLASS(scene, transform_store)
+OCTET_CLASS(scene, joint_texture)
+OCTET_CLASS(scene, cpu_skinner)
 //OCTET_CLASS(scene, value)
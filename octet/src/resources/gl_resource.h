@@ -23,6 +23,9 @@ namespace octet { namespace resources {
     // GL_ARRAY_BUFFER etc.
     GLuint target;
 
+    // incremented every time the contents may have changed
+    mutable unsigned version;
+
   public:
     /// Helper class to make a write-only lock
     class wolock {
@@ -70,6 +73,10 @@ namespace octet { namespace resources {
     /// Make a new OpenGL Resource
     gl_resource(unsigned target=0, unsigned size=0) {
       buffer = 0;
+      version = 0;
+      #ifndef OCTET_GLES2
+        this->size = 0;
+      #endif
       this->target = target;
       if (size) {
         allocate(target, size);
@@ -82,6 +89,7 @@ namespace octet { namespace resources {
         v.visit(bytes, atom_bytes);
       #endif
       v.visit(target, atom_target);
+      version++;
     }
 
     /// Allocate a new OpenGL object.
@@ -101,11 +109,14 @@ namespace octet { namespace resources {
 
     /// Clear the OpenGL object
     void reset() {
+      version++;
       if (buffer != 0) {
         glDeleteBuffers(1, &buffer);
       }
       #ifdef OCTET_GLES2
         bytes.reset();
+      #else
+        size = 0;
       #endif
       buffer = 0;
     }
@@ -129,6 +140,12 @@ namespace octet { namespace resources {
       #endif
     }
 
+    /// Get a number that changes whenever the contents may have changed (after writing with a lock).
+    /// Use this to tell when data derived from the buffer is out of date.
+    unsigned get_version() const {
+      return version;
+    }
+
     /// get the GL buffer object we are wrapping.
     GLuint get_buffer() const {
       return buffer;
@@ -179,6 +196,7 @@ namespace octet { namespace resources {
     /// release a read-write lock
     /// deprecated
     void unlock() const {
+      version++;
       #ifdef OCTET_GLES2
         glBindBuffer(target, buffer);
         glBufferSubData(target, 0, bytes.size(), &bytes[0]);
@@ -206,6 +224,7 @@ namespace octet { namespace resources {
     /// release a read-write lock
     /// deprecated
     void unlock_write_only() const {
+      version++;
       #ifdef OCTET_GLES2
         glBindBuffer(target, buffer);
         glBufferSubData(target, 0, bytes.size(), &bytes[0]);
@@ -227,6 +246,24 @@ namespace octet { namespace resources {
       unlock_write_only();
     }
 
+    /// Replace the whole contents with size bytes, eg. vertices that change every frame.
+    /// The old storage is orphaned, so we do not wait for the GPU to finish drawing from it.
+    void stream(const void *ptr, size_t size) {
+      version++;
+      if (!buffer) glGenBuffers(1, &buffer);
+      if (!target) target = GL_ARRAY_BUFFER;
+      #ifdef OCTET_GLES2
+        bytes.resize(size);
+        memcpy(bytes.data(), ptr, size);
+      #else
+        this->size = size;
+      #endif
+      glBindBuffer(target, buffer);
+      glBufferData(target, size, NULL, GL_STREAM_DRAW);
+      glBufferSubData(target, 0, size, ptr);
+      glBindBuffer(target, 0);
+    }
+
     /// copy data from another gl resource.
     void copy(const gl_resource *rhs) {
       allocate(rhs->get_target(), rhs->get_size());
@@ -4,52 +4,390 @@
 //
 // Modular Framework for OpenGLES2 rendering on multiple platforms.
 //
-// work in progress
+// Jobs and a work-stealing job scheduler
+//
+// Each thread (the main thread and one worker per core) has its own queue of jobs.
+// A thread pushes and pops jobs at the back of its own queue, so recently made
+// jobs, whose data is still in the cache, run first. A thread with nothing to do
+// steals from the front of another thread's queue, where the oldest and usually
+// biggest pieces of work are.
+//
 
 namespace octet { namespace resources {
+  class job_scheduler;
+
+  /// A piece of work that can run on any thread.
+  ///
+  /// Derive from job and override kernel(), then give the job to job_scheduler::run().
+  /// A job is not finished until its kernel has run and all of its children have finished,
+  /// so waiting on a parent waits for a whole tree of work.
+  ///
+  /// Jobs are resources, but the scheduler does not add lives to them.
+  /// Keep a ref<> to a job (or keep it on the stack) until it has finished.
+  /// Reference counts are only thread safe with OCTET_ATOMIC_REFCOUNT, so without it
+  /// only the thread that made a job should change its ref<>s.
+  ///
+  /// Example:
+  ///
+  ///     class skin_job : public job {
+  ///       void kernel() { ... }
+  ///     };
+  ///
+  ///     ref<skin_job> jb = new skin_job();
+  ///     job_scheduler::get().run(jb);
+  ///     ... do something else ...
+  ///     job_scheduler::get().wait(jb);
   class job : public resource {
-    ref<job> next;
+    friend class job_scheduler;
+
+    // one for the kernel plus one for each unfinished child.
+    std::atomic<int> num_unfinished;
+
+    // state_waiting etc.
+    std::atomic<int> state;
+
+    // this job's parent is not finished until this job is.
+    job *parent;
 
+    job(const job &);
+    job &operator=(const job &);
+  public:
     enum state_t {
+      /// not given to the scheduler yet.
+      state_new,
+
+      /// in a queue.
       state_waiting,
+
+      /// the kernel is running or the job is waiting for its children.
       state_running,
+
+      /// the kernel and all the children have finished.
+      state_finished,
     };
 
-    state_t state;
+    job() : num_unfinished(1), state(state_new) {
+      parent = 0;
+    }
+
+    virtual ~job() {
+    }
+
+    /// Do the work. This is called once, on any thread.
+    /// Child jobs may be run from here with job_scheduler::run(child, this).
+    virtual void kernel() = 0;
+
+    /// where is this job in its life?
+    state_t get_state() const {
+      return num_unfinished.load(std::memory_order_acquire) == 0 ? state_finished : (state_t)state.load(std::memory_order_relaxed);
+    }
+
+    /// true when the kernel and all the children have finished.
+    /// Everything they wrote is visible to the thread that sees this return true.
+    bool is_finished() const {
+      return num_unfinished.load(std::memory_order_acquire) == 0;
+    }
+
+    /// the job that is waiting for this one, if any.
+    job *get_parent() const {
+      return parent;
+    }
+  };
 
-    class scheduler {
-      job *waiting;
-      job *running;
+  /// Runs jobs on all the cores.
+  ///
+  /// There is one scheduler, made on first use by get(), with OCTET_JOB_THREADS worker threads
+  /// (by default one for each core apart from the main thread's).
+  /// Threads that wait for a job run other jobs while they wait, so waiting
+  /// on the main thread also works with no worker threads at all.
+  ///
+  /// Example:
+  ///
+  ///     dynarray<float> values(1000000);
+  ///     job_scheduler::get().parallel_for(0, values.size(), 4096, [&](unsigned begin, unsigned end) {
+  ///       for (unsigned i = begin; i != end; ++i) values[i] = sqrtf((float)i);
+  ///     });
+  class job_scheduler {
+  public:
+    enum {
+      /// jobs in each thread's queue; run() does the work at once if its queue is full.
+      queue_size = 4096,
+
+      /// parallel_for makes at most this many jobs per thread.
+      chunks_per_thread = 4,
+    };
+
+  private:
+    // a thread's queue: a ring of jobs with the oldest at "front".
+    // The lock is only held for a few instructions, so the owner rarely waits for thieves.
+    struct queue_t {
+      spin_lock lock;
+      unsigned front;
+      unsigned back;
+      job *jobs[queue_size];
+      char pad[64];     // keep the next queue's lock off this cache line
+
+      queue_t() {
+        front = back = 0;
+      }
+
+      // add a job at the back; false if the queue is full.
+      bool push(job *jb) {
+        std::lock_guard<spin_lock> guard(lock);
+        if (back - front == queue_size) return false;
+        jobs[back++ % queue_size] = jb;
+        return true;
+      }
+
+      // take the newest job.
+      job *pop() {
+        std::lock_guard<spin_lock> guard(lock);
+        if (back == front) return 0;
+        return jobs[--back % queue_size];
+      }
+
+      // take the oldest job.
+      job *steal() {
+        std::lock_guard<spin_lock> guard(lock);
+        if (back == front) return 0;
+        return jobs[front++ % queue_size];
+      }
+    };
+
+    // runs a range of a parallel_for.
+    template <class fn_t> class range_job : public job {
     public:
-      scheduler() {
-        waiting = 0;
-        running = 0;
+      const fn_t *fn;
+      unsigned begin;
+      unsigned end;
+
+      void kernel() {
+        (*fn)(begin, end);
       }
+    };
 
-      void add_to_waiting(job *jb) {
-        jb->next = waiting;
-        waiting = this;
+    // a job with nothing to do, used as a parent to wait on.
+    class root_job : public job {
+    public:
+      void kernel() {
       }
     };
 
-    scheduler *get_scheduler() {
-      static scheduler sch;
-      return &sch;
+    // queue 0 belongs to the main thread (and any thread that is not a worker).
+    queue_t *queues;
+    unsigned num_queues;
+    dynarray<std::thread *> threads;
+
+    // jobs in all the queues; sleeping workers are woken when this goes up.
+    std::atomic<int> num_queued;
+    std::atomic<int> num_sleeping;
+    std::atomic<bool> quitting;
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+
+    // this thread's queue.
+    static unsigned &thread_index() {
+      static thread_local unsigned index = 0;
+      return index;
+    }
+
+    // random numbers for choosing a thread to steal from.
+    static unsigned next_random() {
+      static thread_local unsigned seed = 0;
+      if (seed == 0) seed = (unsigned)std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+      seed ^= seed << 13;
+      seed ^= seed >> 17;
+      seed ^= seed << 5;
+      return seed;
+    }
+
+    // find something to do: our own newest job, or another thread's oldest.
+    job *find_job() {
+      if (num_queued.load(std::memory_order_relaxed) == 0) return 0;
+      unsigned self = thread_index();
+      job *jb = queues[self].pop();
+      if (!jb) {
+        unsigned start = next_random();
+        for (unsigned i = 0; i != num_queues && !jb; ++i) {
+          unsigned victim = (start + i) % num_queues;
+          if (victim != self) jb = queues[victim].steal();
+        }
+      }
+      if (jb) num_queued.fetch_sub(1, std::memory_order_relaxed);
+      return jb;
+    }
+
+    // a job's kernel or one of its children has finished.
+    // The job may be deleted by a waiting thread as soon as its count reaches zero.
+    static void finish(job *jb) {
+      while (jb) {
+        job *parent = jb->parent;
+        if (jb->num_unfinished.fetch_sub(1, std::memory_order_acq_rel) != 1) break;
+        jb = parent;
+      }
+    }
+
+    static void execute(job *jb) {
+      jb->state.store(job::state_running, std::memory_order_relaxed);
+      jb->kernel();
+      finish(jb);
+    }
+
+    void worker(unsigned index) {
+      thread_index() = index;
+      while (!quitting.load(std::memory_order_acquire)) {
+        if (job *jb = find_job()) {
+          execute(jb);
+        } else {
+          // nothing anywhere: sleep until run() adds a job.
+          std::unique_lock<std::mutex> guard(sleep_mutex);
+          num_sleeping.fetch_add(1);
+          while (num_queued.load() == 0 && !quitting.load()) {
+            wake.wait(guard);
+          }
+          num_sleeping.fetch_sub(1);
+        }
+      }
+    }
+
+    void start(unsigned num_threads) {
+      num_queues = num_threads + 1;
+      queues = new queue_t[num_queues];
+      quitting = false;
+      for (unsigned i = 0; i != num_threads; ++i) {
+        threads.push_back(new std::thread(&job_scheduler::worker, this, i + 1));
+      }
+    }
+
+    void stop() {
+      {
+        std::lock_guard<std::mutex> guard(sleep_mutex);
+        quitting = true;
+      }
+      wake.notify_all();
+      for (unsigned i = 0; i != threads.size(); ++i) {
+        threads[i]->join();
+        delete threads[i];
+      }
+      threads.reset();
+
+      // anything left over runs here so that nobody waits forever.
+      while (job *jb = find_job()) {
+        execute(jb);
+      }
+      delete [] queues;
+      queues = 0;
+    }
+
+    static unsigned default_num_threads() {
+      if (OCTET_JOB_THREADS) return OCTET_JOB_THREADS;
+      unsigned num_cores = std::thread::hardware_concurrency();
+      return num_cores > 1 ? num_cores - 1 : 0;
+    }
+
+    job_scheduler() : num_queued(0), num_sleeping(0), quitting(false) {
+      start(default_num_threads());
     }
+
+    ~job_scheduler() {
+      stop();
+    }
+
+    job_scheduler(const job_scheduler &);
+    job_scheduler &operator=(const job_scheduler &);
   public:
-    job() {
-      scheduler *sch = get_scheduler();
-      sch->add_to_waiting(this);
+    /// get the scheduler, starting the worker threads the first time.
+    static job_scheduler &get() {
+      static job_scheduler instance;
+      return instance;
     }
 
-    virtual ~job() {
+    /// Change the number of worker threads (0 runs every job in wait()).
+    /// Call this from the main thread when no jobs are running.
+    void set_num_threads(unsigned num_threads) {
+      stop();
+      start(num_threads);
     }
 
-    virtual void kernel() = 0;
-    virtual bool is_ready() = 0;
+    /// number of worker threads, not counting the main thread.
+    unsigned get_num_threads() const {
+      return threads.size();
+    }
+
+    /// Queue a job to run on any thread.
+    /// If parent is given, the parent does not finish until this job has.
+    /// The parent must not have finished yet: add children from the parent's kernel
+    /// or before the parent is run.
+    void run(job *jb, job *parent = 0) {
+      assert(jb->get_state() == job::state_new);
+      jb->parent = parent;
+      if (parent) parent->num_unfinished.fetch_add(1, std::memory_order_relaxed);
+      jb->state.store(job::state_waiting, std::memory_order_relaxed);
+
+      if (!queues[thread_index()].push(jb)) {
+        // our queue is full: doing the work now is as good as anything.
+        execute(jb);
+        return;
+      }
+
+      num_queued.fetch_add(1);
+      if (num_sleeping.load() != 0) {
+        // taking the lock makes sure a worker that is about to sleep sees the new job.
+        { std::lock_guard<std::mutex> guard(sleep_mutex); }
+        wake.notify_one();
+      }
+    }
+
+    /// Run one queued job on this thread, if there is one.
+    /// Returns false if there was nothing to do.
+    bool run_one() {
+      job *jb = find_job();
+      if (!jb) return false;
+      execute(jb);
+      return true;
+    }
+
+    /// Wait for a job (and all its children) to finish, running other jobs meanwhile.
+    /// The job must have been given to run().
+    void wait(job *jb) {
+      while (!jb->is_finished()) {
+        if (!run_one()) {
+          std::this_thread::yield();
+        }
+      }
+    }
+
+    /// Call fn(begin, end) for sub-ranges of [begin, end) on all the threads and wait for them.
+    /// Each sub-range has at least min_size indices (except perhaps the last), so choose
+    /// min_size big enough to make a call worth more than a few microseconds.
+    template <class fn_t> void parallel_for(unsigned begin, unsigned end, unsigned min_size, const fn_t &fn) {
+      if (end <= begin) return;
+      unsigned size = end - begin;
+      if (min_size == 0) min_size = 1;
+      unsigned max_chunks = num_queues * chunks_per_thread;
+      unsigned num_chunks = (size + min_size - 1) / min_size;
+      if (num_chunks > max_chunks) num_chunks = max_chunks;
+
+      if (num_chunks <= 1) {
+        fn(begin, end);
+        return;
+      }
+
+      root_job root;
+      range_job<fn_t> *chunks = new range_job<fn_t>[num_chunks];
+      for (unsigned i = 0; i != num_chunks; ++i) {
+        range_job<fn_t> &chunk = chunks[i];
+        chunk.fn = &fn;
+        chunk.begin = begin + (unsigned)((uint64_t)size * i / num_chunks);
+        chunk.end = begin + (unsigned)((uint64_t)size * (i + 1) / num_chunks);
+        run(&chunk, &root);
+      }
 
-    state_t get_state() {
-      return state;
+      // the root has no kernel of its own to wait for.
+      root.state.store(job::state_running, std::memory_order_relaxed);
+      finish(&root);
+      wait(&root);
+      delete [] chunks;
     }
   };
 } }
@@ -13,19 +13,44 @@
 #define RESOURCE_META(classname) \
   classname *get_##classname() { return this; } \
   atom_t get_type() { return atom_##classname; } \
-  static atom_t get_type_static() { return atom_##classname; }
+  static atom_t get_type_static() { return atom_##classname; } \
+  RESOURCE_ALLOC_STATS(classname)
+
+// count allocations of each resource type (see alloc_stats)
+#if OCTET_ALLOC_STATS
+  #define RESOURCE_ALLOC_STATS(classname) \
+    static alloc_stats::counter_t &get_alloc_counter() { \
+      static alloc_stats::counter_t counter("resource", #classname, atom_##classname); \
+      return counter; \
+    } \
+    void *operator new (size_t size) { get_alloc_counter().add(size); return allocator::malloc(size); } \
+    void operator delete (void *ptr, size_t size) { get_alloc_counter().remove(size); allocator::free(ptr, size); }
+#else
+  #define RESOURCE_ALLOC_STATS(classname)
+#endif
 
 namespace octet { namespace resources {
   /// Base class for resources; provides aligned allocation and reference counting.
   class resource {
-    // how many lives do we have?
-    int ref_count;
+    // how many lives do we have? (atomic if OCTET_ATOMIC_REFCOUNT is set)
+    ref_count_t ref_count;
+
+    // shared with weak_ref<>s to this resource, made on demand.
+    std::atomic<weak_ref_block *> weak_block;
 
   public:
     /// Make a new resource with no lives.
     /// Adding it to a ref<> will give it a life.
-    resource() {
-      ref_count = 0;
+    resource() : weak_block(0) {
+    }
+
+    /// Copying a resource copies its contents, not its lives or weak references.
+    resource(const resource &rhs) : weak_block(0) {
+    }
+
+    /// Copying a resource copies its contents, not its lives or weak references.
+    resource &operator=(const resource &rhs) {
+      return *this;
     }
 
     /// factory for making new resources of various kinds
@@ -55,16 +80,41 @@ namespace octet { namespace resources {
 
     /// Give this resource an extra life; see the %ref class.
     void add_ref() {
-      ref_count++;
+      ref_count.add_ref();
     }
 
     /// Remove a life from this resource and delete it if it is dead; see the %ref class.
     void release() {
-      if (--ref_count == 0) {
+      if (ref_count.release()) {
+        weak_ref_block *block = weak_block.load(std::memory_order_acquire);
+        if (block) {
+          block->expire();
+          block->release();
+        }
         delete this;
       }
     }
 
+    /// Get the number of lives this resource has.
+    int get_ref_count() const {
+      return ref_count.get();
+    }
+
+    /// Get the block shared with weak references to this resource; see the %weak_ref class.
+    weak_ref_block *get_weak_block() {
+      weak_ref_block *block = weak_block.load(std::memory_order_acquire);
+      if (!block) {
+        weak_ref_block *new_block = weak_ref_block::create(&ref_count);
+        if (weak_block.compare_exchange_strong(block, new_block, std::memory_order_acq_rel, std::memory_order_acquire)) {
+          block = new_block;
+        } else {
+          // another thread got there first.
+          new_block->release();
+        }
+      }
+      return block;
+    }
+
     /// use the allocator to allocate this resource and its child classes
     void *operator new (size_t size) {
       return allocator::malloc(size);
@@ -7,7 +7,10 @@
 
 namespace octet { namespace scene {
   /// Animation resource: Contains times and values.
-  /// Still a work in progress. Requires splines, compression, blending etc.
+  /// Still a work in progress. Requires splines, blending etc.
+  ///
+  /// Times are stored in whole milliseconds (32 bits, so there is no practical limit on length).
+  /// compress() makes a much smaller copy for playback and throws the original away.
   class animation : public resource {
     // todo: this could be a GL/CL buffer
     dynarray<unsigned char> data;
@@ -22,6 +25,15 @@ namespace octet { namespace scene {
       unsigned component_size; /// number of bytes per component
     };
 
+    /// one channel of a compressed animation
+    struct packed_channel {
+      uint32_t offset;     /// where the key times are in packed; the keys follow them
+      uint32_t num_keys;   /// how many keys
+      uint32_t range;      /// where the channel's minimums and steps are in packed_ranges
+      uint16_t format;     /// animation_codec::format_raw etc.
+      uint16_t key_bytes;  /// bytes in one key
+    };
+
     // format and component of channels
     dynarray<channel> channels;
 
@@ -31,12 +43,223 @@ namespace octet { namespace scene {
     dynarray<ref<resource> > targets;
 
     float end_time;
+
+    // The compressed animation, if we have one (see compress()): times and keys of every channel.
+    dynarray<uint8_t> packed;
+    dynarray<packed_channel> packed_channels;
+    dynarray<float> packed_ranges;
+
+    // Evaluation data, made from "data" by prepare(). Each channel field is its own array
+    // and the keys of all the channels share two more, so eval() streams through memory.
+    dynarray<unsigned> chan_first_key;    // index of the channel's first key in key_times
+    dynarray<unsigned> chan_num_keys;     // keys in the channel
+    dynarray<unsigned> chan_first_value;  // index of the channel's first value in key_values
+    dynarray<unsigned> chan_size;         // floats in one value
+    dynarray<unsigned> chan_pose_offset;  // index of the channel's value in a pose
+    dynarray<float> key_times;            // seconds
+    dynarray<float> key_rates;            // 1 / (time of next key - time of this key), or 0
+    dynarray<float> key_values;
+    unsigned pose_size;
+    bool prepared;
+
+    // build the evaluation arrays. Compressed animations only need the pose layout.
+    // A channel with no keys (which can only come from a file) has no values: eval() skips it.
+    void prepare() {
+      unsigned num_channels = channels.size();
+      chan_first_key.resize(num_channels);
+      chan_num_keys.resize(num_channels);
+      chan_first_value.resize(num_channels);
+      chan_size.resize(num_channels);
+      chan_pose_offset.resize(num_channels);
+      key_times.resize(0);
+      key_rates.resize(0);
+      key_values.resize(0);
+      pose_size = 0;
+
+      for (unsigned c = 0; c != num_channels; ++c) {
+        const channel &ch = channels[c];
+        unsigned size = ch.component_size / sizeof(float);
+        chan_size[c] = size;
+        chan_pose_offset[c] = pose_size;
+        pose_size += size;
+        if (is_compressed()) continue;
+
+        const uint32_t *times = (const uint32_t *)&data[ch.offset];
+        const float *values = (const float *)&data[ch.offset + ch.num_times * sizeof(uint32_t)];
+        chan_first_key[c] = key_times.size();
+        chan_num_keys[c] = ch.num_times;
+        chan_first_value[c] = key_values.size();
+
+        for (unsigned k = 0; k != ch.num_times; ++k) {
+          key_times.push_back(times[k] * 0.001f);
+          float dt = k + 1 < ch.num_times ? (times[k+1] - times[k]) * 0.001f : 0.0f;
+          key_rates.push_back(dt > 0 ? 1.0f / dt : 0.0f);
+        }
+        for (unsigned i = 0; i != ch.num_times * size; ++i) {
+          key_values.push_back(values[i]);
+        }
+      }
+      prepared = true;
+    }
+
+    // find k so that times[k] <= time < times[k+1], starting at last frame's k.
+    // Playing forwards, this is nearly always k or k+1.
+    template <class time_t> static unsigned find_key(const time_t *times, unsigned num_keys, float time, unsigned k) {
+      if (num_keys < 2) return 0;
+      unsigned last = num_keys - 2;
+      if (k > last || time < times[k]) {
+        // we have gone backwards (eg. looped): search from the start.
+        k = 0;
+      }
+      for (unsigned i = 0; i != 4; ++i) {
+        if (k == last || time < times[k+1]) return k;
+        k++;
+      }
+
+      // a big step: binary search the rest.
+      unsigned a = k, b = last + 1;
+      while (b - a > 1) {
+        unsigned mid = a + ((b - a) >> 1);
+        if (time >= times[mid]) {
+          a = mid;
+        } else {
+          b = mid;
+        }
+      }
+      return a;
+    }
+
+    // dest = a + (b - a) * t
+    static void lerp(float *dest, const float *a, const float *b, float t, unsigned size) {
+      unsigned i = 0;
+      #if OCTET_SSE
+        __m128 t4 = _mm_set1_ps(t);
+        for (; i + 4 <= size; i += 4) {
+          __m128 a4 = _mm_loadu_ps(a + i);
+          __m128 b4 = _mm_loadu_ps(b + i);
+          _mm_storeu_ps(dest + i, _mm_add_ps(a4, _mm_mul_ps(_mm_sub_ps(b4, a4), t4)));
+        }
+      #endif
+      for (; i != size; ++i) {
+        dest[i] = a[i] + (b[i] - a[i]) * t;
+      }
+    }
+
+    // interpolate one channel of an uncompressed animation at a time in seconds.
+    void eval_raw_channel(unsigned chan, float time, unsigned &cursor, float *dest) const {
+      unsigned first_key = chan_first_key[chan];
+      unsigned num_keys = chan_num_keys[chan];
+      if (num_keys == 0) return;
+      unsigned n = chan_size[chan];
+      const float *chan_times = key_times.data() + first_key;
+      unsigned k = cursor = find_key(chan_times, num_keys, time, cursor);
+      const float *a = key_values.data() + chan_first_value[chan] + k * n;
+      if (num_keys < 2) {
+        memcpy(dest, a, n * sizeof(float));
+      } else {
+        // clamp before the first key and after the last.
+        float t = (time - chan_times[k]) * key_rates[first_key + k];
+        t = t < 0 ? 0 : t > 1 ? 1 : t;
+        lerp(dest, a, a + n, t, n);
+      }
+    }
+
+    // find the two keys of a compressed channel either side of a time in ms and how far we are between them.
+    float find_packed_keys(unsigned chan, float time_ms, unsigned &cursor, const uint8_t *&a, const uint8_t *&b) const {
+      const packed_channel &pc = packed_channels[chan];
+      const uint8_t *base = packed.data() + pc.offset;
+      const uint32_t *times = (const uint32_t *)base;
+      unsigned k = cursor = find_key(times, pc.num_keys, time_ms, cursor);
+      a = b = base + pc.num_keys * sizeof(uint32_t) + k * pc.key_bytes;
+      if (pc.num_keys < 2) return 0;
+      b = a + pc.key_bytes;
+      float dt = (float)(times[k+1] - times[k]);
+      float t = dt > 0 ? (time_ms - times[k]) / dt : 0;
+      return t < 0 ? 0 : t > 1 ? 1 : t;
+    }
+
+    // decompress one channel of a compressed animation at a time in ms.
+    void eval_packed_channel(unsigned chan, float time_ms, unsigned &cursor, float *dest) const {
+      const packed_channel &pc = packed_channels[chan];
+      if (pc.num_keys == 0) return;
+      const uint8_t *a, *b;
+      float t = find_packed_keys(chan, time_ms, cursor, a, b);
+      animation_codec::decode(dest, pc.format, a, b, t, packed_ranges.data() + pc.range, channels[chan].component_size / sizeof(float));
+    }
+
+    // biggest difference between two values.
+    static float max_difference(const float *a, const float *b, unsigned size) {
+      float result = 0;
+      for (unsigned i = 0; i != size; ++i) {
+        float d = fabsf(a[i] - b[i]);
+        if (d > result) result = d;
+      }
+      return result;
+    }
+
+    // pack every key of a channel in one format and work out its ranges.
+    // Returns false if the format loses more than tolerance at any key.
+    static bool pack_channel(dynarray<uint8_t> &keys, dynarray<float> &ranges, unsigned format, const float *values, unsigned num_keys, unsigned size, float tolerance) {
+      unsigned key_bytes = format == animation_codec::format_trs ? (unsigned)animation_codec::trs_key_bytes : format == animation_codec::format_quantized ? size * 2 : size * 4;
+      keys.resize(num_keys * key_bytes);
+      ranges.resize(0);
+
+      if (format == animation_codec::format_raw) {
+        memcpy(keys.data(), values, num_keys * key_bytes);
+        return true;
+      }
+
+      // minimums and maximums of the floats we quantize.
+      unsigned num_floats = format == animation_codec::format_trs ? 6 : size;
+      dynarray<float> floats(num_keys * num_floats);
+      for (unsigned k = 0; k != num_keys; ++k) {
+        const float *value = values + k * size;
+        float *dest = floats.data() + k * num_floats;
+        if (format == animation_codec::format_trs) {
+          float q[4];
+          if (!animation_codec::decompose(q, dest, dest + 3, value)) return false;
+        } else {
+          memcpy(dest, value, size * sizeof(float));
+        }
+      }
+
+      // ranges: minimums then steps, once for a quantized channel, twice (translation, scale) for trs.
+      ranges.resize(num_floats * 2);
+      unsigned group = format == animation_codec::format_trs ? 3 : size;
+      for (unsigned i = 0; i != num_floats; ++i) {
+        float lo = floats[i], hi = floats[i];
+        for (unsigned k = 1; k != num_keys; ++k) {
+          float v = floats[k * num_floats + i];
+          lo = v < lo ? v : lo;
+          hi = v > hi ? v : hi;
+        }
+        unsigned base = (i / group) * group * 2;
+        ranges[base + i % group] = lo;
+        ranges[base + group + i % group] = (hi - lo) / 65535;
+      }
+
+      float decoded[16];
+      for (unsigned k = 0; k != num_keys; ++k) {
+        uint8_t *key = keys.data() + k * key_bytes;
+        const float *value = values + k * size;
+        if (format == animation_codec::format_trs) {
+          animation_codec::pack_trs(key, value, ranges.data());
+        } else {
+          animation_codec::pack_quantized((uint16_t*)key, value, ranges.data(), size);
+        }
+        animation_codec::decode(decoded, format, key, key, 0, ranges.data(), size);
+        if (max_difference(decoded, value, size) > tolerance) return false;
+      }
+      return true;
+    }
   public:
     RESOURCE_META(animation)
   
     /// Default constructor. Use add_channel to add channels to the animation,
     animation() {
       end_time = 0;
+      pose_size = 0;
+      prepared = false;
     }
 
     /// Serialisation, script etc.
@@ -45,6 +268,12 @@ namespace octet { namespace scene {
       v.visit(channels, atom_channels);
       v.visit(targets, atom_targets);
       v.visit(end_time, atom_end_time);
+      v.visit(packed, atom_packed);
+      v.visit(packed_channels, atom_packed_channels);
+      v.visit(packed_ranges, atom_packed_ranges);
+      if (v.is_reader()) {
+        prepared = false;
+      }
     }
 
     /// How many channels?
@@ -77,10 +306,11 @@ namespace octet { namespace scene {
       return end_time;
     }
 
-    /// add a channel to the animation.
-    // just store the floats in the channel for now.
-    // todo: optimise animation data
+    /// add a channel to the animation. Times are in seconds.
+    /// The floats are stored as they are; call compress() when all the channels are added.
     void add_channel(resource *target, atom_t sid, atom_t sub_target, atom_t component, dynarray<float> &times, dynarray<float> &values) {
+      assert(!is_compressed());
+      assert(times.size() != 0 && "a channel needs at least one key");
       int num_times = (int)times.size();
       int num_values = (int)values.size();
       int component_size = (num_values / num_times) * sizeof(float);
@@ -93,32 +323,131 @@ namespace octet { namespace scene {
       ch.component_size = component_size;
 
       int offset = ch.offset = (int)data.size();
-      int bytes = num_times * sizeof(unsigned short) + component_size * num_times;
+      int bytes = num_times * sizeof(uint32_t) + component_size * num_times;
       data.resize(ch.offset + bytes);
       end_time = times[num_times-1] > end_time ? times[num_times-1] : end_time;
       for (int i = 0; i != num_times; ++i) {
-        unsigned short it = (unsigned short)( times[i] * 1000 );
-        *((unsigned short*)&data[offset]) = it;
-        offset += sizeof(unsigned short);
+        uint32_t it = (uint32_t)( times[i] * 1000 );
+        *((uint32_t*)&data[offset]) = it;
+        offset += sizeof(uint32_t);
       }
       
       memcpy(&data[offset], &values[0], component_size * num_times);
       channels.push_back(ch);
       targets.push_back(target);
+      prepared = false;
+    }
+
+    /// number of floats in a pose: the values of all the channels at one time.
+    unsigned get_pose_size() {
+      if (!prepared) prepare();
+      return pose_size;
+    }
+
+    /// where a channel's value is in a pose.
+    unsigned get_pose_offset(int chan) {
+      if (!prepared) prepare();
+      return chan_pose_offset[chan];
+    }
+
+    /// number of floats in a channel's value: 16 for a matrix.
+    unsigned get_channel_size(int chan) const {
+      return channels[chan].component_size / sizeof(float);
+    }
+
+    /// Evaluate every channel at a time in seconds, writing get_pose_size() floats to pose.
+    /// cursors has one entry per channel, zero to start with. It remembers the key used last time
+    /// so that playing forwards does not have to search for keys.
+    /// The values of channels with no keys are left as they are.
+    void eval(float time, unsigned *cursors, float *pose) {
+      if (!prepared) prepare();
+
+      if (is_compressed()) {
+        float time_ms = time * 1000;
+        const unsigned *pose_offset = chan_pose_offset.data();
+        for (unsigned c = 0; c != channels.size(); ++c) {
+          eval_packed_channel(c, time_ms, cursors[c], pose + pose_offset[c]);
+        }
+        return;
+      }
+
+      const unsigned *pose_offset = chan_pose_offset.data();
+      unsigned num_channels = channels.size();
+      for (unsigned c = 0; c != num_channels; ++c) {
+        eval_raw_channel(c, time, cursors[c], pose + pose_offset[c]);
+      }
+    }
+
+    /// Evaluate the matrix channels straight into the joints of a pose, for blending.
+    /// channel_joints has the joint of each channel, or -1 for channels to skip;
+    /// only channels of 16 floats (collada matrices) may have joints.
+    /// Joints with no channel are left as they are.
+    void eval_joints(float time, unsigned *cursors, const int *channel_joints, pose_buffer &dest) {
+      if (!prepared) prepare();
+      float value[16];
+      unsigned num_channels = channels.size();
+      for (unsigned c = 0; c != num_channels; ++c) {
+        int joint = channel_joints[c];
+        if (joint < 0 || channels[c].num_times == 0) continue;
+        assert(chan_size[c] == 16);
+        if (is_compressed() && packed_channels[c].format == animation_codec::format_trs) {
+          // rotation, translation and scale come out of the keys as they are.
+          const packed_channel &pc = packed_channels[c];
+          const uint8_t *a, *b;
+          float t = find_packed_keys(c, time * 1000, cursors[c], a, b);
+          float q[4], translation[3], scale[3];
+          animation_codec::decode_trs_parts(q, translation, scale, a, b, t, packed_ranges.data() + pc.range);
+          dest.set_joint((unsigned)joint, q, translation, scale);
+        } else {
+          if (is_compressed()) {
+            eval_packed_channel(c, time * 1000, cursors[c], value);
+          } else {
+            eval_raw_channel(c, time, cursors[c], value);
+          }
+          dest.set_collada((unsigned)joint, value);
+        }
+      }
+    }
+
+    /// Send a pose to the channels' targets, or to target if it is not null.
+    void apply(const float *pose, resource *target) {
+      if (!prepared) prepare();
+      for (unsigned c = 0; c != channels.size(); ++c) {
+        resource *chan_target = target ? target : (resource*)targets[c];
+        if (chan_target && channels[c].num_times != 0) {
+          const channel &ch = channels[c];
+          chan_target->set_value(ch.sid, ch.sub_target, ch.component, (float*)pose + chan_pose_offset[c]);
+        }
+      }
     }
 
-    /// Evaluate one channel. Time is in ms. This is very inefficient, it is much better to evalaute all channels together.
+    /// Evaluate one channel. Time is in seconds. This is very inefficient, it is much better to evalaute all channels together with eval().
     void eval_chan(int chan, float time, resource *target) const {
-      int time_ms = int(time * 1000);
       const channel &ch = channels[chan];
-      unsigned short *p = (unsigned short *)&data[ch.offset];
+      if (ch.num_times == 0) return;
+      if (is_compressed()) {
+        float tmp[16];
+        unsigned cursor = 0;
+        if (ch.component_size <= sizeof(tmp)) {
+          eval_packed_channel(chan, time * 1000, cursor, tmp);
+          target->set_value(ch.sid, ch.sub_target, ch.component, tmp);
+        }
+        return;
+      }
+
+      uint32_t time_ms = time < 0 ? 0 : uint32_t(time * 1000);
+      const uint32_t *p = (const uint32_t *)&data[ch.offset];
       unsigned a = 0;
       unsigned b = ch.num_times - 1;
       unsigned component_size = ch.component_size;
       //log("ec %f %d\n", time, time_ms);
 
-      if (time_ms < p[0]) {
+      if (b == 0) {
+        target->set_value(ch.sid, ch.sub_target, ch.component, (float*)&data[ch.offset + sizeof(uint32_t)]);
+        return;
+      } else if (time_ms < p[0]) {
         time_ms = p[0];
+        b = 1;
       } else if (time_ms >= p[b]) {
         time_ms = p[b];
         a = b - 1;
@@ -135,7 +464,7 @@ namespace octet { namespace scene {
 
       //log("t=%d a=%d b=%d p[a]=%d p[b]=%d\n", time_ms, a, b, p[a], p[b]);
 
-      unsigned data_offset = ch.offset + ch.num_times * sizeof(unsigned short);
+      unsigned data_offset = ch.offset + ch.num_times * sizeof(uint32_t);
 
       float t = float(time_ms - p[a]) / (p[b] - p[a]);
       float tmp1[16];
@@ -150,5 +479,112 @@ namespace octet { namespace scene {
         target->set_value(ch.sid, ch.sub_target, ch.component, tmp1);
       }
     }
+
+    /// true if compress() has been called.
+    bool is_compressed() const {
+      return packed_channels.size() != 0;
+    }
+
+    /// Compress the animation for playback. Call when all the channels have been added.
+    ///
+    /// Matrix channels are stored as a quaternion, translation and scale in 18 bytes per key
+    /// (instead of 64) and other channels at 16 bits per float. Keys that can be interpolated
+    /// from their neighbours are dropped. No value of any channel at any of the original key
+    /// times moves by more than tolerance; channels that can not be packed that well are kept as floats.
+    /// Zero only drops keys that are exactly in line with their neighbours.
+    void compress(float tolerance = 0.001f) {
+      if (is_compressed()) return;
+
+      dynarray<uint8_t> keys;
+      dynarray<float> ranges;
+      dynarray<unsigned> kept;
+      float decoded[16];
+
+      unsigned num_channels = channels.size();
+      packed_channels.resize(num_channels);
+      for (unsigned c = 0; c != num_channels; ++c) {
+        channel &ch = channels[c];
+        unsigned num_keys = ch.num_times;
+        unsigned size = ch.component_size / sizeof(float);
+        if (num_keys == 0) {
+          // nothing to pack: eval() skips the channel.
+          packed_channel &pc = packed_channels[c];
+          pc.offset = ch.offset = packed.size();
+          pc.num_keys = 0;
+          pc.range = packed_ranges.size();
+          pc.format = animation_codec::format_raw;
+          pc.key_bytes = 0;
+          continue;
+        }
+        const uint32_t *times = (const uint32_t *)&data[ch.offset];
+        const float *values = (const float *)&data[ch.offset + num_keys * sizeof(uint32_t)];
+
+        // the smallest format that is good enough.
+        unsigned format = animation_codec::format_raw;
+        if (size == 16 && pack_channel(keys, ranges, animation_codec::format_trs, values, num_keys, size, tolerance)) {
+          format = animation_codec::format_trs;
+        } else if (size <= 16 && pack_channel(keys, ranges, animation_codec::format_quantized, values, num_keys, size, tolerance)) {
+          format = animation_codec::format_quantized;
+        } else {
+          pack_channel(keys, ranges, animation_codec::format_raw, values, num_keys, size, tolerance);
+        }
+        unsigned key_bytes = keys.size() / num_keys;
+
+        // drop keys: from each kept key, go as far as we can while every key in between
+        // is within tolerance of the interpolated value.
+        kept.resize(0);
+        kept.push_back(0);
+        for (unsigned a = 0; a + 1 < num_keys; ) {
+          unsigned b = a + 1;
+          while (b + 1 < num_keys && size <= 16) {
+            unsigned next = b + 1;
+            float dt = (float)(times[next] - times[a]);
+            bool ok = true;
+            for (unsigned k = a + 1; k != next && ok; ++k) {
+              float t = dt > 0 ? (times[k] - times[a]) / dt : 0;
+              animation_codec::decode(decoded, format, &keys[a * key_bytes], &keys[next * key_bytes], t, ranges.data(), size);
+              ok = max_difference(decoded, values + k * size, size) <= tolerance;
+            }
+            if (!ok) break;
+            b = next;
+          }
+          kept.push_back(b);
+          a = b;
+        }
+
+        // kept times then kept keys, each channel four byte aligned.
+        packed_channel &pc = packed_channels[c];
+        pc.offset = packed.size();
+        pc.num_keys = kept.size();
+        pc.range = packed_ranges.size();
+        pc.format = (uint16_t)format;
+        pc.key_bytes = (uint16_t)key_bytes;
+        unsigned bytes = (kept.size() * (sizeof(uint32_t) + key_bytes) + 3) & ~3;
+        packed.resize(pc.offset + bytes);
+        uint8_t *dest = &packed[pc.offset];
+        memset(dest, 0, bytes);
+        for (unsigned i = 0; i != kept.size(); ++i) {
+          memcpy(dest + i * sizeof(uint32_t), &times[kept[i]], sizeof(uint32_t));
+          memcpy(dest + kept.size() * sizeof(uint32_t) + i * key_bytes, &keys[kept[i] * key_bytes], key_bytes);
+        }
+        for (unsigned i = 0; i != ranges.size(); ++i) {
+          packed_ranges.push_back(ranges[i]);
+        }
+        ch.offset = pc.offset;
+        ch.num_times = pc.num_keys;
+      }
+
+      // the floats are no longer needed.
+      data.reset();
+      key_times.reset();
+      key_rates.reset();
+      key_values.reset();
+      prepared = false;
+    }
+
+    /// bytes used by the keys of this animation.
+    unsigned get_memory_size() const {
+      return data.size() + packed.size() + packed_channels.size() * sizeof(packed_channel) + packed_ranges.size() * sizeof(float) + channels.size() * sizeof(channel);
+    }
   };
 }}
@@ -0,0 +1,199 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Packed key formats for compressed animations
+//
+// Matrix channels are split into rotation, translation and scale. Rotations are
+// stored as the three smallest components of a unit quaternion (the largest can be
+// worked out from them) at 15 bits each, translations and scales at 16 bits each
+// within the channel's range. Other channels are stored at 16 bits per float.
+//
+
+namespace octet { namespace scene {
+  /// Encode and decode the keys of compressed animation channels (see animation::compress()).
+  class animation_codec {
+  public:
+    enum format_t {
+      /// floats, as they came.
+      format_raw,
+
+      /// 16 bits per float in the channel's range.
+      format_quantized,
+
+      /// a collada style 4x4 matrix as a rotation, translation and scale.
+      format_trs,
+    };
+
+    enum {
+      /// bytes in a format_trs key: quaternion, translation and scale.
+      trs_key_bytes = 18,
+
+      /// range floats (minimums and steps) of a format_trs channel.
+      trs_num_ranges = 12,
+    };
+
+    /// sqrt(1/2): the largest the three smallest components of a unit quaternion can be.
+    static float quat_limit() {
+      return 0.70710678f;
+    }
+
+    /// Pack a unit quaternion (x, y, z, w) into 48 bits: the index of the largest component
+    /// in the top bits of the first two words, then the other three at 15 bits each.
+    static void pack_quat(uint16_t *dest, const float *q) {
+      unsigned largest = 0;
+      for (unsigned i = 1; i != 4; ++i) {
+        if (fabsf(q[i]) > fabsf(q[largest])) largest = i;
+      }
+
+      // q and -q are the same rotation: make the largest positive so we need not store its sign.
+      float sign = q[largest] < 0 ? -1.0f : 1.0f;
+      unsigned values[3];
+      for (unsigned i = 0, j = 0; i != 4; ++i) {
+        if (i == largest) continue;
+        float v = q[i] * sign / quat_limit();
+        v = v < -1 ? -1 : v > 1 ? 1 : v;
+        values[j++] = (unsigned)((v + 1) * 0.5f * 32767 + 0.5f);
+      }
+      dest[0] = (uint16_t)((largest >> 1) << 15 | values[0]);
+      dest[1] = (uint16_t)((largest & 1) << 15 | values[1]);
+      dest[2] = (uint16_t)values[2];
+    }
+
+    /// Unpack a quaternion made by pack_quat().
+    static void unpack_quat(float *q, const uint16_t *src) {
+      unsigned largest = (src[0] >> 15) << 1 | (src[1] >> 15);
+      const float scale = 2 * quat_limit() / 32767;
+      float a = (src[0] & 0x7fff) * scale - quat_limit();
+      float b = (src[1] & 0x7fff) * scale - quat_limit();
+      float c = (src[2] & 0x7fff) * scale - quat_limit();
+      float d2 = 1 - a * a - b * b - c * c;
+      float d = d2 > 0 ? sqrtf(d2) : 0;
+      switch (largest) {
+        case 0: q[0] = d; q[1] = a; q[2] = b; q[3] = c; break;
+        case 1: q[0] = a; q[1] = d; q[2] = b; q[3] = c; break;
+        case 2: q[0] = a; q[1] = b; q[2] = d; q[3] = c; break;
+        default: q[0] = a; q[1] = b; q[2] = c; q[3] = d; break;
+      }
+    }
+
+    /// Pack floats at 16 bits each. ranges has the minimums then the steps (range / 65535).
+    static void pack_quantized(uint16_t *dest, const float *src, const float *ranges, unsigned size) {
+      for (unsigned i = 0; i != size; ++i) {
+        float step = ranges[size + i];
+        float v = step > 0 ? (src[i] - ranges[i]) / step + 0.5f : 0;
+        dest[i] = (uint16_t)(v < 0 ? 0 : v > 65535 ? 65535 : v);
+      }
+    }
+
+    /// dest = the floats packed in a and b, interpolated by t.
+    static void decode_quantized(float *dest, const uint16_t *a, const uint16_t *b, float t, const float *ranges, unsigned size) {
+      for (unsigned i = 0; i != size; ++i) {
+        float va = a[i], vb = b[i];
+        dest[i] = ranges[i] + (va + (vb - va) * t) * ranges[size + i];
+      }
+    }
+
+    /// Split a collada matrix (as passed to resource::set_value) into a quaternion, translation and scale.
+    /// Returns false if it has no rotation in it (eg. a zero scale).
+    static bool decompose(float *q, float *translation, float *scale, const float *value) {
+      // the rows of the octet matrix are the columns of the collada one.
+      mat4t m;
+      m.init_transpose(value);
+      for (unsigned i = 0; i != 3; ++i) {
+        scale[i] = length(m[i].xyz());
+        if (scale[i] < 1e-6f) return false;
+        m[i] = m[i] * (1.0f / scale[i]);
+      }
+
+      // a reflection: put it in the scale.
+      if (dot(cross(m[0].xyz(), m[1].xyz()), m[2].xyz()) < 0) {
+        scale[0] = -scale[0];
+        m[0] = -m[0];
+      }
+
+      quat r = m.toQuaternion();
+      float len = length((vec4&)r);
+      for (unsigned i = 0; i != 4; ++i) q[i] = r[i] / len;
+      translation[0] = value[3];
+      translation[1] = value[7];
+      translation[2] = value[11];
+      return true;
+    }
+
+    /// Pack a collada matrix as a format_trs key. ranges are the translation then the scale ranges.
+    static bool pack_trs(uint8_t *dest, const float *value, const float *ranges) {
+      float q[4], translation[3], scale[3];
+      if (!decompose(q, translation, scale, value)) return false;
+      uint16_t *words = (uint16_t*)dest;
+      pack_quat(words, q);
+      pack_quantized(words + 3, translation, ranges, 3);
+      pack_quantized(words + 6, scale, ranges + 6, 3);
+      return true;
+    }
+
+    /// Get the unit quaternion, translation and scale from two format_trs keys interpolated by t.
+    /// The rotations are blended with a normalised lerp, which is close to a slerp for nearby keys.
+    static void decode_trs_parts(float *q, float *translation, float *scale, const uint8_t *a, const uint8_t *b, float t, const float *ranges) {
+      const uint16_t *wa = (const uint16_t*)a;
+      const uint16_t *wb = (const uint16_t*)b;
+      float qa[4], qb[4];
+      unpack_quat(qa, wa);
+      unpack_quat(qb, wb);
+      float sign = qa[0] * qb[0] + qa[1] * qb[1] + qa[2] * qb[2] + qa[3] * qb[3] < 0 ? -t : t;
+      for (unsigned i = 0; i != 4; ++i) {
+        q[i] = qa[i] * (1 - t) + qb[i] * sign;
+      }
+      float rlen = 1.0f / sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+      for (unsigned i = 0; i != 4; ++i) {
+        q[i] *= rlen;
+      }
+      decode_quantized(translation, wa + 3, wb + 3, t, ranges, 3);
+      decode_quantized(scale, wa + 6, wb + 6, t, ranges + 6, 3);
+    }
+
+    /// Make a collada matrix from two format_trs keys interpolated by t.
+    static void decode_trs(float *dest, const uint8_t *a, const uint8_t *b, float t, const float *ranges) {
+      float q[4], translation[3], scale[3];
+      decode_trs_parts(q, translation, scale, a, b, t, ranges);
+      float x = q[0], y = q[1], z = q[2], w = q[3];
+
+      // rows of mat4t(quat) times the scale, transposed to collada order.
+      dest[0] = (w*w + x*x - y*y - z*z) * scale[0];
+      dest[4] = 2 * (x*y + w*z) * scale[0];
+      dest[8] = 2 * (x*z - w*y) * scale[0];
+      dest[1] = 2 * (x*y - w*z) * scale[1];
+      dest[5] = (w*w - x*x + y*y - z*z) * scale[1];
+      dest[9] = 2 * (y*z + w*x) * scale[1];
+      dest[2] = 2 * (x*z + w*y) * scale[2];
+      dest[6] = 2 * (y*z - w*x) * scale[2];
+      dest[10] = (w*w - x*x - y*y + z*z) * scale[2];
+      dest[3] = translation[0];
+      dest[7] = translation[1];
+      dest[11] = translation[2];
+      dest[12] = dest[13] = dest[14] = 0;
+      dest[15] = 1;
+    }
+
+    /// Decode a value of size floats from two keys of any format, interpolated by t.
+    static void decode(float *dest, unsigned format, const uint8_t *a, const uint8_t *b, float t, const float *ranges, unsigned size) {
+      switch (format) {
+        case format_trs: {
+          decode_trs(dest, a, b, t, ranges);
+        } break;
+        case format_quantized: {
+          decode_quantized(dest, (const uint16_t*)a, (const uint16_t*)b, t, ranges, size);
+        } break;
+        default: {
+          const float *fa = (const float*)a;
+          const float *fb = (const float*)b;
+          for (unsigned i = 0; i != size; ++i) {
+            dest[i] = fa[i] + (fb[i] - fa[i]) * t;
+          }
+        } break;
+      }
+    }
+  };
+} }
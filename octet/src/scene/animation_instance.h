@@ -15,6 +15,12 @@ namespace octet { namespace scene {
     float time;
     bool is_looping;
     bool is_paused;
+
+    // the key each channel used last frame, so playing forwards does not search.
+    dynarray<unsigned> cursors;
+
+    // the values of all the channels at the current time.
+    dynarray<float> pose;
   public:
     RESOURCE_META(animation_instance)
 
@@ -46,18 +52,23 @@ namespace octet { namespace scene {
       return time;
     }
 
+    /// get the values of all the channels from the last update (see animation::get_pose_offset()).
+    const float *get_pose() const {
+      return pose.data();
+    }
+
     /// update the animation and the resources it connects to.
     void update(float delta_time) {
-      if (target) {
-        for (int ch = 0; ch != anim->get_num_channels(); ++ch) {
-          anim->eval_chan(ch, time, target);
-        }
-      } else {
-        for (int ch = 0; ch != anim->get_num_channels(); ++ch) {
-          resource *anim_target = anim->get_target(ch);
-          anim->eval_chan(ch, time, anim_target);
-        }
+      unsigned num_channels = (unsigned)anim->get_num_channels();
+      if (cursors.size() != num_channels) {
+        cursors.resize(num_channels);
+        for (unsigned i = 0; i != num_channels; ++i) cursors[i] = 0;
       }
+      pose.resize(anim->get_pose_size());
+
+      // all the channels in one pass, then send them to the targets.
+      anim->eval(time, cursors.data(), pose.data());
+      anim->apply(pose.data(), target);
 
       //log("update %f\n", delta_time);
       if (!is_paused) {
@@ -0,0 +1,412 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Layers of animations blended into one pose for a skeleton
+//
+// animation_instance sends each channel to its target's set_value(), one virtual call
+// per channel, and skeleton::calc_transforms() then copies the nodes' matrices back.
+// An animation_mixer samples each layer's animation straight into a pose_buffer,
+// blends the layers joint by joint and gives the result to the skeleton, so the
+// scene_nodes are never touched.
+//
+
+namespace octet { namespace scene {
+  /// One animation playing in an animation_mixer, with its time, weight and blend mode.
+  class animation_layer : public resource {
+    friend class animation_mixer;
+
+    ref<animation> anim;
+    float time;
+    float speed;
+    float weight;
+    float fade_target;
+    float fade_rate;
+    int mode;
+    bool is_looping;
+    bool is_paused;
+
+    // fade_to() reached zero at once; advance() reports it as faded out.
+    bool fade_finished;
+
+    // false until bind() has set up channel_joints, cursors and the poses for the mixer's skeleton.
+    bool bound;
+
+    // weight of each joint; empty for all joints.
+    dynarray<float> mask;
+
+    // the key each channel used last frame.
+    dynarray<unsigned> cursors;
+
+    // joint of each channel or -1.
+    dynarray<int> channel_joints;
+
+    // the animation at the current time, joints it does not drive in the rest pose.
+    pose_buffer sample;
+
+    // additive layers: the first frame, which the other frames are relative to.
+    pose_buffer reference;
+
+    // find the joints of the channels and set up the poses.
+    void bind(skeleton *skel, const pose_buffer &rest) {
+      unsigned num_channels = (unsigned)anim->get_num_channels();
+      channel_joints.resize(num_channels);
+      cursors.resize(num_channels);
+      for (unsigned c = 0; c != num_channels; ++c) {
+        bool is_matrix = anim->get_sub_target(c) == atom_transform && anim->get_channel_size(c) == 16;
+        channel_joints[c] = is_matrix ? skel->find_joint(anim->get_sid(c)) : -1;
+        cursors[c] = 0;
+      }
+      sample = rest;
+      if (mode == blend_additive) {
+        reference = rest;
+        anim->eval_joints(0, cursors.data(), channel_joints.data(), reference);
+      }
+      bound = true;
+    }
+
+    // move on by delta_time. Returns true if the layer has just faded out.
+    bool advance(float delta_time) {
+      bool faded_out = fade_finished;
+      fade_finished = false;
+      if (fade_rate != 0) {
+        weight += fade_rate * delta_time;
+        if ((fade_rate > 0) == (weight >= fade_target)) {
+          weight = fade_target;
+          fade_rate = 0;
+          faded_out = weight <= 0;
+        }
+      }
+
+      if (!is_paused) {
+        float end_time = anim->get_end_time();
+        time += delta_time * speed;
+        if (time >= end_time || time < 0) {
+          if (is_looping && end_time > 0) {
+            time = fmodf(time, end_time);
+            if (time < 0) time += end_time;
+          } else {
+            time = time < 0 ? 0 : end_time;
+            is_paused = true;
+          }
+        }
+      }
+      return faded_out;
+    }
+  public:
+    RESOURCE_META(animation_layer)
+
+    enum blend_mode_t {
+      /// move the pose towards this animation by the layer's weight.
+      blend_override,
+
+      /// add the difference between this animation and its first frame to the pose.
+      blend_additive,
+    };
+
+    /// Make a layer. Use animation_mixer::add_layer() to play it.
+    animation_layer(animation *anim = 0, int mode = blend_override, float weight = 1, bool is_looping = true) {
+      this->anim = anim;
+      this->mode = mode;
+      this->weight = weight;
+      this->is_looping = is_looping;
+      time = 0;
+      speed = 1;
+      fade_target = weight;
+      fade_rate = 0;
+      is_paused = false;
+      fade_finished = false;
+      bound = false;
+    }
+
+    /// Serialise
+    void visit(visitor &v) {
+      v.visit(anim, atom_anim);
+      v.visit(time, atom_time);
+      v.visit(speed, atom_speed);
+      v.visit(weight, atom_weight);
+      v.visit(mode, atom_mode);
+      v.visit(is_looping, atom_is_looping);
+      v.visit(is_paused, atom_is_paused);
+      v.visit(mask, atom_mask);
+      if (v.is_reader()) {
+        fade_target = weight;
+        fade_rate = 0;
+        fade_finished = false;
+        bound = false;
+      }
+    }
+
+    /// get the animation.
+    animation *get_anim() const {
+      return anim;
+    }
+
+    /// blend_override or blend_additive.
+    int get_mode() const {
+      return mode;
+    }
+
+    /// current time in seconds.
+    float get_time() const {
+      return time;
+    }
+
+    /// jump to a time in seconds.
+    void set_time(float value) {
+      time = value;
+    }
+
+    /// Playback speed: 1 is normal, negative plays backwards.
+    void set_speed(float value) {
+      speed = value;
+    }
+
+    /// get the playback speed.
+    float get_speed() const {
+      return speed;
+    }
+
+    /// get the weight: 0 has no effect, 1 is the full effect.
+    float get_weight() const {
+      return weight;
+    }
+
+    /// set the weight at once, stopping any fade.
+    void set_weight(float value) {
+      weight = fade_target = value;
+      fade_rate = 0;
+      fade_finished = false;
+    }
+
+    /// Change the weight smoothly over a number of seconds.
+    /// A layer in an animation_mixer is removed when it finishes fading to zero.
+    void fade_to(float value, float duration) {
+      fade_target = value;
+      if (duration <= 0 || value == weight) {
+        set_weight(value);
+        fade_finished = value <= 0;
+      } else {
+        fade_rate = (value - weight) / duration;
+      }
+    }
+
+    /// true while fade_to() is changing the weight.
+    bool is_fading() const {
+      return fade_rate != 0;
+    }
+
+    /// Stop or restart the clock.
+    void set_paused(bool value) {
+      is_paused = value;
+    }
+
+    /// true if the layer is paused or a non-looping animation has reached its end.
+    bool get_paused() const {
+      return is_paused;
+    }
+
+    /// Set the weight of each joint (see animation_mixer::make_mask()). An empty mask drives every joint.
+    void set_mask(const dynarray<float> &value) {
+      mask = value;
+    }
+
+    /// get the weight of each joint; empty for every joint.
+    const dynarray<float> &get_mask() const {
+      return mask;
+    }
+  };
+
+  /// Plays and blends layers of animations on a skeleton.
+  ///
+  /// Layers are applied in order, starting from the skeleton's rest pose. Override layers
+  /// are weighted against each other, so two layers at 0.5 during a crossfade give half of
+  /// each; the rest pose only makes up any total weight under one. Additive layers add their
+  /// animation's movement relative to its first frame (eg. breathing or a flinch on top of a run).
+  /// Masks restrict a layer to some joints, eg. an upper body aim on top of legs that walk.
+  ///
+  /// Example:
+  ///
+  ///     ref<animation_mixer> mixer = new animation_mixer(skel);
+  ///     mixer->add_layer(walk);
+  ///     animation_layer *aim = mixer->add_layer(aim_anim);
+  ///     dynarray<float> upper;
+  ///     mixer->make_mask(upper, app_utils::get_atom("spine"));
+  ///     aim->set_mask(upper);
+  ///     app_scene->add_animation_mixer(mixer);
+  ///     ...
+  ///     mixer->crossfade(run, 0.3f);
+  class animation_mixer : public resource {
+    ref<skeleton> skel;
+    dynarray<ref<animation_layer> > layers;
+
+    // the skeleton's nodes' transforms.
+    pose_buffer rest;
+
+    // the blended result of the last update().
+    pose_buffer pose;
+
+    // per joint during update(): the override weight so far, and how far to blend the current layer.
+    dynarray<float> override_weight;
+    dynarray<float> blend_factor;
+
+    // (re)read the rest pose and bind any new layers.
+    void bind() {
+      if (rest.size() != (unsigned)skel->get_num_joints()) {
+        skel->get_rest_pose(rest);
+        for (unsigned i = 0; i != layers.size(); ++i) {
+          layers[i]->bound = false;
+        }
+      }
+      for (unsigned i = 0; i != layers.size(); ++i) {
+        animation_layer *layer = layers[i];
+        if (!layer->bound) {
+          layer->bind(skel, rest);
+        }
+      }
+    }
+  public:
+    RESOURCE_META(animation_mixer)
+
+    /// Make a mixer for a skeleton.
+    animation_mixer(skeleton *skel = 0) {
+      this->skel = skel;
+    }
+
+    /// The skeleton goes back to following its nodes.
+    ~animation_mixer() {
+      clear_pose();
+    }
+
+    /// Serialise
+    void visit(visitor &v) {
+      if (v.is_reader()) clear_pose();
+      v.visit(skel, atom_skel);
+      v.visit(layers, atom_layers);
+      if (v.is_reader()) {
+        rest.resize(0);
+      }
+    }
+
+    /// Play an animation on top of the existing layers.
+    animation_layer *add_layer(animation *anim, int mode = animation_layer::blend_override, float weight = 1, bool is_looping = true) {
+      animation_layer *layer = new animation_layer(anim, mode, weight, is_looping);
+      layers.push_back(layer);
+      return layer;
+    }
+
+    /// Stop playing a layer.
+    void remove_layer(animation_layer *layer) {
+      for (unsigned i = 0; i != layers.size(); ++i) {
+        if (layers[i] == layer) {
+          layers.erase(i);
+          return;
+        }
+      }
+    }
+
+    /// Fade in an animation over duration seconds while the override layers playing now fade out.
+    animation_layer *crossfade(animation *anim, float duration, bool is_looping = true) {
+      for (unsigned i = 0; i != layers.size(); ++i) {
+        if (layers[i]->mode == animation_layer::blend_override) {
+          layers[i]->fade_to(0, duration);
+        }
+      }
+      animation_layer *layer = add_layer(anim, animation_layer::blend_override, 0, is_looping);
+      layer->fade_to(1, duration);
+      return layer;
+    }
+
+    /// number of layers.
+    unsigned get_num_layers() const {
+      return layers.size();
+    }
+
+    /// get a layer; the first is applied first.
+    animation_layer *get_layer(unsigned index) const {
+      return layers[index];
+    }
+
+    /// Make a joint mask of weight for a joint and all the joints below it and zero for the rest.
+    void make_mask(dynarray<float> &mask, atom_t root_sid, float weight = 1) const {
+      unsigned num_joints = (unsigned)skel->get_num_joints();
+      int root = skel->find_joint(root_sid);
+      mask.resize(num_joints);
+      for (unsigned i = 0; i != num_joints; ++i) {
+        int parent = skel->get_parent(i);
+        mask[i] = (int)i == root || (parent >= 0 && mask[parent] != 0) ? weight : 0;
+      }
+    }
+
+    /// Advance the layers, blend them and drive the skeleton with the result.
+    void update(float delta_time) {
+      if (!skel) return;
+      bind();
+
+      // the rest pose has whatever weight the override layers leave below one.
+      unsigned num_joints = rest.size();
+      override_weight.resize(num_joints);
+      blend_factor.resize(num_joints);
+      for (unsigned j = 0; j != num_joints; ++j) {
+        override_weight[j] = 0;
+      }
+      for (unsigned i = 0; i != layers.size(); ++i) {
+        animation_layer *layer = layers[i];
+        if (layer->weight > 0 && layer->mode == animation_layer::blend_override) {
+          const float *mask = layer->mask.size() ? layer->mask.data() : 0;
+          for (unsigned j = 0; j != num_joints; ++j) {
+            override_weight[j] += mask ? layer->weight * mask[j] : layer->weight;
+          }
+        }
+      }
+      for (unsigned j = 0; j != num_joints; ++j) {
+        override_weight[j] = override_weight[j] < 1 ? 1 - override_weight[j] : 0;
+      }
+
+      // each override layer moves the pose to the weighted average of the rest pose and the layers so far.
+      pose = rest;
+      for (unsigned i = 0; i != layers.size(); ) {
+        animation_layer *layer = layers[i];
+        const float *mask = layer->mask.size() ? layer->mask.data() : 0;
+        if (layer->weight > 0) {
+          layer->anim->eval_joints(layer->time, layer->cursors.data(), layer->channel_joints.data(), layer->sample);
+          if (layer->mode == animation_layer::blend_additive) {
+            pose.add(layer->sample, layer->reference, layer->weight, mask);
+          } else {
+            for (unsigned j = 0; j != num_joints; ++j) {
+              float w = mask ? layer->weight * mask[j] : layer->weight;
+              override_weight[j] += w;
+              blend_factor[j] = override_weight[j] > 0 ? w / override_weight[j] : 0;
+            }
+            pose.blend(layer->sample, 1, blend_factor.data());
+          }
+        }
+        if (layer->advance(delta_time)) {
+          layers.erase(i);
+        } else {
+          ++i;
+        }
+      }
+
+      skel->set_pose(pose);
+    }
+
+    /// Stop driving the skeleton: it goes back to following its nodes until the next update().
+    /// visual_scene calls this when the mixer is deleted.
+    void clear_pose() {
+      if (skel) skel->clear_pose();
+    }
+
+    /// the skeleton being driven.
+    skeleton *get_skeleton() const {
+      return skel;
+    }
+
+    /// the blended pose from the last update().
+    const pose_buffer &get_pose() const {
+      return pose;
+    }
+  };
+} }
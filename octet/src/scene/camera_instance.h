@@ -144,6 +144,11 @@ namespace octet { namespace scene {
       return cameraToProjection;
     }
 
+    /// get the view volume in world space for culling; call set_cameraToWorld first.
+    frustum get_frustum() const {
+      return frustum(worldToCamera * cameraToProjection);
+    }
+
     /// return a ray from screen (x, y) to the far plane; used for picking.
     ray get_ray(float x, float y) {
       vec4 ray_start, ray_end;
@@ -175,7 +180,7 @@ namespace octet { namespace scene {
       mat4t result;
       result.loadIdentity();
       if (node) {
-        mat4t worldToCamera = node->calcModelToWorld().inverse3x4();
+        const mat4t &worldToCamera = node->get_worldToNode();
         result = worldToCamera * cameraToProjection;
       }
       return result;
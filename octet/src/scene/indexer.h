@@ -58,6 +58,7 @@ namespace octet { namespace scene {
       if (get_index_type() != GL_UNSIGNED_INT) return;
 
       hash_map<vertex, unsigned, vertex_cmp> vertex_to_index;
+      vertex_to_index.reserve(get_num_vertices());
 
       dynarray<uint8_t> dest_vertices;
       dynarray<uint32_t> dest_indices;
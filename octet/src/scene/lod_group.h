@@ -0,0 +1,128 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Level of detail chain for a mesh instance
+//
+
+namespace octet { namespace scene {
+  /// A chain of meshes for one object, from the most detailed to the least.
+  ///
+  /// Each level has an error: how far (in model units) its surface may be from the real shape.
+  /// Give the group to mesh_instance::set_lod_group() and the visual_scene draws one level
+  /// per instance, the coarsest whose error covers no more than max_pixel_error pixels on screen.
+  ///
+  /// Example:
+  ///
+  ///     lod_group *lod = new lod_group();
+  ///     lod->add_level(new mesh_sphere(vec3(0), 1, 3), 0.005f);
+  ///     lod->add_level(new mesh_sphere(vec3(0), 1, 1), 0.07f);
+  ///     mesh_instance *mi = new mesh_instance(node, 0, mat);
+  ///     mi->set_lod_group(lod);
+  ///     app_scene->add_mesh_instance(mi);
+  class lod_group : public resource {
+    // one of each per level, errors increasing.
+    dynarray<ref<mesh> > meshes;
+    dynarray<ref<material> > materials;
+    dynarray<float> errors;
+
+    // most pixels of error we will put up with (before the scene's LOD bias).
+    float max_pixel_error;
+
+    // fraction of the error budget a coarser level must be below before we switch to it.
+    float hysteresis;
+
+  public:
+    RESOURCE_META(lod_group)
+
+    /// Make an empty chain; add_level() from the most detailed mesh to the least.
+    lod_group() {
+      max_pixel_error = 1.0f;
+      hysteresis = 0.25f;
+    }
+
+    /// Serialise
+    void visit(visitor &v) {
+      v.visit(meshes, atom_meshes);
+      v.visit(materials, atom_materials);
+      v.visit(errors, atom_errors);
+    }
+
+    /// Add a level, coarser than the ones before it.
+    /// error is the greatest distance between this mesh and the real shape in model units.
+    /// mat overrides the instance's material (eg. a cheaper shader far away); null uses the instance's.
+    void add_level(mesh *msh, float error, material *mat = 0) {
+      assert(errors.size() == 0 || error >= errors.back());
+      meshes.push_back(msh);
+      materials.push_back(mat);
+      errors.push_back(error);
+    }
+
+    /// Pick a level to draw.
+    /// pixels_per_unit is the size on screen of one model unit at the object's distance.
+    /// bias multiplies the error budget: above one uses coarser levels (faster), below one finer levels.
+    /// current is the level drawn last frame; we only move to a coarser level once it is well
+    /// inside the budget, so objects near a switch distance do not flick between levels.
+    unsigned select_level(float pixels_per_unit, float bias, unsigned current) const {
+      unsigned num_levels = errors.size();
+      if (num_levels <= 1) return 0;
+
+      float budget = max_pixel_error * bias;
+      unsigned level = 0;
+      while (level + 1 != num_levels && errors[level + 1] * pixels_per_unit <= budget) {
+        level++;
+      }
+
+      if (level > current) {
+        float strict_budget = budget * (1.0f - hysteresis);
+        while (level > current && errors[level] * pixels_per_unit > strict_budget) {
+          level--;
+        }
+      }
+      return level;
+    }
+
+    /// number of levels.
+    unsigned get_num_levels() const {
+      return meshes.size();
+    }
+
+    /// mesh to draw for a level.
+    mesh *get_mesh(unsigned level) const {
+      return meshes[level];
+    }
+
+    /// material override for a level, or null to use the instance's material.
+    material *get_material(unsigned level) const {
+      return materials[level];
+    }
+
+    /// error of a level in model units.
+    float get_error(unsigned level) const {
+      return errors[level];
+    }
+
+    /// Most pixels of error allowed on screen (default 1).
+    void set_max_pixel_error(float value) {
+      max_pixel_error = value;
+    }
+
+    /// Most pixels of error allowed on screen.
+    float get_max_pixel_error() const {
+      return max_pixel_error;
+    }
+
+    /// Fraction of the error budget that a coarser level must be under before we switch to it (default 0.25).
+    /// Zero switches as soon as a level is good enough, which may flicker at the boundary.
+    void set_hysteresis(float value) {
+      hysteresis = value;
+    }
+
+    /// Fraction of the error budget that a coarser level must be under before we switch to it.
+    float get_hysteresis() const {
+      return hysteresis;
+    }
+  };
+} }
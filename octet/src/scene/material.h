@@ -18,12 +18,75 @@ namespace octet { namespace scene {
   class material : public resource {
     ref<param_shader> custom_shader;
 
+    // instanced version of custom_shader, made when first needed from instanced_vs_url.
+    ref<param_shader> instanced_shader;
+    const char *instanced_vs_url;
+
+    // uniform locations of the params in instanced_shader
+    dynarray<GLint> instanced_uniforms;
+    GLint instanced_cameraToProjection;
+
+    // skinned version of custom_shader, made when first needed from skinned_vs_url.
+    ref<param_shader> skinned_shader;
+    const char *skinned_vs_url;
+
+    // uniform locations of the params, the matrices and the joints in skinned_shader
+    dynarray<GLint> skinned_uniforms;
+    GLint skinned_draw_uniforms[2];
+    GLint skinned_joint_texture;
+    GLint skinned_joint_rows;
+
     // Parameters connect colors and other values to uniform buffers.
-    dynarray<ref<param> > params;
+    small_dynarray<ref<param>, 8> params;
 
     //dynarray<uint8_t> static_buffer;
     dynarray<uint8_t> buffer;
 
+    // the params we set on every draw, found once when the params are made
+    // so that we do not look them up by name every time.
+    param_uniform *modelToProjection_param;
+    param_uniform *modelToCamera_param;
+    param_uniform *lighting_param;
+    param_uniform *num_lights_param;
+
+    // changes whenever any value other than the matrices and lighting does (see get_static_version()).
+    uint32_t static_version;
+
+    // the lighting_block version in the lighting params.
+    uint32_t lighting_version;
+
+    #if OCTET_UNIFORM_BUFFERS
+      // the octet_material uniform block on the GPU and the static_version it holds.
+      GLuint static_ubo;
+      uint32_t static_ubo_version;
+    #endif
+
+    // versions are unique across all materials, so a shader can tell whose values it has.
+    static uint32_t next_version() {
+      static uint32_t version = 0;
+      return ++version;
+    }
+
+    void init_state() {
+      instanced_vs_url = 0;
+      skinned_vs_url = 0;
+      modelToProjection_param = modelToCamera_param = lighting_param = num_lights_param = 0;
+      static_version = next_version();
+      lighting_version = 0;
+      #if OCTET_UNIFORM_BUFFERS
+        static_ubo = 0;
+        static_ubo_version = 0;
+      #endif
+    }
+
+    // look up the params we set on every draw.
+    void find_dynamic_params() {
+      modelToProjection_param = get_param_uniform(atom_modelToProjection);
+      modelToCamera_param = get_param_uniform(atom_modelToCamera);
+      lighting_param = get_param_uniform(atom_lighting);
+      num_lights_param = get_param_uniform(atom_num_lights);
+    }
+
     // create the parameters that change frequently such as the matrices and lighting
     void create_dynamic_params() {
       buffer.reserve(0x200);
@@ -35,6 +98,135 @@ namespace octet { namespace scene {
       params.push_back(new param_uniform(dynamic_pbi, NULL, atom_num_lights, GL_INT, 1, param::stage_fragment));
     }
 
+    // copy a value to the buffer, changing the version only if it is different.
+    void update_value(param_uniform *param, const void *value, unsigned size) {
+      uint8_t *dest = buffer.data() + param->get_offset();
+      if (memcmp(dest, value, size)) {
+        memcpy(dest, value, size);
+        static_version = next_version();
+      }
+    }
+
+    // put the lighting in the buffer. It changes whenever the camera moves, so it has its own
+    // version (from lighting_block) and does not change static_version.
+    void set_lighting_values(vec4 *light_uniforms, int num_light_uniforms, int num_lights) {
+      uint32_t version = lighting_block::get().update(light_uniforms, num_light_uniforms, num_lights);
+      if (version == lighting_version) return;
+      if (lighting_param) lighting_param->set_value(buffer.data(), light_uniforms, sizeof(vec4) * num_light_uniforms);
+      if (num_lights_param) num_lights_param->set_value(buffer.data(), &num_lights, sizeof(int32_t));
+      lighting_version = version;
+    }
+
+    // set the matrices: in the uniform_ring if the shader has an octet_draw block, otherwise with glUniform*.
+    // locations are the matrix uniforms in shader if it is not custom_shader.
+    void render_draw_values(param_shader *shader, const mat4t &modelToProjection, const mat4t &modelToCamera, const GLint *locations = NULL) {
+      param_uniform *draw_params[2] = { modelToProjection_param, modelToCamera_param };
+      const mat4t *values[2] = { &modelToProjection, &modelToCamera };
+
+      #if OCTET_UNIFORM_BUFFERS
+        unsigned block_size = shader->get_draw_block_size();
+        uint8_t block[uniform_ring::max_draw_size];
+        assert(block_size <= sizeof(block));
+      #endif
+
+      for (unsigned i = 0; i != 2; ++i) {
+        param_uniform *p = draw_params[i];
+        if (!p) continue;
+        p->set_value(buffer.data(), values[i]->get(), sizeof(mat4t));
+        #if OCTET_UNIFORM_BUFFERS
+          if (p->get_uniform_buffer_index() == param_uniform::buffer_dynamic) {
+            p->write_block(block, buffer.data());
+            continue;
+          }
+        #endif
+        if (locations) {
+          p->render_at(buffer.data(), locations[i]);
+        } else {
+          p->render(buffer.data());
+        }
+      }
+
+      #if OCTET_UNIFORM_BUFFERS
+        if (block_size) {
+          uniform_ring::get().push(uniform_ring::draw_binding, block, block_size);
+        }
+      #endif
+    }
+
+    // set everything but the matrices in a shader, skipping the glUniform* calls if it already has our values.
+    // locations are the uniforms in shader if it is not custom_shader.
+    void render_static_values(param_shader *shader, const GLint *locations) {
+      bool up_to_date = shader->get_uniform_version() == static_version;
+      bool lighting_up_to_date = shader->get_lighting_version() == lighting_version;
+
+      #if OCTET_UNIFORM_BUFFERS
+        unsigned block_size = shader->get_material_block_size();
+        if (block_size) {
+          if (static_ubo_version != static_version) {
+            upload_static_block(block_size);
+          }
+          glBindBufferBase(GL_UNIFORM_BUFFER, uniform_ring::material_binding, static_ubo);
+        }
+        unsigned lighting_size = shader->get_lighting_block_size();
+        if (lighting_size && lighting_block::get().needs_upload(lighting_size)) {
+          upload_lighting_block(lighting_size);
+        }
+      #endif
+
+      for (unsigned i = 0; i != params.size(); ++i) {
+        param_uniform *pu = params[i]->get_param_uniform();
+        if (!pu || pu == modelToProjection_param || pu == modelToCamera_param) continue;
+        if (pu == lighting_param || pu == num_lights_param) {
+          if (!lighting_up_to_date && pu->get_uniform_buffer_index() == param_uniform::buffer_none) {
+            pu->render_at(buffer.data(), locations ? locations[i] : pu->get_uniform());
+          }
+          continue;
+        }
+        if (up_to_date || pu->get_uniform_buffer_index() != param_uniform::buffer_none) {
+          // textures are global state, so they are bound whenever we switch materials.
+          pu->bind_textures();
+        } else {
+          //printf("%s: %d off=%x\n", app_utils::get_atom_name(pu->get_name()), pu->get_uniform_buffer_index(), pu->get_offset());
+          pu->render_at(buffer.data(), locations ? locations[i] : pu->get_uniform());
+        }
+      }
+      shader->set_uniform_version(static_version);
+      shader->set_lighting_version(lighting_version);
+    }
+
+    #if OCTET_UNIFORM_BUFFERS
+      // copy the static values to the octet_material block on the GPU.
+      void upload_static_block(unsigned block_size) {
+        dynarray<uint8_t> block(block_size);
+        memset(block.data(), 0, block_size);
+        for (unsigned i = 0; i != params.size(); ++i) {
+          param_uniform *pu = params[i]->get_param_uniform();
+          if (pu && pu->get_uniform_buffer_index() == param_uniform::buffer_static) {
+            pu->write_block(block.data(), buffer.data());
+          }
+        }
+
+        if (!static_ubo) glGenBuffers(1, &static_ubo);
+        glBindBuffer(GL_UNIFORM_BUFFER, static_ubo);
+        glBufferData(GL_UNIFORM_BUFFER, block_size, block.data(), GL_DYNAMIC_DRAW);
+        static_ubo_version = static_version;
+      }
+
+      // copy the lighting to the octet_lighting block shared by all materials.
+      void upload_lighting_block(unsigned block_size) {
+        dynarray<uint8_t> block(block_size);
+        memset(block.data(), 0, block_size);
+        param_uniform *lighting_params[2] = { lighting_param, num_lights_param };
+        for (unsigned i = 0; i != 2; ++i) {
+          param_uniform *pu = lighting_params[i];
+          if (pu && pu->get_uniform_buffer_index() == param_uniform::buffer_lighting) {
+            pu->write_block(block.data(), buffer.data());
+          }
+        }
+        lighting_block::get().upload(block.data(), block_size);
+      }
+    #endif
+
     // create the attribute parameters
     void create_attribute_params() {
       params.push_back(new param_attribute(atom_pos, GL_FLOAT_VEC4));
@@ -53,12 +245,14 @@ namespace octet { namespace scene {
 
     /// Default constructor makes a blank material.
     material() {
+      init_state();
     }
 
     /// Alternative constructor.
     material(const vec4 &color, param_shader *shader = NULL) {
       // materials are constructed from parameters which build the final shader.
       // this allows us to use OpenGLES2 (uniforms) and 3 (buffers) as well as new shader features.
+      init_state();
       params.reserve(16);
 
       create_dynamic_params();
@@ -66,9 +260,12 @@ namespace octet { namespace scene {
 
       param_buffer_info static_pbi(buffer);
       params.push_back(new param_color(static_pbi, color, atom_diffuse, param::stage_fragment));
+      find_dynamic_params();
 
       if (shader == NULL) {
         shader = new param_shader("shaders/default.vs", "shaders/default_solid.fs");
+        instanced_vs_url = "shaders/default_instanced.vs";
+        skinned_vs_url = "shaders/default_skinned.vs";
       }
       shader->init(params);
       custom_shader = shader;
@@ -76,6 +273,7 @@ namespace octet { namespace scene {
 
     /// create a material from an existing image
     material(image *img, sampler *smpl = NULL, param_shader *shader = NULL) {
+      init_state();
       if (!smpl) smpl = new sampler();
 
       params.reserve(16);
@@ -85,15 +283,25 @@ namespace octet { namespace scene {
 
       param_buffer_info static_pbi(buffer);
       params.push_back(new param_sampler(static_pbi, atom_diffuse_sampler, img, smpl, param::stage_fragment));
+      find_dynamic_params();
 
       if (shader == NULL) {
         shader = new param_shader("shaders/default.vs", "shaders/default_textured.fs");
         shader->init(params);
+        instanced_vs_url = "shaders/default_instanced.vs";
+        skinned_vs_url = "shaders/default_skinned.vs";
       }
       custom_shader = shader;
     }
 
     material(param *diffuse, param *ambient, param *emission, param *specular, param *bump, param *shininess) {
+      init_state();
+    }
+
+    ~material() {
+      #if OCTET_UNIFORM_BUFFERS
+        if (static_ubo) glDeleteBuffers(1, &static_ubo);
+      #endif
     }
 
     /// Serialize.
@@ -107,39 +315,106 @@ namespace octet { namespace scene {
       log("lu[1] = %s\n", light_uniforms[1].toString(tmp, sizeof(tmp)));
       log("lu[2] = %s\n", light_uniforms[2].toString(tmp, sizeof(tmp)));
       log("lu[3] = %s\n", light_uniforms[3].toString(tmp, sizeof(tmp)));*/
-      {
-        // matrices and lighting go in the dynamic uniform buffer
-        param_uniform *modelToProjection_param = get_param_uniform(atom_modelToProjection);
-        if (modelToProjection_param) modelToProjection_param->set_value(buffer.data(), modelToProjection.get(), sizeof(modelToProjection));
+      custom_shader->render();
 
-        param_uniform *modelToCamera_param = get_param_uniform(atom_modelToCamera);
-        if (modelToCamera_param) modelToCamera_param->set_value(buffer.data(), modelToCamera.get(), sizeof(modelToCamera));
+      render_uniforms(modelToProjection, modelToCamera, light_uniforms, num_light_uniforms, num_lights);
+    }
 
-        param_uniform *lighting_param = get_param_uniform(atom_lighting);
-        if (lighting_param) lighting_param->set_value(buffer.data(), light_uniforms, sizeof(vec4) * num_light_uniforms);
+    /// Set the uniforms for this material when its shader is already in use.
+    /// Colours and textures are only sent again if they have changed or another material
+    /// has used the shader since; the lighting only if it has changed.
+    void render_uniforms(const mat4t &modelToProjection, const mat4t &modelToCamera, vec4 *light_uniforms, int num_light_uniforms, int num_lights) {
+      set_lighting_values(light_uniforms, num_light_uniforms, num_lights);
+      render_static_values(custom_shader, NULL);
+      render_draw_values(custom_shader, modelToProjection, modelToCamera);
+    }
 
-        param_uniform *num_lights_param = get_param_uniform(atom_num_lights);
-        if (num_lights_param) num_lights_param->set_value(buffer.data(), &num_lights, sizeof(int32_t));
+    /// Set only the matrices, for another draw straight after rendering this material.
+    /// The colours, textures and lighting are left as they are.
+    void render_matrices(const mat4t &modelToProjection, const mat4t &modelToCamera) {
+      render_draw_values(custom_shader, modelToProjection, modelToCamera);
+    }
+
+    /// get the shader used by this material.
+    param_shader *get_shader() const {
+      return custom_shader;
+    }
+
+    /// Use an instanced version of a custom shader's vertex shader for drawing many copies of a mesh at once.
+    /// The vertex shader gets the model to camera matrix from the instance_modelToCamera attribute
+    /// and has a cameraToProjection uniform (see shaders/default_instanced.vs).
+    /// Materials using the default shaders have one already.
+    void set_instanced_vertex_shader(const char *vs_url) {
+      instanced_vs_url = vs_url;
+      instanced_shader = 0;
+    }
+
+    /// get the instanced shader, compiling it if necessary. Returns null if there isn't one.
+    param_shader *get_instanced_shader() {
+      if (!instanced_shader && instanced_vs_url && custom_shader) {
+        instanced_shader = custom_shader->make_variant(instanced_vs_url);
+        instanced_shader->compile();
+        instanced_cameraToProjection = glGetUniformLocation(instanced_shader->get_program(), "cameraToProjection");
+        instanced_uniforms.resize(0);
       }
+      return instanced_shader;
+    }
 
-      custom_shader->render();
+    /// Set the uniforms for drawing instances with the instanced shader, when it is in use.
+    /// The matrices come from the instance attributes.
+    void render_instanced_uniforms(const mat4t &cameraToProjection, vec4 *light_uniforms, int num_light_uniforms, int num_lights) {
+      // find the params in the instanced shader (more may have been added since last time).
+      GLint program = instanced_shader->get_program();
+      for (unsigned i = instanced_uniforms.size(); i != params.size(); ++i) {
+        param_uniform *pu = params[i]->get_param_uniform();
+        instanced_uniforms.push_back(pu ? glGetUniformLocation(program, pu->get_atom_name()) : -1);
+      }
 
-      {
-        // colours and textures go in the static uniform buffer
-        for (unsigned i = 0; i != params.size(); ++i) {
-          param_uniform *pu = params[i]->get_param_uniform();
-          if (pu) {
-            //printf("%s: %d off=%x\n", app_utils::get_atom_name(pu->get_name()), pu->get_uniform_buffer_index(), pu->get_offset());
-            pu->render(buffer.data());
-          }
-        }
+      set_lighting_values(light_uniforms, num_light_uniforms, num_lights);
+      glUniformMatrix4fv(instanced_cameraToProjection, 1, GL_FALSE, cameraToProjection.get());
+      render_static_values(instanced_shader, instanced_uniforms.data());
+    }
+
+    /// Use a skinned version of a custom shader's vertex shader for meshes skinned on the GPU.
+    /// The vertex shader reads the joints from a joint_texture (see shaders/default_skinned.vs).
+    /// Materials using the default shaders have one already.
+    void set_skinned_vertex_shader(const char *vs_url) {
+      skinned_vs_url = vs_url;
+      skinned_shader = 0;
+    }
+
+    /// get the skinned shader, compiling it if necessary. Returns null if there isn't one.
+    param_shader *get_skinned_shader() {
+      if (!skinned_shader && skinned_vs_url && custom_shader) {
+        skinned_shader = custom_shader->make_variant(skinned_vs_url);
+        skinned_shader->compile();
+        GLint program = skinned_shader->get_program();
+        skinned_draw_uniforms[0] = glGetUniformLocation(program, "modelToProjection");
+        skinned_draw_uniforms[1] = glGetUniformLocation(program, "modelToCamera");
+        skinned_joint_texture = glGetUniformLocation(program, "joint_texture");
+        skinned_joint_rows = glGetUniformLocation(program, "joint_rows");
+        skinned_uniforms.resize(0);
       }
+      return skinned_shader;
     }
 
-    /// Set the uniforms for this material on skinned meshes.
-    void render_skinned(const mat4t &cameraToProjection, const mat4t *modelToCamera, int num_nodes, vec4 *light_uniforms, int num_light_uniforms, int num_lights) const {
-      //shader.render_skinned(cameraToProjection, modelToCamera, num_nodes, light_uniforms, num_light_uniforms, num_lights);
-      //bind_textures();
+    /// Set the uniforms for drawing a mesh skinned on the GPU with the skinned shader, when it is in use.
+    /// The joints are in model space, as the vertices.
+    void render_skinned(const mat4t &modelToProjection, const mat4t &modelToCamera, const joint_texture *joints, vec4 *light_uniforms, int num_light_uniforms, int num_lights) {
+      // find the params in the skinned shader (more may have been added since last time).
+      GLint program = skinned_shader->get_program();
+      for (unsigned i = skinned_uniforms.size(); i != params.size(); ++i) {
+        param_uniform *pu = params[i]->get_param_uniform();
+        skinned_uniforms.push_back(pu ? glGetUniformLocation(program, pu->get_atom_name()) : -1);
+      }
+
+      set_lighting_values(light_uniforms, num_light_uniforms, num_lights);
+      render_static_values(skinned_shader, skinned_uniforms.data());
+      render_draw_values(skinned_shader, modelToProjection, modelToCamera, skinned_draw_uniforms);
+
+      joints->bind();
+      glUniform1i(skinned_joint_texture, joint_texture::texture_unit);
+      glUniform1f(skinned_joint_rows, (float)joints->get_num_rows());
     }
 
     /// get a named parameter
@@ -160,13 +435,19 @@ namespace octet { namespace scene {
 
     /// set the diffuse color parameter (if it exists)
     void set_diffuse(const vec4 &color) {
-      if (param *p = get_param_uniform(atom_diffuse)) {
-        p->get_param_uniform()->set_value(buffer.data(), &color, sizeof(color));
+      if (param_uniform *p = get_param_uniform(atom_diffuse)) {
+        update_value(p, &color, sizeof(color));
       }
     }
 
+    /// set the value of one of our uniforms. It is sent to the GPU the next time we render.
     void set_uniform(param_uniform *param, const void *data, size_t size) {
-      memcpy(buffer.data() + param->get_offset(), data, size);
+      update_value(param, data, (unsigned)size);
+    }
+
+    /// Get a number that changes whenever a colour, texture or other value (but not a matrix or the lighting) changes.
+    uint32_t get_static_version() const {
+      return static_version;
     }
 
     dynarray<ref<param> > &get_params() {
@@ -178,9 +459,10 @@ namespace octet { namespace scene {
       param_uniform *result = new param_uniform(pbi, data, name, _type, _repeat, _stage);
       params.push_back(result);
 
-      param_bind_info pbind;
-      pbind.program = custom_shader->get_program();
+      param_bind_info pbind = custom_shader->get_bind_info();
       result->bind(pbind);
+      find_dynamic_params();
+      static_version = next_version();
       return result;
     }
 
@@ -190,9 +472,9 @@ namespace octet { namespace scene {
       param_sampler *result = new param_sampler(pbi, name, _image, _sampler, _stage);
       params.push_back(result);
 
-      param_bind_info pbind;
-      pbind.program = custom_shader->get_program();
+      param_bind_info pbind = custom_shader->get_bind_info();
       result->bind(pbind);
+      static_version = next_version();
       return result;
     }
   };
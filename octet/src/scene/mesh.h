@@ -25,6 +25,12 @@ namespace octet { namespace scene {
       }
     };
 
+    /// ways of drawing a skinned mesh (see set_skinning_mode()).
+    enum {
+      skinning_gpu,
+      skinning_cpu,
+    };
+
     // sortable edge
     struct edge {
       int32_t idx0;
@@ -51,12 +57,41 @@ namespace octet { namespace scene {
 
     uint8_t num_slots;
 
+    // skinning_gpu or skinning_cpu
+    uint8_t skinning_mode;
+
     // optional skin
     ref<skin> mesh_skin;
     
     // bounding box
     aabb mesh_aabb;
 
+    // false until set_aabb() or calc_aabb(); get_aabb() then calculates it from the vertices.
+    bool has_aabb;
+
+    // a triangle for ray_cast(): positions copied from the vertices and the indices they came from.
+    struct ray_cast_triangle {
+      vec3p pos[3];
+      uint32_t idx[3];
+    };
+
+    // triangles for ray_cast(), built when first needed.
+    bvh<ray_cast_triangle> triangle_tree;
+    bool triangle_tree_valid;
+
+    // what the tree was built from. If any of this changes, the tree is rebuilt.
+    struct triangle_tree_key {
+      const gl_resource *vertices;
+      const gl_resource *indices;
+      unsigned vertices_version;
+      unsigned indices_version;
+      uint32_t num_indices;
+      uint32_t first_index;
+      uint32_t stride;
+      uint32_t pos_offset;
+    };
+    triangle_tree_key tree_key;
+
     struct general_vertex {
       const uint8_t *bytes;
       unsigned size;
@@ -175,8 +210,12 @@ namespace octet { namespace scene {
       num_slots = rhs.num_slots;
       index_type = rhs.index_type;
       mode = rhs.mode;
+      skinning_mode = rhs.skinning_mode;
 
       mesh_skin = rhs.mesh_skin;
+      mesh_aabb = rhs.mesh_aabb;
+      has_aabb = rhs.has_aabb;
+      triangle_tree_valid = false;
     }
 
     /// Init function used for aggregated meshes.
@@ -197,8 +236,11 @@ namespace octet { namespace scene {
       num_slots = 0;
       index_type = GL_UNSIGNED_SHORT;
       mode = GL_TRIANGLES;
+      skinning_mode = skinning_gpu;
 
       mesh_skin = _skin;
+      has_aabb = false;
+      triangle_tree_valid = false;
 
       if (max_vertices || max_indices) {
         set_default_attributes();
@@ -221,6 +263,12 @@ namespace octet { namespace scene {
       v.visit(num_slots, atom_num_slots);
       v.visit(mesh_skin, atom_mesh_skin);
       v.visit(mesh_aabb, atom_aabb);
+      if (v.is_reader()) {
+        // an empty box was never set.
+        vec3 half_extent = mesh_aabb.get_half_extent();
+        has_aabb = half_extent.x() != 0 || half_extent.y() != 0 || half_extent.z() != 0;
+      }
+      triangle_tree_valid = false;
     }
 
     // Destructor
@@ -346,6 +394,17 @@ namespace octet { namespace scene {
       mode = value;
     }
 
+    /// How this mesh is skinned, if it has a skin: skinning_gpu or skinning_cpu.
+    unsigned get_skinning_mode() const {
+      return skinning_mode;
+    }
+
+    /// Skin on the GPU with a joint texture (the default) or on the CPU with a cpu_skinner (see scene/skinning.h).
+    /// The CPU is better for meshes with few vertices and many joints, or where vertex shaders cannot read textures.
+    void set_skinning_mode(unsigned value) {
+      skinning_mode = (uint8_t)value;
+    }
+
     /// set the optional skin
     /// note: the mesh state owns the skin.
     void set_skin(skin *value) {
@@ -355,10 +414,16 @@ namespace octet { namespace scene {
     /// set the axis aligned bounding box of the untransformed mesh
     void set_aabb(const aabb &value) {
       mesh_aabb = value;
+      has_aabb = true;
     }
 
-    /// get the axis aligned bounding box of the untransformed mesh
+    /// Get the axis aligned bounding box of the untransformed mesh.
+    /// If it has not been set, it is calculated from the vertices the first time;
+    /// call calc_aabb() again if they move later.
     aabb get_aabb() {
+      if (!has_aabb && get_num_vertices()) {
+        calc_aabb();
+      }
       return mesh_aabb;
     }
 
@@ -500,6 +565,19 @@ namespace octet { namespace scene {
       }
     }
 
+    /// Draw many copies of the primitives with one call. The shader tells the copies apart
+    /// with per instance attributes (see glVertexAttribDivisor) or gl_InstanceID.
+    void draw_instanced(unsigned num_instances) {
+      #if OCTET_INSTANCING
+        if (get_index_type()) {
+          indices->bind();
+          glDrawElementsInstanced(get_mode(), get_num_indices(), get_index_type(), (GLvoid*)(get_index_size() * first_index), num_instances);
+        } else {
+          glDrawArraysInstanced(get_mode(), 0, get_num_vertices(), num_instances);
+        }
+      #endif
+    }
+
     /// When rendering a mesh, call this last to disable attributes.
     void disable_attributes() {
       for (unsigned slot = 0; slot != get_num_slots(); ++slot) {
@@ -520,6 +598,7 @@ namespace octet { namespace scene {
       unsigned num_vertices = get_num_vertices();
       if (get_num_vertices() == 0) {
         mesh_aabb = aabb();
+        has_aabb = false;
         return;
       }
 
@@ -534,87 +613,140 @@ namespace octet { namespace scene {
         vmax = max(pos, vmax);
       }
       mesh_aabb = aabb((vmax + vmin) * 0.5f, (vmax - vmin) * 0.5f);
+      has_aabb = true;
+    }
+
+    /// Intersect a ray (org + dir * t) with a triangle.
+    /// returns "barycentric" coordinates as a numerator and denominator (see ray_cast).
+    static bool ray_cast_triangle_test(const vec3 &pa, const vec3 &pb, const vec3 &pc, const vec3 &org, const vec3 &dir, vec4 &numer, float &denom) {
+      vec3 a = pa - org;
+      vec3 b = pb - org;
+      vec3 c = pc - org;
+      vec3 d = dir;
+
+      // solve [ba, bb, bc, bd] * [[ax, ay, az, 1], [bx, by, bz, 1], [cx, cy, cz, 1], [-dx, -dy, -dz, 0]] = [0, 0, 0, 1]
+      //
+      // ie. ba + bb + bc = 1  and  ba * a + bb * b + bc * c = bd * d
+      //
+      // [ba, bb, bc] are barycentric coordinates, bd is the distance along the vector
+
+      // The last line of the inverse matrix is the solution (vector triple products)
+
+      // numerator
+      numer = vec4(
+        dot(cross(b, c), d),
+        dot(cross(c, a), d),
+        dot(cross(a, b), d),
+        dot(cross(a, b), c)
+      );
+
+      // denominator
+      denom = numer[0] + numer[1] + numer[2];
+
+      // using a multiply lets us check the sign without using a divide.
+      vec4 bary2 = numer * denom;
+      return all(bary2 >= vec4(0, 0, 0, 0));
     }
 
-    /// *very* slow ray cast.
+    /// Mark the ray cast tree as out of date.
+    /// Call this after changing the vertex positions or indices through your own pointer.
+    /// (changes through a gl_resource lock are detected automatically)
+    void invalidate_ray_cast() {
+      triangle_tree_valid = false;
+    }
+
+    /// Get the tree of triangles used by ray_cast(), building it if the mesh has changed.
+    /// Returns null if the mesh can't be ray cast (only float positions and 32 bit indices are supported).
+    const bvh<ray_cast_triangle> *get_triangle_tree() {
+      unsigned pos_slot = get_slot(attribute_pos);
+      if (get_mode() != GL_TRIANGLES) return 0;
+      if (get_index_type() != GL_UNSIGNED_INT) return 0;
+      if (pos_slot == ~0u || get_size(pos_slot) < 3) return 0;
+      if (get_kind(pos_slot) != GL_FLOAT) return 0;
+      if (!vertices || !indices) return 0;
+
+      triangle_tree_key key;
+      memset(&key, 0, sizeof(key));
+      key.vertices = vertices;
+      key.indices = indices;
+      key.vertices_version = vertices->get_version();
+      key.indices_version = indices->get_version();
+      key.num_indices = num_indices;
+      key.first_index = first_index;
+      key.stride = stride;
+      key.pos_offset = get_offset(pos_slot);
+
+      if (triangle_tree_valid && !memcmp(&key, &tree_key, sizeof(key))) {
+        return &triangle_tree;
+      }
+
+      unsigned num_triangles = num_indices / 3;
+      dynarray<ray_cast_triangle> triangles(num_triangles);
+      dynarray<aabb> bounds(num_triangles);
+      if (num_triangles) {
+        gl_resource::rolock idx_lock(get_indices());
+        gl_resource::rolock vtx_lock(get_vertices());
+        const uint32_t *idx = idx_lock.u32() + first_index;
+        const uint8_t *vtx = vtx_lock.u8() + key.pos_offset;
+        for (unsigned i = 0; i != num_triangles; ++i) {
+          ray_cast_triangle &tri = triangles[i];
+          vec3 lo(1e37f, 1e37f, 1e37f), hi(-1e37f, -1e37f, -1e37f);
+          for (unsigned j = 0; j != 3; ++j) {
+            tri.idx[j] = idx[i*3+j];
+            tri.pos[j] = *(const vec3p*)(vtx + stride * tri.idx[j]);
+            lo = min(lo, (vec3)tri.pos[j]);
+            hi = max(hi, (vec3)tri.pos[j]);
+          }
+          bounds[i] = aabb((lo + hi) * 0.5f, (hi - lo) * 0.5f);
+        }
+      }
+
+      triangle_tree.build_sah(triangles.data(), bounds.data(), num_triangles);
+      tree_key = key;
+      triangle_tree_valid = true;
+      return &triangle_tree;
+    }
+
+    /// Find the nearest triangle hit by a ray.
+    /// The triangles are kept in a bvh, built on the first call, so this is quick
+    /// unless the mesh changes between calls.
+    /// Only hits between start and start + distance * t_max are considered.
     /// returns "barycentric" coordinates.
     /// eg. hit pos = bary[0] * pos0 + bary[1] * pos1 + bary[2] * pos2 (or ray.start + ray.distance * bary[3])
     /// eg. hit uv = bary[0] * uv0 + bary[1] * uv1 + bary[2] * uv2
-    bool ray_cast(const ray &the_ray, int indices[], vec4 &bary_numer, float &bary_denom) {
-      unsigned pos_slot = get_slot(attribute_pos);
-      if (get_index_type() != GL_UNSIGNED_INT) return false;
-      if (get_size(pos_slot) < 3) return false;
-      if (get_kind(pos_slot) != GL_FLOAT) return false;
+    bool ray_cast(const ray &the_ray, int indices[], vec4 &bary_numer, float &bary_denom, float t_max = 1e30f) {
+      const bvh<ray_cast_triangle> *tree = get_triangle_tree();
+      if (!tree) return false;
 
       vec3 org = the_ray.get_start();
       vec3 dir = the_ray.get_distance();
-      //log("ray_cast: org=%s dir=%s\n", org.toString(), dir.toString());
-
-      unsigned pos_offset = get_offset(pos_slot);
-      gl_resource::rolock idx_lock(get_indices());
-      gl_resource::rolock vtx_lock(get_vertices());
-      const uint32_t *idx = idx_lock.u32() + first_index;
-      const uint8_t *vtx = vtx_lock.u8();
 
+      const ray_cast_triangle *best = 0;
       float best_denom = 0;
       vec4 best_numer(0, 0, 0, 0);
-      for (unsigned i = 0; i != get_num_indices(); i += 3) {
-        vec3 a = (vec3)*(const vec3p*)(vtx + pos_offset + stride * idx[i+0]) - org;
-        vec3 b = (vec3)*(const vec3p*)(vtx + pos_offset + stride * idx[i+1]) - org;
-        vec3 c = (vec3)*(const vec3p*)(vtx + pos_offset + stride * idx[i+2]) - org;
-        vec3 d = dir;
-
-        // solve [ba, bb, bc, bd] * [[ax, ay, az, 1], [bx, by, bz, 1], [cx, cy, cz, 1], [-dx, -dy, -dz, 0]] = [0, 0, 0, 1]
-        //
-        // ie. ba + bb + bc = 1  and  ba * a + bb * b + bc * c = bd * d
-        //
-        // [ba, bb, bc] are barycentric coordinates, bd is the distance along the vector
-
-        // The last line of the inverse matrix is the solution (vector triple products)
-
-        // numerator
-        vec4 numer(
-          dot(cross(b, c), d),
-          dot(cross(c, a), d),
-          dot(cross(a, b), d),
-          dot(cross(a, b), c)
-        );
-
-        // denominator
-        float denom = numer[0] + numer[1] + numer[2];
-
-        //log("a=%s b=%s c=%s d=%s denom=%f\n", a.toString(), b.toString(), c.toString(), d.toString(), denom);
-        //log("numer=%s\n", numer.toString());
-        //log("res=%s\n", (numer / denom).toString());
-
-        // using a multiply lets us check the sign without using a divide.
-        vec4 bary2 = numer * denom;
-
-        if (all(bary2 >= vec4(0, 0, 0, 0))) {
-          rational best_distance(best_numer[3], best_denom);
-          rational new_distance(numer[3], denom);
-          /*printf(
-            "t%d %9.3f %d %d %d  %s %s %s\n",
-            i, numer[3]/denom, idx[i+0], idx[i+1], idx[i+2],
-            (numer/denom).toString(), best_distance.toString(), new_distance.toString()
-          );*/
-
-          unsigned further = new_distance > best_distance;
-          if (!further) {
-            indices[0] = idx[i+0];
-            indices[1] = idx[i+1];
-            indices[2] = idx[i+2];
+      tree->cast(the_ray, t_max, [&](const ray_cast_triangle &tri, float &t) {
+        vec4 numer;
+        float denom;
+        if (ray_cast_triangle_test(tri.pos[0], tri.pos[1], tri.pos[2], org, dir, numer, denom) && fabsf(denom) >= 1e-6f) {
+          float dist = numer[3] / denom;
+          if (dist <= t) {
+            t = dist;
+            best = &tri;
             best_numer = numer;
             best_denom = denom;
           }
         }
-      }
+        return false;
+      });
 
-      if (fabsf(best_denom) < 1e-6f) {
+      if (!best) {
         bary_numer = vec4(0, 0, 0, 0);
         bary_denom = 0;
         return false;
       } else {
+        indices[0] = best->idx[0];
+        indices[1] = best->idx[1];
+        indices[2] = best->idx[2];
         bary_numer = best_numer;
         bary_denom = best_denom;
         return true;
@@ -634,6 +766,7 @@ namespace octet { namespace scene {
     /// set a new VBO object
     void set_vertices(gl_resource *value) {
       vertices = value;
+      triangle_tree_valid = false;
     }
 
     /// assign a vector to the vertex buffer and set params
@@ -645,11 +778,13 @@ namespace octet { namespace scene {
       vertices->assign(rhs.data(), 0, rhs.size() * sizeof(elem_t));
       stride = sizeof(elem_t);
       set_num_vertices(rhs.size());
+      triangle_tree_valid = false;
     }
 
     /// set a new IBO object
     void set_indices(gl_resource *value) {
       indices = value;
+      triangle_tree_valid = false;
     }
 
     /// assign a vector to the index buffer and set params
@@ -662,6 +797,7 @@ namespace octet { namespace scene {
       set_index_type(sizeof(elem_t) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT);
       set_num_indices(rhs.size());
       set_first_index(0);
+      triangle_tree_valid = false;
     }
 
     /// Get all the edges in a hash map to avoid duplicates.
@@ -792,10 +928,11 @@ namespace octet { namespace scene {
     void reindex() {
       if (get_index_type() != GL_UNSIGNED_INT) return;
 
-      hash_map<general_vertex, unsigned, vertex_cmp> vertex_to_index;
+      hash_map<general_vertex, unsigned, vertex_cmp, frame_allocator> vertex_to_index;
+      vertex_to_index.reserve(get_num_vertices());
 
-      dynarray<uint8_t> dest_vertices;
-      dynarray<uint32_t> dest_indices;
+      dynarray<uint8_t, frame_allocator> dest_vertices;
+      dynarray<uint32_t, frame_allocator> dest_indices;
       dest_indices.reserve(get_num_indices());
 
       //The code below is inside a new scope { ... } with the purpose of be sure that outside the scope idx_lock will be deleted
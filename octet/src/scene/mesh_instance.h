@@ -8,6 +8,22 @@
 //
 
 namespace octet { namespace scene {
+  class mesh_instance;
+
+  /// A visual_scene's mesh instances for each scene_node.
+  /// The instances of a node are a list through the instances themselves, kept up to date by mesh_instance::set_node().
+  struct mesh_instance_node_index {
+    /// first instance of each node; the rest follow with mesh_instance::get_next_on_node().
+    hash_map<scene_node *, mesh_instance *> first;
+
+    /// set when an instance joins or leaves a node, so the scene can update its bounds.
+    bool changed;
+
+    mesh_instance_node_index() {
+      changed = false;
+    }
+  };
+
   /// Instance of a mesh in a game world; node, mesh, material and skin.
   class mesh_instance : public resource {
   public:
@@ -35,6 +51,25 @@ namespace octet { namespace scene {
     // if the object is further than this from the camera, do not draw.
     float max_draw_distance;
 
+    // lower layers are drawn first.
+    uint8_t layer;
+
+    // level of lod drawn last frame.
+    uint8_t lod_level;
+
+    // optional chain of meshes to choose from by screen size
+    ref<lod_group> lod;
+
+    // skinned meshes: the joints for the GPU or the vertices skinned on the CPU, made when first drawn.
+    ref<joint_texture> joints;
+    ref<cpu_skinner> skinner;
+
+    // the scene's index this instance is in, and the other instances of its node.
+    // next is null at the end of the list; the first instance's prev is the last one.
+    mesh_instance_node_index *node_index;
+    mesh_instance *prev_on_node;
+    mesh_instance *next_on_node;
+
   public:
     RESOURCE_META(mesh_instance)
 
@@ -47,6 +82,10 @@ namespace octet { namespace scene {
       flags = flag_enabled;
       min_draw_distance = -8.507059e37f;
       max_draw_distance = 8.507059e37f;
+      layer = 0;
+      lod_level = 0;
+      node_index = 0;
+      prev_on_node = next_on_node = 0;
     }
 
     /// metadata visitor. Used for serialisation and script interface.
@@ -56,6 +95,7 @@ namespace octet { namespace scene {
       v.visit(mat, atom_mat);
       v.visit(skel, atom_skel);
       v.visit(flags, atom_flags);
+      v.visit(lod, atom_lod_group);
     }
 
     //////////////////////////////
@@ -81,7 +121,6 @@ namespace octet { namespace scene {
         static float translate[3];
         static float scale[3];
 
-        // todo: cache the index
         int index = skel->get_bone_index(sid);
         if (index != -1) {
           switch (sub_target) {
@@ -130,8 +169,64 @@ namespace octet { namespace scene {
     /// Get the LOD max distance
     float get_max_draw_distance() const { return max_draw_distance; }
 
-    /// Set the transformation for this instance.
-    void set_node(scene_node *value) { node = value; }
+    /// Get the draw layer
+    unsigned get_layer() const { return layer; }
+
+    /// Get the level of detail chain, if any.
+    lod_group *get_lod_group() const { return lod; }
+
+    /// Get the level of the lod_group drawn last frame.
+    unsigned get_lod_level() const { return lod_level; }
+
+    /// Set the transformation for this instance. A scene's index of its instances follows the change.
+    void set_node(scene_node *value) {
+      mesh_instance_node_index *index = node_index;
+      unlink_node_index();
+      node = value;
+      if (index) link_node_index(index);
+    }
+
+    /// Add this instance to the end of its node's list in a scene's index. Used by visual_scene.
+    /// An instance can be in one scene's index at a time.
+    void link_node_index(mesh_instance_node_index *index) {
+      assert(!node_index && "mesh_instance: already in another scene");
+      node_index = index;
+      next_on_node = 0;
+      mesh_instance *&head = index->first[node];
+      if (head) {
+        prev_on_node = head->prev_on_node;
+        prev_on_node->next_on_node = this;
+        head->prev_on_node = this;
+      } else {
+        prev_on_node = this;
+        head = this;
+      }
+      index->changed = true;
+    }
+
+    /// Remove this instance from its scene's index. Used by visual_scene.
+    void unlink_node_index() {
+      if (!node_index) return;
+      int index = node_index->first.get_index(node);
+      mesh_instance *&head = node_index->first.get_value(index);
+      if (head == this) {
+        if (next_on_node) {
+          next_on_node->prev_on_node = prev_on_node;
+          head = next_on_node;
+        } else {
+          node_index->first.erase(node);
+        }
+      } else {
+        prev_on_node->next_on_node = next_on_node;
+        (next_on_node ? next_on_node : head)->prev_on_node = prev_on_node;
+      }
+      node_index->changed = true;
+      node_index = 0;
+      prev_on_node = next_on_node = 0;
+    }
+
+    /// Get the next instance with the same node in the scene, or null. See visual_scene::get_first_mesh_instance().
+    mesh_instance *get_next_on_node() const { return next_on_node; }
 
     /// Set the mesh for this instance.
     void set_mesh(mesh *value) { msh = value; }
@@ -150,6 +245,36 @@ namespace octet { namespace scene {
 
     /// Set the flags for this instance.
     void set_max_draw_distance(float value) { max_draw_distance = value; }
+
+    /// Set the draw layer (0-15). Instances in lower layers are drawn first,
+    /// otherwise the scene orders draws to save state changes.
+    void set_layer(unsigned value) { layer = (uint8_t)(value < 15 ? value : 15); }
+
+    /// Draw one of a chain of meshes chosen by screen size instead of the instance's mesh.
+    /// If the instance has no mesh, it gets the most detailed level for bounds and ray casts.
+    void set_lod_group(lod_group *value) {
+      lod = value;
+      lod_level = 0;
+      if (!msh && lod && lod->get_num_levels()) msh = lod->get_mesh(0);
+    }
+
+    /// Get the joint texture for skinning this instance's mesh on the GPU, making it if necessary.
+    joint_texture *get_joint_texture() {
+      if (!joints) joints = new joint_texture();
+      return joints;
+    }
+
+    /// Get the cpu_skinner for skinning a mesh of this instance on the CPU, making it if necessary.
+    /// Returns null if the mesh cannot be skinned on the CPU.
+    cpu_skinner *get_cpu_skinner(mesh *skinned_mesh) {
+      if (!skinner || skinner->get_source() != skinned_mesh) {
+        skinner = new cpu_skinner(skinned_mesh);
+      }
+      return skinner->is_valid() ? (cpu_skinner*)skinner : 0;
+    }
+
+    /// Set the level of the lod_group drawn (the scene does this when rendering).
+    void set_lod_level(unsigned value) { lod_level = (uint8_t)value; }
   };
 }}
 
@@ -47,12 +47,12 @@ namespace octet { namespace scene {
   public:
     unsigned num_faces;
     face_counter() { num_faces = 0; }
-    void add_lefts(uint32_t v, int, int) { num_faces += pop_count(v); }
-    void add_rights(uint32_t v, int, int) { num_faces += pop_count(v); }
-    void add_tops(uint32_t v, int, int) { num_faces += pop_count(v); }
-    void add_bottoms(uint32_t v, int, int) { num_faces += pop_count(v); }
-    void add_fronts(uint32_t v, int, int) { num_faces += pop_count(v); }
-    void add_backs(uint32_t v, int, int) { num_faces += pop_count(v); }
+    void add_lefts(uint32_t v, int, int) { num_faces += bit_ops::pop_count(v); }
+    void add_rights(uint32_t v, int, int) { num_faces += bit_ops::pop_count(v); }
+    void add_tops(uint32_t v, int, int) { num_faces += bit_ops::pop_count(v); }
+    void add_bottoms(uint32_t v, int, int) { num_faces += bit_ops::pop_count(v); }
+    void add_fronts(uint32_t v, int, int) { num_faces += bit_ops::pop_count(v); }
+    void add_backs(uint32_t v, int, int) { num_faces += bit_ops::pop_count(v); }
   };
 
   class face_adder {
@@ -70,23 +70,21 @@ namespace octet { namespace scene {
 
     void add_faces(uint32_t v, vec3_in base, vec3_in du, vec3_in dv, const vec3p &normal) {
       unsigned idx_val = num_faces * 4;
-      for (int i = 0; i < 32; v >>= 1, i++) {
-        if ((v & 0xff) == 0) { v >>= 8; i += 8; }
-        if ((v & 0x3) == 0) { v >>= 2; i += 2; }
-        if (v & 1) {
-          vec3 pos = base + (float)(i) * dx;
-          vtx->pos = pos; vtx->normal = normal; vtx->uv = vec2p(0, 0); vtx++;
-          vtx->pos = pos + du; vtx->normal = normal; vtx->uv = vec2p(1, 0); vtx++;
-          vtx->pos = pos + du + dv; vtx->normal = normal; vtx->uv = vec2p(1, 1); vtx++;
-          vtx->pos = pos + dv; vtx->normal = normal; vtx->uv = vec2p(0, 1); vtx++;
-          idx[0] = idx_val + 0;
-          idx[3] = idx[1] = idx_val + 1;
-          idx[5] = idx[2] = idx_val + 3;
-          idx[4] = idx_val + 2;
-          idx += 6;
-          num_faces++;
-          idx_val += 4;
-        }
+      // visit only the set bits
+      for (; v; v &= v - 1) {
+        unsigned i = bit_ops::find_first(v);
+        vec3 pos = base + (float)(i) * dx;
+        vtx->pos = pos; vtx->normal = normal; vtx->uv = vec2p(0, 0); vtx++;
+        vtx->pos = pos + du; vtx->normal = normal; vtx->uv = vec2p(1, 0); vtx++;
+        vtx->pos = pos + du + dv; vtx->normal = normal; vtx->uv = vec2p(1, 1); vtx++;
+        vtx->pos = pos + dv; vtx->normal = normal; vtx->uv = vec2p(0, 1); vtx++;
+        idx[0] = idx_val + 0;
+        idx[3] = idx[1] = idx_val + 1;
+        idx[5] = idx[2] = idx_val + 3;
+        idx[4] = idx_val + 2;
+        idx += 6;
+        num_faces++;
+        idx_val += 4;
       }
     }
 
@@ -45,7 +45,7 @@ namespace octet { namespace scene {
       return name;
     }
 
-    uint16_t get_gl_type() {
+    uint16_t get_gl_type() const {
       return type;
     }
 
@@ -86,6 +86,9 @@ namespace octet { namespace scene {
 
   struct param_bind_info {
     GLint program;
+    GLuint draw_block;        // index of the octet_draw uniform block or ~0 (GL_INVALID_INDEX)
+    GLuint material_block;    // index of the octet_material uniform block or ~0
+    GLuint lighting_block;    // index of the octet_lighting uniform block or ~0
   };
 
   struct param_buffer_info {
@@ -104,15 +107,37 @@ namespace octet { namespace scene {
   /// For OpenGL ES2 we keep uniforms in a dynarray and use glUniform* to copy them to OpenGL.
   /// For OpenGL ES3 we keep uniforms in a uniform buffer and use the buffer.
   /// The parameter uniform records the location, name and type of the uniform as well as the repeat count for arrays.
+  ///
+  /// The dynarray is always packed tightly, as glUniform* expects. When the shader puts the uniform
+  /// in a uniform block, bind() finds where it lives in the block and write_block() copies it there.
   class param_uniform : public param {
     GLint uniform;           // uniform index
     uint16_t offset;         // offset in uniform buffer
     uint16_t repeat;         // how many in array?
-    uint8_t uniform_buffer;  // Which uniform buffer? 0 = dynamic, 1 = static.
+    uint8_t uniform_buffer;  // Which uniform buffer? 0 = dynamic, 1 = static, 2 = none (use glUniform*), 3 = lighting.
+    uint16_t block_offset;   // offset in the uniform block
+    uint16_t array_stride;   // bytes between array elements in the uniform block
+    uint16_t matrix_stride;  // bytes between matrix columns in the uniform block
   public:
     RESOURCE_META(param_uniform)
 
+    enum {
+      /// in the octet_draw block, which changes every draw.
+      buffer_dynamic,
+
+      /// in the octet_material block, which changes when the material does.
+      buffer_static,
+
+      /// not in a block: set with glUniform*.
+      buffer_none,
+
+      /// in the octet_lighting block, shared by all materials (see lighting_block).
+      buffer_lighting,
+    };
+
     param_uniform() {
+      uniform = -1;
+      uniform_buffer = buffer_none;
     }
 
     /// create a new uniform parameter with a prototype in "buffer"
@@ -121,6 +146,8 @@ namespace octet { namespace scene {
       param(name, _type, _stage)
     {
       repeat = _repeat;
+      uniform = -1;
+      uniform_buffer = buffer_none;
 
       // in uniform buffers, everything is in units of 16 bytes
       // matrices are repeats of vec4s
@@ -170,7 +197,33 @@ namespace octet { namespace scene {
     /// connect the parameter to the shader
     void bind(param_bind_info &pbi) {
       uniform = glGetUniformLocation(pbi.program, get_atom_name());
+      uniform_buffer = buffer_none;
       //log("bind %d %s\n", uniform, get_atom_name());
+
+      #if OCTET_UNIFORM_BUFFERS
+        // members of uniform blocks have no location; find their place in the block instead.
+        const char *name = get_atom_name();
+        GLuint index = GL_INVALID_INDEX;
+        glGetUniformIndices(pbi.program, 1, &name, &index);
+        if (index == GL_INVALID_INDEX) return;
+
+        GLint block = -1, block_offset_ = 0, array_stride_ = 0, matrix_stride_ = 0;
+        glGetActiveUniformsiv(pbi.program, 1, &index, GL_UNIFORM_BLOCK_INDEX, &block);
+        if (block == -1) return;
+        glGetActiveUniformsiv(pbi.program, 1, &index, GL_UNIFORM_OFFSET, &block_offset_);
+        glGetActiveUniformsiv(pbi.program, 1, &index, GL_UNIFORM_ARRAY_STRIDE, &array_stride_);
+        glGetActiveUniformsiv(pbi.program, 1, &index, GL_UNIFORM_MATRIX_STRIDE, &matrix_stride_);
+        block_offset = (uint16_t)block_offset_;
+        array_stride = (uint16_t)array_stride_;
+        matrix_stride = (uint16_t)matrix_stride_;
+        if ((GLuint)block == pbi.draw_block) {
+          uniform_buffer = buffer_dynamic;
+        } else if ((GLuint)block == pbi.material_block) {
+          uniform_buffer = buffer_static;
+        } else if ((GLuint)block == pbi.lighting_block) {
+          uniform_buffer = buffer_lighting;
+        }
+      #endif
     }
 
     /// get the uniform location
@@ -192,16 +245,46 @@ namespace octet { namespace scene {
       return buffer + offset;
     }
 
-    /// which uniform buffer does this parameter belong to?
-    uint8_t get_uniform_buffer_index() {
+    /// which uniform buffer does this parameter belong to? (buffer_dynamic etc.)
+    uint8_t get_uniform_buffer_index() const {
       return uniform_buffer;
     }
 
+    /// copy the value from buffer to its place in a uniform block with the shader's layout (std140 etc.)
+    void write_block(uint8_t *block, const uint8_t *buffer) const {
+      unsigned columns = 1, column_size = 4;
+      switch (get_gl_type()) {
+        case GL_FLOAT_VEC2: case GL_INT_VEC2: case GL_BOOL_VEC2: column_size = 8; break;
+        case GL_FLOAT_VEC3: case GL_INT_VEC3: case GL_BOOL_VEC3: column_size = 12; break;
+        case GL_FLOAT_VEC4: case GL_INT_VEC4: case GL_BOOL_VEC4: column_size = 16; break;
+        case GL_FLOAT_MAT2: columns = 2; column_size = 8; break;
+        case GL_FLOAT_MAT3: columns = 3; column_size = 12; break;
+        case GL_FLOAT_MAT4: columns = 4; column_size = 16; break;
+      }
+
+      const uint8_t *src = buffer + offset;
+      for (unsigned i = 0; i != repeat; ++i) {
+        uint8_t *dest = block + block_offset + i * array_stride;
+        for (unsigned j = 0; j != columns; ++j) {
+          memcpy(dest + j * matrix_stride, src, column_size);
+          src += column_size;
+        }
+      }
+    }
+
+    /// set any OpenGL state other than the uniform itself (eg. textures).
+    /// This must be done every time the parameter is used, even if the uniform is already set.
+    virtual void bind_textures() {
+    }
+
     /// for OpenGL ES2, call glUniform* to copy the uniform to the GPU command buffer.
     /// for OpenGL ES3, we can use the uniform buffer directly and so don't need this.
     void render(const uint8_t *buffer) {
-      GLint uni = get_uniform();
+      render_at(buffer, get_uniform());
+    }
 
+    /// copy the uniform to a location in another program (eg. an instanced version of the shader).
+    virtual void render_at(const uint8_t *buffer, GLint uni) {
       if (uni == -1) return;
 
       switch (get_gl_type()) {
@@ -288,8 +371,13 @@ namespace octet { namespace scene {
     }
 
     /// Set the OpenGL state for this sampler.
-    void render(const uint8_t *buffer) {
-      param_uniform::render(buffer);
+    void render_at(const uint8_t *buffer, GLint uni) {
+      param_uniform::render_at(buffer, uni);
+      bind_textures();
+    }
+
+    /// Bind the texture to our texture slot.
+    void bind_textures() {
       glActiveTexture(GL_TEXTURE0 + texture_slot);
       glBindTexture(sampler_->get_gl_target(), sampler_->get_gl_texture(image_));
 
@@ -298,17 +386,85 @@ namespace octet { namespace scene {
   };
 
   /// Shader that uses parameters.
+  ///
+  /// Shader source is compiled with OCTET_UNIFORM_BUFFERS defined as 0 or 1 so that
+  /// one file can declare its uniforms in blocks or not (see uniform_ring.h).
   class param_shader : public shader {
     std::string vertex_shader;
     std::string fragment_shader;
 
+    // uniform blocks and their sizes in bytes (zero if the shader does not have them).
+    GLuint draw_block;
+    GLuint material_block;
+    GLuint lighting_block;
+    unsigned draw_block_size;
+    unsigned material_block_size;
+    unsigned lighting_block_size;
+
+    // which material's values are in this program's uniforms (see material::get_static_version()).
+    uint32_t uniform_version;
+
+    // which lighting_block version is in this program's lighting uniforms.
+    uint32_t lighting_version;
+
+    // put the #defines at the start of the source, after any #version line.
+    static std::string add_defines(const std::string &source) {
+      const char *defines = OCTET_UNIFORM_BUFFERS ? "#define OCTET_UNIFORM_BUFFERS 1\n" : "#define OCTET_UNIFORM_BUFFERS 0\n";
+      size_t pos = 0;
+      if (source.compare(0, 8, "#version") == 0) {
+        pos = source.find('\n');
+        pos = pos == std::string::npos ? source.size() : pos + 1;
+      }
+      return source.substr(0, pos) + defines + source.substr(pos);
+    }
+
+    // no uniform blocks (~0 is GL_INVALID_INDEX, which GLES2 headers do not have).
+    void reset_blocks() {
+      draw_block = material_block = lighting_block = ~0u;
+      draw_block_size = material_block_size = lighting_block_size = 0;
+      uniform_version = 0;
+      lighting_version = 0;
+    }
+
+    // find the uniform blocks and attach them to the uniform_ring binding points.
+    void find_blocks() {
+      reset_blocks();
+      #if OCTET_UNIFORM_BUFFERS
+        GLuint program = get_program();
+        draw_block = glGetUniformBlockIndex(program, "octet_draw");
+        if (draw_block != GL_INVALID_INDEX) {
+          GLint size = 0;
+          glGetActiveUniformBlockiv(program, draw_block, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+          glUniformBlockBinding(program, draw_block, uniform_ring::draw_binding);
+          draw_block_size = (unsigned)size;
+        }
+        material_block = glGetUniformBlockIndex(program, "octet_material");
+        if (material_block != GL_INVALID_INDEX) {
+          GLint size = 0;
+          glGetActiveUniformBlockiv(program, material_block, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+          glUniformBlockBinding(program, material_block, uniform_ring::material_binding);
+          material_block_size = (unsigned)size;
+        }
+        lighting_block = glGetUniformBlockIndex(program, "octet_lighting");
+        if (lighting_block != GL_INVALID_INDEX) {
+          GLint size = 0;
+          glGetActiveUniformBlockiv(program, lighting_block, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+          glUniformBlockBinding(program, lighting_block, uniform_ring::lighting_binding);
+          lighting_block_size = (unsigned)size;
+        }
+      #endif
+    }
+
   public:
     RESOURCE_META(param_shader)
 
     param_shader() {
+      reset_blocks();
     }
 
     param_shader(const char *vs_url, const char *fs_url) {
+      reset_blocks();
+
       dynarray<uint8_t> vs;
       dynarray<uint8_t> fs;
       app_utils::get_url(vs, vs_url);
@@ -318,16 +474,78 @@ namespace octet { namespace scene {
       fragment_shader.assign((const char*)fs.data(), (const char*)(fs.data() + fs.size()));
     }
 
-    void init(dynarray<ref<param> > &params) {
-      shader::init(vertex_shader.data(), fragment_shader.data());
+    /// Make an uncompiled copy of this shader with another vertex shader,
+    /// for example an instanced one.
+    param_shader *make_variant(const char *vs_url) const {
+      dynarray<uint8_t> vs;
+      app_utils::get_url(vs, vs_url);
+      param_shader *result = new param_shader();
+      result->vertex_shader.assign((const char*)vs.data(), (const char*)(vs.data() + vs.size()));
+      result->fragment_shader = fragment_shader;
+      return result;
+    }
 
-      param_bind_info pbi;
-      pbi.program = get_program();
+    /// compile and link the shader without binding any parameters.
+    void compile() {
+      std::string vs = add_defines(vertex_shader);
+      std::string fs = add_defines(fragment_shader);
+      shader::init(vs.c_str(), fs.c_str());
+      find_blocks();
+    }
 
+    void init(dynarray<ref<param> > &params) {
+      compile();
+
+      param_bind_info pbi = get_bind_info();
       for (unsigned i = 0; i != params.size(); ++i) {
         params[i]->bind(pbi);
       }
     }
+
+    /// what param::bind() needs to know about this shader.
+    param_bind_info get_bind_info() const {
+      param_bind_info pbi;
+      pbi.program = get_program();
+      pbi.draw_block = draw_block;
+      pbi.material_block = material_block;
+      pbi.lighting_block = lighting_block;
+      return pbi;
+    }
+
+    /// size in bytes of the octet_draw uniform block, or zero if the shader sets its matrices with glUniform*.
+    unsigned get_draw_block_size() const {
+      return draw_block_size;
+    }
+
+    /// size in bytes of the octet_material uniform block, or zero if there isn't one.
+    unsigned get_material_block_size() const {
+      return material_block_size;
+    }
+
+    /// size in bytes of the octet_lighting uniform block, or zero if there isn't one.
+    unsigned get_lighting_block_size() const {
+      return lighting_block_size;
+    }
+
+    /// version of the material whose values are in this program's uniforms.
+    uint32_t get_uniform_version() const {
+      return uniform_version;
+    }
+
+    /// record that a material has set this program's uniforms.
+    void set_uniform_version(uint32_t value) {
+      uniform_version = value;
+    }
+
+    /// version of the lighting (see lighting_block) in this program's lighting uniforms.
+    uint32_t get_lighting_version() const {
+      return lighting_version;
+    }
+
+    /// record that the lighting has been set in this program's uniforms.
+    void set_lighting_version(uint32_t value) {
+      lighting_version = value;
+    }
   };
 }}
 
@@ -0,0 +1,157 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Local poses of a skeleton for blending animations
+//
+// Each joint's node to parent transform is kept as a rotation, translation and scale
+// in three arrays, one entry per joint of the skeleton. Poses blend a joint at a time
+// with no matrices, so several animations can be mixed cheaply before the result
+// is turned into matrices once by skeleton::set_pose().
+//
+
+namespace octet { namespace scene {
+  /// The local (node to parent) transforms of every joint of a skeleton.
+  ///
+  /// Rotations are unit quaternions (x, y, z, w). Translations and scales use xyz.
+  class pose_buffer {
+    dynarray<vec4> rotations;
+    dynarray<vec4> translations;
+    dynarray<vec4> scales;
+
+    // a = a normalised lerp of a and b, the short way round.
+    static void nlerp(vec4 &a, const vec4 &b, float t) {
+      float sign = dot(a, b) < 0 ? -t : t;
+      a = normalize(a * (1 - t) + b * sign);
+    }
+  public:
+    /// Make an empty pose; resize() it to the number of joints.
+    pose_buffer() {
+    }
+
+    /// Set the number of joints. New joints are not initialised.
+    void resize(unsigned num_joints) {
+      rotations.resize(num_joints);
+      translations.resize(num_joints);
+      scales.resize(num_joints);
+    }
+
+    /// number of joints.
+    unsigned size() const {
+      return rotations.size();
+    }
+
+    /// Set every joint to no rotation, no translation and unit scale.
+    void set_identity() {
+      for (unsigned i = 0; i != rotations.size(); ++i) {
+        rotations[i] = vec4(0, 0, 0, 1);
+        translations[i] = vec4(0, 0, 0, 0);
+        scales[i] = vec4(1, 1, 1, 0);
+      }
+    }
+
+    /// Set a joint from a node to parent matrix.
+    void set_matrix(unsigned joint, const mat4t &nodeToParent) {
+      float value[16];
+      for (unsigned i = 0; i != 16; ++i) {
+        value[i] = nodeToParent[i & 3][i >> 2];
+      }
+      set_collada(joint, value);
+    }
+
+    /// Set a joint from a collada matrix, as an animation channel's value.
+    void set_collada(unsigned joint, const float *value) {
+      float q[4], translation[3], scale[3];
+      if (!animation_codec::decompose(q, translation, scale, value)) {
+        // no rotation in a squashed matrix: use the translation alone.
+        q[0] = q[1] = q[2] = 0; q[3] = 1;
+        scale[0] = scale[1] = scale[2] = 0;
+        translation[0] = value[3]; translation[1] = value[7]; translation[2] = value[11];
+      }
+      set_joint(joint, q, translation, scale);
+    }
+
+    /// Set a joint from a unit quaternion, translation and scale.
+    void set_joint(unsigned joint, const float *q, const float *translation, const float *scale) {
+      rotations[joint] = vec4(q[0], q[1], q[2], q[3]);
+      translations[joint] = vec4(translation[0], translation[1], translation[2], 0);
+      scales[joint] = vec4(scale[0], scale[1], scale[2], 0);
+    }
+
+    /// Get a joint's node to parent matrix.
+    void get_matrix(unsigned joint, mat4t &nodeToParent) const {
+      const vec4 &s = scales[joint];
+      nodeToParent = mat4t(quat(rotations[joint]));
+      nodeToParent[0] = nodeToParent[0] * s.x();
+      nodeToParent[1] = nodeToParent[1] * s.y();
+      nodeToParent[2] = nodeToParent[2] * s.z();
+      nodeToParent[3] = translations[joint].xyz1();
+    }
+
+    /// get a joint's rotation as (x, y, z, w).
+    const vec4 &get_rotation(unsigned joint) const {
+      return rotations[joint];
+    }
+
+    /// get a joint's translation.
+    const vec4 &get_translation(unsigned joint) const {
+      return translations[joint];
+    }
+
+    /// get a joint's scale.
+    const vec4 &get_scale(unsigned joint) const {
+      return scales[joint];
+    }
+
+    /// Move towards another pose: weight 0 keeps this pose, 1 gives the other one.
+    /// mask, if not null, has a weight for each joint which multiplies the weight.
+    void blend(const pose_buffer &other, float weight, const float *mask = 0) {
+      unsigned num_joints = size();
+      for (unsigned i = 0; i != num_joints; ++i) {
+        float t = mask ? weight * mask[i] : weight;
+        if (t >= 1) {
+          rotations[i] = other.rotations[i];
+          translations[i] = other.translations[i];
+          scales[i] = other.scales[i];
+        } else if (t > 0) {
+          nlerp(rotations[i], other.rotations[i], t);
+          translations[i] = translations[i] + (other.translations[i] - translations[i]) * t;
+          scales[i] = scales[i] + (other.scales[i] - scales[i]) * t;
+        }
+      }
+    }
+
+    /// Add the difference between a pose and a reference pose to this pose.
+    /// Adding the whole difference to the reference itself gives the pose.
+    void add(const pose_buffer &pose, const pose_buffer &reference, float weight, const float *mask = 0) {
+      unsigned num_joints = size();
+      vec4 identity(0, 0, 0, 1);
+      vec4 one(1, 1, 1, 0);
+      for (unsigned i = 0; i != num_joints; ++i) {
+        float t = mask ? weight * mask[i] : weight;
+        if (t <= 0) continue;
+
+        // rotation and scale relative to the reference.
+        vec4 r = quat(reference.rotations[i]).conjugate() * quat(pose.rotations[i]);
+        if (t < 1) {
+          vec4 delta = r;
+          r = identity;
+          nlerp(r, delta, t);
+        }
+        const vec4 &s = pose.scales[i], &ref_s = reference.scales[i];
+        vec4 ratio(
+          ref_s.x() != 0 ? s.x() / ref_s.x() : 1,
+          ref_s.y() != 0 ? s.y() / ref_s.y() : 1,
+          ref_s.z() != 0 ? s.z() / ref_s.z() : 1,
+          0
+        );
+
+        rotations[i] = normalize(quat(rotations[i]) * quat(r));
+        translations[i] = translations[i] + (pose.translations[i] - reference.translations[i]) * t;
+        scales[i] = scales[i] * (one + (ratio - one) * t);
+      }
+    }
+  };
+} }
@@ -10,20 +10,27 @@
 #ifndef OCTET_SCENE_INCLUDED
 #define OCTET_SCENE_INCLUDED
 
+#include "../scene/transform_store.h"
 #include "../scene/scene_node.h"
 #include "../scene/skin.h"
+#include "../scene/animation_codec.h"
+#include "../scene/pose_buffer.h"
 #include "../scene/skeleton.h"
 #include "../scene/animation.h"
 #include "../scene/mesh.h"
+#include "../scene/skinning.h"
 #include "../scene/image.h"
 #include "../scene/sampler.h"
+#include "../scene/uniform_ring.h"
 #include "../scene/param.h"
 #include "../scene/material.h"
+#include "../scene/lod_group.h"
 #include "../scene/light.h"
 #include "../scene/camera_instance.h"
 #include "../scene/light_instance.h"
 #include "../scene/mesh_instance.h"
 #include "../scene/animation_instance.h"
+#include "../scene/animation_mixer.h"
 #include "../scene/visual_scene.h"
 #include "../scene/displacement_map.h"
 #include "../scene/indexer.h"
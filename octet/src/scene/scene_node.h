@@ -16,7 +16,7 @@ namespace octet { namespace scene {
     ref<scene_node> parent;
 
     // child nodes
-    dynarray<ref<scene_node> > children;
+    small_dynarray<ref<scene_node>, 4> children;
 
     // this node's transform relative to parent
     mat4t nodeToParent;
@@ -27,14 +27,152 @@ namespace octet { namespace scene {
     // is this node and all its children renderable?
     bool enabled;
 
+    // cached nodeToParent * parent->nodeToWorld, valid when world_dirty is false.
+    mat4t nodeToWorld;
+
+    // cached inverse of nodeToWorld, valid when inverse_dirty is false.
+    mat4t worldToNode;
+
+    // cached enabled state of this node and all its parents.
+    bool enabled_in_world;
+
+    // nodeToWorld needs recomputing. If a node is dirty, so are all its descendants.
+    bool world_dirty;
+
+    // worldToNode needs recomputing.
+    bool inverse_dirty;
+
+    // some descendant is dirty (used to find dirty subtrees from the top).
+    bool descendants_dirty;
+
+    // world_bounds needs recomputing. Set with world_dirty, but only cleared by update_world_transforms().
+    bool bounds_dirty;
+
+    // bounds of things drawn at this node in node space (see set_local_bounds()).
+    aabb local_bounds;
+    bool has_local_bounds;
+
+    // world space bounds of this node's subtree, valid after update_world_transforms().
+    aabb world_bounds;
+    bool has_world_bounds;
+
+    // result of the last hierarchical cull (see visual_scene).
+    int cull_frame;
+    unsigned cull_mask;
+
+    // if set, nodeToParent and nodeToWorld live here instead (see use_transform_store()).
+    ref<transform_store> store;
+    unsigned store_handle;
+
+    // the node to parent matrix wherever it lives.
+    mat4t &local_matrix() {
+      return store ? store->access_local(store_handle) : nodeToParent;
+    }
+
+    // the node to world matrix wherever it lives.
+    const mat4t &world_matrix() {
+      return store ? store->get_world(store_handle) : nodeToWorld;
+    }
+
+    // flag this node and its subtree as dirty and tell the ancestors.
+    void mark_dirty() {
+      if (!world_dirty) {
+        mark_subtree_dirty();
+      }
+      mark_parents_dirty();
+    }
+
+    // tell the ancestors that there is a dirty node below them.
+    void mark_parents_dirty() {
+      for (scene_node *p = parent; p != NULL && !p->descendants_dirty; p = p->parent) {
+        p->descendants_dirty = true;
+      }
+    }
+
+    // flag every clean node in the subtree as dirty.
+    // a dirty node already has a dirty subtree, so we can stop there.
+    void mark_subtree_dirty() {
+      world_dirty = true;
+      inverse_dirty = true;
+      bounds_dirty = true;
+      descendants_dirty = children.size() != 0;
+      for (int i = 0; i != children.size(); ++i) {
+        if (!children[i]->world_dirty) {
+          children[i]->mark_subtree_dirty();
+        }
+      }
+    }
+
+    // recompute the cached world state from the parent's (which must be up to date).
+    // The store does its own matrices, in a batch.
+    void update_world() {
+      if (parent) {
+        if (!store) nodeToWorld = nodeToParent * parent->nodeToWorld;
+        enabled_in_world = enabled && parent->enabled_in_world;
+      } else {
+        if (!store) nodeToWorld = nodeToParent;
+        enabled_in_world = enabled;
+      }
+      world_dirty = false;
+      inverse_dirty = true;
+    }
+
+    // bring the cached world state up to date, doing dirty parents first.
+    void refresh_world() {
+      if (parent && parent->world_dirty) {
+        parent->refresh_world();
+      }
+      update_world();
+    }
+
+    // union of the local bounds in this subtree in world space. Children must be up to date.
+    void update_bounds() {
+      has_world_bounds = has_local_bounds;
+      if (has_local_bounds) {
+        world_bounds = local_bounds.get_transform(world_matrix());
+      }
+      for (int i = 0; i != children.size(); ++i) {
+        scene_node *child = children[i];
+        if (child->has_world_bounds) {
+          world_bounds = has_world_bounds ? world_bounds.get_union(child->world_bounds) : child->world_bounds;
+          has_world_bounds = true;
+        }
+      }
+      bounds_dirty = false;
+    }
+
+    void init_world() {
+      enabled_in_world = true;
+      world_dirty = true;
+      inverse_dirty = true;
+      descendants_dirty = false;
+      bounds_dirty = true;
+      has_local_bounds = false;
+      has_world_bounds = false;
+      cull_frame = -1;
+      cull_mask = 0;
+    }
+
+    // put this node and its subtree in a store below parent_handle (-1 for a root).
+    void join_store(transform_store *new_store, int parent_handle) {
+      store_handle = new_store->add(parent_handle, nodeToParent);
+      store = new_store;
+      for (int i = 0; i != children.size(); ++i) {
+        children[i]->join_store(new_store, (int)store_handle);
+      }
+      mark_subtree_dirty();
+    }
+
   public:
     RESOURCE_META(scene_node)
 
     /// Construct a scene node with an identity transform and no parent.
     scene_node(scene_node *parent = 0) {
       nodeToParent.loadIdentity();
+      store_handle = 0;
       sid = atom_;
       enabled = true;
+      init_world();
       if (parent) {
         parent->add_child(this);
       }
@@ -44,7 +182,9 @@ namespace octet { namespace scene {
     scene_node(const mat4t &nodeToParent, atom_t sid) {
       this->nodeToParent = nodeToParent;
       this->sid = sid;
+      store_handle = 0;
       enabled = true;
+      init_world();
     }
 
     /// the virtual add_ref on animation_target gets passed to here and we pass iton (delegate it) to the resource
@@ -60,7 +200,8 @@ namespace octet { namespace scene {
     /// animation input: for now, we only support skeleton animation
     void set_value(atom_t sid, atom_t sub_target, atom_t component, float *value) {
       if (sub_target == atom_transform) {
-        nodeToParent.init_transpose(value);
+        local_matrix().init_transpose(value);
+        mark_dirty();
       }
     }
 
@@ -71,8 +212,15 @@ namespace octet { namespace scene {
       //log("visit scene_node children\n");
       v.visit(children, atom_children);
       //log("visit scene_node nodeToParent\n");
+      if (store) nodeToParent = store->get_local(store_handle);
       v.visit(nodeToParent, atom_nodeToParent);
+      if (store && v.is_reader()) store->access_local(store_handle) = nodeToParent;
       v.visit(sid, atom_sid);
+      if (v.is_reader()) {
+        // children may be read before their parents, so be pessimistic.
+        init_world();
+        descendants_dirty = true;
+      }
     }
 
 
@@ -80,6 +228,11 @@ namespace octet { namespace scene {
     void add_child(scene_node *new_node) {
       new_node->parent = this;
       children.push_back(new_node);
+      if (store && !new_node->store) {
+        new_node->join_store(store, (int)store_handle);
+      }
+      new_node->mark_subtree_dirty();
+      new_node->mark_parents_dirty();
     }
 
     /// Get the parent node of this node.
@@ -97,65 +250,196 @@ namespace octet { namespace scene {
       return children[index];
     }
 
-    // compute the scene_node to world matrix for an individual scene_node;
-    mat4t calcModelToWorld() {
-      mat4t result = nodeToParent;
-      for (scene_node *p = parent; p != NULL; p = p->parent) {
-        result = result * p->nodeToParent;
+    /// get the cached node to world matrix, computing it if the node has moved.
+    const mat4t &get_nodeToWorld() {
+      if (world_dirty) refresh_world();
+      return world_matrix();
+    }
+
+    /// get the cached world to node matrix (the inverse of get_nodeToWorld()).
+    const mat4t &get_worldToNode() {
+      if (world_dirty) refresh_world();
+      if (inverse_dirty) {
+        worldToNode = world_matrix().inverse3x4();
+        inverse_dirty = false;
       }
-      return result;
+      return worldToNode;
     }
 
-    // calculate whether this node is enabled (recursively)
-    bool calcEnabled() {
-      for (scene_node *p = this; p != NULL; p = p->parent) {
-        if (!p->enabled) return false;
+    /// Refresh the cached world matrices and bounds of every moved node in this subtree.
+    /// Called once per frame on the scene root, this visits only dirty subtrees,
+    /// so unchanged parts of the hierarchy cost nothing.
+    void update_world_transforms() {
+      if (store) store->update();
+      if (world_dirty) refresh_world();
+      if (!descendants_dirty && !bounds_dirty) return;
+
+      // breadth first, so parents are updated before their children.
+      dynarray<scene_node*> visited;
+      visited.push_back(this);
+      for (unsigned i = 0; i != visited.size(); ++i) {
+        scene_node *node = visited[i];
+        if (node->world_dirty) node->update_world();
+        if (node->descendants_dirty) {
+          node->descendants_dirty = false;
+          for (int j = 0; j != node->children.size(); ++j) {
+            scene_node *child = node->children[j];
+            if (child->bounds_dirty || child->descendants_dirty) {
+              visited.push_back(child);
+            }
+          }
+        }
+      }
+
+      // children come after their parents, so go backwards to gather the bounds.
+      for (unsigned i = visited.size(); i-- != 0; ) {
+        visited[i]->update_bounds();
+      }
+    }
+
+    /// true if something in this subtree has moved since the last update_world_transforms().
+    bool is_subtree_dirty() const {
+      return world_dirty || bounds_dirty || descendants_dirty;
+    }
+
+    /// Set the bounds of things drawn at this node (in node space) for culling the subtree.
+    /// visual_scene does this for nodes with mesh instances.
+    void set_local_bounds(const aabb &bounds) {
+      local_bounds = bounds;
+      has_local_bounds = true;
+      bounds_dirty = true;
+      mark_parents_dirty();
+    }
+
+    /// Get the bounds set by set_local_bounds(). Returns false if there are none.
+    bool get_local_bounds(aabb &result) const {
+      result = local_bounds;
+      return has_local_bounds;
+    }
+
+    /// This node draws nothing by itself.
+    void clear_local_bounds() {
+      if (has_local_bounds) {
+        has_local_bounds = false;
+        bounds_dirty = true;
+        mark_parents_dirty();
       }
-      return true;
+    }
+
+    /// Get the world space bounds of everything drawn in this subtree.
+    /// Returns false if nothing has bounds. Valid after update_world_transforms().
+    bool get_world_bounds(aabb &result) const {
+      result = world_bounds;
+      return has_world_bounds;
+    }
+
+    /// Remember the result of culling this node in a frame.
+    void set_cull_state(int frame, unsigned mask) {
+      cull_frame = frame;
+      cull_mask = mask;
+    }
+
+    /// Frame number of the last cull of this node.
+    int get_cull_frame() const {
+      return cull_frame;
+    }
+
+    /// Planes still to test for things in this subtree (see frustum::classify()).
+    unsigned get_cull_mask() const {
+      return cull_mask;
+    }
+
+    /// get the scene_node to world matrix for an individual scene_node (cached, see get_nodeToWorld()).
+    mat4t calcModelToWorld() {
+      return get_nodeToWorld();
+    }
+
+    /// get whether this node and all its parents are enabled (cached).
+    bool calcEnabled() {
+      if (world_dirty) refresh_world();
+      return enabled_in_world;
     }
 
     /// transform a point from model space to world space
     vec3 transform(vec3_in world_pos) {
-      mat4t model_to_world = calcModelToWorld();
-      return world_pos * model_to_world;
+      return world_pos * get_nodeToWorld();
     }
 
     /// transform a point from world space to model space
     vec3 inverse_transform(vec3_in world_pos) {
-      mat4t model_to_world = calcModelToWorld();
-      // this can be done more efficiently
-      mat4t world_to_model = model_to_world.inverse3x4();
-      return world_pos * world_to_model;
+      return world_pos * get_worldToNode();
     }
 
     /// read the node to parent transform matrix
     const mat4t &get_nodeToParent() const {
-      return nodeToParent;
+      return store ? store->get_local(store_handle) : nodeToParent;
     }
 
     /// access the node to parent transform matrix for writing.
+    /// This flags the node as moved, so write to the matrix before the next world query
+    /// and do not keep the reference: use set_nodeToParent() to write a matrix made elsewhere.
     mat4t &access_nodeToParent() {
-      return nodeToParent;
+      mark_dirty();
+      return local_matrix();
+    }
+
+    /// set the node to parent transform matrix.
+    void set_nodeToParent(const mat4t &value) {
+      local_matrix() = value;
+      mark_dirty();
+    }
+
+    /// Keep the matrices of this node and everything below it in a transform_store.
+    /// World matrices are then computed for the whole store at once, in contiguous arrays,
+    /// and visual_scene can make all the model to projection matrices in one batch.
+    /// Children added later join the store too. Call this on a root node (one with no parent).
+    /// Adding nodes to the store moves its arrays, so do not hold on to matrix references meanwhile.
+    void use_transform_store(transform_store *new_store) {
+      assert(!parent && !store);
+      join_store(new_store, -1);
+    }
+
+    /// Move the matrices of this subtree back into the nodes and forget the store.
+    void release_transform_store() {
+      if (!store) return;
+      nodeToParent = store->get_local(store_handle);
+      nodeToWorld = store->get_world(store_handle);
+      for (int i = 0; i != children.size(); ++i) {
+        children[i]->release_transform_store();
+      }
+      store = 0;
+      store_handle = 0;
+      mark_subtree_dirty();
+    }
+
+    /// The store holding this node's matrices, if any.
+    transform_store *get_transform_store() const {
+      return store;
+    }
+
+    /// This node's handle in its transform_store.
+    unsigned get_transform_handle() const {
+      return store_handle;
     }
 
     /// get the x axis (left, right) of the node
     vec3 get_x() {
-      return calcModelToWorld().x().xyz();
+      return get_nodeToWorld().x().xyz();
     }
 
     /// get the y axis (up, down) of the node
     vec3 get_y() {
-      return calcModelToWorld().y().xyz();
+      return get_nodeToWorld().y().xyz();
     }
 
     /// get the z axis (forward, back) of the node
     vec3 get_z() {
-      return calcModelToWorld().z().xyz();
+      return get_nodeToWorld().z().xyz();
     }
 
     /// get the position of the node in world space
     vec3 get_position() {
-      return calcModelToWorld().w().xyz();
+      return get_nodeToWorld().w().xyz();
     }
 
     /// get enabled state
@@ -165,27 +449,34 @@ namespace octet { namespace scene {
 
     /// set enabled state
     void set_enabled(bool value) {
-      enabled = value;
+      if (enabled != value) {
+        enabled = value;
+        mark_dirty();
+      }
     }
 
     /// reset the matrix
     void loadIdentity() {
-      nodeToParent.loadIdentity();
+      local_matrix().loadIdentity();
+      mark_dirty();
     }
 
     /// Translate the matrix
     void translate(vec3_in xyz) {
-      nodeToParent.translate(xyz[0], xyz[1], xyz[2]);
+      local_matrix().translate(xyz[0], xyz[1], xyz[2]);
+      mark_dirty();
     }
 
     /// Rotate the matrix
     void rotate(float angle, vec3_in axis) {
-      nodeToParent.rotate(angle, axis[0], axis[1], axis[2]);
+      local_matrix().rotate(angle, axis[0], axis[1], axis[2]);
+      mark_dirty();
     }
 
     /// Scale the matrix
     void scale(vec3_in xyz) {
-      nodeToParent.scale(xyz[0], xyz[1], xyz[2]);
+      local_matrix().scale(xyz[0], xyz[1], xyz[2]);
+      mark_dirty();
     }
 
     /// Get the identifying sid
@@ -17,13 +17,96 @@ namespace octet { namespace scene {
     dynarray<int> parents;
     dynarray<mat4t> boneToNode;
 
-    // cached skin components
-    dynarray<mat4t> result;  /// uniforms to shader
-    dynarray<int> indices;   /// map skeleton to skin indices
+    // joint of each sid, so animations and skins can find joints quickly.
+    hash_map<atom_t, int> joint_indices;
+
+    // skins drawn with this skeleton (see bind_skin()). The bindings are one after another
+    // in binding_indices and transforms; binding b is from binding_starts[b] to binding_starts[b+1].
+    dynarray<ref<skin> > bound_skins;
+    dynarray<unsigned> binding_starts;
+    dynarray<int> binding_indices;    // skeleton joint of each skin joint, or -1
+    dynarray<mat4t> transforms;       // skin to model matrices for the shader or cpu_skinner
+
+    // nodeToParents come from set_pose(), not from the nodes.
+    bool posed;
+
+    // forget the skins, eg. when joints are added.
+    void clear_bindings() {
+      bound_skins.reset();
+      binding_starts.reset();
+      binding_indices.reset();
+      transforms.reset();
+    }
+
+    // compute the matrix hierarchy: bone to model, or to whatever the roots' parent goes to.
+    void calc_bones(const mat4t &rootToModel) {
+      if (boneToNode.size() < nodeToParents.size()) {
+        boneToNode.resize(nodeToParents.size());
+      }
+
+      // a pose from set_pose() drives the skeleton directly, otherwise the nodes do.
+      if (!posed) {
+        for (int i = 0; i != nodes.size(); ++i) {
+          nodeToParents[i] = nodes[i]->get_nodeToParent();
+        }
+      }
+
+      // parents come before their children.
+      for (int i = 0; i != nodeToParents.size(); ++i) {
+        int parent = parents[i];
+        // skeleton -> parent -> parent -> model
+        if (parent == -1) {
+          boneToNode[i] = nodeToParents[i] * rootToModel;
+        } else {
+          boneToNode[i] = nodeToParents[i] * boneToNode[parent];
+        }
+      }
+    }
+
+    // make room for num_joints joints in a binding, moving the bindings after it.
+    void resize_binding(unsigned binding, unsigned num_joints) {
+      unsigned start = binding_starts[binding];
+      unsigned end = binding_starts[binding + 1];
+      unsigned total = binding_indices.size();
+      unsigned new_end = start + num_joints;
+      if (new_end > end) {
+        binding_indices.resize(total + new_end - end);
+        transforms.resize(total + new_end - end);
+        for (unsigned i = total; i != end; --i) {
+          binding_indices[i - 1 + new_end - end] = binding_indices[i - 1];
+          transforms[i - 1 + new_end - end] = transforms[i - 1];
+        }
+      } else if (new_end < end) {
+        for (unsigned i = end; i != total; ++i) {
+          binding_indices[i - (end - new_end)] = binding_indices[i];
+          transforms[i - (end - new_end)] = transforms[i];
+        }
+        binding_indices.resize(total - (end - new_end));
+        transforms.resize(total - (end - new_end));
+      }
+      for (unsigned b = binding + 1; b != binding_starts.size(); ++b) {
+        binding_starts[b] = binding_starts[b] + new_end - end;
+      }
+    }
+
+    // premultiply the bones by a bound skin's matrices.
+    void calc_binding(unsigned binding, const mat4t &rootToModel) {
+      const skin *skn = bound_skins[binding];
+      unsigned start = binding_starts[binding];
+      unsigned num_joints = binding_starts[binding + 1] - start;
+      const int *indices = binding_indices.data() + start;
+      mat4t *result = transforms.data() + start;
+      for (unsigned i = 0; i != num_joints; ++i) {
+        // skin -> bind space -> skeleton -> parent -> parent -> model
+        int index = indices[i];
+        result[i] = index != -1 ? skn->get_modelToJoint(i) * boneToNode[index] : rootToModel;
+      }
+    }
   public:
     RESOURCE_META(skeleton)
 
     skeleton() {
+      posed = false;
     }
 
     void visit(visitor &v) {
@@ -32,8 +115,13 @@ namespace octet { namespace scene {
       v.visit(nodes, atom_nodes);
       v.visit(parents, atom_parents);
       v.visit(boneToNode, atom_boneToNode);
-      v.visit(result, atom_result);  /// uniforms to shader
-      v.visit(indices, atom_indices);   /// map skeleton to skin indices
+      if (v.is_reader()) {
+        joint_indices.clear();
+        for (unsigned i = 0; i != joints.size(); ++i) {
+          if (!joint_indices.contains(joints[i])) joint_indices[joints[i]] = (int)i;
+        }
+        clear_bindings();
+      }
     }
 
     void add_bone(scene_node *node, int parent) {
@@ -41,79 +129,119 @@ namespace octet { namespace scene {
       nodeToParents.push_back(node->get_nodeToParent());
       joints.push_back(node->get_sid());
       parents.push_back(parent);
+      if (!joint_indices.contains(node->get_sid())) {
+        joint_indices[node->get_sid()] = joints.size() - 1;
+      }
+      clear_bindings();
       //char tmp[256];
       //log("skeleton: add_bone %d [%s]\n", node->get_sid(), node->access_nodeToParent().toString(tmp, sizeof(tmp)));
     }
 
-    int get_num_bones() const { return result.size(); }
+    int get_num_bones() const { return joints.size(); }
 
-    int find_joint(atom_t sid) {
-      for (unsigned i = 0; i != joints.size(); ++i) {
-        if (joints[i] == sid) {
-          return i;
-        }
-      }
-      return -1;
+    /// number of joints (bones) in the skeleton; the size of its poses.
+    int get_num_joints() const { return joints.size(); }
+
+    /// parent joint of a joint, or -1. Parents come before their children.
+    int get_parent(int joint) const { return parents[joint]; }
+
+    /// get the joint with a sid, or -1.
+    int find_joint(atom_t sid) const {
+      int index = joint_indices.get_index(sid);
+      return index < 0 ? -1 : joint_indices.get_value(index);
     }
 
-    mat4t *calc_transforms(const mat4t &worldToCamera, skin *skn) {
-      //static bool first_frame = true;
-      if (boneToNode.size() < nodeToParents.size()) {
-        boneToNode.resize(nodeToParents.size());
+    /// Find or make the binding of a skin to this skeleton: which joint drives each joint of the skin.
+    /// Bindings are kept, so this is cheap after the first call for a skin.
+    /// A skin keeps its binding index even if its joints change.
+    /// Do not call it while calc_skins() may be running on another thread.
+    unsigned bind_skin(skin *skn) {
+      unsigned num_joints = skn->get_num_joints();
+      unsigned binding = 0;
+      while (binding != bound_skins.size() && bound_skins[binding] != skn) {
+        ++binding;
       }
 
-      // todo: optionally drive animation directly to the skeleton.
-      for (int i = 0; i != nodes.size(); ++i) {
-        nodeToParents[i] = nodes[i]->access_nodeToParent();
+      if (binding == bound_skins.size()) {
+        if (binding_starts.size() == 0) binding_starts.push_back(0);
+        binding_starts.push_back(binding_indices.size());
+        bound_skins.push_back(skn);
+      } else if (binding_starts[binding + 1] - binding_starts[binding] == num_joints) {
+        return binding;
       }
 
-      // compute matrix heirachy
-      for (int i = 0; i != nodeToParents.size(); ++i) {
-        int parent = parents[i];
-        // skeleton -> parent -> parent -> world -> camera
-        if (parent == -1) {
-          boneToNode[i] = nodeToParents[i] * worldToCamera;
-        } else {
-          boneToNode[i] = nodeToParents[i] * boneToNode[parent];
-        }
-        //log("%d %s p=%d\n", i, result[i].toString(), parent);
+      // new, or the skin has changed: rebuild the binding in place.
+      resize_binding(binding, num_joints);
+      int *indices = binding_indices.data() + binding_starts[binding];
+      for (unsigned i = 0; i != num_joints; ++i) {
+        indices[i] = find_joint(skn->get_joint(i));
       }
+      return binding;
+    }
 
-      unsigned num_joints = skn->get_num_joints();
-      if (result.size() < num_joints) {
-        result.resize(num_joints);
-        indices.resize(num_joints);
-        for (int i = 0; i != num_joints; ++i) {
-          // skin -> bind space -> skeleton -> parent -> parent -> world -> camera
-          indices[i] = find_joint(skn->get_joint(i));
-        }
+    /// Compute the joint matrices of every bound skin in model space.
+    /// Skeletons do not share anything, so different skeletons can do this on different threads.
+    void calc_skins() {
+      mat4t identity;
+      calc_bones(identity);
+      for (unsigned b = 0; b != bound_skins.size(); ++b) {
+        calc_binding(b, identity);
       }
+    }
 
-      // premultiply by skin matrices
-      for (int i = 0; i != num_joints; ++i) {
-        // skin -> bind space -> skeleton -> parent -> parent -> world -> camera
-        int index = indices[i];
-        if (index != -1) {
-          result[i] = skn->get_modelToBind() * skn->get_bindToModel(i) * boneToNode[index];
-        } else {
-          result[i] = worldToCamera;
-        }
-        //if (first_frame) log("%d %d [%s]\n", i, index, result[i].toString());
-      }
+    /// get the joint matrices of a binding from the last calc_skins() or calc_transforms().
+    const mat4t *get_skin_transforms(unsigned binding) const {
+      return transforms.data() + binding_starts[binding];
+    }
 
-      return &result[0];
+    /// Compute the joint matrices of one skin, with the roots' parent at worldToCamera.
+    mat4t *calc_transforms(const mat4t &worldToCamera, skin *skn) {
+      unsigned binding = bind_skin(skn);
+      calc_bones(worldToCamera);
+      calc_binding(binding, worldToCamera);
+      return transforms.data() + binding_starts[binding];
     }
 
-    // convert an sid into an index. (should be cached!)
-    int get_bone_index(atom_t sid) {
-      for (int i = 0; i != joints.size(); ++i) {
-        if (joints[i] == sid) return i;
-      }
-      return -1;
+    /// convert an sid into an index, or -1.
+    int get_bone_index(atom_t sid) const {
+      return find_joint(sid);
     }
 
     void set_bone(int index, const mat4t &value) {
       nodeToParents[index] = value;
     }
+
+    /// get a joint's node to parent transform as last used or set.
+    const mat4t &get_bone(int index) const {
+      return nodeToParents[index];
+    }
+
+    /// Get the rest pose: the transforms of the skeleton's nodes.
+    void get_rest_pose(pose_buffer &pose) const {
+      pose.resize(nodes.size());
+      for (unsigned i = 0; i != nodes.size(); ++i) {
+        pose.set_matrix(i, nodes[i]->get_nodeToParent());
+      }
+    }
+
+    /// Drive the skeleton from a pose (see animation_mixer) instead of from its nodes.
+    /// The nodes are not changed. clear_pose() goes back to using them.
+    void set_pose(const pose_buffer &pose) {
+      unsigned num_joints = pose.size() < nodeToParents.size() ? pose.size() : nodeToParents.size();
+      for (unsigned i = 0; i != num_joints; ++i) {
+        pose.get_matrix(i, nodeToParents[i]);
+      }
+      posed = true;
+    }
+
+    /// Go back to taking the joint transforms from the nodes.
+    void clear_pose() {
+      posed = false;
+    }
+
+    /// true if set_pose() is driving the skeleton.
+    bool is_posed() const {
+      return posed;
+    }
   };
 }}
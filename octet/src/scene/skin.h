@@ -18,6 +18,9 @@ namespace octet { namespace scene {
     // a name for each joint (sid)
     dynarray<atom_t> joints;
 
+    // modelToBind * bindToModel for each joint, worked out once when the joints are added.
+    dynarray<mat4t> modelToJoint;
+
   public:
     RESOURCE_META(skin)
 
@@ -32,10 +35,17 @@ namespace octet { namespace scene {
       v.visit(modelToBind, atom_modelToBind);
       v.visit(bindToModel, atom_bindToModel);
       v.visit(joints, atom_joints);
+      if (v.is_reader()) {
+        modelToJoint.resize(bindToModel.size());
+        for (unsigned i = 0; i != bindToModel.size(); ++i) {
+          modelToJoint[i] = modelToBind * bindToModel[i];
+        }
+      }
     }
 
     void add_joint(const mat4t &bindToModel, atom_t sid) {
       this->bindToModel.push_back(bindToModel);
+      modelToJoint.push_back(modelToBind * bindToModel);
       joints.push_back(sid);
       log("skin: add_joint %d\n", sid);
     }
@@ -51,6 +61,9 @@ namespace octet { namespace scene {
 
     const mat4t &get_bindToModel(int i) const { return bindToModel[i]; }
     const mat4t &get_modelToBind() const { return modelToBind; }
+
+    /// modelToBind * bindToModel(i): takes the skin's vertices to joint i's space.
+    const mat4t &get_modelToJoint(int i) const { return modelToJoint[i]; }
     atom_t get_joint(int i) const { return joints[i]; }
     unsigned get_num_joints() const { return joints.size(); }
   };
@@ -0,0 +1,395 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Skinning: moving the vertices of a mesh with the joints of a skeleton
+//
+// Each vertex of a skinned mesh has up to four joints and three weights (the first
+// joint gets one minus the others). There are two ways to draw one:
+//
+// On the GPU, the joint matrices go in a float texture, three texels each, which the
+// vertex shader reads (see shaders/default_skinned.vs). There is no limit on the number
+// of joints as there is with an array of uniforms.
+//
+// On the CPU, a cpu_skinner blends the joints for each vertex with SIMD, spread over
+// the job threads, and streams the result to a vertex buffer drawn with the normal
+// shaders. This costs CPU time but works everywhere and leaves the results in memory.
+//
+
+namespace octet { namespace scene {
+  /// Joint matrices in a float texture for skinning in the vertex shader.
+  ///
+  /// Each joint is three texels: the first three columns of its 4x4 matrix (the last is
+  /// always 0, 0, 0, 1), so x' = dot(pos, texel0) and so on. There are joints_per_row
+  /// joints in each row of the texture and as many rows as we need.
+  class joint_texture : public resource {
+    GLuint texture;
+    unsigned num_rows;
+    dynarray<vec4> texels;
+
+  public:
+    RESOURCE_META(joint_texture)
+
+    enum {
+      /// joints in a row of the texture (shaders/default_skinned.vs has the same number).
+      joints_per_row = 256,
+
+      /// texture unit the joints are bound to, above those used by materials.
+      texture_unit = 7,
+    };
+
+    /// Make an empty texture; update() fills it.
+    joint_texture() {
+      texture = 0;
+      num_rows = 0;
+    }
+
+    ~joint_texture() {
+      if (texture) glDeleteTextures(1, &texture);
+    }
+
+    /// true if vertex shaders can read textures on this GPU.
+    static bool is_supported() {
+      static GLint num_units = -1;
+      if (num_units < 0) {
+        num_units = 0;
+        glGetIntegerv(GL_MAX_VERTEX_TEXTURE_IMAGE_UNITS, &num_units);
+      }
+      return num_units > 0;
+    }
+
+    /// Pack the texels for some joint matrices. This does not need a GL context.
+    static void pack(vec4 *dest, const mat4t *joints, unsigned num_joints) {
+      for (unsigned i = 0; i != num_joints; ++i) {
+        const mat4t &m = joints[i];
+        dest[0] = vec4(m[0][0], m[1][0], m[2][0], m[3][0]);
+        dest[1] = vec4(m[0][1], m[1][1], m[2][1], m[3][1]);
+        dest[2] = vec4(m[0][2], m[1][2], m[2][2], m[3][2]);
+        dest += 3;
+      }
+    }
+
+    /// Copy the joints to the texture, making it bigger if it has to be.
+    void update(const mat4t *joints, unsigned num_joints) {
+      unsigned rows = (num_joints + joints_per_row - 1) / joints_per_row;
+      if (rows == 0) rows = 1;
+      texels.resize(rows * joints_per_row * 3);
+      pack(texels.data(), joints, num_joints);
+
+      if (!texture) {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      } else {
+        glBindTexture(GL_TEXTURE_2D, texture);
+      }
+
+      // only send the rows we have used.
+      unsigned used_rows = (num_joints + joints_per_row - 1) / joints_per_row;
+      if (rows != num_rows) {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, joints_per_row * 3, rows, 0, GL_RGBA, GL_FLOAT, texels.data());
+        num_rows = rows;
+      } else if (used_rows) {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, joints_per_row * 3, used_rows, GL_RGBA, GL_FLOAT, texels.data());
+      }
+    }
+
+    /// Bind the texture to texture_unit.
+    void bind() const {
+      glActiveTexture(GL_TEXTURE0 + texture_unit);
+      glBindTexture(GL_TEXTURE_2D, texture);
+      glActiveTexture(GL_TEXTURE0);
+    }
+
+    /// rows in the texture, for the joint_rows uniform.
+    unsigned get_num_rows() const {
+      return num_rows;
+    }
+
+    /// the texels from the last update().
+    const dynarray<vec4> &get_texels() const {
+      return texels;
+    }
+  };
+
+  /// Skins a mesh on the CPU into a vertex buffer of its own.
+  ///
+  /// The positions, normals, tangents and bitangents are transformed; everything else
+  /// is copied from the source mesh once. skin() needs no GL context, so it can be
+  /// used (and tested) without a window; upload() then sends the vertices to the GPU.
+  ///
+  /// Example:
+  ///
+  ///     ref<cpu_skinner> skinner = new cpu_skinner(msh);
+  ///     ...
+  ///     skinner->skin(skel->calc_transforms(mat4t(), msh->get_skin()), msh->get_skin()->get_num_joints());
+  ///     mesh *skinned = skinner->upload();
+  class cpu_skinner : public resource {
+  public:
+    /// where the skinned attributes are in a vertex, in bytes. Missing attributes are ~0u.
+    struct layout {
+      unsigned stride;
+      unsigned pos;
+      unsigned normal;
+      unsigned tangent;
+      unsigned bitangent;
+      unsigned blendweight;
+      unsigned blendindices;
+    };
+
+  private:
+    // the mesh we skin and a copy of it with our vertices.
+    ref<mesh> src;
+    ref<mesh> skinned;
+
+    // the source vertices in the bind pose and the skinned ones.
+    dynarray<uint8_t> bind_pose;
+    dynarray<uint8_t> vertices;
+
+    layout lay;
+    unsigned num_vertices;
+    bool valid;
+
+    // offset of a three or four float attribute, or ~0u if there isn't one (or it is another kind).
+    static unsigned find_float_attribute(const mesh *msh, unsigned attr, unsigned min_size, unsigned max_size) {
+      for (unsigned slot = 0; slot != msh->get_num_slots(); ++slot) {
+        if (msh->get_attr(slot) == attr) {
+          bool ok = msh->get_kind(slot) == GL_FLOAT && msh->get_size(slot) >= min_size && msh->get_size(slot) <= max_size;
+          return ok ? msh->get_offset(slot) : ~0u;
+        }
+      }
+      return ~0u;
+    }
+
+    // dest = xyz of (x, y, z, w) * m, where m's rows are r0..r3.
+    static void transform(float *dest, const float *v, float w, const float *r0, const float *r1, const float *r2, const float *r3) {
+      float x = v[0], y = v[1], z = v[2];
+      dest[0] = x * r0[0] + y * r1[0] + z * r2[0] + w * r3[0];
+      dest[1] = x * r0[1] + y * r1[1] + z * r2[1] + w * r3[1];
+      dest[2] = x * r0[2] + y * r1[2] + z * r2[2] + w * r3[2];
+    }
+
+  public:
+    RESOURCE_META(cpu_skinner)
+
+    /// Make a skinner for a mesh with blendweight and blendindices attributes.
+    cpu_skinner(mesh *src = 0) {
+      num_vertices = 0;
+      valid = false;
+      if (src) init(src);
+    }
+
+    /// Find the attributes. Returns false if the mesh cannot be skinned on the CPU:
+    /// it needs float positions, three float blendweights and four float blendindices.
+    static bool find_layout(layout &result, const mesh *msh) {
+      result.stride = msh->get_stride();
+      result.pos = find_float_attribute(msh, attribute_pos, 3, 4);
+      result.normal = find_float_attribute(msh, attribute_normal, 3, 3);
+      result.tangent = find_float_attribute(msh, attribute_tangent, 3, 3);
+      result.bitangent = find_float_attribute(msh, attribute_bitangent, 3, 3);
+      result.blendweight = find_float_attribute(msh, attribute_blendweight, 3, 3);
+      result.blendindices = find_float_attribute(msh, attribute_blendindices, 4, 4);
+      return result.pos != ~0u && result.blendweight != ~0u && result.blendindices != ~0u;
+    }
+
+    // the joint of a blend index, clamped to the last joint so bad vertex data can not read past joints.
+    static unsigned joint_index(float index, unsigned last) {
+      unsigned i = index > 0 ? (unsigned)index : 0;
+      return i < last ? i : last;
+    }
+
+    /// Skin vertices begin to end, reading from src and writing to dest.
+    /// Both have the layout lay; only the skinned attributes of dest are written.
+    /// Blend indices past num_joints - 1 use the last joint.
+    static void skin_vertices(uint8_t *dest, const uint8_t *src, unsigned begin, unsigned end, const layout &lay, const mat4t *joints, unsigned num_joints) {
+      unsigned stride = lay.stride;
+      unsigned last = num_joints - 1;
+      const float *base = joints[0].get();
+      unsigned extra[3] = { lay.normal, lay.tangent, lay.bitangent };
+      unsigned num_extra = 0;
+      for (unsigned i = 0; i != 3; ++i) {
+        if (extra[i] != ~0u) extra[num_extra++] = extra[i];
+      }
+
+      for (unsigned v = begin; v != end; ++v) {
+        const uint8_t *s = src + v * stride;
+        uint8_t *d = dest + v * stride;
+        const float *w = (const float*)(s + lay.blendweight);
+        const float *idx = (const float*)(s + lay.blendindices);
+        float w0 = 1 - w[0] - w[1] - w[2];
+        const float *m0 = base + joint_index(idx[0], last) * 16;
+        const float *m1 = base + joint_index(idx[1], last) * 16;
+        const float *m2 = base + joint_index(idx[2], last) * 16;
+        const float *m3 = base + joint_index(idx[3], last) * 16;
+
+        #if OCTET_AVX2
+          // two rows at once: rows 0 and 1 in r01, 2 and 3 in r23.
+          __m256 w0v = _mm256_set1_ps(w0), w1v = _mm256_set1_ps(w[0]), w2v = _mm256_set1_ps(w[1]), w3v = _mm256_set1_ps(w[2]);
+          __m256 r01 = _mm256_mul_ps(_mm256_loadu_ps(m0), w0v);
+          r01 = _mm256_add_ps(r01, _mm256_mul_ps(_mm256_loadu_ps(m1), w1v));
+          r01 = _mm256_add_ps(r01, _mm256_mul_ps(_mm256_loadu_ps(m2), w2v));
+          r01 = _mm256_add_ps(r01, _mm256_mul_ps(_mm256_loadu_ps(m3), w3v));
+          __m256 r23 = _mm256_mul_ps(_mm256_loadu_ps(m0 + 8), w0v);
+          r23 = _mm256_add_ps(r23, _mm256_mul_ps(_mm256_loadu_ps(m1 + 8), w1v));
+          r23 = _mm256_add_ps(r23, _mm256_mul_ps(_mm256_loadu_ps(m2 + 8), w2v));
+          r23 = _mm256_add_ps(r23, _mm256_mul_ps(_mm256_loadu_ps(m3 + 8), w3v));
+
+          // (x * row0 + y * row1) + (z * row2 + w * row3), then add the halves.
+          const float *p = (const float*)(s + lay.pos);
+          __m256 xy = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(p[0])), _mm_set1_ps(p[1]), 1);
+          __m256 zw = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(p[2])), _mm_set1_ps(1.0f), 1);
+          __m256 sum = _mm256_add_ps(_mm256_mul_ps(r01, xy), _mm256_mul_ps(r23, zw));
+          __m128 res = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+          float *dp = (float*)(d + lay.pos);
+          _mm_storel_pi((__m64*)dp, res);
+          _mm_store_ss(dp + 2, _mm_movehl_ps(res, res));
+
+          __m256 mask = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(1.0f)), _mm_setzero_ps(), 1);
+          for (unsigned e = 0; e != num_extra; ++e) {
+            const float *n = (const float*)(s + extra[e]);
+            __m256 nxy = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(n[0])), _mm_set1_ps(n[1]), 1);
+            __m256 nz = _mm256_mul_ps(_mm256_set1_ps(n[2]), mask);
+            __m256 nsum = _mm256_add_ps(_mm256_mul_ps(r01, nxy), _mm256_mul_ps(r23, nz));
+            __m128 nres = _mm_add_ps(_mm256_castps256_ps128(nsum), _mm256_extractf128_ps(nsum, 1));
+            float *dn = (float*)(d + extra[e]);
+            _mm_storel_pi((__m64*)dn, nres);
+            _mm_store_ss(dn + 2, _mm_movehl_ps(nres, nres));
+          }
+        #elif OCTET_SSE
+          __m128 w0v = _mm_set1_ps(w0), w1v = _mm_set1_ps(w[0]), w2v = _mm_set1_ps(w[1]), w3v = _mm_set1_ps(w[2]);
+          __m128 rows[4];
+          for (unsigned r = 0; r != 4; ++r) {
+            __m128 row = _mm_mul_ps(_mm_loadu_ps(m0 + r * 4), w0v);
+            row = _mm_add_ps(row, _mm_mul_ps(_mm_loadu_ps(m1 + r * 4), w1v));
+            row = _mm_add_ps(row, _mm_mul_ps(_mm_loadu_ps(m2 + r * 4), w2v));
+            rows[r] = _mm_add_ps(row, _mm_mul_ps(_mm_loadu_ps(m3 + r * 4), w3v));
+          }
+
+          const float *p = (const float*)(s + lay.pos);
+          __m128 res = _mm_add_ps(_mm_mul_ps(rows[0], _mm_set1_ps(p[0])), _mm_mul_ps(rows[1], _mm_set1_ps(p[1])));
+          res = _mm_add_ps(res, _mm_add_ps(_mm_mul_ps(rows[2], _mm_set1_ps(p[2])), rows[3]));
+          float *dp = (float*)(d + lay.pos);
+          _mm_storel_pi((__m64*)dp, res);
+          _mm_store_ss(dp + 2, _mm_movehl_ps(res, res));
+
+          for (unsigned e = 0; e != num_extra; ++e) {
+            const float *n = (const float*)(s + extra[e]);
+            __m128 nres = _mm_add_ps(_mm_mul_ps(rows[0], _mm_set1_ps(n[0])), _mm_mul_ps(rows[1], _mm_set1_ps(n[1])));
+            nres = _mm_add_ps(nres, _mm_mul_ps(rows[2], _mm_set1_ps(n[2])));
+            float *dn = (float*)(d + extra[e]);
+            _mm_storel_pi((__m64*)dn, nres);
+            _mm_store_ss(dn + 2, _mm_movehl_ps(nres, nres));
+          }
+        #else
+          float m[16];
+          for (unsigned i = 0; i != 16; ++i) {
+            m[i] = m0[i] * w0 + m1[i] * w[0] + m2[i] * w[1] + m3[i] * w[2];
+          }
+          transform((float*)(d + lay.pos), (const float*)(s + lay.pos), 1, m, m + 4, m + 8, m + 12);
+          for (unsigned e = 0; e != num_extra; ++e) {
+            transform((float*)(d + extra[e]), (const float*)(s + extra[e]), 0, m, m + 4, m + 8, m + 12);
+          }
+        #endif
+      }
+    }
+
+    /// Copy the vertices in the bind pose from a mesh with its format.
+    /// Returns false if the mesh cannot be skinned on the CPU (see find_layout()).
+    bool init(mesh *msh) {
+      src = msh;
+      valid = find_layout(lay, msh);
+      if (!valid) return false;
+
+      num_vertices = msh->get_num_vertices();
+      bind_pose.resize(num_vertices * lay.stride);
+      if (num_vertices) {
+        gl_resource::rolock lock(msh->get_vertices());
+        memcpy(bind_pose.data(), lock.u8(), bind_pose.size());
+      }
+      vertices = bind_pose;
+
+      skinned = new mesh(*msh);
+      skinned->set_vertices(new gl_resource(GL_ARRAY_BUFFER));
+      return true;
+    }
+
+    /// Use vertices in memory instead of a mesh's buffer; the mesh gives the format.
+    /// There is no skinned mesh to upload() to, so this is for skinning without a GL context.
+    bool init(const mesh *format, const void *src_vertices, unsigned num_src_vertices) {
+      src = 0;
+      skinned = 0;
+      valid = find_layout(lay, format);
+      if (!valid) return false;
+
+      num_vertices = num_src_vertices;
+      bind_pose.resize(num_vertices * lay.stride);
+      memcpy(bind_pose.data(), src_vertices, bind_pose.size());
+      vertices = bind_pose;
+      return true;
+    }
+
+    /// true if init() succeeded.
+    bool is_valid() const {
+      return valid;
+    }
+
+    /// the mesh we were made from.
+    mesh *get_source() const {
+      return src;
+    }
+
+    /// Skin the vertices with the joints of the mesh's skin, in model space
+    /// (see skeleton::calc_transforms). Large meshes are split between the job threads.
+    void skin(const mat4t *joints, unsigned num_joints, bool use_threads = true) {
+      if (!valid || !num_joints) return;
+      uint8_t *dest = vertices.data();
+      const uint8_t *source = bind_pose.data();
+      const layout &l = lay;
+      if (use_threads) {
+        job_scheduler::get().parallel_for(0, num_vertices, 1024, [=, &l](unsigned begin, unsigned end) {
+          skin_vertices(dest, source, begin, end, l, joints, num_joints);
+        });
+      } else {
+        skin_vertices(dest, source, 0, num_vertices, l, joints, num_joints);
+      }
+    }
+
+    /// Send the skinned vertices to the skinned mesh's buffer and return the mesh.
+    mesh *upload() {
+      if (skinned) {
+        skinned->get_vertices()->stream(vertices.data(), vertices.size());
+      }
+      return skinned;
+    }
+
+    /// the skinned vertices, with the source mesh's format.
+    const uint8_t *get_vertices() const {
+      return vertices.data();
+    }
+
+    /// the unskinned vertices.
+    const uint8_t *get_bind_pose() const {
+      return bind_pose.data();
+    }
+
+    /// number of vertices.
+    unsigned get_num_vertices() const {
+      return num_vertices;
+    }
+
+    /// where the attributes are.
+    const layout &get_layout() const {
+      return lay;
+    }
+
+    /// the mesh that is drawn, which shares the source mesh's indices.
+    mesh *get_skinned_mesh() const {
+      return skinned;
+    }
+  };
+} }
@@ -0,0 +1,247 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Contiguous storage for a hierarchy of transforms
+//
+// scene_nodes are separate objects on the heap, so walking a hierarchy chases pointers
+// and multiplies matrices one at a time. A transform_store keeps every node's matrices in
+// arrays, sorted by depth, with parents as indices. Every parent comes before its children and
+// nodes at the same depth do not depend on each other, so each depth is one batch of
+// independent multiplies that stream through memory.
+//
+
+namespace octet { namespace scene {
+  /// Matrices for a hierarchy of nodes in arrays, updated in batches.
+  ///
+  /// Nodes are identified by handles, which stay the same when the arrays are re-sorted.
+  /// scene_node::use_transform_store() puts a hierarchy in a store and the scene_node
+  /// accessors then read and write the store, so existing code keeps working.
+  /// Writing matrices with access_local() instead of through the scene_nodes is quicker still,
+  /// as the nodes' dirty flags are not touched, but then the bounds used for hierarchical
+  /// culling are not updated (see visual_scene::invalidate_node_bounds()).
+  ///
+  /// Example:
+  ///
+  ///     ref<transform_store> store = new transform_store();
+  ///     unsigned root = store->add(-1, mat4t());
+  ///     unsigned arm = store->add(root, armToRoot);
+  ///     store->access_local(root).rotateY(10);
+  ///     const mat4t &armToWorld = store->get_world(arm);
+  class transform_store : public resource {
+    // these are indexed by slot, in depth order.
+    dynarray<mat4t> locals;             // node to parent
+    dynarray<mat4t> worlds;             // node to world
+    dynarray<int> parents;              // slot of the parent or -1 for roots
+    dynarray<unsigned> depths;          // number of ancestors
+    dynarray<unsigned> slot_handles;    // handle of each slot
+
+    // handle -> slot
+    dynarray<unsigned> handle_slots;
+
+    // end slot of each depth
+    dynarray<unsigned> depth_ends;
+
+    // results of calc_view(), by slot.
+    dynarray<mat4t> modelToCamera;
+    dynarray<mat4t> modelToProjection;
+
+    // a local matrix has changed since the last update().
+    bool worlds_dirty;
+
+    // nodes have been added since the arrays were sorted by depth.
+    bool order_dirty;
+
+    // dest = a * b for one matrix, a row at a time (octet matrices multiply row vectors).
+    static void multiply(float *dest, const float *a, const float *b) {
+      #if OCTET_AVX2
+        // two rows at once: each half of a register does one row.
+        __m256 b0 = _mm256_broadcast_ps((const __m128*)(b + 0));
+        __m256 b1 = _mm256_broadcast_ps((const __m128*)(b + 4));
+        __m256 b2 = _mm256_broadcast_ps((const __m128*)(b + 8));
+        __m256 b3 = _mm256_broadcast_ps((const __m128*)(b + 12));
+        for (unsigned i = 0; i != 16; i += 8) {
+          __m256 r = _mm256_loadu_ps(a + i);
+          __m256 res = _mm256_mul_ps(_mm256_shuffle_ps(r, r, 0x00), b0);
+          res = _mm256_add_ps(res, _mm256_mul_ps(_mm256_shuffle_ps(r, r, 0x55), b1));
+          res = _mm256_add_ps(res, _mm256_mul_ps(_mm256_shuffle_ps(r, r, 0xaa), b2));
+          res = _mm256_add_ps(res, _mm256_mul_ps(_mm256_shuffle_ps(r, r, 0xff), b3));
+          _mm256_storeu_ps(dest + i, res);
+        }
+      #elif OCTET_SSE
+        __m128 b0 = _mm_loadu_ps(b + 0), b1 = _mm_loadu_ps(b + 4), b2 = _mm_loadu_ps(b + 8), b3 = _mm_loadu_ps(b + 12);
+        for (unsigned i = 0; i != 16; i += 4) {
+          __m128 r = _mm_loadu_ps(a + i);
+          __m128 res = _mm_mul_ps(_mm_shuffle_ps(r, r, 0x00), b0);
+          res = _mm_add_ps(res, _mm_mul_ps(_mm_shuffle_ps(r, r, 0x55), b1));
+          res = _mm_add_ps(res, _mm_mul_ps(_mm_shuffle_ps(r, r, 0xaa), b2));
+          res = _mm_add_ps(res, _mm_mul_ps(_mm_shuffle_ps(r, r, 0xff), b3));
+          _mm_storeu_ps(dest + i, res);
+        }
+      #else
+        for (unsigned i = 0; i != 16; i += 4) {
+          float x = a[i+0], y = a[i+1], z = a[i+2], w = a[i+3];
+          for (unsigned j = 0; j != 4; ++j) {
+            dest[i+j] = x * b[j] + y * b[4+j] + z * b[8+j] + w * b[12+j];
+          }
+        }
+      #endif
+    }
+
+    // sort the slots by depth (stable, so siblings stay in order) and find where each depth ends.
+    void sort_by_depth() {
+      unsigned num_nodes = locals.size();
+      unsigned max_depth = 0;
+      for (unsigned i = 0; i != num_nodes; ++i) {
+        if (depths[i] > max_depth) max_depth = depths[i];
+      }
+
+      // counting sort: depth_ends[d] is first the count, then the start, then the end of depth d.
+      depth_ends.resize(max_depth + 1);
+      for (unsigned d = 0; d <= max_depth; ++d) depth_ends[d] = 0;
+      for (unsigned i = 0; i != num_nodes; ++i) depth_ends[depths[i]]++;
+      unsigned start = 0;
+      for (unsigned d = 0; d <= max_depth; ++d) {
+        unsigned count = depth_ends[d];
+        depth_ends[d] = start;
+        start += count;
+      }
+
+      dynarray<unsigned> new_slots(num_nodes);
+      for (unsigned i = 0; i != num_nodes; ++i) {
+        new_slots[i] = depth_ends[depths[i]]++;
+      }
+
+      dynarray<mat4t> new_locals(num_nodes);
+      dynarray<int> new_parents(num_nodes);
+      dynarray<unsigned> new_depths(num_nodes);
+      dynarray<unsigned> new_handles(num_nodes);
+      for (unsigned i = 0; i != num_nodes; ++i) {
+        unsigned slot = new_slots[i];
+        new_locals[slot] = locals[i];
+        new_parents[slot] = parents[i] < 0 ? -1 : (int)new_slots[parents[i]];
+        new_depths[slot] = depths[i];
+        new_handles[slot] = slot_handles[i];
+        handle_slots[slot_handles[i]] = slot;
+      }
+      locals = std::move(new_locals);
+      parents = std::move(new_parents);
+      depths = std::move(new_depths);
+      slot_handles = std::move(new_handles);
+      worlds.resize(num_nodes);
+      modelToCamera.resize(0);
+      modelToProjection.resize(0);
+      order_dirty = false;
+      worlds_dirty = true;
+    }
+
+  public:
+    RESOURCE_META(transform_store)
+
+    /// Make an empty store.
+    transform_store() {
+      worlds_dirty = false;
+      order_dirty = false;
+    }
+
+    /// Add a node below parent (a handle, or -1 for a root) and return its handle.
+    unsigned add(int parent, const mat4t &nodeToParent) {
+      unsigned handle = handle_slots.size();
+      unsigned slot = locals.size();
+      int parent_slot = parent < 0 ? -1 : (int)handle_slots[parent];
+      handle_slots.push_back(slot);
+      slot_handles.push_back(handle);
+      locals.push_back(nodeToParent);
+      worlds.push_back(nodeToParent);
+      parents.push_back(parent_slot);
+      depths.push_back(parent_slot < 0 ? 0 : depths[parent_slot] + 1);
+      order_dirty = true;
+      worlds_dirty = true;
+      return handle;
+    }
+
+    /// number of nodes.
+    unsigned size() const {
+      return locals.size();
+    }
+
+    /// read a node to parent matrix.
+    const mat4t &get_local(unsigned handle) const {
+      return locals[handle_slots[handle]];
+    }
+
+    /// get a node to parent matrix for writing. The world matrices are recomputed on the next update().
+    mat4t &access_local(unsigned handle) {
+      worlds_dirty = true;
+      return locals[handle_slots[handle]];
+    }
+
+    /// get a node to world matrix, updating the store if anything has moved.
+    const mat4t &get_world(unsigned handle) {
+      if (worlds_dirty || order_dirty) update();
+      return worlds[handle_slots[handle]];
+    }
+
+    /// true if get_world() would have to update the store.
+    bool is_dirty() const {
+      return worlds_dirty || order_dirty;
+    }
+
+    /// Recompute every node to world matrix, one depth at a time.
+    /// This does the whole store (so moving one node costs as much as moving all of them),
+    /// but it is a tight loop over contiguous memory with no branches for dirty flags.
+    void update() {
+      if (order_dirty) sort_by_depth();
+      if (!worlds_dirty) return;
+
+      unsigned num_roots = depth_ends.size() ? depth_ends[0] : 0;
+      for (unsigned i = 0; i != num_roots; ++i) {
+        worlds[i] = locals[i];
+      }
+
+      unsigned num_nodes = locals.size();
+      const mat4t *local = locals.data();
+      mat4t *world = worlds.data();
+      const int *parent = parents.data();
+      for (unsigned i = num_roots; i != num_nodes; ++i) {
+        multiply(world[i].get(), local[i].get(), world[parent[i]].get());
+      }
+      worlds_dirty = false;
+    }
+
+    /// Compute model to camera and model to projection matrices for every node in one batch.
+    /// Call once per frame after moving things, then read them with get_modelToCamera() etc.
+    void calc_view(const mat4t &worldToCamera, const mat4t &cameraToProjection) {
+      update();
+      unsigned num_nodes = locals.size();
+      modelToCamera.resize(num_nodes);
+      modelToProjection.resize(num_nodes);
+      const mat4t *world = worlds.data();
+      mat4t *toCamera = modelToCamera.data();
+      mat4t *toProjection = modelToProjection.data();
+      const float *w2c = worldToCamera.get();
+      const float *c2p = cameraToProjection.get();
+      for (unsigned i = 0; i != num_nodes; ++i) {
+        multiply(toCamera[i].get(), world[i].get(), w2c);
+        multiply(toProjection[i].get(), toCamera[i].get(), c2p);
+      }
+    }
+
+    /// model to camera matrix from the last calc_view().
+    const mat4t &get_modelToCamera(unsigned handle) const {
+      return modelToCamera[handle_slots[handle]];
+    }
+
+    /// model to projection matrix from the last calc_view().
+    const mat4t &get_modelToProjection(unsigned handle) const {
+      return modelToProjection[handle_slots[handle]];
+    }
+
+    /// true if the last calc_view() included this node.
+    bool has_view(unsigned handle) const {
+      return handle_slots[handle] < modelToCamera.size();
+    }
+  };
+} }
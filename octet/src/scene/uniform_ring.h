@@ -0,0 +1,174 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// (C) Andy Thomason 2012-2014
+//
+// Modular Framework for OpenGLES2 rendering on multiple platforms.
+//
+// Ring buffer for uniforms that change every draw
+//
+// Each draw's matrices are copied to the next free part of one big uniform buffer
+// and that part is bound to the shader. When we reach the end, the buffer is
+// orphaned (re-allocated with glBufferData) so we never wait for the GPU to finish
+// with the parts it is still drawing from.
+//
+// The lights are shared by every material and change whenever the camera moves,
+// so they have a version and a buffer of their own (lighting_block).
+//
+
+namespace octet { namespace scene {
+  /// One uniform buffer object shared by all materials for their per-draw uniforms.
+  ///
+  /// Shaders declare the per-draw uniforms in a block called octet_draw, the lights
+  /// in octet_lighting and the per-material ones in a block called octet_material
+  /// (see shaders/default.vs and shaders/default_solid.fs):
+  ///
+  ///     #if OCTET_UNIFORM_BUFFERS
+  ///       #extension GL_ARB_uniform_buffer_object : enable
+  ///       layout(std140) uniform octet_draw {
+  ///         mat4 modelToProjection;
+  ///         mat4 modelToCamera;
+  ///       };
+  ///     #else
+  ///       uniform mat4 modelToProjection;
+  ///       uniform mat4 modelToCamera;
+  ///     #endif
+  ///
+  /// param_shader binds the blocks to draw_binding, lighting_binding and material_binding when it compiles.
+  class uniform_ring {
+  public:
+    enum {
+      /// binding point of the octet_draw block.
+      draw_binding = 0,
+
+      /// binding point of the octet_material block.
+      material_binding = 1,
+
+      /// binding point of the octet_lighting block.
+      lighting_binding = 2,
+
+      /// bytes in the ring: enough for several thousand draws before we orphan it.
+      ring_size = 0x80000,
+
+      /// largest octet_draw block we will push.
+      max_draw_size = 1024,
+    };
+
+  private:
+    GLuint buffer;
+    unsigned offset;
+    unsigned alignment;
+
+    uniform_ring() {
+      buffer = 0;
+      offset = 0;
+      alignment = 256;
+    }
+
+    uniform_ring(const uniform_ring &);
+    uniform_ring &operator=(const uniform_ring &);
+  public:
+    /// get the ring, made on first use in the current GL context.
+    static uniform_ring &get() {
+      static uniform_ring instance;
+      return instance;
+    }
+
+    /// Copy size bytes to the next free part of the ring and bind it to a binding point.
+    void push(GLuint binding, const void *data, unsigned size) {
+      #if OCTET_UNIFORM_BUFFERS
+        if (!buffer) {
+          GLint value = 0;
+          glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &value);
+          if (value >= 16) alignment = (unsigned)value;
+          glGenBuffers(1, &buffer);
+          glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+          glBufferData(GL_UNIFORM_BUFFER, ring_size, NULL, GL_STREAM_DRAW);
+        } else {
+          glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        }
+
+        if (offset + size > ring_size) {
+          // orphan: the driver keeps the old storage until the GPU has finished with it.
+          glBufferData(GL_UNIFORM_BUFFER, ring_size, NULL, GL_STREAM_DRAW);
+          offset = 0;
+        }
+
+        glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
+        glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, offset, size);
+        offset = (offset + size + alignment - 1) & ~(alignment - 1);
+      #endif
+    }
+  };
+
+  /// The lighting uniforms of the current render, shared by all materials.
+  ///
+  /// Materials pass the lights in with every draw. The version only changes when the
+  /// values do, so shaders (and the octet_lighting uniform buffer) are only updated then,
+  /// and the materials' own values and buffers are left alone.
+  class lighting_block {
+    dynarray<vec4> values;
+    int32_t num_lights;
+    uint32_t version;
+
+    #if OCTET_UNIFORM_BUFFERS
+      // the octet_lighting buffer, the version it holds and its size.
+      GLuint buffer;
+      uint32_t buffer_version;
+      unsigned buffer_size;
+    #endif
+
+    lighting_block() {
+      num_lights = 0;
+      version = 1;
+      #if OCTET_UNIFORM_BUFFERS
+        buffer = 0;
+        buffer_version = 0;
+        buffer_size = 0;
+      #endif
+    }
+
+    lighting_block(const lighting_block &);
+    lighting_block &operator=(const lighting_block &);
+  public:
+    /// get the lighting, shared by all materials.
+    static lighting_block &get() {
+      static lighting_block instance;
+      return instance;
+    }
+
+    /// Set the lighting for the next draws. Returns the version, which changes when the values do.
+    uint32_t update(const vec4 *light_uniforms, int num_light_uniforms, int num_lights_) {
+      if (num_light_uniforms != (int)values.size() || num_lights_ != num_lights || memcmp(values.data(), light_uniforms, sizeof(vec4) * num_light_uniforms)) {
+        values.resize(num_light_uniforms);
+        for (int i = 0; i != num_light_uniforms; ++i) {
+          values[i] = light_uniforms[i];
+        }
+        num_lights = num_lights_;
+        version++;
+      }
+      return version;
+    }
+
+    /// the version of the current lighting.
+    uint32_t get_version() const {
+      return version;
+    }
+
+    #if OCTET_UNIFORM_BUFFERS
+      /// Does the octet_lighting buffer need a new upload() for a block of this size?
+      bool needs_upload(unsigned size) const {
+        return buffer_version != version || buffer_size < size;
+      }
+
+      /// Copy the current lighting, laid out as the shader's block, to the octet_lighting buffer.
+      void upload(const void *data, unsigned size) {
+        if (!buffer) glGenBuffers(1, &buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, size, data, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, uniform_ring::lighting_binding, buffer);
+        buffer_version = version;
+        buffer_size = size;
+      }
+    #endif
+  };
+}}
@@ -8,24 +8,196 @@
 //
 
 namespace octet { namespace scene {
+  /// A list of instances (meshes, cameras etc.) in a visual_scene.
+  ///
+  /// The instances are packed in a slot_map for fast iteration when rendering.
+  /// Handles stay valid until the instance is deleted and instances can be
+  /// found and deleted by pointer in O(1) time.
+  template <class type> class instance_list {
+    slot_map<ref<type> > instances;
+    hash_map<type *, slot_map_handle> handles;
+  public:
+    /// add an instance (once) and return its handle.
+    slot_map_handle add(type *inst) {
+      if (!inst) return slot_map_handle();
+      slot_map_handle &handle = handles[inst];
+      if (handle.is_null()) {
+        handle = instances.insert(inst);
+      }
+      return handle;
+    }
+
+    /// remove an instance. returns false if it is not in the list.
+    bool erase(type *inst) {
+      int index = handles.get_index(inst);
+      if (index < 0) return false;
+      instances.erase(handles.get_value(index));
+      handles.erase(inst);
+      return true;
+    }
+
+    /// remove an instance by handle. returns false if it has already gone.
+    bool erase(slot_map_handle handle) {
+      ref<type> *inst = instances.get(handle);
+      return inst ? erase((type*)*inst) : false;
+    }
+
+    /// get an instance by handle or null if it has been deleted.
+    type *get(slot_map_handle handle) {
+      ref<type> *inst = instances.get(handle);
+      return inst ? (type*)*inst : (type*)NULL;
+    }
+
+    /// get the handle of an instance or a null handle if it is not in the list.
+    slot_map_handle get_handle(type *inst) const {
+      int index = handles.get_index(inst);
+      return index < 0 ? slot_map_handle() : handles.get_value(index);
+    }
+
+    /// access instances in (packed) order. deletion changes the order.
+    type *operator[](unsigned index) {
+      return instances[index];
+    }
+
+    /// number of instances.
+    unsigned size() const {
+      return instances.size();
+    }
+
+    /// remove all instances.
+    void reset() {
+      instances.reset();
+      handles.clear();
+    }
+
+    /// Serialization
+    void visit(visitor &v, atom_t sid) {
+      dynarray<ref<type> > tmp;
+      if (!v.is_reader()) {
+        for (unsigned i = 0; i != instances.size(); ++i) {
+          tmp.push_back(instances[i]);
+        }
+      }
+      v.visit(tmp, sid);
+      if (v.is_reader()) {
+        reset();
+        for (unsigned i = 0; i != tmp.size(); ++i) {
+          add(tmp[i]);
+        }
+      }
+    }
+  };
+
   /// Visual scene; contains instances of meshes, cameras and lights required to draw a scene.
   class visual_scene : public scene_node {
+  public:
+    /// counts from the last render, for measuring culling.
+    struct render_stats {
+      unsigned num_tested;  /// bounding boxes tested against the frustum
+      unsigned num_culled;  /// mesh instances outside the frustum
+      unsigned num_drawn;   /// mesh instances drawn
+      unsigned num_draw_calls;        /// glDraw* calls, less than num_drawn when instancing
+      unsigned num_program_changes;   /// shader programs selected
+      unsigned num_material_changes;  /// materials whose uniforms were all set
+      unsigned num_mesh_changes;      /// vertex attribute setups
+      unsigned num_lod_switches;      /// instances that drew a different lod_group level from last frame
+    };
+
+    /// result of cast_ray()
+    struct cast_result {
+      mesh_instance *mi;
+      rational depth;
+    };
+
+  private:
     ///////////////////////////////////////////
     //
     // rendering information
     //
 
     /// each of these is a set of (scene_node, mesh, material)
-    dynarray<ref<mesh_instance> > mesh_instances;
+    instance_list<mesh_instance> mesh_instances;
 
     /// animations playing at the moment
-    dynarray<ref<animation_instance> > animation_instances;
+    instance_list<animation_instance> animation_instances;
+
+    /// blended animations driving skeletons
+    instance_list<animation_mixer> animation_mixers;
 
     /// cameras available
-    dynarray<ref<camera_instance> > camera_instances;
+    instance_list<camera_instance> camera_instances;
 
     /// lights available
-    dynarray<ref<light_instance> > light_instances;
+    instance_list<light_instance> light_instances;
+
+    /// the mesh instances of each node, for get_first_mesh_instance()
+    mesh_instance_node_index node_index;
+
+    /// skip mesh instances outside the camera's view
+    bool frustum_culling;
+
+    /// also skip whole scene_node subtrees, using bounds kept in the nodes
+    bool hierarchical_culling;
+
+    /// the node bounds need rebuilding from the mesh instances
+    bool node_bounds_dirty;
+
+    /// nodes given local bounds by update_node_bounds()
+    dynarray<ref<scene_node> > bounded_nodes;
+
+    /// tree of mesh instance world bounds for ray casts
+    bvh<mesh_instance*> instance_tree;
+
+    /// mesh instances have been added or removed since the tree was built
+    bool instance_tree_dirty;
+
+    /// counts calls to update_world_transforms() that moved something
+    unsigned transforms_version;
+
+    /// transforms_version when the tree was last built or refitted
+    unsigned instance_tree_version;
+
+    render_stats stats;
+
+    /// a visible mesh instance waiting to be drawn
+    struct draw_item {
+      mesh_instance *mi;
+      mesh *msh;          // the instance's mesh or its lod level
+      material *mat;
+      mat4t modelToCamera;
+      const mat4t *modelToProjection;   // from the transform store, or null to compute when drawing
+      unsigned skin_binding;            // skinned meshes: skeleton::bind_skin() of the mesh's skin
+    };
+
+    /// draw order: the key sorts draws to group shaders, materials and meshes
+    struct draw_entry {
+      uint64_t key;
+      unsigned index;
+    };
+
+    /// sort the draws to save state changes
+    bool draw_sorting;
+
+    /// render queue, kept between frames to save allocation
+    dynarray<draw_item> draw_items;
+    dynarray<draw_entry> draw_order;
+    dynarray<draw_entry> draw_order_tmp;
+
+    /// skeletons of the skinned meshes being drawn, evaluated together before drawing
+    dynarray<skeleton *> skinned_skeletons;
+
+    /// draw runs of instances with the same mesh and material with one draw call
+    bool instancing;
+
+    /// model to camera matrices for instanced draws
+    ref<gl_resource> instance_buffer;
+    dynarray<mat4t> instance_matrices;
+
+    /// multiplies the screen error allowed by every lod_group: above 1 is faster and coarser
+    float lod_bias;
+
+    /// viewport height from begin_render(), to turn lod errors into pixels
+    int viewport_height;
 
     /// set this to draw bounding boxes
     bool render_aabbs;
@@ -181,8 +353,217 @@ namespace octet { namespace scene {
       }
     }
 
+    // update the world matrices and note whether anything moved.
+    void refresh_transforms() {
+      transform_store *store = get_transform_store();
+      if (is_subtree_dirty() || (store && store->is_dirty())) {
+        update_world_transforms();
+        transforms_version++;
+      }
+    }
+
+    // world space bounds of a mesh instance
+    static aabb get_instance_aabb(mesh_instance *mi) {
+      return mi->get_mesh()->get_aabb().get_transform(mi->get_node()->get_nodeToWorld());
+    }
+
+    // bring the mesh instance tree up to date:
+    // rebuild it if instances have come or gone, refit it if they have moved.
+    bvh<mesh_instance*> &get_instance_tree() {
+      check_node_index();
+      refresh_transforms();
+      if (instance_tree_dirty) {
+        dynarray<mesh_instance*> items;
+        dynarray<aabb> bounds;
+        items.reserve(mesh_instances.size());
+        bounds.reserve(mesh_instances.size());
+        for (unsigned i = 0; i != mesh_instances.size(); ++i) {
+          mesh_instance *mi = mesh_instances[i];
+          if (mi->get_node() && mi->get_mesh()) {
+            items.push_back(mi);
+            bounds.push_back(get_instance_aabb(mi));
+          }
+        }
+        instance_tree.build(items.data(), bounds.data(), items.size());
+        instance_tree_dirty = false;
+      } else if (instance_tree_version != transforms_version) {
+        instance_tree.refit(get_instance_aabb);
+      }
+      instance_tree_version = transforms_version;
+      return instance_tree;
+    }
+
+    // cast a ray against the triangles of a mesh instance; returns the distance along the ray or -1.
+    // hits further than t_max are ignored.
+    static float cast_ray_at_instance(mesh_instance *mi, const ray &the_ray, float t_max) {
+      ray model_ray = the_ray.get_transform(mi->get_node()->get_worldToNode());
+      int indices[3] = {0};
+      vec4 bary_numer(0, 0, 0, 0);
+      float bary_denom;
+      if (!mi->get_mesh()->ray_cast(model_ray, indices, bary_numer, bary_denom, t_max)) return -1;
+      // the transform keeps distances along the ray in proportion.
+      return bary_numer.w() / bary_denom;
+    }
+
+    // nearest hit in the tree
+    static void cast_ray(const bvh<mesh_instance*> &tree, cast_result &result, const ray &the_ray) {
+      result.mi = 0;
+      result.depth = rational(0, 0);
+
+      tree.cast(the_ray, 1.0f, [&](mesh_instance *mi, float &t_max) {
+        float t = cast_ray_at_instance(mi, the_ray, t_max);
+        if (t >= 0 && t <= t_max) {
+          t_max = t;
+          result.mi = mi;
+          result.depth = rational(t);
+        }
+        return false;
+      });
+    }
+
+    // give each node with mesh instances the union of their bounds.
+    void update_node_bounds() {
+      for (unsigned i = 0; i != bounded_nodes.size(); ++i) {
+        bounded_nodes[i]->clear_local_bounds();
+      }
+      bounded_nodes.resize(0);
+      for (unsigned i = 0; i != mesh_instances.size(); ++i) {
+        mesh_instance *mi = mesh_instances[i];
+        scene_node *node = mi->get_node();
+        if (!node || !mi->get_mesh()) continue;
+        aabb bb = mi->get_mesh()->get_aabb();
+        aabb old_bb;
+        if (node->get_local_bounds(old_bb)) {
+          bb = bb.get_union(old_bb);
+        } else {
+          bounded_nodes.push_back(node);
+        }
+        node->set_local_bounds(bb);
+      }
+      node_bounds_dirty = false;
+    }
+
+    // cull scene_node subtrees against the frustum, leaving the results in the nodes.
+    // Subtrees that are outside or completely inside are not visited.
+    void cull_nodes(const frustum &view) {
+      dynarray<scene_node*> stack;
+      stack.push_back(this);
+      while (!stack.empty()) {
+        scene_node *node = stack.back();
+        stack.pop_back();
+        aabb bb;
+        unsigned mask = frustum::outside;
+        if (node->get_world_bounds(bb)) {
+          scene_node *parent = node->get_parent();
+          unsigned parent_mask = node == this || !parent ? (unsigned)frustum::all_planes : parent->get_cull_mask();
+          mask = view.classify(bb, parent_mask);
+          stats.num_tested++;
+        }
+        node->set_cull_state(frame_number, mask);
+        if (mask != frustum::outside && mask != 0) {
+          for (int i = 0; i != node->get_num_children(); ++i) {
+            stack.push_back(node->get_child(i));
+          }
+        }
+      }
+    }
+
+    // planes a node still has to be tested against after cull_nodes().
+    // Nodes inside culled or visible subtrees were not visited, so use the nearest visited
+    // ancestor and remember the answer for the other nodes on the way.
+    unsigned get_node_cull_mask(scene_node *node) {
+      scene_node *p = node;
+      while (p && p->get_cull_frame() != frame_number) {
+        p = p->get_parent();
+      }
+      // not in this scene: test everything.
+      unsigned mask = p ? p->get_cull_mask() : (unsigned)frustum::all_planes;
+      for (scene_node *q = node; q != p; q = q->get_parent()) {
+        q->set_cull_state(frame_number, mask);
+      }
+      return mask;
+    }
+
+    // Draw key, most significant first: layer (4 bits), shader (12), material (16), mesh (16), depth (16).
+    // Materials and meshes are identified by hashes of their addresses. Two may rarely share a hash,
+    // but that only costs a state change as the draw loop compares the pointers.
+    static uint64_t get_draw_key(unsigned layer, material *mat, mesh *msh, float distance) {
+      param_shader *shader = mat ? mat->get_shader() : 0;
+      uint64_t shader_id = shader ? shader->get_program() & 0xfff : 0;
+      uint64_t mat_id = hash_map_cmp::fuzz_hash64((uint64_t)(intptr_t)mat) & 0xffff;
+      uint64_t mesh_id = hash_map_cmp::fuzz_hash64((uint64_t)(intptr_t)msh) & 0xffff;
+
+      // the top bits of a positive float sort in the same order as the float: near to far.
+      float d = distance > 0 ? distance : 0;
+      uint32_t bits;
+      memcpy(&bits, &d, sizeof(bits));
+      uint64_t depth = bits >> 16;
+
+      return (uint64_t)layer << 60 | shader_id << 48 | mat_id << 32 | mesh_id << 16 | depth;
+    }
+
+    // count the draws starting at draw_order[first] that have the same mesh and material and can be instanced.
+    unsigned count_instances(unsigned first) const {
+      const draw_item &item = draw_items[draw_order[first].index];
+      unsigned end = first + 1;
+      for (; end != draw_order.size(); ++end) {
+        const draw_item &next = draw_items[draw_order[end].index];
+        if (next.msh != item.msh || next.mat != item.mat) break;
+        if ((next.mi->get_skeleton() && item.msh->get_skin()) || (next.mi->get_flags() & mesh_instance::flag_selected)) break;
+      }
+      return end - first;
+    }
+
+    // size in pixels of one world unit at a depth in front of the camera.
+    float get_pixels_per_unit(const camera_instance &cam, float depth) const {
+      float yscale = cam.get_yscale();
+      if (cam.get_is_ortho()) return viewport_height * yscale;
+      if (depth < cam.get_near_plane()) depth = cam.get_near_plane();
+      return viewport_height / (2 * yscale * depth);
+    }
+
+    // draw a run of instances with one call. The mesh attributes and instanced shader are already set up.
+    void draw_instances(mesh *msh, unsigned first, unsigned num_instances) {
+      #if OCTET_INSTANCING
+        instance_matrices.resize(num_instances);
+        for (unsigned i = 0; i != num_instances; ++i) {
+          instance_matrices[i] = draw_items[draw_order[first + i].index].modelToCamera;
+        }
+
+        // orphan last run's storage rather than wait for the GPU to finish drawing from it.
+        instance_buffer->stream(instance_matrices.data(), num_instances * sizeof(mat4t));
+
+        // the matrix is four vec4 attributes that step once per instance.
+        instance_buffer->bind();
+        for (unsigned i = 0; i != 4; ++i) {
+          GLuint attr = attribute_instance_modelToCamera + i;
+          glVertexAttribPointer(attr, 4, GL_FLOAT, GL_FALSE, sizeof(mat4t), (void*)(i * sizeof(vec4)));
+          glVertexAttribDivisor(attr, 1);
+          glEnableVertexAttribArray(attr);
+        }
+
+        msh->draw_instanced(num_instances);
+
+        for (unsigned i = 0; i != 4; ++i) {
+          GLuint attr = attribute_instance_modelToCamera + i;
+          glVertexAttribDivisor(attr, 0);
+          glDisableVertexAttribArray(attr);
+        }
+      #endif
+    }
+
     void render_impl(bump_shader &object_shader, bump_shader &skin_shader, camera_instance &cam, float aspect_ratio) {
-      mat4t cameraToWorld = cam.get_node()->calcModelToWorld();
+      check_node_index();
+      if (hierarchical_culling && node_bounds_dirty) {
+        update_node_bounds();
+      }
+
+      // one pass over the moved parts of the hierarchy, then every world matrix is a cached read.
+      refresh_transforms();
+
+      memset(&stats, 0, sizeof(stats));
+
+      mat4t cameraToWorld = cam.get_node()->get_nodeToWorld();
 
       mat4t worldToCamera;
       cameraToWorld.invertQuick(worldToCamera);
@@ -194,6 +575,22 @@ namespace octet { namespace scene {
 
       draw_debug_data(cam);
 
+      // with a transform store, every node's matrices are made in one batch.
+      transform_store *store = get_transform_store();
+      if (store) {
+        store->calc_view(worldToCamera, cameraToProjection);
+      }
+
+      frustum view = cam.get_frustum();
+      bool use_node_culling = frustum_culling && hierarchical_culling;
+      if (use_node_culling) {
+        cull_nodes(view);
+      }
+
+      // find the visible instances and their draw keys...
+      draw_items.resize(0);
+      draw_order.resize(0);
+      skinned_skeletons.resize(0);
       for (unsigned mesh_index = 0; mesh_index != mesh_instances.size(); ++mesh_index) {
         mesh_instance *mi = mesh_instances[mesh_index];
 
@@ -206,20 +603,14 @@ namespace octet { namespace scene {
         ) continue;
 
         mesh *msh = mi->get_mesh();
-        skin *skn = msh->get_skin();
-        skeleton *skel = mi->get_skeleton();
         material *mat = mi->get_material();
+        const mat4t &modelToWorld = node->get_nodeToWorld();
 
-        mat4t modelToWorld = node->calcModelToWorld();
-        mat4t modelToCamera;
-        mat4t modelToProjection;
-        cam.get_matrices(modelToProjection, modelToCamera, modelToWorld);
-        //printf("%d %f\n", mesh_index, modelToWorld.w().y());
+        // depth of the model's origin, for choosing LODs before building any matrices.
+        float distance = -(modelToWorld.w() * worldToCamera).z();
 
         // selecting LOD meshes by distance
         if (flags & mesh_instance::flag_lod) {
-          float distance = -modelToCamera.w().z();
-          //printf("%f %f %f\n", distance, mi->get_min_draw_distance(), mi->get_max_draw_distance());
           if (
             distance < mi->get_min_draw_distance() ||
             distance >= mi->get_max_draw_distance()
@@ -228,40 +619,219 @@ namespace octet { namespace scene {
           }
         }
 
-        if (!skel || !skn) {
+        // or one mesh from a chain by the size of its error on screen
+        if (lod_group *lod = mi->get_lod_group()) {
+          if (lod->get_num_levels()) {
+            float pixels_per_unit = get_pixels_per_unit(cam, distance) * length(modelToWorld.x().xyz());
+            unsigned level = lod->select_level(pixels_per_unit, lod_bias, mi->get_lod_level());
+            if (level != mi->get_lod_level()) {
+              mi->set_lod_level(level);
+              stats.num_lod_switches++;
+            }
+            msh = lod->get_mesh(level);
+            if (lod->get_material(level)) mat = lod->get_material(level);
+          }
+        }
+
+        skin *skn = msh->get_skin();
+        skeleton *skel = mi->get_skeleton();
+
+        // skinned meshes move away from their bind pose bounds, so they are always drawn.
+        if (frustum_culling && !(skel && skn)) {
+          unsigned mask = use_node_culling ? get_node_cull_mask(node) : (unsigned)frustum::all_planes;
+          if (mask != 0 && mask != frustum::outside) {
+            mask = view.classify(msh->get_aabb().get_transform(modelToWorld), mask);
+            stats.num_tested++;
+          }
+          if (mask == frustum::outside) {
+            stats.num_culled++;
+            continue;
+          }
+        }
+
+        draw_entry entry = { get_draw_key(mi->get_layer(), mat, msh, distance), draw_items.size() };
+        draw_order.push_back(entry);
+        draw_item item = { mi, msh, mat };
+        item.skin_binding = 0;
+        if (skel && skn) {
+          item.skin_binding = skel->bind_skin(skn);
+          skinned_skeletons.push_back(skel);
+        }
+        if (store && node->get_transform_store() == store) {
+          item.modelToCamera = store->get_modelToCamera(node->get_transform_handle());
+          item.modelToProjection = &store->get_modelToProjection(node->get_transform_handle());
+        } else {
+          mat4t modelToProjection;
+          cam.get_matrices(modelToProjection, item.modelToCamera, modelToWorld);
+          item.modelToProjection = 0;
+        }
+        draw_items.push_back(item);
+      }
+
+      // ...pose every skeleton once, spread over the job threads (characters do not depend on each other)...
+      if (skinned_skeletons.size()) {
+        std::sort(skinned_skeletons.data(), skinned_skeletons.data() + skinned_skeletons.size());
+        skeleton **end = std::unique(skinned_skeletons.data(), skinned_skeletons.data() + skinned_skeletons.size());
+        skeleton **skeletons = skinned_skeletons.data();
+        job_scheduler::get().parallel_for(0, (unsigned)(end - skeletons), 4, [skeletons](unsigned begin, unsigned end) {
+          for (unsigned i = begin; i != end; ++i) {
+            skeletons[i]->calc_skins();
+          }
+        });
+      }
+
+      // ...put draws that share state next to each other...
+      if (draw_sorting) {
+        radix_sort::sort(draw_order, draw_order_tmp, [](const draw_entry &e) { return e.key; });
+      }
+
+      // ...and draw them, only changing state when we have to.
+      param_shader *cur_shader = 0;
+      material *cur_mat = 0;
+      mesh *cur_mesh = 0;
+      unsigned num_instances = 1;
+      for (unsigned i = 0; i != draw_order.size(); i += num_instances) {
+        const draw_item &item = draw_items[draw_order[i].index];
+        mesh_instance *mi = item.mi;
+        mesh *msh = item.msh;
+        skin *skn = msh->get_skin();
+        skeleton *skel = mi->get_skeleton();
+        material *mat = item.mat;
+        const mat4t &modelToCamera = item.modelToCamera;
+
+        // sorting puts instances of the same mesh and material together: draw them with one call if we can.
+        num_instances = 1;
+        if (instancing && !(skel && skn) && !(mi->get_flags() & mesh_instance::flag_selected)) {
+          num_instances = count_instances(i);
+          if (num_instances < 2 || !mat->get_instanced_shader()) num_instances = 1;
+        }
+
+        if (num_instances > 1) {
+          param_shader *shader = mat->get_instanced_shader();
+          if (shader != cur_shader) {
+            shader->render();
+            cur_shader = shader;
+            stats.num_program_changes++;
+          }
+          mat->render_instanced_uniforms(cameraToProjection, light_uniforms, num_light_uniforms, num_lights);
+          // the instanced shader has its own uniforms.
+          cur_mat = 0;
+          stats.num_material_changes++;
+        } else if (!skel || !skn) {
           /// normal rendering for single matrix objects
           /// build a projection matrix: model -> world -> camera_instance -> projection
           /// the projection space is the cube -1 <= x/w, y/w, z/w <= 1
-          mat->render(modelToProjection, modelToCamera, light_uniforms, num_light_uniforms, num_lights);
+          mat4t modelToProjection = item.modelToProjection ? *item.modelToProjection : modelToCamera * cameraToProjection;
+          if (mat == cur_mat) {
+            mat->render_matrices(modelToProjection, modelToCamera);
+          } else {
+            param_shader *shader = mat->get_shader();
+            if (shader != cur_shader) {
+              shader->render();
+              cur_shader = shader;
+              stats.num_program_changes++;
+            }
+            mat->render_uniforms(modelToProjection, modelToCamera, light_uniforms, num_light_uniforms, num_lights);
+            cur_mat = mat;
+            stats.num_material_changes++;
+          }
         } else {
-          /// multi-matrix rendering
-          mat4t *transforms = skel->calc_transforms(modelToCamera, skn);
-          int num_bones = skel->get_num_bones();
-          if(num_bones > 192) {
-            GLint mvuv = 0;
-            //glGetIntegerv(GL_MAX_VERTEX_UNIFORM_VECTORS, &mvuv);
-            printf("warning: too many bones (%d/%d)\n", num_bones, mvuv/4);
+          /// skinned rendering: the joints move the vertices in model space,
+          /// then we draw with the instance's matrices like any other mesh.
+          const mat4t *joints = skel->get_skin_transforms(item.skin_binding);
+          unsigned num_joints = skn->get_num_joints();
+          mat4t modelToProjection = item.modelToProjection ? *item.modelToProjection : modelToCamera * cameraToProjection;
+
+          param_shader *shader = 0;
+          if (msh->get_skinning_mode() == mesh::skinning_gpu && joint_texture::is_supported()) {
+            shader = mat->get_skinned_shader();
+          }
+
+          if (shader) {
+            joint_texture *jt = mi->get_joint_texture();
+            jt->update(joints, num_joints);
+            if (shader != cur_shader) {
+              shader->render();
+              cur_shader = shader;
+              stats.num_program_changes++;
+            }
+            mat->render_skinned(modelToProjection, modelToCamera, jt, light_uniforms, num_light_uniforms, num_lights);
+            // the skinned shader has its own uniforms.
+            cur_mat = 0;
           } else {
-            mat->render_skinned(cameraToProjection, transforms, num_bones, light_uniforms, num_light_uniforms, num_lights);
+            // skin on the CPU and draw the skinned copy (or the bind pose if we cannot skin it).
+            if (cpu_skinner *skinner = mi->get_cpu_skinner(msh)) {
+              skinner->skin(joints, num_joints);
+              msh = skinner->upload();
+            }
+            shader = mat->get_shader();
+            if (shader != cur_shader) {
+              shader->render();
+              cur_shader = shader;
+              stats.num_program_changes++;
+            }
+            mat->render_uniforms(modelToProjection, modelToCamera, light_uniforms, num_light_uniforms, num_lights);
+            cur_mat = mat;
           }
+          stats.num_material_changes++;
         }
 
         /*if (true) {
           static bool dumped;
           if (!dumped) { msh->dump_transformed(modelToProjection); dumped = true; }
         }*/
-        msh->enable_attributes();
-        msh->draw();
-        msh->disable_attributes();
+        if (msh != cur_mesh) {
+          if (cur_mesh) cur_mesh->disable_attributes();
+          msh->enable_attributes();
+          cur_mesh = msh;
+          stats.num_mesh_changes++;
+        }
+        if (num_instances > 1) {
+          draw_instances(msh, i, num_instances);
+        } else {
+          msh->draw();
+        }
+        stats.num_drawn += num_instances;
+        stats.num_draw_calls++;
 
         if (mi->get_flags() & mesh_instance::flag_selected) {
-          aabb bb = mi->get_mesh()->get_aabb();
+          // draw_aabb uses its own vertex attributes.
+          msh->disable_attributes();
+          cur_mesh = 0;
+          aabb bb = msh->get_aabb();
           bb = bb.get_transform(mi->get_node()->calcModelToWorld());
           draw_aabb(bb);
         }
       }
+      if (cur_mesh) cur_mesh->disable_attributes();
       frame_number++;
     }
+    // instances have joined or left nodes (eg. by mesh_instance::set_node()): the bounds need updating.
+    void check_node_index() {
+      if (node_index.changed) {
+        node_bounds_dirty = true;
+        instance_tree_dirty = true;
+        node_index.changed = false;
+      }
+    }
+
+    // take the instances out of the node index, eg. before they are released.
+    void unindex_mesh_instances() {
+      for (unsigned i = 0; i != mesh_instances.size(); ++i) {
+        mesh_instances[i]->unlink_node_index();
+      }
+      node_index.first.clear();
+      node_index.changed = true;
+    }
+
+    // rebuild the node index after loading
+    void index_mesh_instances() {
+      unindex_mesh_instances();
+      for (unsigned i = 0; i != mesh_instances.size(); ++i) {
+        mesh_instances[i]->link_node_index(&node_index);
+      }
+    }
+
   public:
     RESOURCE_META(visual_scene)
 
@@ -273,6 +843,18 @@ namespace octet { namespace scene {
       render_aabbs = false;
       dump_vertices = false;
       render_debug_lines = false;
+      frustum_culling = true;
+      hierarchical_culling = false;
+      draw_sorting = true;
+      instancing = OCTET_INSTANCING != 0;
+      instance_buffer = new gl_resource(GL_ARRAY_BUFFER);
+      lod_bias = 1.0f;
+      viewport_height = 720;
+      node_bounds_dirty = true;
+      instance_tree_dirty = true;
+      transforms_version = 0;
+      instance_tree_version = 0;
+      memset(&stats, 0, sizeof(stats));
       debug_material = new material(vec4(1, 0, 0, 1));
       debug_line_buffer.resize(256);
       assert(is_power_of_two(debug_line_buffer.size()));
@@ -288,6 +870,7 @@ namespace octet { namespace scene {
     }
 
     ~visual_scene() {
+      unindex_mesh_instances();
       #ifdef OCTET_BULLET
         delete world;
         delete solver;
@@ -299,7 +882,7 @@ namespace octet { namespace scene {
     /// helper to add a mesh to a scene and also to create the corresponding physics object
     mesh_instance *add_shape(mat4t_in mat, mesh *msh, material *mtl, bool is_dynamic=false, float mass=1, collison_shape_t *shape=NULL) {
       scene_node *node = new scene_node(this);
-      node->access_nodeToParent() = mat;
+      node->set_nodeToParent(mat);
 
       mesh_instance *result = NULL;
       if (msh && mtl) {
@@ -362,24 +945,39 @@ namespace octet { namespace scene {
     /// Serialization
     void visit(visitor &v) {
       scene_node::visit(v);
-      v.visit(mesh_instances, atom_mesh_instances);
-      v.visit(animation_instances, atom_animation_instances);
-      v.visit(camera_instances, atom_camera_instances);
-      v.visit(light_instances, atom_light_instances);
+      if (v.is_reader()) {
+        unindex_mesh_instances();
+      }
+      mesh_instances.visit(v, atom_mesh_instances);
+      animation_instances.visit(v, atom_animation_instances);
+      animation_mixers.visit(v, atom_animation_mixers);
+      camera_instances.visit(v, atom_camera_instances);
+      light_instances.visit(v, atom_light_instances);
+      if (v.is_reader()) {
+        index_mesh_instances();
+      }
     }
 
     /// reset the scene.
     void reset() {
+      unindex_mesh_instances();
       mesh_instances.reset();
       animation_instances.reset();
+      for (unsigned i = 0; i != animation_mixers.size(); ++i) {
+        animation_mixers[i]->clear_pose();
+      }
+      animation_mixers.reset();
       camera_instances.reset();
       light_instances.reset();
+      node_bounds_dirty = true;
+      instance_tree_dirty = true;
     }
 
     /// set up OpenGL state
     void begin_render(int vx, int vy, vec4_in clear_color=vec4(0.5f, 0.5f, 0.5f, 1.0f)) {
       /// set a viewport - includes whole window area
       glViewport(0, 0, vx, vy);
+      viewport_height = vy;
 
       /// clear the background to black
       glClearColor(clear_color.x(), clear_color.y(), clear_color.z(), clear_color.w());
@@ -420,7 +1018,7 @@ namespace octet { namespace scene {
         float f = distance * 2, n = f * 0.001f;
         cam->set_node(node);
         cam->set_perspective(0, 45, 1, n, f*2);
-        camera_instances.push_back(cam);
+        camera_instances.add(cam);
       }
 
       /// default light instance
@@ -435,7 +1033,7 @@ namespace octet { namespace scene {
         _light->set_kind(atom_directional);
         li->set_node(node);
         li->set_light(_light);
-        light_instances.push_back(li);
+        light_instances.add(li);
       }
 
       if (!object_shader) {
@@ -466,40 +1064,80 @@ namespace octet { namespace scene {
       return new_node;
     }
 
+    /// add a mesh instance to the scene. Adding the same instance twice has no effect.
     mesh_instance *add_mesh_instance(mesh_instance *inst=0) {
-      mesh_instances.push_back(inst);
+      if (inst && mesh_instances.get_handle(inst).is_null()) {
+        mesh_instances.add(inst);
+        inst->link_node_index(&node_index);
+      }
       return inst;
     }
 
     animation_instance *add_animation_instance(animation_instance *inst) {
-      animation_instances.push_back(inst);
+      animation_instances.add(inst);
       return inst;
     }
 
+    /// add a mixer to be updated every frame.
+    animation_mixer *add_animation_mixer(animation_mixer *mixer) {
+      animation_mixers.add(mixer);
+      return mixer;
+    }
+
     camera_instance *add_camera_instance(camera_instance *inst) {
-      camera_instances.push_back(inst);
+      camera_instances.add(inst);
       return inst;
     }
 
     light_instance *add_light_instance(light_instance *inst) {
-      light_instances.push_back(inst);
+      light_instances.add(inst);
       return inst;
     }
 
+    /// remove a mesh instance from the scene. This is O(1).
+    /// The last mesh instance takes its index.
     void delete_mesh_instance(mesh_instance *inst) {
-      //mesh_instances.erase_by_value(inst);
+      slot_map_handle handle = mesh_instances.get_handle(inst);
+      if (!handle.is_null()) {
+        // note: erasing may free the instance.
+        inst->unlink_node_index();
+        mesh_instances.erase(handle);
+      }
+    }
+
+    /// remove a mesh instance from the scene by handle. Stale handles are ignored.
+    void delete_mesh_instance(slot_map_handle handle) {
+      mesh_instance *inst = mesh_instances.get(handle);
+      if (inst) delete_mesh_instance(inst);
     }
 
     void delete_animation_instance(animation_instance *inst) {
-      //animation_instances.erase_by_value(inst);
+      animation_instances.erase(inst);
+    }
+
+    /// remove a mixer; its skeleton goes back to following its nodes.
+    void delete_animation_mixer(animation_mixer *mixer) {
+      mixer->clear_pose();
+      animation_mixers.erase(mixer);
     }
 
     void delete_camera_instance(camera_instance *inst) {
-      //camera_instances.erase_by_value(inst);
+      camera_instances.erase(inst);
     }
 
     void delete_light_instance(light_instance *inst) {
-      //light_instances.erase_by_value(inst);
+      light_instances.erase(inst);
+    }
+
+    /// get a handle for a mesh instance in the scene (or a null handle).
+    /// handles, unlike indices, do not change when other instances are deleted.
+    slot_map_handle get_mesh_instance_handle(mesh_instance *inst) const {
+      return mesh_instances.get_handle(inst);
+    }
+
+    /// get a mesh instance by handle; null if it has been deleted.
+    mesh_instance *get_mesh_instance(slot_map_handle handle) {
+      return mesh_instances.get(handle);
     }
 
     /// how many mesh instances do we have?
@@ -536,6 +1174,74 @@ namespace octet { namespace scene {
       dump_vertices = value;
     }
 
+    /// skip mesh instances whose bounding boxes are outside the camera's view (on by default).
+    void set_frustum_culling(bool value) {
+      frustum_culling = value;
+    }
+
+    /// Also cull whole scene_node subtrees with bounds kept in the nodes (off by default).
+    /// This pays off when large parts of the hierarchy are off screen.
+    void set_hierarchical_culling(bool value) {
+      hierarchical_culling = value;
+    }
+
+    /// Sort draws by layer, shader, material, mesh and depth to save state changes (on by default).
+    /// With sorting off, instances are drawn in the order they were added.
+    void set_draw_sorting(bool value) {
+      draw_sorting = value;
+    }
+
+    /// Draw instances that share a mesh and material with glDrawElementsInstanced (on by default).
+    /// The material needs an instanced shader, see material::get_instanced_shader().
+    /// This needs OpenGL 3.1 or ES3; it has no effect if OCTET_INSTANCING is 0.
+    void set_instancing(bool value) {
+      instancing = value && OCTET_INSTANCING;
+    }
+
+    /// Keep the matrices of every node in the scene in one transform_store (off by default).
+    /// World matrices and model to projection matrices are then made in batches over contiguous
+    /// arrays instead of node by node. This pays off when most nodes are on screen or move every frame.
+    void set_transform_store(bool value) {
+      if (value && !get_transform_store()) {
+        use_transform_store(new transform_store());
+      } else if (!value) {
+        release_transform_store();
+      }
+    }
+
+    /// Scale the screen error allowed by every lod_group (default 1).
+    /// 2 allows twice as many pixels of error, so coarser meshes are drawn sooner.
+    void set_lod_bias(float value) {
+      lod_bias = value;
+    }
+
+    /// get the scale on the screen error allowed by every lod_group.
+    float get_lod_bias() const {
+      return lod_bias;
+    }
+
+    /// Adjust the lod bias a little each frame to draw frames in target_time seconds.
+    /// Slow frames use coarser meshes, fast ones finer, between min_bias and max_bias.
+    void update_lod_budget(float frame_time, float target_time, float min_bias = 1.0f, float max_bias = 8.0f) {
+      float ratio = target_time > 0 ? frame_time / target_time : 1.0f;
+      ratio = ratio < 0.9f ? 0.9f : ratio > 1.1f ? 1.1f : ratio;
+      lod_bias *= ratio;
+      lod_bias = lod_bias < min_bias ? min_bias : lod_bias > max_bias ? max_bias : lod_bias;
+    }
+
+    /// Rebuild the bounds used by hierarchical culling and ray casts.
+    /// Adding, removing and moving mesh instances or giving them another node updates them,
+    /// but call this after changing a mesh's vertices or giving a mesh instance another mesh.
+    void invalidate_node_bounds() {
+      node_bounds_dirty = true;
+      instance_tree_dirty = true;
+    }
+
+    /// get the culling and state change counts for the last render.
+    const render_stats &get_render_stats() const {
+      return stats;
+    }
+
     /// access camera_instance information
     camera_instance *get_camera_instance(int index) {
       return camera_instances[index];
@@ -543,7 +1249,7 @@ namespace octet { namespace scene {
 
     /// access mesh_instance information
     mesh_instance *get_mesh_instance(int index) {
-      return (unsigned)index < mesh_instances.size() ? (mesh_instance*)mesh_instances[index] : (mesh_instance*)NULL;
+      return (unsigned)index < mesh_instances.size() ? mesh_instances[index] : (mesh_instance*)NULL;
     }
 
     /// access light_instance information
@@ -561,8 +1267,9 @@ namespace octet { namespace scene {
           btCollisionObject *co = array[i];
           scene_node *node = (scene_node *)co->getUserPointer();
           if (node) {
-            mat4t &mat = node->access_nodeToParent();
+            mat4t mat;
             co->getWorldTransform().getOpenGLMatrix(mat.get());
+            node->set_nodeToParent(mat);
             //printf("%d %f\n", i, mat.w().y());
           }
         }
@@ -573,6 +1280,10 @@ namespace octet { namespace scene {
         inst->update(delta_time);
       }
 
+      for (int idx = 0; idx != animation_mixers.size(); ++idx) {
+        animation_mixers[idx]->update(delta_time);
+      }
+
       for (int idx = 0; idx != mesh_instances.size(); ++idx) {
         mesh_instance *inst = mesh_instances[idx];
         inst->update(delta_time);
@@ -596,81 +1307,56 @@ namespace octet { namespace scene {
     /// play an animation on another target (not the same one as in the collada file)
     void play(animation *anim, resource *target, bool is_looping) {
       animation_instance *inst = new animation_instance(anim, target, is_looping);
-      animation_instances.push_back(inst);
+      animation_instances.add(inst);
     }
 
     /// play an animation with built-in targets (as in the collada file)
     void play(animation *anim, bool is_looping) {
       animation_instance *inst = new animation_instance(anim, NULL, is_looping);
-      animation_instances.push_back(inst);
+      animation_instances.add(inst);
     }
 
-    /// find a mesh instance for a node
+    /// find a mesh instance for a node. The others follow with mesh_instance::get_next_on_node().
     mesh_instance *get_first_mesh_instance(scene_node *node) {
-      for (int i = 0; i != mesh_instances.size(); ++i) {
-        mesh_instance *mi = mesh_instances[i];
-        if (mi && mi->get_node() == node) {
-          return mi;
-        }
-      }
-      return NULL;
+      int index = node_index.first.get_index(node);
+      return index < 0 ? NULL : node_index.first.get_value(index);
     }
 
     /// get the approximate size of the scene, not including lights or cameras
     aabb get_world_aabb() {
       aabb world_aabb;
-      bool first = true;
-      for (int i = 0; i != mesh_instances.size(); ++i) {
-        mesh_instance *mi = mesh_instances[i];
-        if (mi && mi->get_node()) {
-          mat4t nodeToWorld = mi->get_node()->calcModelToWorld();
-          aabb bb = mi->get_mesh()->get_aabb();
-          bb = bb.get_transform(nodeToWorld);
-          if (first) {
-            world_aabb = bb;
-            first = false;
-          } else {
-            world_aabb = world_aabb.get_union(bb);
-          }
-        }
-      }
+      get_instance_tree().get_bounds(world_aabb);
       return world_aabb;
     }
 
-    struct cast_result {
-      mesh_instance *mi;
-      rational depth;
-    };
-
-    /// brute force & ignorance ray cast.
-    /// return the mesh instance and location of hits.
-    /// todo: build a kd tree for mesh instance bbs & mesh triangles
+    /// Find the nearest mesh instance hit by a ray (from start to end).
+    /// result.mi is null if nothing is hit. result.depth is the distance along the ray (0..1).
+    /// Only instances whose bounding boxes cross the ray are tested, nearest first (see bvh).
     void cast_ray(cast_result &result, const ray &the_ray) {
-      result.mi = 0;
-      result.depth = rational(0, 0);
+      cast_ray(get_instance_tree(), result, the_ray);
+    }
 
-      for (int i = 0; i != mesh_instances.size(); ++i) {
-        mesh_instance *mi = mesh_instances[i];
-        if (mi && mi->get_node()) {
-          mat4t nodeToWorld = mi->get_node()->calcModelToWorld();
-          mesh *mesh = mi->get_mesh();
-          aabb bb = mesh->get_aabb();
-          bb = bb.get_transform(nodeToWorld);
-          if (the_ray.intersects(bb)) {
-            mat4t worldToNode = nodeToWorld.inverse3x4();
-            //ray model_ray = ray(vec3(0, 0, -1), vec3(0, 0, 2)); //the_ray.get_transform(worldToNode);
-            ray model_ray = the_ray.get_transform(worldToNode);
-            int indices[3] = {0};
-            vec4 bary_numer(0, 0, 0, 0);
-            float bary_denom;
-            bool hit = mesh->ray_cast(model_ray, indices, bary_numer, bary_denom);
-            if (hit) {
-              rational depth(bary_numer.w() / bary_denom);
-              result.depth = min(depth, result.depth);
-            }
-            //printf("hit=%d %s %f\n", hit, (bary_numer/bary_denom).toString(tmp, sizeof(tmp)), (float)result.depth);
-          }
+    /// Find any mesh instance hit by a ray. This is quicker than cast_ray when we do not
+    /// need the nearest one, for example for line of sight tests. Returns null for no hit.
+    mesh_instance *cast_ray_any(const ray &the_ray) {
+      mesh_instance *result = 0;
+      get_instance_tree().cast(the_ray, 1.0f, [&](mesh_instance *mi, float &t_max) {
+        float t = cast_ray_at_instance(mi, the_ray, t_max);
+        if (t >= 0 && t <= t_max) {
+          result = mi;
+          return true;
         }
+        return false;
+      });
+      return result;
+    }
+
+    /// Cast many rays, for example for AI sensors. Finds the nearest hit for each ray.
+    void cast_rays(cast_result *results, const ray *rays, unsigned num_rays) {
+      // bring the tree up to date once for the whole batch.
+      bvh<mesh_instance*> &tree = get_instance_tree();
+      for (unsigned i = 0; i != num_rays; ++i) {
+        cast_ray(tree, results[i], rays[i]);
       }
     }
 
@@ -32,7 +32,9 @@ namespace octet { namespace shaders {
     }
 
   public:
-    void init(bool is_skinned=false) {
+    /// compile the shader. Instanced shaders get the model to camera matrix from
+    /// the instance_modelToCamera attribute instead of uniforms (see render_instanced).
+    void init(bool is_skinned=false, bool is_instanced=false) {
       // this is the vertex shader for regular geometry
       // it is called for each corner of each triangle
       // it inputs pos and uv from each corner
@@ -62,6 +64,32 @@ namespace octet { namespace shaders {
         }
       );
 
+      // this is the vertex shader for instanced geometry
+      // each instance has its own model to camera matrix, which steps once per instance.
+      const char instanced_vertex_shader[] = SHADER_STR(
+        varying vec2 uv_;
+        varying vec3 normal_;
+        varying vec3 tangent_;
+        varying vec3 bitangent_;
+      
+        attribute vec4 pos;
+        attribute vec3 normal;
+        attribute vec3 tangent;
+        attribute vec3 bitangent;
+        attribute vec2 uv;
+        attribute mat4 instance_modelToCamera;
+      
+        uniform mat4 cameraToProjection;
+      
+        void main() {
+          uv_ = uv;
+          normal_ = (instance_modelToCamera * vec4(normal,0)).xyz;
+          tangent_ = (instance_modelToCamera * vec4(tangent,0)).xyz;
+          bitangent_ = (instance_modelToCamera * vec4(bitangent,0)).xyz;
+          gl_Position = cameraToProjection * (instance_modelToCamera * pos);
+        }
+      );
+
       // this is the vertex shader for skinned geometry
       // this is the shader for skinned geometry
       // it is not terribly efficient, but does the job.
@@ -159,7 +187,7 @@ namespace octet { namespace shaders {
     
       // use the common shader code to compile and link the shaders
       // the result is a shader program
-      init_uniforms(is_skinned ? skinned_vertex_shader : vertex_shader, fragment_shader);
+      init_uniforms(is_skinned ? skinned_vertex_shader : is_instanced ? instanced_vertex_shader : vertex_shader, fragment_shader);
     }
 
     void render(const mat4t &modelToProjection, const mat4t &modelToCamera, const vec4 *light_uniforms, int num_light_uniforms, int num_lights) {
@@ -178,6 +206,23 @@ namespace octet { namespace shaders {
       glUniform1iv(samplers_index, 6, samplers);
     }
 
+    /// set up an instanced shader. Put the model to camera matrices in the instance_modelToCamera
+    /// attributes and draw with glDrawElementsInstanced (see mesh::draw_instanced).
+    void render_instanced(const mat4t &cameraToProjection, const vec4 *light_uniforms, int num_light_uniforms, int num_lights) {
+      // tell openGL to use the program
+      shader::render();
+
+      // customize the program with uniforms
+      glUniformMatrix4fv(cameraToProjection_index, 1, GL_FALSE, cameraToProjection.get());
+
+      glUniform4fv(light_uniforms_index, num_light_uniforms, (float*)light_uniforms);
+      glUniform1i(num_lights_index, num_lights);
+
+      // we use textures 0-3 for material properties.
+      static const GLint samplers[] = { 0, 1, 2, 3, 4, 5 };
+      glUniform1iv(samplers_index, 6, samplers);
+    }
+
     void render_skinned(const mat4t &cameraToProjection, const mat4t *modelToCamera, int num_matrices, const vec4 *light_uniforms, int num_light_uniforms, int num_lights) {
       // tell openGL to use the program
       shader::render();
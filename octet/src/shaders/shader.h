@@ -29,6 +29,7 @@ namespace octet { namespace shaders {
       glBindAttribLocation(program, attribute_blendindices, "blendindices");
       glBindAttribLocation(program, attribute_color, "color");
       glBindAttribLocation(program, attribute_uv, "uv");
+      glBindAttribLocation(program, attribute_instance_modelToCamera, "instance_modelToCamera");
       glLinkProgram(program);
 
       program_ = program;